@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Generator of btsnoop captures of fleet of N virtual MyAirScanner devices, load for adv_ingest.
+// Frames are encoded by firmware payload_encode with payload_measurement_schema (as make_adv_data in main.c),
+// devices rotate frames like ble_adv (slot 100 ms, live frame weight 2, diag frame) with adv interval 20-40 ms + advDelay.
+// State of device is derived from hash of its index, so memory of generator does not depend on length of capture.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "btsnoop.h"
+#include "adv_decoder.h"
+#include "payload.h"
+
+#define GEN_ADV_INTERVAL_MIN_US     20000   // ble_adv_params adv_int_min 0x20
+#define GEN_ADV_INTERVAL_MAX_US     40000   // adv_int_max 0x40
+#define GEN_ADV_DELAY_MAX_US        10000   // random advDelay added by controller
+#define GEN_SLOT_US                 100000  // BLE_ADV_SLOT_MS
+#define GEN_CYCLE_US                340000000ull // measurement cycle, new live data
+#define GEN_START_US                1640995200000000ull // 2022-01-01 00:00:00 UTC
+#define GEN_DIAG_ID                 0x0687
+
+// rotation of frames: live (weight 2), avg, 1h avg, 24h avg, diag
+static const uint8_t gen_rotation[] = {0, 0, 1, 2, 3, 4};
+#define GEN_ROTATION_LEN            (sizeof(gen_rotation)/sizeof(gen_rotation[0]))
+
+typedef struct {
+    uint64_t    time_us;            // next adv event
+    uint32_t    device;
+} gen_event_t;
+
+
+static uint32_t gen_hash(uint32_t a, uint32_t b) //murmur3 finalizer of pair
+{
+    uint32_t h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u + (a << 6) + (a >> 2));
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+
+static void gen_addr(uint32_t seed, uint32_t device, uint8_t *addr) //little endian as in HCI, OUI of Espressif
+{
+    uint32_t h = gen_hash(seed, device);
+    addr[0] = device;
+    addr[1] = device >> 8;
+    addr[2] = (device >> 16) ^ h;
+    addr[3] = 0xC4;
+    addr[4] = 0x0A;
+    addr[5] = 0x24;
+}
+
+
+static void gen_frame(uint32_t seed, uint32_t device, uint64_t time_us, uint8_t frame, uint8_t *dst) //31bytes adv data
+{
+    static const uint8_t head[ADV_DECODER_HEAD_ID_LEN] = {0x1E, 0x06, 0x06};
+    int32_t values[PAYLOAD_MEASUREMENT_FIELDS_NUM];
+    uint32_t phase = gen_hash(seed, device);
+    uint32_t cycle = (time_us + phase % GEN_CYCLE_US) / GEN_CYCLE_US;
+
+    memcpy(dst, head, ADV_DECODER_HEAD_ID_LEN);
+    dst[3] = device; // device id - two lowest bytes of MAC, sequence - cycle
+    dst[4] = device >> 8;
+    dst[5] = cycle;
+    if(frame == 4)
+    {
+        dst[1] = GEN_DIAG_ID & 0xFF;
+        dst[2] = GEN_DIAG_ID >> 8;
+        memset(dst + ADV_DECODER_HEAD_LEN, 0, ADV_DECODER_FRAME_LEN - ADV_DECODER_HEAD_LEN);
+        memcpy(dst + ADV_DECODER_HEAD_LEN, &cycle, sizeof(cycle));
+        return;
+    }
+
+    // averages change less often than live data
+    static const uint32_t cycles_per_value[4] = {1, 1, 11, 254};
+    uint32_t h = gen_hash(device ^ seed, cycle / cycles_per_value[frame] * 4 + frame);
+    int32_t pm = 5 + (h % 60) + (phase % 40);
+
+    values[PAYLOAD_FIELD_TYPE] = frame;
+    values[PAYLOAD_FIELD_TEMPERATURE] = 150 + (int32_t)(phase % 120) + (int32_t)(h >> 8 & 0x1F) - 16;
+    values[PAYLOAD_FIELD_HUMIDITY] = 300 + (phase >> 8) % 400 + (h >> 13 & 0x3F);
+    values[PAYLOAD_FIELD_SM_PM10] = pm * 2 / 3;
+    values[PAYLOAD_FIELD_SM_PM25] = pm;
+    values[PAYLOAD_FIELD_SM_PM100] = pm * 4 / 3;
+    values[PAYLOAD_FIELD_AE_PM10] = pm * 2 / 3;
+    values[PAYLOAD_FIELD_AE_PM25] = pm;
+    values[PAYLOAD_FIELD_AE_PM100] = pm * 4 / 3;
+    for(int j=PAYLOAD_FIELD_UM3; j<=PAYLOAD_FIELD_UM100; ++j)
+        values[j] = (pm * 300) >> (2 * (j - PAYLOAD_FIELD_UM3));
+    values[PAYLOAD_FIELD_ESP_TEMPERATURE] = 100 + (h >> 20) % 30;
+
+    payload_encode(&payload_measurement_schema, values, dst + ADV_DECODER_HEAD_LEN);
+}
+
+
+static void gen_sift_down(gen_event_t *heap, uint32_t num, uint32_t i) //min-heap by time
+{
+    gen_event_t item = heap[i];
+    for(;;)
+    {
+        uint32_t child = 2*i + 1;
+        if(child >= num)
+            break;
+        if(child + 1 < num && heap[child + 1].time_us < heap[child].time_us)
+            ++child;
+        if(heap[child].time_us >= item.time_us)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = item;
+}
+
+
+static void gen_usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options] --out FILE\n"
+        "  --devices N       virtual devices (default 10000)\n"
+        "  --seconds N       length of capture (default 10)\n"
+        "  --heard X         probability that gateway receives adv event (default 0.3)\n"
+        "  --foreign X       adv reports of other devices per report of MyAirScanner (default 0.5)\n"
+        "  --seed N          seed of fleet (default 1)\n",
+        name);
+}
+
+
+int main(int argc, char **argv)
+{
+    uint32_t devices = 10000;
+    double seconds = 10.0;
+    double heard = 0.3;
+    double foreign = 0.5;
+    uint32_t seed = 1;
+    const char *out_path = NULL;
+
+    for(int i=1; i<argc; ++i)
+    {
+        const char *opt = argv[i];
+        const char *val = (i+1 < argc) ? argv[i+1] : NULL;
+
+        if(val == NULL)
+        {
+            gen_usage(argv[0]);
+            return 1;
+        }
+        if(strcmp(opt, "--devices") == 0 && strtoul(val, NULL, 0) > 0)
+            devices = strtoul(val, NULL, 0);
+        else if(strcmp(opt, "--seconds") == 0)
+            seconds = atof(val);
+        else if(strcmp(opt, "--heard") == 0)
+            heard = atof(val);
+        else if(strcmp(opt, "--foreign") == 0)
+            foreign = atof(val);
+        else if(strcmp(opt, "--seed") == 0)
+            seed = strtoul(val, NULL, 0);
+        else if(strcmp(opt, "--out") == 0)
+            out_path = val;
+        else
+        {
+            gen_usage(argv[0]);
+            return 1;
+        }
+        ++i;
+    }
+    if(out_path == NULL)
+    {
+        gen_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *out = fopen(out_path, "wb");
+    gen_event_t *heap = malloc(devices * sizeof(gen_event_t));
+    if(out == NULL || heap == NULL)
+    {
+        perror(out_path);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    uint32_t heard_limit = heard >= 1.0 ? UINT32_MAX : (uint32_t)(heard * UINT32_MAX);
+    uint32_t foreign_limit = foreign >= 1.0 ? UINT32_MAX : (uint32_t)(foreign * UINT32_MAX);
+    uint64_t end_us = seconds * 1e6;
+    uint64_t events = 0, reports = 0, foreign_reports = 0;
+    uint8_t addr[BTSNOOP_ADDR_LEN];
+    uint8_t frame[ADV_DECODER_FRAME_LEN];
+    int ret = btsnoop_write_head(out) == BTSNOOP_OK ? 0 : 1;
+
+    for(uint32_t i=0; i<devices; ++i) // power on of devices spread over one adv interval
+    {
+        heap[i].time_us = gen_hash(seed, i) % GEN_ADV_INTERVAL_MAX_US;
+        heap[i].device = i;
+    }
+    for(uint32_t i=devices/2; i-->0; )
+        gen_sift_down(heap, devices, i);
+
+    while(ret == 0 && heap[0].time_us < end_us)
+    {
+        uint64_t time_us = heap[0].time_us;
+        uint32_t device = heap[0].device;
+        uint32_t h = gen_hash(device, events++);
+
+        if(h < heard_limit)
+        {
+            uint32_t phase = gen_hash(seed, device);
+            uint8_t slot = (time_us / GEN_SLOT_US + phase) % GEN_ROTATION_LEN;
+            gen_addr(seed, device, addr);
+            gen_frame(seed, device, time_us, gen_rotation[slot], frame);
+            if(btsnoop_write_adv_report(out, GEN_START_US + time_us, addr, -50 - (int8_t)(phase % 45), frame, sizeof(frame)) != BTSNOOP_OK)
+                ret = 1;
+            ++reports;
+
+            // other BLE devices around (phones, beacons) - same head length, other data
+            if(gen_hash(h, device) < foreign_limit)
+            {
+                uint32_t other = gen_hash(h, seed);
+                memset(frame, other, sizeof(frame));
+                frame[0] = 0x1E;
+                frame[1] = 0xFF; // manufacturer specific data
+                memcpy(addr, &other, sizeof(other));
+                if(btsnoop_write_adv_report(out, GEN_START_US + time_us, addr, -80, frame, sizeof(frame)) != BTSNOOP_OK)
+                    ret = 1;
+                ++foreign_reports;
+            }
+        }
+
+        heap[0].time_us += GEN_ADV_INTERVAL_MIN_US + h % (GEN_ADV_INTERVAL_MAX_US - GEN_ADV_INTERVAL_MIN_US + GEN_ADV_DELAY_MAX_US);
+        gen_sift_down(heap, devices, 0);
+    }
+
+    if(fclose(out) != 0)
+        ret = 1;
+    free(heap);
+    if(ret != 0)
+    {
+        fprintf(stderr, "Fail write %s.\n", out_path);
+        return ret;
+    }
+    printf("devices %u, %.1f s, adv events %llu, reports %llu (MyAirScanner %llu, foreign %llu), %.0f reports/s\n", devices,
+        seconds, (unsigned long long)events, (unsigned long long)(reports + foreign_reports), (unsigned long long)reports,
+        (unsigned long long)foreign_reports, (reports + foreign_reports) / seconds);
+    return 0;
+}
@@ -0,0 +1,504 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Offline ingester of btsnoop captures - MyAirScanner measurement frames (id 0x0606) are decoded in batches by adv_decoder
+// into columnar time series, one sample per new cycle of device (frames repeated by rotation are dropped by sequence from head).
+// Reports sustained rate and memory per tracked device - sizing of gateways.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "btsnoop.h"
+#include "adv_decoder.h"
+#include "payload.h"
+#include "ts_store.h"
+
+#define INGEST_BATCH            4096    // frames decoded at once
+#define INGEST_STRIDE           32
+#define INGEST_TYPES_NUM        4       // live, avg, 1h avg, 24h avg
+#define INGEST_TABLE_MIN        1024    // slots of device index, power of 2, load kept below 1/2
+#define INGEST_SERIES_MIN       65536
+#define INGEST_REPORTS_MAX      32      // adv reports in one HCI event
+
+// head of frame from ble_adv_head_t: len_payload, id, device, sequence
+#define INGEST_LEN_PAYLOAD      0x1E
+#define INGEST_ID_MEASUREMENT   0x0606
+#define INGEST_ID_DIAG          0x0687
+#define INGEST_ID_SENSOR        0x0688
+#define INGEST_ID_RELAY         0x0689
+
+typedef struct { // tracked device
+    uint8_t     addr[BTSNOOP_ADDR_LEN];
+    uint16_t    other;              // diag, instance and relay frames
+    uint32_t    frames;             // measurement frames
+    uint32_t    samples;            // new data
+    uint16_t    seq[INGEST_TYPES_NUM]; // 0x100 | last sequence of every type, 0 - none
+} ingest_device_t;
+
+typedef struct { // columnar time series, decoder writes directly to columns
+    size_t      len;
+    size_t      capacity;
+    uint64_t    *time_us;
+    uint32_t    *device;
+    uint8_t     *valid;
+    uint16_t    *device_id;         // from head of frame
+    uint8_t     *seq;
+    uint8_t     *type;
+    int16_t     *temperature;
+    uint16_t    *humidity;
+    uint16_t    *pm[ADV_DECODER_PM_NUM];
+    uint16_t    *um[ADV_DECODER_UM_NUM];
+    uint8_t     *esp_temperature;
+} ingest_series_t;
+
+#define INGEST_SAMPLE_SIZE  (sizeof(uint64_t) + sizeof(uint32_t) + 4*sizeof(uint8_t) + sizeof(int16_t) \
+                            + (2 + ADV_DECODER_PM_NUM + ADV_DECODER_UM_NUM)*sizeof(uint16_t)) // all columns
+
+typedef struct {
+    ingest_device_t *devices;
+    uint32_t        devices_num;
+    uint32_t        devices_capacity;
+    uint32_t        *table;         // index of device + 1, 0 - free slot
+    uint32_t        table_size;
+    ingest_series_t series;
+    uint8_t         *batch;         // frames waiting for decoder
+    size_t          batch_num;
+    adv_decoder_path_t path;
+    // stats
+    uint64_t        records;
+    uint64_t        reports;
+    uint64_t        frames;         // measurement frames
+    uint64_t        other;          // diag, instance, relay frames
+    uint64_t        duplicates;     // measurement frames of cycle already in series or of older cycle
+    uint64_t        first_us;
+    uint64_t        last_us;
+} ingest_t;
+
+
+static double ingest_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+static uint32_t ingest_addr_hash(const uint8_t *addr)
+{
+    uint64_t key = 0;
+    memcpy(&key, addr, BTSNOOP_ADDR_LEN);
+    return (key * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+
+static int ingest_table_grow(ingest_t *ing)
+{
+    uint32_t size = ing->table_size ? ing->table_size * 2 : INGEST_TABLE_MIN;
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    if(table == NULL)
+        return 0;
+
+    for(uint32_t i=0; i<ing->devices_num; ++i)
+    {
+        uint32_t slot = ingest_addr_hash(ing->devices[i].addr) & (size - 1);
+        while(table[slot] != 0)
+            slot = (slot + 1) & (size - 1);
+        table[slot] = i + 1;
+    }
+    free(ing->table);
+    ing->table = table;
+    ing->table_size = size;
+    return 1;
+}
+
+
+static ingest_device_t *ingest_device(ingest_t *ing, const uint8_t *addr) //find or add device, NULL - out of memory
+{
+    uint32_t slot = ingest_addr_hash(addr) & (ing->table_size - 1);
+
+    while(ing->table[slot] != 0)
+    {
+        ingest_device_t *device = &(ing->devices[ing->table[slot] - 1]);
+        if(memcmp(device->addr, addr, BTSNOOP_ADDR_LEN) == 0)
+            return device;
+        slot = (slot + 1) & (ing->table_size - 1);
+    }
+
+    if(ing->devices_num == ing->devices_capacity)
+    {
+        uint32_t capacity = ing->devices_capacity ? ing->devices_capacity * 2 : INGEST_TABLE_MIN / 2;
+        ingest_device_t *devices = realloc(ing->devices, capacity * sizeof(ingest_device_t));
+        if(devices == NULL)
+            return NULL;
+        ing->devices = devices;
+        ing->devices_capacity = capacity;
+    }
+
+    ingest_device_t *device = &(ing->devices[ing->devices_num++]);
+    memset(device, 0, sizeof(*device));
+    memcpy(device->addr, addr, BTSNOOP_ADDR_LEN);
+    ing->table[slot] = ing->devices_num;
+    if(ing->devices_num * 2 > ing->table_size && !ingest_table_grow(ing))
+        return NULL;
+    return device;
+}
+
+
+static int ingest_series_reserve(ingest_series_t *s, size_t num) //space for num more samples
+{
+    if(s->len + num <= s->capacity)
+        return 1;
+
+    size_t capacity = s->capacity ? s->capacity : INGEST_SERIES_MIN;
+    while(capacity < s->len + num)
+        capacity *= 2;
+
+    int ok = 1;
+#define INGEST_GROW(col) do { void *p = realloc(s->col, capacity * sizeof(*(s->col))); if(p) s->col = p; else ok = 0; } while(0)
+    INGEST_GROW(time_us);
+    INGEST_GROW(device);
+    INGEST_GROW(valid);
+    INGEST_GROW(device_id);
+    INGEST_GROW(seq);
+    INGEST_GROW(type);
+    INGEST_GROW(temperature);
+    INGEST_GROW(humidity);
+    INGEST_GROW(esp_temperature);
+    for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+        INGEST_GROW(pm[j]);
+    for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+        INGEST_GROW(um[j]);
+#undef INGEST_GROW
+    if(ok)
+        s->capacity = capacity;
+    return ok;
+}
+
+
+static void ingest_series_free(ingest_series_t *s)
+{
+    free(s->time_us);
+    free(s->device);
+    free(s->valid);
+    free(s->device_id);
+    free(s->seq);
+    free(s->type);
+    free(s->temperature);
+    free(s->humidity);
+    free(s->esp_temperature);
+    for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+        free(s->pm[j]);
+    for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+        free(s->um[j]);
+}
+
+
+static void ingest_flush(ingest_t *ing) //decode batch into columns reserved by ingest_frame
+{
+    ingest_series_t *s = &(ing->series);
+    size_t at = s->len;
+    adv_decoder_result_t dst = {
+        .valid = s->valid + at,
+        .device = s->device_id + at,
+        .seq = s->seq + at,
+        .type = s->type + at,
+        .temperature = s->temperature + at,
+        .humidity = s->humidity + at,
+        .esp_temperature = s->esp_temperature + at
+    };
+    for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+        dst.pm[j] = s->pm[j] + at;
+    for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+        dst.um[j] = s->um[j] + at;
+
+    adv_decoder_decode(ing->batch, INGEST_STRIDE, ing->batch_num, &dst, ing->path);
+    s->len += ing->batch_num;
+    ing->batch_num = 0;
+}
+
+
+static int ingest_frame(ingest_t *ing, uint64_t time_us, const btsnoop_adv_report_t *report) //0 - out of memory
+{
+    if(report->len < ADV_DECODER_FRAME_LEN || report->data[0] != INGEST_LEN_PAYLOAD)
+        return 1;
+
+    uint16_t id = report->data[1] | (report->data[2] << 8);
+    if(id != INGEST_ID_MEASUREMENT)
+    {
+        if(id == INGEST_ID_DIAG || id == INGEST_ID_SENSOR || id == INGEST_ID_RELAY)
+        {
+            ingest_device_t *device = ingest_device(ing, report->addr);
+            if(device == NULL)
+                return 0;
+            ++device->other;
+            ++ing->other;
+        }
+        return 1;
+    }
+
+    ingest_device_t *device = ingest_device(ing, report->addr);
+    if(device == NULL)
+        return 0;
+    ++device->frames;
+    ++ing->frames;
+
+    // repeat of frame in rotation - the same cycle of device and type, or older cycle (scan response and adv data
+    // are set by two HCI commands, one adv event can carry both cycles) - serial number arithmetic
+    uint8_t seq = report->data[5];
+    uint8_t type = PAYLOAD_MEASUREMENT_TYPE(report->data + ADV_DECODER_HEAD_LEN);
+    if(device->seq[type] != 0 && (int8_t)(seq - (uint8_t)device->seq[type]) <= 0)
+    {
+        ++ing->duplicates;
+        return 1;
+    }
+    device->seq[type] = 0x100 | seq;
+    ++device->samples;
+
+    if(ing->batch_num == 0 && !ingest_series_reserve(&(ing->series), INGEST_BATCH))
+        return 0;
+    size_t at = ing->series.len + ing->batch_num;
+    ing->series.time_us[at] = time_us;
+    ing->series.device[at] = device - ing->devices;
+    memcpy(ing->batch + ing->batch_num * INGEST_STRIDE, report->data, ADV_DECODER_FRAME_LEN);
+    if(++ing->batch_num == INGEST_BATCH)
+        ingest_flush(ing);
+    return 1;
+}
+
+
+static btsnoop_error_t ingest_capture(ingest_t *ing, const uint8_t *data, size_t size)
+{
+    btsnoop_reader_t reader;
+    btsnoop_record_t record;
+    btsnoop_adv_report_t reports[INGEST_REPORTS_MAX];
+    btsnoop_error_t err = btsnoop_reader_init(&reader, data, size);
+
+    while(err == BTSNOOP_OK && (err = btsnoop_next(&reader, &record)) == BTSNOOP_OK)
+    {
+        if(ing->records++ == 0)
+            ing->first_us = record.time_us;
+        ing->last_us = record.time_us;
+
+        uint8_t num = btsnoop_adv_reports(&reader, &record, reports, INGEST_REPORTS_MAX);
+        ing->reports += num;
+        for(uint8_t i=0; i<num; ++i)
+        {
+            if(!ingest_frame(ing, record.time_us, &reports[i]))
+            {
+                fprintf(stderr, "Fail alloc memory after %llu records.\n", (unsigned long long)ing->records);
+                exit(1);
+            }
+        }
+    }
+    if(ing->batch_num > 0)
+        ingest_flush(ing);
+    return err;
+}
+
+
+static void ingest_csv(const ingest_t *ing, FILE *csv)
+{
+    const ingest_series_t *s = &(ing->series);
+
+    fprintf(csv, "time_s,addr,device,seq,type,temperature,humidity,sm_pm10,sm_pm25,sm_pm100,ae_pm10,ae_pm25,ae_pm100,"
+        "um3,um5,um10,um25,um50,um100,esp_temperature\n");
+    for(size_t i=0; i<s->len; ++i)
+    {
+        const uint8_t *a = ing->devices[s->device[i]].addr;
+        fprintf(csv, "%.6f,%02X:%02X:%02X:%02X:%02X:%02X,%04X,%u,%u,%.1f,%.1f", s->time_us[i] / 1e6,
+            a[5], a[4], a[3], a[2], a[1], a[0], s->device_id[i], s->seq[i], s->type[i], s->temperature[i] / 10.0, s->humidity[i] / 10.0);
+        for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+            fprintf(csv, ",%u", s->pm[j][i]);
+        for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+            fprintf(csv, ",%u", s->um[j][i]);
+        fprintf(csv, ",%u\n", s->esp_temperature[i]);
+    }
+}
+
+
+static ts_store_error_t ingest_store(const ingest_t *ing, const char *path) //append series to ts_store
+{
+    const ingest_series_t *s = &(ing->series);
+    ts_store_writer_t writer;
+    int32_t values[TS_STORE_FIELDS_NUM];
+    ts_store_error_t err = ts_store_writer_open(&writer, path);
+
+    for(size_t i=0; i<s->len && err == TS_STORE_OK; ++i)
+    {
+        uint64_t device = 0;
+        memcpy(&device, ing->devices[s->device[i]].addr, BTSNOOP_ADDR_LEN);
+        values[TS_STORE_FIELD_TEMPERATURE] = s->temperature[i];
+        values[TS_STORE_FIELD_HUMIDITY] = s->humidity[i];
+        for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+            values[TS_STORE_FIELD_SM_PM10 + j] = s->pm[j][i];
+        for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+            values[TS_STORE_FIELD_UM3 + j] = s->um[j][i];
+        values[TS_STORE_FIELD_ESP_TEMPERATURE] = s->esp_temperature[i];
+        err = ts_store_append(&writer, device, s->type[i], s->time_us[i] / 1000, values);
+    }
+    if(writer.dat != NULL)
+    {
+        ts_store_error_t close_err = ts_store_writer_close(&writer);
+        if(err == TS_STORE_OK)
+            err = close_err;
+    }
+    return err;
+}
+
+
+static void ingest_usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options] CAPTURE\n"
+        "  --path P          decoder path auto|scalar|sse4.1|avx2 (default auto)\n"
+        "  --csv FILE        time series, one line per new data of device\n"
+        "  --store PATH      append time series to columnar store PATH.idx/PATH.dat (ts_store)\n",
+        name);
+}
+
+
+int main(int argc, char **argv)
+{
+    static const adv_decoder_path_t paths[] = {ADV_DECODER_PATH_AUTO, ADV_DECODER_PATH_SCALAR, ADV_DECODER_PATH_SSE41, ADV_DECODER_PATH_AVX2};
+    ingest_t ing = { .path = adv_decoder_best_path() };
+    const char *capture_path = NULL;
+    const char *csv_path = NULL;
+    const char *store_path = NULL;
+
+    for(int i=1; i<argc; ++i)
+    {
+        const char *opt = argv[i];
+        const char *val = (i+1 < argc) ? argv[i+1] : NULL;
+
+        if(opt[0] != '-' && capture_path == NULL)
+        {
+            capture_path = opt;
+            continue;
+        }
+        if(val == NULL)
+        {
+            ingest_usage(argv[0]);
+            return 1;
+        }
+        if(strcmp(opt, "--csv") == 0)
+            csv_path = val;
+        else if(strcmp(opt, "--store") == 0)
+            store_path = val;
+        else if(strcmp(opt, "--path") == 0)
+        {
+            size_t p = 0;
+            while(p < sizeof(paths)/sizeof(paths[0]) && strcmp(val, adv_decoder_path_name(paths[p])) != 0)
+                ++p;
+            if(p == sizeof(paths)/sizeof(paths[0]) || paths[p] > adv_decoder_best_path())
+            {
+                fprintf(stderr, "Decoder path %s is not supported.\n", val);
+                return 1;
+            }
+            ing.path = paths[p] == ADV_DECODER_PATH_AUTO ? adv_decoder_best_path() : paths[p];
+        }
+        else
+        {
+            ingest_usage(argv[0]);
+            return 1;
+        }
+        ++i;
+    }
+    if(capture_path == NULL)
+    {
+        ingest_usage(argv[0]);
+        return 1;
+    }
+
+    int fd = open(capture_path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(capture_path);
+        return 1;
+    }
+    const uint8_t *data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if(data == MAP_FAILED)
+    {
+        perror(capture_path);
+        return 1;
+    }
+    madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+
+    ing.batch = malloc(INGEST_BATCH * INGEST_STRIDE);
+    if(ing.batch == NULL || !ingest_table_grow(&ing))
+    {
+        fprintf(stderr, "Fail alloc memory.\n");
+        return 1;
+    }
+    memset(ing.batch, 0, INGEST_BATCH * INGEST_STRIDE);
+
+    double start = ingest_now();
+    btsnoop_error_t err = ingest_capture(&ing, data, st.st_size);
+    double elapsed = ingest_now() - start;
+
+    if(err == BTSNOOP_BAD_HEAD || err == BTSNOOP_BAD_DATALINK)
+    {
+        fprintf(stderr, "%s: not btsnoop HCI capture.\n", capture_path);
+        return 1;
+    }
+    if(err == BTSNOOP_TRUNCATED)
+        fprintf(stderr, "%s: last record is truncated.\n", capture_path);
+
+    double span = (ing.last_us - ing.first_us) / 1e6;
+    size_t devices_mem = ing.devices_capacity * sizeof(ingest_device_t) + ing.table_size * sizeof(uint32_t);
+    size_t series_mem = ing.series.capacity * INGEST_SAMPLE_SIZE;
+    uint32_t devices = ing.devices_num ? ing.devices_num : 1;
+
+    printf("capture         %.1f MB, records %llu, adv reports %llu, span %.1f s\n", st.st_size / 1e6,
+        (unsigned long long)ing.records, (unsigned long long)ing.reports, span);
+    printf("frames          measurement %llu (new cycles %zu, duplicates %llu), diag/instance/relay %llu\n",
+        (unsigned long long)ing.frames, ing.series.len, (unsigned long long)ing.duplicates, (unsigned long long)ing.other);
+    printf("ingest          %.3f s, %.2f Mrecords/s, %.2f Mframes/s, decoder %s\n", elapsed, ing.records / elapsed * 1e-6,
+        (ing.frames + ing.other) / elapsed * 1e-6, adv_decoder_path_name(ing.path));
+    printf("devices         %u, index %zu B (%.1f B/device), series %zu samples %zu B (%.1f B/device, %zu B/sample)\n",
+        ing.devices_num, devices_mem, (double)devices_mem / devices, ing.series.len, series_mem,
+        (double)series_mem / devices, INGEST_SAMPLE_SIZE);
+    if(span > 0.0)
+        printf("load            capture %.0f frames/s, headroom x%.0f\n", (ing.frames + ing.other) / span, span / elapsed);
+
+    int ret = 0;
+    if(csv_path != NULL)
+    {
+        FILE *csv = fopen(csv_path, "w");
+        if(csv == NULL)
+        {
+            perror(csv_path);
+            ret = 1;
+        }
+        else
+        {
+            ingest_csv(&ing, csv);
+            fclose(csv);
+        }
+    }
+    if(store_path != NULL)
+    {
+        start = ingest_now();
+        ts_store_error_t store_err = ingest_store(&ing, store_path);
+        if(store_err != TS_STORE_OK)
+        {
+            fprintf(stderr, "Fail append to store %s (%d).\n", store_path, store_err);
+            ret = 1;
+        }
+        else
+            printf("store           %zu samples in %.3f s\n", ing.series.len, ingest_now() - start);
+    }
+
+    ingest_series_free(&(ing.series));
+    free(ing.devices);
+    free(ing.table);
+    free(ing.batch);
+    munmap((void*)data, st.st_size);
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#include <string.h>
+#include "btsnoop.h"
+
+static const uint8_t BTSNOOP_MAGIC[8] = {'b', 't', 's', 'n', 'o', 'o', 'p', 0};
+
+#define BTSNOOP_H4_EVENT                0x04
+#define BTSNOOP_HCI_LE_META             0x3E
+#define BTSNOOP_LE_ADV_REPORT           0x02
+#define BTSNOOP_LE_EXT_ADV_REPORT       0x0D
+#define BTSNOOP_ADV_REPORT_HEAD_LEN     9   // event type, addr type, addr, data len
+#define BTSNOOP_EXT_ADV_REPORT_HEAD_LEN 24  // event type (2), addr type, addr, phy (2), sid, tx power, rssi, interval (2), direct addr type, direct addr, data len
+
+static uint32_t btsnoop_be32(const uint8_t *src)
+{
+    return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+}
+
+
+static uint64_t btsnoop_be64(const uint8_t *src)
+{
+    return ((uint64_t)btsnoop_be32(src) << 32) | btsnoop_be32(src + 4);
+}
+
+
+static void btsnoop_put_be32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = value >> 24;
+    dst[1] = value >> 16;
+    dst[2] = value >> 8;
+    dst[3] = value;
+}
+
+
+static void btsnoop_put_be64(uint8_t *dst, uint64_t value)
+{
+    btsnoop_put_be32(dst, value >> 32);
+    btsnoop_put_be32(dst + 4, value);
+}
+
+
+btsnoop_error_t btsnoop_reader_init(btsnoop_reader_t *reader, const uint8_t *data, size_t size) //check head of capture
+{
+    if(size < BTSNOOP_HEAD_LEN || memcmp(data, BTSNOOP_MAGIC, sizeof(BTSNOOP_MAGIC)) != 0 || btsnoop_be32(data + 8) != BTSNOOP_VERSION)
+        return BTSNOOP_BAD_HEAD;
+
+    reader->datalink = btsnoop_be32(data + 12);
+    if(reader->datalink != BTSNOOP_DATALINK_HCI && reader->datalink != BTSNOOP_DATALINK_H4)
+        return BTSNOOP_BAD_DATALINK;
+
+    reader->data = data;
+    reader->size = size;
+    reader->pos = BTSNOOP_HEAD_LEN;
+    return BTSNOOP_OK;
+}
+
+
+btsnoop_error_t btsnoop_next(btsnoop_reader_t *reader, btsnoop_record_t *dst) //next record, packet is not copied
+{
+    if(reader->pos == reader->size)
+        return BTSNOOP_END;
+    if(reader->size - reader->pos < BTSNOOP_RECORD_HEAD_LEN)
+        return BTSNOOP_TRUNCATED;
+
+    const uint8_t *head = reader->data + reader->pos;
+    uint32_t included = btsnoop_be32(head + 4);
+    if(reader->size - reader->pos - BTSNOOP_RECORD_HEAD_LEN < included)
+        return BTSNOOP_TRUNCATED;
+
+    dst->flags = btsnoop_be32(head + 8);
+    dst->time_us = btsnoop_be64(head + 16) - BTSNOOP_UNIX_EPOCH_US;
+    dst->len = included;
+    dst->packet = head + BTSNOOP_RECORD_HEAD_LEN;
+    reader->pos += BTSNOOP_RECORD_HEAD_LEN + included;
+    return BTSNOOP_OK;
+}
+
+
+uint8_t btsnoop_adv_reports(const btsnoop_reader_t *reader, const btsnoop_record_t *record, btsnoop_adv_report_t *dst, uint8_t max) //return number of reports
+{                                                                                                                                   // in record, 0 - other packet
+    const uint8_t *packet = record->packet;
+    uint32_t len = record->len;
+
+    if(reader->datalink == BTSNOOP_DATALINK_H4)
+    {
+        if(len == 0 || packet[0] != BTSNOOP_H4_EVENT)
+            return 0;
+        ++packet;
+        --len;
+    }
+    else if((record->flags & (BTSNOOP_FLAG_RECEIVED | BTSNOOP_FLAG_COMMAND_EVENT)) != (BTSNOOP_FLAG_RECEIVED | BTSNOOP_FLAG_COMMAND_EVENT))
+        return 0;
+
+    // event code, parameters len, subevent, number of reports
+    if(len < 4 || packet[0] != BTSNOOP_HCI_LE_META || packet[1] + 2u > len)
+        return 0;
+    uint8_t subevent = packet[2];
+    uint8_t reports = packet[3];
+    const uint8_t *end = packet + 2 + packet[1];
+    const uint8_t *pos = packet + 4;
+    uint8_t num = 0;
+
+    // reports one after another (as BlueZ and Bluedroid parse them), incomplete report ends parsing
+    for(uint8_t i=0; i<reports && num<max; ++i)
+    {
+        btsnoop_adv_report_t *report = &dst[num];
+        if(subevent == BTSNOOP_LE_ADV_REPORT)
+        {
+            if(end - pos < BTSNOOP_ADV_REPORT_HEAD_LEN || end - pos < BTSNOOP_ADV_REPORT_HEAD_LEN + pos[8] + 1)
+                break;
+            report->addr_type = pos[1];
+            report->addr = pos + 2;
+            report->len = pos[8];
+            report->data = pos + BTSNOOP_ADV_REPORT_HEAD_LEN;
+            report->rssi = (int8_t)report->data[report->len];
+            pos += BTSNOOP_ADV_REPORT_HEAD_LEN + report->len + 1;
+        }
+        else if(subevent == BTSNOOP_LE_EXT_ADV_REPORT)
+        {
+            if(end - pos < BTSNOOP_EXT_ADV_REPORT_HEAD_LEN || end - pos < BTSNOOP_EXT_ADV_REPORT_HEAD_LEN + pos[23])
+                break;
+            report->addr_type = pos[2];
+            report->addr = pos + 3;
+            report->rssi = (int8_t)pos[13];
+            report->len = pos[23];
+            report->data = pos + BTSNOOP_EXT_ADV_REPORT_HEAD_LEN;
+            pos += BTSNOOP_EXT_ADV_REPORT_HEAD_LEN + report->len;
+        }
+        else
+            break;
+        ++num;
+    }
+    return num;
+}
+
+
+btsnoop_error_t btsnoop_write_head(FILE *file) //head of capture with H4 packets
+{
+    uint8_t head[BTSNOOP_HEAD_LEN];
+
+    memcpy(head, BTSNOOP_MAGIC, sizeof(BTSNOOP_MAGIC));
+    btsnoop_put_be32(head + 8, BTSNOOP_VERSION);
+    btsnoop_put_be32(head + 12, BTSNOOP_DATALINK_H4);
+    return fwrite(head, sizeof(head), 1, file) == 1 ? BTSNOOP_OK : BTSNOOP_FAIL_WRITE;
+}
+
+
+btsnoop_error_t btsnoop_write_adv_report(FILE *file, uint64_t time_us, const uint8_t *addr, int8_t rssi, const uint8_t *data, uint8_t len) //one LE Advertising
+{                                                                                                                                            // Report event with one report
+    uint8_t record[BTSNOOP_RECORD_HEAD_LEN + 5 + BTSNOOP_ADV_REPORT_HEAD_LEN + 255 + 1];
+    uint8_t *packet = record + BTSNOOP_RECORD_HEAD_LEN;
+    uint32_t packet_len = 5 + BTSNOOP_ADV_REPORT_HEAD_LEN + len + 1;
+
+    btsnoop_put_be32(record, packet_len);
+    btsnoop_put_be32(record + 4, packet_len);
+    btsnoop_put_be32(record + 8, BTSNOOP_FLAG_RECEIVED | BTSNOOP_FLAG_COMMAND_EVENT);
+    btsnoop_put_be32(record + 12, 0);
+    btsnoop_put_be64(record + 16, time_us + BTSNOOP_UNIX_EPOCH_US);
+
+    packet[0] = BTSNOOP_H4_EVENT;
+    packet[1] = BTSNOOP_HCI_LE_META;
+    packet[2] = packet_len - 3;
+    packet[3] = BTSNOOP_LE_ADV_REPORT;
+    packet[4] = 1;
+    packet[5] = 0x03; // ADV_NONCONN_IND
+    packet[6] = 0x00; // public address
+    memcpy(packet + 7, addr, BTSNOOP_ADDR_LEN);
+    packet[13] = len;
+    memcpy(packet + 14, data, len);
+    packet[14 + len] = (uint8_t)rssi;
+
+    return fwrite(record, BTSNOOP_RECORD_HEAD_LEN + packet_len, 1, file) == 1 ? BTSNOOP_OK : BTSNOOP_FAIL_WRITE;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef BTSNOOP_H_
+#define BTSNOOP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Reader and writer of btsnoop captures (btmon -w, hcidump -w, Android bugreport) - HCI packets with timestamps.
+// Reader works on capture in memory (mmap), records are not copied. All numbers in file are big endian.
+// Only LE Advertising Report (0x02) and LE Extended Advertising Report (0x0D) events are parsed.
+
+#define BTSNOOP_HEAD_LEN            16
+#define BTSNOOP_RECORD_HEAD_LEN     24
+#define BTSNOOP_VERSION             1
+#define BTSNOOP_DATALINK_HCI        1001    // packet without H4 type, type is in flags
+#define BTSNOOP_DATALINK_H4         1002    // first byte of packet is H4 type
+#define BTSNOOP_FLAG_RECEIVED       0x01    // controller -> host
+#define BTSNOOP_FLAG_COMMAND_EVENT  0x02
+#define BTSNOOP_UNIX_EPOCH_US       0x00DCDDB30F2F8000ull // btsnoop time (us since year 0) of 1970-01-01
+#define BTSNOOP_ADDR_LEN            6
+
+//ERROR
+typedef enum {
+    BTSNOOP_OK              = 0,
+    BTSNOOP_END             = 1,    // no more records
+    BTSNOOP_BAD_HEAD        = -1,   // not btsnoop file or unknown version
+    BTSNOOP_BAD_DATALINK    = -2,   // not HCI capture
+    BTSNOOP_TRUNCATED       = -3,   // last record is cut (capture was not closed)
+    BTSNOOP_FAIL_WRITE      = -4
+} btsnoop_error_t;
+
+typedef struct {
+    const uint8_t   *data;
+    size_t          size;
+    size_t          pos;
+    uint32_t        datalink;
+} btsnoop_reader_t;
+
+typedef struct {
+    uint64_t        time_us;        // unix time
+    uint32_t        flags;
+    uint32_t        len;
+    const uint8_t   *packet;        // points into capture
+} btsnoop_record_t;
+
+typedef struct {
+    const uint8_t   *addr;          // little endian as in HCI
+    uint8_t         addr_type;
+    int8_t          rssi;
+    uint8_t         len;
+    const uint8_t   *data;          // adv data, points into capture
+} btsnoop_adv_report_t;
+
+
+btsnoop_error_t btsnoop_reader_init(btsnoop_reader_t *reader, const uint8_t *data, size_t size);
+btsnoop_error_t btsnoop_next(btsnoop_reader_t *reader, btsnoop_record_t *dst);
+uint8_t btsnoop_adv_reports(const btsnoop_reader_t *reader, const btsnoop_record_t *record, btsnoop_adv_report_t *dst, uint8_t max);
+
+btsnoop_error_t btsnoop_write_head(FILE *file);
+btsnoop_error_t btsnoop_write_adv_report(FILE *file, uint64_t time_us, const uint8_t *addr, int8_t rssi, const uint8_t *data, uint8_t len);
+
+#endif
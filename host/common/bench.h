@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Helpers shared by host benchmarks - random generator, clock and parser of "--name value" options.
+
+typedef enum {
+    BENCH_OPTION_U32 = 0,   // uint32_t, greater than 0
+    BENCH_OPTION_U64,       // uint64_t, greater than 0
+    BENCH_OPTION_DOUBLE,    // double
+    BENCH_OPTION_STRING,    // const char *
+} bench_option_type_t;
+
+typedef struct {
+    const char          *name;      // with leading "--"
+    bench_option_type_t type;
+    void                *value;     // left unchanged if option is not given
+} bench_option_t;
+
+
+static inline uint32_t bench_rand(uint32_t *state) //xorshift32, state must not be 0
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+
+static inline double bench_now(void) //monotonic time in seconds
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+static inline void bench_usage(const char *program, const bench_option_t *options, size_t options_num)
+{
+    fprintf(stderr, "usage: %s", program);
+    for(size_t i=0; i<options_num; ++i)
+    {
+        if(options[i].type == BENCH_OPTION_STRING)
+        {
+            fprintf(stderr, " [%s ", options[i].name);
+            for(const char *c = options[i].name + 2; *c; ++c)
+                fputc(*c >= 'a' && *c <= 'z' ? *c - 'a' + 'A' : *c, stderr);
+            fputc(']', stderr);
+        }
+        else
+            fprintf(stderr, " [%s N]", options[i].name);
+    }
+    fputc('\n', stderr);
+}
+
+
+static inline int bench_options_parse(int argc, char **argv, const bench_option_t *options, size_t options_num) //0 or -1 after usage printed
+{
+    if(argc % 2 == 0)
+    {
+        bench_usage(argv[0], options, options_num);
+        return -1;
+    }
+    for(int i=1; i+1<argc; i+=2)
+    {
+        size_t o = 0;
+        while(o < options_num && strcmp(argv[i], options[o].name) != 0)
+            ++o;
+        if(o == options_num)
+        {
+            bench_usage(argv[0], options, options_num);
+            return -1;
+        }
+
+        switch(options[o].type)
+        {
+        case BENCH_OPTION_U32:
+        case BENCH_OPTION_U64:
+        {
+            char *end;
+            unsigned long long value = strtoull(argv[i+1], &end, 0);
+            if(*end != '\0' || value == 0 || (options[o].type == BENCH_OPTION_U32 && value > UINT32_MAX))
+            {
+                bench_usage(argv[0], options, options_num);
+                return -1;
+            }
+            if(options[o].type == BENCH_OPTION_U32)
+                *(uint32_t *)options[o].value = value;
+            else
+                *(uint64_t *)options[o].value = value;
+            break;
+        }
+        case BENCH_OPTION_DOUBLE:
+            *(double *)options[o].value = atof(argv[i+1]);
+            break;
+        case BENCH_OPTION_STRING:
+            *(const char **)options[o].value = argv[i+1];
+            break;
+        }
+    }
+    return 0;
+}
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#include <string.h>
+#include "adv_decoder.h"
+#include "payload.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ADV_DECODER_X86 1
+#endif
+
+// head of frame from ble_adv_head_t: len_payload, id (0x0606), device, sequence
+static const uint8_t ADV_DECODER_HEAD[ADV_DECODER_HEAD_ID_LEN] = {0x1E, 0x06, 0x06};
+#define ADV_DECODER_HEAD_DWORD  0x0006061Eu // bytes 0..2 of head, little endian
+#define ADV_DECODER_HEAD_MASK   0x00FFFFFFu
+
+static size_t adv_decoder_decode_scalar(const uint8_t *frames, size_t stride, size_t begin, size_t count, adv_decoder_result_t *dst);
+
+
+
+static size_t adv_decoder_decode_scalar(const uint8_t *frames, size_t stride, size_t begin, size_t count, adv_decoder_result_t *dst) //reference path
+{
+    size_t valid_num = 0;
+    int32_t values[PAYLOAD_MEASUREMENT_FIELDS_NUM];
+
+    for(size_t i=begin; i<count; ++i)
+    {
+        const uint8_t *frame = frames + i*stride;
+
+        dst->valid[i] = memcmp(frame, ADV_DECODER_HEAD, ADV_DECODER_HEAD_ID_LEN) == 0;
+        valid_num += dst->valid[i];
+        dst->device[i] = frame[3] | (frame[4] << 8);
+        dst->seq[i] = frame[5];
+
+        payload_decode(&payload_measurement_schema, frame + ADV_DECODER_HEAD_LEN, values);
+        dst->type[i] = values[PAYLOAD_FIELD_TYPE];
+        dst->temperature[i] = values[PAYLOAD_FIELD_TEMPERATURE];
+        dst->humidity[i] = values[PAYLOAD_FIELD_HUMIDITY];
+        for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+            dst->pm[j][i] = values[PAYLOAD_FIELD_SM_PM10 + j];
+        for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+            dst->um[j][i] = values[PAYLOAD_FIELD_UM3 + j];
+        dst->esp_temperature[i] = values[PAYLOAD_FIELD_ESP_TEMPERATURE];
+    }
+    return valid_num;
+}
+
+#ifdef ADV_DECODER_X86
+
+// Vector paths read little endian dwords from head and payload (offsets relative to start of frame):
+//  0: len, id in low 3 bytes; 3: device 16bit, sequence
+//  6: tttttt yy | hh tttttt | hhhhhhhh      type, temperature (sign-magnitude), humidity
+//  9, 12, 15: aaaaaaaa | aaaa bbbb | bbbbbbbb   2x12bit pm
+//  18, 22, 26: um little endian 16bit, 2 values per dword
+//  27: esp temperature in highest byte (dword at 30 would read past 31bytes frame)
+
+__attribute__((target("sse4.1")))
+static inline __m128i adv_decoder_load4(const uint8_t *frame, size_t stride, size_t offset)
+{
+    int32_t d[4];
+    for(int k=0; k<4; ++k)
+        memcpy(&d[k], frame + k*stride + offset, 4);
+    return _mm_loadu_si128((const __m128i*)d);
+}
+
+__attribute__((target("sse4.1")))
+static inline void adv_decoder_store4_u16(uint16_t *dst, __m128i v)
+{
+    _mm_storel_epi64((__m128i*)dst, _mm_packus_epi32(v, v));
+}
+
+__attribute__((target("sse4.1")))
+static inline void adv_decoder_store4_u8(uint8_t *dst, __m128i v)
+{
+    int32_t packed = _mm_cvtsi128_si32(_mm_shuffle_epi8(v, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)));
+    memcpy(dst, &packed, 4);
+}
+
+__attribute__((target("sse4.1")))
+static size_t adv_decoder_decode_sse41(const uint8_t *frames, size_t stride, size_t count, adv_decoder_result_t *dst)
+{
+    const __m128i mask_2 = _mm_set1_epi32(0x3), mask_4 = _mm_set1_epi32(0xF), mask_6 = _mm_set1_epi32(0x3F);
+    const __m128i mask_8 = _mm_set1_epi32(0xFF), mask_11 = _mm_set1_epi32(0x7FF), mask_16 = _mm_set1_epi32(0xFFFF);
+    const __m128i one = _mm_set1_epi32(1);
+    __m128i valid_sum = _mm_setzero_si128();
+    size_t i = 0;
+
+    for(; i + 4 <= count; i += 4)
+    {
+        const uint8_t *frame = frames + i*stride;
+        __m128i x, a, b;
+
+        // head
+        x = _mm_and_si128(adv_decoder_load4(frame, stride, 0), _mm_set1_epi32((int32_t)ADV_DECODER_HEAD_MASK));
+        x = _mm_and_si128(_mm_cmpeq_epi32(x, _mm_set1_epi32((int32_t)ADV_DECODER_HEAD_DWORD)), one);
+        valid_sum = _mm_add_epi32(valid_sum, x);
+        adv_decoder_store4_u8(dst->valid + i, x);
+        x = adv_decoder_load4(frame, stride, 3);
+        adv_decoder_store4_u16(dst->device + i, _mm_and_si128(x, mask_16));
+        adv_decoder_store4_u8(dst->seq + i, _mm_and_si128(_mm_srli_epi32(x, 16), mask_8));
+
+        // type, temperature, humidity
+        x = adv_decoder_load4(frame, stride, 6);
+        adv_decoder_store4_u8(dst->type + i, _mm_and_si128(x, mask_2));
+        a = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 2), mask_6), _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(x, 8), mask_6), 6));
+        b = _mm_srai_epi32(_mm_slli_epi32(a, 20), 31); // -1 if sign bit
+        a = _mm_sub_epi32(_mm_xor_si128(_mm_and_si128(a, mask_11), b), b);
+        _mm_storel_epi64((__m128i*)(dst->temperature + i), _mm_packs_epi32(a, a));
+        b = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 14), mask_2), _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(x, 16), mask_8), 2));
+        adv_decoder_store4_u16(dst->humidity + i, b);
+
+        // pm pairs
+        for(int j=0; j<3; ++j)
+        {
+            x = adv_decoder_load4(frame, stride, 9 + 3*j);
+            a = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(x, mask_8), 4), _mm_and_si128(_mm_srli_epi32(x, 12), mask_4));
+            b = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(x, 8), mask_4), 8), _mm_and_si128(_mm_srli_epi32(x, 16), mask_8));
+            adv_decoder_store4_u16(dst->pm[2*j] + i, a);
+            adv_decoder_store4_u16(dst->pm[2*j+1] + i, b);
+        }
+
+        // um
+        for(int j=0; j<3; ++j)
+        {
+            x = adv_decoder_load4(frame, stride, 18 + 4*j);
+            adv_decoder_store4_u16(dst->um[2*j] + i, _mm_and_si128(x, mask_16));
+            adv_decoder_store4_u16(dst->um[2*j+1] + i, _mm_srli_epi32(x, 16));
+        }
+
+        x = adv_decoder_load4(frame, stride, 27);
+        adv_decoder_store4_u8(dst->esp_temperature + i, _mm_srli_epi32(x, 24));
+    }
+
+    int32_t sum[4];
+    _mm_storeu_si128((__m128i*)sum, valid_sum);
+    return (size_t)sum[0] + sum[1] + sum[2] + sum[3] + adv_decoder_decode_scalar(frames, stride, i, count, dst);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i adv_decoder_load8(const uint8_t *frame, __m256i index, size_t offset)
+{
+    return _mm256_i32gather_epi32((const int*)(frame + offset), index, 1);
+}
+
+__attribute__((target("avx2")))
+static inline void adv_decoder_store8_u16(uint16_t *dst, __m256i v)
+{
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+    _mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(packed));
+}
+
+__attribute__((target("avx2")))
+static inline void adv_decoder_store8_u8(uint8_t *dst, __m256i v)
+{
+    const __m256i shuffle = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, shuffle), _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+    _mm_storel_epi64((__m128i*)dst, _mm256_castsi256_si128(packed));
+}
+
+__attribute__((target("avx2")))
+static size_t adv_decoder_decode_avx2(const uint8_t *frames, size_t stride, size_t count, adv_decoder_result_t *dst)
+{
+    const __m256i mask_2 = _mm256_set1_epi32(0x3), mask_4 = _mm256_set1_epi32(0xF), mask_6 = _mm256_set1_epi32(0x3F);
+    const __m256i mask_8 = _mm256_set1_epi32(0xFF), mask_11 = _mm256_set1_epi32(0x7FF), mask_16 = _mm256_set1_epi32(0xFFFF);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int32_t)stride));
+    __m256i valid_sum = _mm256_setzero_si256();
+    size_t i = 0;
+
+    if(stride > INT32_MAX / 8)
+        return adv_decoder_decode_scalar(frames, stride, 0, count, dst);
+
+    for(; i + 8 <= count; i += 8)
+    {
+        const uint8_t *frame = frames + i*stride;
+        __m256i x, a, b;
+
+        // head
+        x = _mm256_and_si256(adv_decoder_load8(frame, index, 0), _mm256_set1_epi32((int32_t)ADV_DECODER_HEAD_MASK));
+        x = _mm256_and_si256(_mm256_cmpeq_epi32(x, _mm256_set1_epi32((int32_t)ADV_DECODER_HEAD_DWORD)), one);
+        valid_sum = _mm256_add_epi32(valid_sum, x);
+        adv_decoder_store8_u8(dst->valid + i, x);
+        x = adv_decoder_load8(frame, index, 3);
+        adv_decoder_store8_u16(dst->device + i, _mm256_and_si256(x, mask_16));
+        adv_decoder_store8_u8(dst->seq + i, _mm256_and_si256(_mm256_srli_epi32(x, 16), mask_8));
+
+        // type, temperature, humidity
+        x = adv_decoder_load8(frame, index, 6);
+        adv_decoder_store8_u8(dst->type + i, _mm256_and_si256(x, mask_2));
+        a = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(x, 2), mask_6), _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(x, 8), mask_6), 6));
+        b = _mm256_srai_epi32(_mm256_slli_epi32(a, 20), 31); // -1 if sign bit
+        a = _mm256_sub_epi32(_mm256_xor_si256(_mm256_and_si256(a, mask_11), b), b);
+        _mm_storeu_si128((__m128i*)(dst->temperature + i), _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packs_epi32(a, a), 0x08)));
+        b = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(x, 14), mask_2), _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(x, 16), mask_8), 2));
+        adv_decoder_store8_u16(dst->humidity + i, b);
+
+        // pm pairs
+        for(int j=0; j<3; ++j)
+        {
+            x = adv_decoder_load8(frame, index, 9 + 3*j);
+            a = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(x, mask_8), 4), _mm256_and_si256(_mm256_srli_epi32(x, 12), mask_4));
+            b = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(x, 8), mask_4), 8), _mm256_and_si256(_mm256_srli_epi32(x, 16), mask_8));
+            adv_decoder_store8_u16(dst->pm[2*j] + i, a);
+            adv_decoder_store8_u16(dst->pm[2*j+1] + i, b);
+        }
+
+        // um
+        for(int j=0; j<3; ++j)
+        {
+            x = adv_decoder_load8(frame, index, 18 + 4*j);
+            adv_decoder_store8_u16(dst->um[2*j] + i, _mm256_and_si256(x, mask_16));
+            adv_decoder_store8_u16(dst->um[2*j+1] + i, _mm256_srli_epi32(x, 16));
+        }
+
+        x = adv_decoder_load8(frame, index, 27);
+        adv_decoder_store8_u8(dst->esp_temperature + i, _mm256_srli_epi32(x, 24));
+    }
+
+    int32_t sum[8];
+    _mm256_storeu_si256((__m256i*)sum, valid_sum);
+    size_t valid_num = 0;
+    for(int k=0; k<8; ++k)
+        valid_num += sum[k];
+    return valid_num + adv_decoder_decode_scalar(frames, stride, i, count, dst);
+}
+
+#endif
+
+
+adv_decoder_path_t adv_decoder_best_path(void) //fastest path supported by CPU
+{
+#ifdef ADV_DECODER_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return ADV_DECODER_PATH_AVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+        return ADV_DECODER_PATH_SSE41;
+#endif
+    return ADV_DECODER_PATH_SCALAR;
+}
+
+
+const char *adv_decoder_path_name(adv_decoder_path_t path)
+{
+    switch(path)
+    {
+    case ADV_DECODER_PATH_SCALAR:   return "scalar";
+    case ADV_DECODER_PATH_SSE41:    return "sse4.1";
+    case ADV_DECODER_PATH_AVX2:     return "avx2";
+    default:                        return "auto";
+    }
+}
+
+
+size_t adv_decoder_decode(const uint8_t *frames, size_t stride, size_t count, adv_decoder_result_t *dst, adv_decoder_path_t path)
+{
+    if(stride < ADV_DECODER_FRAME_LEN)
+        return 0;
+    if(path == ADV_DECODER_PATH_AUTO)
+        path = adv_decoder_best_path();
+
+    switch(path)
+    {
+#ifdef ADV_DECODER_X86
+    case ADV_DECODER_PATH_AVX2:
+        return adv_decoder_decode_avx2(frames, stride, count, dst);
+    case ADV_DECODER_PATH_SSE41:
+        return adv_decoder_decode_sse41(frames, stride, count, dst);
+#endif
+    default:
+        return adv_decoder_decode_scalar(frames, stride, 0, count, dst);
+    }
+}
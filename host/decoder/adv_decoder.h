@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ADV_DECODER_H_  
+#define ADV_DECODER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Batch decoder of MyAirScanner measurement frames (raw 31bytes adv data = ble_adv_head_t + measurement payload).
+// Result is struct of arrays, one element per frame. Fields of frames with valid[i]==0 are undefined.
+
+#define ADV_DECODER_FRAME_LEN       31
+#define ADV_DECODER_HEAD_LEN        6   // len, id (0x0606), device, sequence
+#define ADV_DECODER_HEAD_ID_LEN     3   // len, id - same in all frames of MyAirScanner measurement
+#define ADV_DECODER_PM_NUM          6   // sm pm1.0/2.5/10, ae pm1.0/2.5/10
+#define ADV_DECODER_UM_NUM          6   // particles >0.3/0.5/1.0/2.5/5.0/10um
+
+typedef enum {
+    ADV_DECODER_PATH_AUTO   = 0,
+    ADV_DECODER_PATH_SCALAR = 1,    // reference, payload_decode from firmware
+    ADV_DECODER_PATH_SSE41  = 2,    // 4 frames per step
+    ADV_DECODER_PATH_AVX2   = 3     // 8 frames per step
+} adv_decoder_path_t;
+
+typedef struct {
+    uint8_t     *valid;             // head of frame is MyAirScanner head
+    uint16_t    *device;            // id of device from head, two lowest bytes of BT MAC by default
+    uint8_t     *seq;               // cycle of data from head (wraps), the same seq of device = repeat of frame in rotation
+    uint8_t     *type;              // 0 - live, 1 - avg, 2 - 1h avg, 3 - 24h avg
+    int16_t     *temperature;       // 0.1 C
+    uint16_t    *humidity;          // 0.1 %
+    uint16_t    *pm[ADV_DECODER_PM_NUM];
+    uint16_t    *um[ADV_DECODER_UM_NUM];
+    uint8_t     *esp_temperature;
+} adv_decoder_result_t;
+
+
+// frames - count frames, every frame starts stride bytes after previous (stride >= ADV_DECODER_FRAME_LEN)
+// return number of valid frames
+size_t adv_decoder_decode(const uint8_t *frames, size_t stride, size_t count, adv_decoder_result_t *dst, adv_decoder_path_t path);
+adv_decoder_path_t adv_decoder_best_path(void);
+const char *adv_decoder_path_name(adv_decoder_path_t path);
+
+#endif
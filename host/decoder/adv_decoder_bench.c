@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+// Benchmark of adv_decoder paths on synthetic frames encoded by firmware payload_encode,
+// every vector path is checked against scalar reference.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "adv_decoder.h"
+#include "payload.h"
+
+#define BENCH_FRAMES_NUM    (1u<<20)
+#define BENCH_STRIDE        32      // e.g. frames stored in 32bytes records
+#define BENCH_REPEAT        10
+
+static const uint8_t bench_head[ADV_DECODER_HEAD_ID_LEN] = {0x1E, 0x06, 0x06};
+
+
+static void bench_fill(uint8_t *frames, size_t count, size_t stride)
+{
+    uint32_t seed = 0x12345678;
+    int32_t values[PAYLOAD_MEASUREMENT_FIELDS_NUM];
+
+    for(size_t i=0; i<count; ++i)
+    {
+        uint8_t *frame = frames + i*stride;
+
+        values[PAYLOAD_FIELD_TYPE] = bench_rand(&seed) & 1;
+        values[PAYLOAD_FIELD_TEMPERATURE] = (int32_t)(bench_rand(&seed) % 1201) - 400;
+        values[PAYLOAD_FIELD_HUMIDITY] = bench_rand(&seed) % 1001;
+        for(int j=PAYLOAD_FIELD_SM_PM10; j<=PAYLOAD_FIELD_AE_PM100; ++j)
+            values[j] = bench_rand(&seed) % 1000;
+        for(int j=PAYLOAD_FIELD_UM3; j<=PAYLOAD_FIELD_UM100; ++j)
+            values[j] = bench_rand(&seed) & 0xFFFF;
+        values[PAYLOAD_FIELD_ESP_TEMPERATURE] = bench_rand(&seed) % 100;
+
+        memset(frame, 0, stride);
+        memcpy(frame, bench_head, ADV_DECODER_HEAD_ID_LEN);
+        frame[3] = i & 0xFF; // device, sequence
+        frame[4] = (i >> 8) & 0xFF;
+        frame[5] = bench_rand(&seed);
+        payload_encode(&payload_measurement_schema, values, frame + ADV_DECODER_HEAD_LEN);
+        if(bench_rand(&seed) % 16 == 0) // foreign adv frame
+            frame[bench_rand(&seed) % ADV_DECODER_HEAD_ID_LEN] ^= 1 + bench_rand(&seed) % 255;
+    }
+}
+
+
+static int bench_alloc(adv_decoder_result_t *r, size_t count)
+{
+    r->valid = malloc(count);
+    r->device = malloc(count*sizeof(uint16_t));
+    r->seq = malloc(count);
+    r->type = malloc(count);
+    r->temperature = malloc(count*sizeof(int16_t));
+    r->humidity = malloc(count*sizeof(uint16_t));
+    r->esp_temperature = malloc(count);
+    int ok = r->valid && r->device && r->seq && r->type && r->temperature && r->humidity && r->esp_temperature;
+    for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+        ok &= (r->pm[j] = malloc(count*sizeof(uint16_t))) != NULL;
+    for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+        ok &= (r->um[j] = malloc(count*sizeof(uint16_t))) != NULL;
+    return ok;
+}
+
+
+static void bench_free(adv_decoder_result_t *r)
+{
+    free(r->valid);
+    free(r->device);
+    free(r->seq);
+    free(r->type);
+    free(r->temperature);
+    free(r->humidity);
+    free(r->esp_temperature);
+    for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+        free(r->pm[j]);
+    for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+        free(r->um[j]);
+}
+
+
+static size_t bench_compare(const adv_decoder_result_t *a, const adv_decoder_result_t *b, size_t count) //number of different valid frames
+{
+    size_t diff = 0;
+    for(size_t i=0; i<count; ++i)
+    {
+        int same = a->valid[i] == b->valid[i];
+        if(same && a->valid[i])
+        {
+            same = a->device[i] == b->device[i] && a->seq[i] == b->seq[i] && a->type[i] == b->type[i] && a->temperature[i] == b->temperature[i]
+                && a->humidity[i] == b->humidity[i] && a->esp_temperature[i] == b->esp_temperature[i];
+            for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+                same &= a->pm[j][i] == b->pm[j][i];
+            for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+                same &= a->um[j][i] == b->um[j][i];
+        }
+        diff += !same;
+    }
+    return diff;
+}
+
+
+int main(void)
+{
+    static const adv_decoder_path_t paths[] = {ADV_DECODER_PATH_SCALAR, ADV_DECODER_PATH_SSE41, ADV_DECODER_PATH_AVX2};
+    adv_decoder_path_t best = adv_decoder_best_path();
+    adv_decoder_result_t reference, result;
+    uint8_t *frames = malloc(BENCH_FRAMES_NUM*BENCH_STRIDE);
+    int ret = 0;
+
+    if(frames == NULL || !bench_alloc(&reference, BENCH_FRAMES_NUM) || !bench_alloc(&result, BENCH_FRAMES_NUM))
+    {
+        fprintf(stderr, "Fail alloc memory.\n");
+        return 1;
+    }
+    bench_fill(frames, BENCH_FRAMES_NUM, BENCH_STRIDE);
+    size_t valid_ref = adv_decoder_decode(frames, BENCH_STRIDE, BENCH_FRAMES_NUM, &reference, ADV_DECODER_PATH_SCALAR);
+    printf("frames: %u, valid: %zu, best path: %s\n", BENCH_FRAMES_NUM, valid_ref, adv_decoder_path_name(best));
+
+    for(size_t p=0; p<sizeof(paths)/sizeof(paths[0]); ++p)
+    {
+        if(paths[p] > best)
+        {
+            printf("%-8s not supported by CPU\n", adv_decoder_path_name(paths[p]));
+            continue;
+        }
+
+        double start = bench_now();
+        size_t valid = 0;
+        for(int r=0; r<BENCH_REPEAT; ++r)
+            valid = adv_decoder_decode(frames, BENCH_STRIDE, BENCH_FRAMES_NUM, &result, paths[p]);
+        double elapsed = (bench_now() - start) / BENCH_REPEAT;
+
+        size_t diff = bench_compare(&reference, &result, BENCH_FRAMES_NUM);
+        printf("%-8s %8.1f Mframes/s  valid: %zu  mismatch: %zu\n", adv_decoder_path_name(paths[p]),
+               BENCH_FRAMES_NUM / elapsed * 1e-6, valid, diff);
+        if(diff || valid != valid_ref)
+            ret = 1;
+    }
+
+    bench_free(&reference);
+    bench_free(&result);
+    free(frames);
+    return ret;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Test and benchmark of payload bit packing (src/payload.c) - schemas of firmware and test schema with signed,
+// sign-magnitude, scaled, offset and split fields pass payload_schema_check, broken schemas don't. Random values
+// (in range and out of range) go through encode -> decode and are checked against reference of field definition:
+// truncation by scale, clamping to width of field and PAYLOAD_OUT_OF_RANGE. Exit code 1 on any mismatch.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "payload.h"
+
+#define BENCH_FRAMES_DEFAULT    (1u<<20)
+#define BENCH_RARE              64      // 1 of values is any int32, 2 of values are near border of range
+
+typedef enum {
+    BENCH_FIELD_SIGNED = 0,
+    BENCH_FIELD_SIGN_MAGNITUDE,
+    BENCH_FIELD_SCALED,
+    BENCH_FIELD_INT32,
+    BENCH_FIELD_OFFSET,
+    BENCH_FIELDS_NUM
+} bench_field_t;
+
+static const payload_field_t BENCH_FIELDS[BENCH_FIELDS_NUM] = {
+    [BENCH_FIELD_SIGNED]            = {"signed",            9,  PAYLOAD_SIGNED,         1,      0},
+    [BENCH_FIELD_SIGN_MAGNITUDE]    = {"sign_magnitude",    12, PAYLOAD_SIGN_MAGNITUDE, 10,     -5},
+    [BENCH_FIELD_SCALED]            = {"scaled",            20, PAYLOAD_UNSIGNED,       1000,   100},
+    [BENCH_FIELD_INT32]             = {"int32",             32, PAYLOAD_SIGNED,         1,      0},
+    [BENCH_FIELD_OFFSET]            = {"offset",            7,  PAYLOAD_UNSIGNED,       1,      -50},
+};
+
+static const payload_slice_t BENCH_SLICES[] = { // split fields, out of order parts, slices over byte borders, 80bits
+    {BENCH_FIELD_SCALED, 13, 7}, {BENCH_FIELD_SIGNED, 0, 9}, {BENCH_FIELD_SIGN_MAGNITUDE, 6, 6},
+    {BENCH_FIELD_SCALED, 0, 5}, {BENCH_FIELD_INT32, 0, 32}, {BENCH_FIELD_SIGN_MAGNITUDE, 0, 6},
+    {BENCH_FIELD_SCALED, 5, 8}, {BENCH_FIELD_OFFSET, 0, 7},
+};
+
+static const payload_schema_t bench_schema = {
+    .fields     = BENCH_FIELDS,
+    .fields_num = BENCH_FIELDS_NUM,
+    .slices     = BENCH_SLICES,
+    .slices_num = sizeof(BENCH_SLICES) / sizeof(BENCH_SLICES[0]),
+    .size       = 10
+};
+
+// broken variants of test schema - overlapped slices, hole in field, wrong size, slice outside of field
+static const payload_slice_t BENCH_SLICES_OVERLAP[] = {
+    {BENCH_FIELD_SCALED, 13, 7}, {BENCH_FIELD_SIGNED, 0, 9}, {BENCH_FIELD_SIGN_MAGNITUDE, 6, 6},
+    {BENCH_FIELD_SCALED, 1, 5}, {BENCH_FIELD_INT32, 0, 32}, {BENCH_FIELD_SIGN_MAGNITUDE, 0, 6},
+    {BENCH_FIELD_SCALED, 5, 8}, {BENCH_FIELD_OFFSET, 0, 7},
+};
+static const payload_slice_t BENCH_SLICES_HOLE[] = {
+    {BENCH_FIELD_SCALED, 13, 7}, {BENCH_FIELD_SIGNED, 0, 9}, {BENCH_FIELD_SIGN_MAGNITUDE, 6, 6},
+    {BENCH_FIELD_SCALED, 0, 5}, {BENCH_FIELD_INT32, 0, 32}, {BENCH_FIELD_SIGN_MAGNITUDE, 0, 6},
+    {BENCH_FIELD_SCALED, 5, 7}, {BENCH_FIELD_OFFSET, 0, 7}, {BENCH_FIELD_OFFSET, 0, 1},
+};
+static const payload_slice_t BENCH_SLICES_OUTSIDE[] = {
+    {BENCH_FIELD_SCALED, 13, 8}, {BENCH_FIELD_SIGNED, 0, 9}, {BENCH_FIELD_SIGN_MAGNITUDE, 6, 6},
+    {BENCH_FIELD_SCALED, 0, 5}, {BENCH_FIELD_INT32, 0, 32}, {BENCH_FIELD_SIGN_MAGNITUDE, 0, 6},
+    {BENCH_FIELD_SCALED, 5, 7}, {BENCH_FIELD_OFFSET, 0, 7},
+};
+
+#define BENCH_BROKEN_SCHEMA(slices_arr, bytes) \
+    {.fields = BENCH_FIELDS, .fields_num = BENCH_FIELDS_NUM, .slices = slices_arr, \
+     .slices_num = sizeof(slices_arr) / sizeof(slices_arr[0]), .size = bytes}
+
+static const payload_schema_t bench_broken_schemas[] = {
+    BENCH_BROKEN_SCHEMA(BENCH_SLICES_OVERLAP, 10),
+    BENCH_BROKEN_SCHEMA(BENCH_SLICES_HOLE, 10),
+    BENCH_BROKEN_SCHEMA(BENCH_SLICES, 11),
+    BENCH_BROKEN_SCHEMA(BENCH_SLICES_OUTSIDE, 10),
+};
+
+typedef struct {
+    const char *name;
+    const payload_schema_t *schema;
+} bench_schema_t;
+
+static const bench_schema_t bench_schemas[] = {
+    {"measurement", &payload_measurement_schema},
+    {"diag", &payload_diag_schema},
+    {"test", &bench_schema},
+};
+
+
+static void bench_range(const payload_field_t *field, int64_t *min, int64_t *max) //range of encoded value
+{
+    int64_t top = field->sign == PAYLOAD_UNSIGNED ? ((int64_t)1 << field->bits) - 1 : ((int64_t)1 << (field->bits - 1)) - 1;
+
+    *max = top;
+    *min = field->sign == PAYLOAD_SIGNED ? -top - 1 : field->sign == PAYLOAD_SIGN_MAGNITUDE ? -top : 0;
+}
+
+
+static int32_t bench_value(uint32_t *seed, const payload_field_t *field) //in range mostly, near borders and out of range sometimes
+{
+    int64_t min, max, value;
+    uint32_t kind = bench_rand(seed) % BENCH_RARE; // out of range is rare, most of frames are not clamped
+
+    bench_range(field, &min, &max);
+    if(kind == 0) // any
+        return (int32_t)bench_rand(seed);
+    if(kind <= 2) // near border of range
+        value = (bench_rand(seed) & 1 ? max : min) + (int64_t)(bench_rand(seed) % 5) - 2;
+    else
+        value = min + (int64_t)(((uint64_t)bench_rand(seed) << 32 | bench_rand(seed)) % (uint64_t)(max - min + 1));
+
+    value = value * field->scale + field->offset + (int64_t)(bench_rand(seed) % field->scale);
+    return value > INT32_MAX ? INT32_MAX : value < INT32_MIN ? INT32_MIN : (int32_t)value;
+}
+
+
+static int32_t bench_expected(const payload_field_t *field, int32_t value, int *clamped) //reference of field definition
+{
+    int64_t min, max;
+    int64_t scaled = ((int64_t)value - field->offset) / field->scale; // truncation toward zero like C division
+
+    bench_range(field, &min, &max);
+    if(scaled < min || scaled > max)
+    {
+        scaled = scaled < min ? min : max;
+        *clamped = 1;
+    }
+    return (int32_t)(scaled * field->scale + field->offset);
+}
+
+
+static int bench_schema_checks(void)
+{
+    int ret = 0;
+
+    for(size_t s=0; s<sizeof(bench_schemas)/sizeof(bench_schemas[0]); ++s)
+    {
+        payload_error_t result = payload_schema_check(bench_schemas[s].schema);
+        printf("schema %-12s %d bytes, %d fields, %d slices: %s\n", bench_schemas[s].name, bench_schemas[s].schema->size,
+            bench_schemas[s].schema->fields_num, bench_schemas[s].schema->slices_num, result == PAYLOAD_OK ? "ok" : "BAD");
+        if(result != PAYLOAD_OK)
+            ret = 1;
+    }
+    for(size_t s=0; s<sizeof(bench_broken_schemas)/sizeof(bench_broken_schemas[0]); ++s)
+    {
+        if(payload_schema_check(&bench_broken_schemas[s]) != PAYLOAD_BAD_SCHEMA)
+        {
+            printf("broken schema %zu passed check\n", s);
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+
+static int bench_round_trip(const bench_schema_t *s, uint32_t frames, uint32_t seed) //random values, check and timing of encode and decode
+{
+    const payload_schema_t *schema = s->schema;
+    int32_t *values = malloc((size_t)frames * schema->fields_num * sizeof(int32_t));
+    int32_t *decoded = malloc((size_t)frames * schema->fields_num * sizeof(int32_t));
+    uint8_t *payloads = malloc((size_t)frames * schema->size);
+    payload_error_t *results = malloc((size_t)frames * sizeof(payload_error_t));
+    uint32_t mismatch = 0, clamped_num = 0, bad_result = 0;
+
+    if(values == NULL || decoded == NULL || payloads == NULL || results == NULL)
+    {
+        fprintf(stderr, "Fail alloc memory.\n");
+        free(values); free(decoded); free(payloads); free(results);
+        return 1;
+    }
+
+    for(uint32_t i=0; i<frames; ++i)
+        for(uint8_t f=0; f<schema->fields_num; ++f)
+            values[(size_t)i*schema->fields_num + f] = bench_value(&seed, &schema->fields[f]);
+
+    double start = bench_now();
+    for(uint32_t i=0; i<frames; ++i)
+        results[i] = payload_encode(schema, &values[(size_t)i*schema->fields_num], &payloads[(size_t)i*schema->size]);
+    double encode_s = bench_now() - start;
+
+    start = bench_now();
+    for(uint32_t i=0; i<frames; ++i)
+        payload_decode(schema, &payloads[(size_t)i*schema->size], &decoded[(size_t)i*schema->fields_num]);
+    double decode_s = bench_now() - start;
+
+    for(uint32_t i=0; i<frames; ++i)
+    {
+        int clamped = 0;
+        for(uint8_t f=0; f<schema->fields_num; ++f)
+        {
+            size_t k = (size_t)i*schema->fields_num + f;
+            int32_t expected = bench_expected(&schema->fields[f], values[k], &clamped);
+            if(decoded[k] != expected && mismatch++ == 0)
+                printf("%s frame %u field %s: value %d decoded %d expected %d\n", s->name, i, schema->fields[f].name,
+                    values[k], decoded[k], expected);
+        }
+        clamped_num += clamped;
+        if(results[i] != (clamped ? PAYLOAD_OUT_OF_RANGE : PAYLOAD_OK))
+            ++bad_result;
+        if(schema == &payload_measurement_schema && // type is read without decoding by receivers
+            PAYLOAD_MEASUREMENT_TYPE(&payloads[(size_t)i*schema->size]) != (uint32_t)decoded[(size_t)i*schema->fields_num + PAYLOAD_FIELD_TYPE])
+            ++mismatch;
+    }
+
+    printf("%-12s encode %7.2f Mframes/s, decode %7.2f Mframes/s, frames %u, clamped %u, mismatch %u, bad result %u\n",
+        s->name, frames / encode_s / 1e6, frames / decode_s / 1e6, frames, clamped_num, mismatch, bad_result);
+
+    free(values);
+    free(decoded);
+    free(payloads);
+    free(results);
+    return mismatch == 0 && bad_result == 0 ? 0 : 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    uint32_t frames = BENCH_FRAMES_DEFAULT;
+    uint32_t seed = 0x12345678;
+    int ret;
+    const bench_option_t options[] = {
+        {"--frames", BENCH_OPTION_U32, &frames},
+        {"--seed", BENCH_OPTION_U32, &seed},
+    };
+
+    if(bench_options_parse(argc, argv, options, sizeof(options)/sizeof(options[0])) != 0)
+        return 1;
+
+    ret = bench_schema_checks();
+    for(size_t s=0; s<sizeof(bench_schemas)/sizeof(bench_schemas[0]); ++s)
+        ret |= bench_round_trip(&bench_schemas[s], frames, seed + s);
+    return ret;
+}
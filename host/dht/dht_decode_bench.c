@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Test and benchmark of DHT decoder (dht_decode_edges in src/dht.c) - timestamps of edges like saved by ISR, at several
+// CPU frequencies and with cycle counter overflowing in the middle of transmission. Cases are good transmission,
+// jittered pulses (within doc, bit is still recognized), truncated (edges missing), pulse over timeout and bad
+// checksum. Decoded value or error code must be as expected. Exit code 1 on any wrong result.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "dht.h"
+
+#define BENCH_DECODES_DEFAULT   4000000
+#define BENCH_BATCH             1024    // cases generated at once, only decoding is timed
+#define BENCH_JITTER_US         12      // +- on every pulse, "0" is 26-28us and "1" 70us -> still apart of threshold
+
+typedef enum {
+    BENCH_CASE_GOOD = 0,
+    BENCH_CASE_JITTERED,
+    BENCH_CASE_TRUNCATED,
+    BENCH_CASE_TIMEOUT,
+    BENCH_CASE_BAD_CHECKSUM,
+    BENCH_CASES_NUM
+} bench_case_t;
+
+static const char *BENCH_CASE_NAMES[BENCH_CASES_NUM] = {"good", "jittered", "truncated", "timeout", "bad_checksum"};
+static const uint32_t BENCH_TICKS_PER_US[] = {80, 160, 240}; // CPU frequencies of ESP32 in MHz
+
+typedef struct {
+    uint32_t edges[DHT_EDGES_NUM];
+    uint8_t edges_num;
+    uint32_t ticks_per_us;
+    bench_case_t kind;
+    dht_error_t expected;
+    dht_measurement_t value;
+} bench_transmission_t;
+
+typedef struct {
+    uint64_t decodes[BENCH_CASES_NUM];
+    uint64_t wrong[BENCH_CASES_NUM];
+} bench_check_t;
+
+
+static uint32_t bench_pulse(uint32_t *seed, const bench_transmission_t *t, uint32_t us) //length of pulse in ticks
+{
+    int32_t jitter = 0;
+    if(t->kind == BENCH_CASE_JITTERED)
+        jitter = (int32_t)(bench_rand(seed) % (2*BENCH_JITTER_US*t->ticks_per_us + 1)) - BENCH_JITTER_US*(int32_t)t->ticks_per_us;
+    return us*t->ticks_per_us + jitter;
+}
+
+
+static void bench_transmission(uint32_t *seed, bench_case_t kind, bench_transmission_t *t) //edges of one transmission and expected result
+{
+    uint8_t data[5];
+
+    t->kind = kind;
+    t->ticks_per_us = BENCH_TICKS_PER_US[bench_rand(seed) % (sizeof(BENCH_TICKS_PER_US)/sizeof(BENCH_TICKS_PER_US[0]))];
+    t->value.humidity = bench_rand(seed) % 1001;
+    t->value.temperature = (int_least16_t)(bench_rand(seed) % 1201) - 400;
+
+    uint16_t temperature = t->value.temperature < 0 ? (uint16_t)(-t->value.temperature) | 0x8000 : t->value.temperature;
+    data[0] = t->value.humidity >> 8;
+    data[1] = t->value.humidity & 0xFF;
+    data[2] = temperature >> 8;
+    data[3] = temperature & 0xFF;
+    data[4] = data[0] + data[1] + data[2] + data[3];
+    if(kind == BENCH_CASE_BAD_CHECKSUM) // one flipped bit anywhere, sum can't match
+    {
+        uint8_t bit = bench_rand(seed) % 40;
+        data[bit/8] ^= 1 << (7 - bit%8);
+    }
+
+    // cycle counter overflows during every 8th transmission
+    uint32_t t0 = bench_rand(seed) % 8 == 0 ? 0xFFFFFFFFu - bench_rand(seed) % (5000*t->ticks_per_us) : bench_rand(seed);
+    t->edges[0] = t0;
+    t->edges[1] = t->edges[0] + bench_pulse(seed, t, 80); // response low and high
+    t->edges[2] = t->edges[1] + bench_pulse(seed, t, 80);
+    for(uint8_t nBit = 0; nBit < 40; ++nBit)
+    {
+        uint32_t *bit_edges = &t->edges[2 + 2*nBit];
+        bit_edges[1] = bit_edges[0] + bench_pulse(seed, t, 50);
+        bit_edges[2] = bit_edges[1] + bench_pulse(seed, t, data[nBit/8] & (1 << (7 - nBit%8)) ? 70 : 27);
+    }
+    t->edges[DHT_EDGES_NUM-1] = t->edges[DHT_EDGES_NUM-2] + bench_pulse(seed, t, 50); // release line
+    t->edges_num = DHT_EDGES_NUM;
+
+    switch(kind)
+    {
+    case BENCH_CASE_TRUNCATED:
+        t->edges_num = bench_rand(seed) % DHT_EDGES_MIN_NUM;
+        t->expected = t->edges_num < 3 ? DHT_TIMEOUT_START_TRANS : DHT_TIMEOUT_RECEIVE_DATA;
+        break;
+    case BENCH_CASE_TIMEOUT:
+    {
+        // one pulse longer than timeout, edges after it are shifted
+        uint8_t edge = 1 + bench_rand(seed) % (DHT_EDGES_MIN_NUM - 1);
+        uint32_t delay = (DHT_PULSE_TIMEOUT_US + 1)*t->ticks_per_us + bench_rand(seed) % (1000*t->ticks_per_us);
+        for(uint8_t i = edge; i < DHT_EDGES_NUM; ++i)
+            t->edges[i] += delay;
+        t->expected = edge <= 2 ? DHT_TIMEOUT_START_TRANS : DHT_TIMEOUT_RECEIVE_DATA;
+        break;
+    }
+    case BENCH_CASE_BAD_CHECKSUM:
+        t->expected = DHT_BAD_CHECKSUM;
+        break;
+    default:
+        // last edge (release line) is missed sometimes, it is not needed
+        if(bench_rand(seed) % 4 == 0)
+            t->edges_num = DHT_EDGES_MIN_NUM;
+        t->expected = DHT_OK;
+        break;
+    }
+}
+
+
+static void bench_verify(const bench_transmission_t *t, dht_error_t result, const dht_measurement_t *value, bench_check_t *check)
+{
+    ++check->decodes[t->kind];
+    if(result != t->expected || (result == DHT_OK &&
+        (value->temperature != t->value.temperature || value->humidity != t->value.humidity)))
+    {
+        if(check->wrong[t->kind]++ == 0)
+            printf("wrong %s at %u ticks/us: result %d expected %d, value %d/%u expected %d/%u\n",
+                BENCH_CASE_NAMES[t->kind], t->ticks_per_us, result, t->expected, value->temperature, value->humidity,
+                t->value.temperature, t->value.humidity);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    uint64_t decodes = BENCH_DECODES_DEFAULT;
+    uint32_t seed = 0x9E3779B9;
+    static bench_transmission_t batch[BENCH_BATCH];
+    dht_error_t results[BENCH_BATCH];
+    dht_measurement_t values[BENCH_BATCH];
+    bench_check_t check;
+    double seconds = 0;
+    int ret = 0;
+    const bench_option_t options[] = {
+        {"--decodes", BENCH_OPTION_U64, &decodes},
+        {"--seed", BENCH_OPTION_U32, &seed},
+    };
+
+    if(bench_options_parse(argc, argv, options, sizeof(options)/sizeof(options[0])) != 0)
+        return 1;
+
+    esp_log_level_set("*", ESP_LOG_NONE); // every error case is logged by driver
+    memset(&check, 0, sizeof(check));
+    for(uint64_t done = 0; done < decodes; done += BENCH_BATCH)
+    {
+        for(int i=0; i<BENCH_BATCH; ++i)
+            bench_transmission(&seed, (done + i) % BENCH_CASES_NUM, &batch[i]);
+        memset(values, 0, sizeof(values));
+
+        double start = bench_now();
+        for(int i=0; i<BENCH_BATCH; ++i)
+            results[i] = dht_decode_edges(batch[i].edges, batch[i].edges_num, batch[i].ticks_per_us, &values[i]);
+        seconds += bench_now() - start;
+
+        for(int i=0; i<BENCH_BATCH; ++i)
+            bench_verify(&batch[i], results[i], &values[i], &check);
+    }
+
+    uint64_t total = 0;
+    for(int c=0; c<BENCH_CASES_NUM; ++c)
+    {
+        printf("%-14s decodes %llu, wrong %llu\n", BENCH_CASE_NAMES[c], (unsigned long long)check.decodes[c],
+            (unsigned long long)check.wrong[c]);
+        total += check.decodes[c];
+        if(check.wrong[c] != 0)
+            ret = 1;
+    }
+    printf("dht_decode_edges %.2f M decodes/s (%.1f ns per decode)\n", total / seconds / 1e6, seconds / total * 1e9);
+    return ret;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Test and benchmark of streaming PMS parser (src/pms.c) - megabytes of UART stream with valid frames between noise,
+// partial frames (PMS woken up or UART flushed in the middle) and frames corrupted by noise on line.
+// Frames found by parser must be the same as of reference scan (every offset is tried), also when stream is fed in
+// chunks of random size like UART reads. Every valid frame is found after resync, except frames overlapped by noise
+// which is valid frame by chance (16-bit sum) - they are counted. Exit code 1 on missing or wrong frame.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "pms.h"
+
+#define BENCH_MB_DEFAULT    64
+#define BENCH_READ_MAX      120     // chunks of feed_buffer are 1..max, less than PMS_UART_BUFFER_RX_SIZE
+#define BENCH_FOUND_MAX     8       // frames saved by one feed_buffer call
+#define BENCH_VALUES_NUM    12      // 16-bit values in frame: pm sm/ae x3, particles x6
+
+typedef enum {
+    BENCH_SEGMENT_FRAME = 0,
+    BENCH_SEGMENT_NOISE,
+    BENCH_SEGMENT_PARTIAL,
+    BENCH_SEGMENT_CORRUPTED,
+    BENCH_SEGMENTS_NUM
+} bench_segment_t;
+
+static const char *BENCH_SEGMENT_NAMES[BENCH_SEGMENTS_NUM] = {"frames", "noise", "partial", "corrupted"};
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t *inserted;           // offsets of valid frames put to stream
+    size_t inserted_num;
+    pms_measurement_t *frames;  // frames of reference scan in stream order
+    size_t *offsets;
+    size_t frames_num;
+    uint64_t segments[BENCH_SEGMENTS_NUM];
+} bench_stream_t;
+
+typedef struct {
+    size_t found;       // frames equal to reference in order
+    size_t wrong;       // different frame or more frames than reference
+} bench_check_t;
+
+
+static void bench_put16(uint8_t *dst, uint16_t value)
+{
+    dst[0] = value >> 8;
+    dst[1] = value & 0xFF;
+}
+
+
+static void bench_frame(uint32_t *seed, uint8_t *frame, pms_measurement_t *dst) //valid 32 bytes frame and its decoded value
+{
+    uint16_t values[BENCH_VALUES_NUM];
+    uint16_t checksum = 0;
+
+    for(int i=0; i<BENCH_VALUES_NUM; ++i) // low values mostly, frame bytes look like noise sometimes
+        values[i] = bench_rand(seed) % 4 == 0 ? bench_rand(seed) & 0xFFFF : bench_rand(seed) % 500;
+
+    frame[0] = PMS_FRAME_START_1;
+    frame[1] = PMS_FRAME_START_2;
+    bench_put16(&frame[2], PMS_FRAME_DATA_LEN);
+    for(int i=0; i<BENCH_VALUES_NUM; ++i)
+        bench_put16(&frame[4 + 2*i], values[i]);
+    frame[28] = 0x97;
+    frame[29] = 0x00;
+    for(int i=0; i<PMS_FRAME_LEN-2; ++i)
+        checksum += frame[i];
+    bench_put16(&frame[30], checksum);
+
+    dst->sm.pm10 = values[0];
+    dst->sm.pm25 = values[1];
+    dst->sm.pm100 = values[2];
+    dst->ae.pm10 = values[3];
+    dst->ae.pm25 = values[4];
+    dst->ae.pm100 = values[5];
+    dst->num.um3 = values[6];
+    dst->num.um5 = values[7];
+    dst->num.um10 = values[8];
+    dst->num.um25 = values[9];
+    dst->num.um50 = values[10];
+    dst->num.um100 = values[11];
+}
+
+
+static int bench_generate(bench_stream_t *stream, size_t size, uint32_t seed) //stream of segments, 0 - ok
+{
+    pms_measurement_t value;
+    uint8_t frame[PMS_FRAME_LEN];
+
+    size_t frames_max = (size + 2*PMS_FRAME_LEN) / PMS_FRAME_LEN + 1;
+
+    stream->data = malloc(size + 2*PMS_FRAME_LEN);
+    stream->inserted = malloc(frames_max * sizeof(size_t));
+    stream->frames = malloc(frames_max * sizeof(pms_measurement_t));
+    stream->offsets = malloc(frames_max * sizeof(size_t));
+    if(stream->data == NULL || stream->inserted == NULL || stream->frames == NULL || stream->offsets == NULL)
+        return -1;
+    stream->len = 0;
+    stream->inserted_num = 0;
+
+    while(stream->len < size)
+    {
+        uint8_t *dst = stream->data + stream->len;
+        uint32_t r = bench_rand(&seed) % 100;
+        bench_segment_t segment = r < 55 ? BENCH_SEGMENT_FRAME : r < 75 ? BENCH_SEGMENT_NOISE :
+            r < 88 ? BENCH_SEGMENT_PARTIAL : BENCH_SEGMENT_CORRUPTED;
+        size_t len = PMS_FRAME_LEN;
+
+        bench_frame(&seed, frame, &value); // value is checked by reference scan
+        switch(segment)
+        {
+        case BENCH_SEGMENT_FRAME:
+            memcpy(dst, frame, PMS_FRAME_LEN);
+            stream->inserted[stream->inserted_num++] = stream->len;
+            break;
+        case BENCH_SEGMENT_NOISE: // random bytes, start bytes and frame length are more frequent than in real noise
+            len = 1 + bench_rand(&seed) % (2*PMS_FRAME_LEN);
+            for(size_t i=0; i<len; ++i)
+            {
+                uint32_t b = bench_rand(&seed) % 8;
+                dst[i] = b == 0 ? PMS_FRAME_START_1 : b == 1 ? PMS_FRAME_START_2 : b == 2 ? PMS_FRAME_DATA_LEN : bench_rand(&seed);
+            }
+            break;
+        case BENCH_SEGMENT_PARTIAL: // head or tail of frame
+            len = 1 + bench_rand(&seed) % (PMS_FRAME_LEN - 1);
+            memcpy(dst, bench_rand(&seed) & 1 ? frame : frame + PMS_FRAME_LEN - len, len);
+            break;
+        case BENCH_SEGMENT_CORRUPTED: // flipped bit anywhere, also in start bytes and length
+            memcpy(dst, frame, PMS_FRAME_LEN);
+            dst[bench_rand(&seed) % PMS_FRAME_LEN] ^= 1 << (bench_rand(&seed) % 8);
+            break;
+        default:
+            break;
+        }
+        ++stream->segments[segment];
+        stream->len += len;
+    }
+    return 0;
+}
+
+
+static uint16_t bench_get16(const uint8_t *src)
+{
+    return ((uint16_t)src[0] << 8) | src[1];
+}
+
+
+static void bench_reference(bench_stream_t *stream) //frames found by trying every offset, next frame starts after found one
+{
+    size_t i = 0;
+
+    stream->frames_num = 0;
+    while(i + PMS_FRAME_LEN <= stream->len)
+    {
+        const uint8_t *f = stream->data + i;
+        uint16_t checksum = 0;
+        for(int j=0; j<PMS_FRAME_LEN-2; ++j)
+            checksum += f[j];
+        if(f[0] != PMS_FRAME_START_1 || f[1] != PMS_FRAME_START_2 || bench_get16(&f[2]) != PMS_FRAME_DATA_LEN ||
+            bench_get16(&f[PMS_FRAME_LEN-2]) != checksum)
+        {
+            ++i;
+            continue;
+        }
+        pms_measurement_t *dst = &stream->frames[stream->frames_num];
+        uint_least16_t *fields[BENCH_VALUES_NUM] = {&dst->sm.pm10, &dst->sm.pm25, &dst->sm.pm100, &dst->ae.pm10,
+            &dst->ae.pm25, &dst->ae.pm100, &dst->num.um3, &dst->num.um5, &dst->num.um10, &dst->num.um25, &dst->num.um50,
+            &dst->num.um100};
+        for(int j=0; j<BENCH_VALUES_NUM; ++j)
+            *fields[j] = bench_get16(&f[4 + 2*j]);
+        stream->offsets[stream->frames_num++] = i;
+        i += PMS_FRAME_LEN;
+    }
+}
+
+
+static size_t bench_lost(const bench_stream_t *stream) //inserted frames not found by reference - overlapped by frame made by noise
+{
+    size_t lost = 0, r = 0;
+
+    for(size_t i=0; i<stream->inserted_num; ++i)
+    {
+        while(r < stream->frames_num && stream->offsets[r] < stream->inserted[i])
+            ++r;
+        if(r >= stream->frames_num || stream->offsets[r] != stream->inserted[i])
+            ++lost;
+    }
+    return lost;
+}
+
+
+static void bench_match(const bench_stream_t *stream, const pms_measurement_t *value, bench_check_t *check) //found frame against reference in order
+{
+    if(check->found < stream->frames_num && memcmp(value, &stream->frames[check->found], sizeof(pms_measurement_t)) == 0)
+        ++check->found;
+    else
+        ++check->wrong;
+}
+
+
+static void bench_feed(const bench_stream_t *stream, bench_check_t *check) //byte by byte, as acquisition task
+{
+    pms_parser_t parser;
+    pms_measurement_t value;
+
+    pms_parser_reset(&parser);
+    for(size_t i=0; i<stream->len; ++i)
+    {
+        if(pms_parser_feed(&parser, stream->data[i], &value) == PMS_OK && check != NULL)
+            bench_match(stream, &value, check);
+    }
+}
+
+
+static void bench_feed_buffer(const bench_stream_t *stream, uint32_t seed, bench_check_t *check) //chunks of UART reads
+{
+    pms_parser_t parser;
+    pms_measurement_t found[BENCH_FOUND_MAX];
+    size_t pos = 0;
+
+    pms_parser_reset(&parser);
+    while(pos < stream->len)
+    {
+        size_t len = 1 + bench_rand(&seed) % BENCH_READ_MAX;
+        if(len > stream->len - pos)
+            len = stream->len - pos;
+        uint16_t num = pms_parser_feed_buffer(&parser, stream->data + pos, len, found, BENCH_FOUND_MAX);
+        for(uint16_t i=0; i<num && check != NULL; ++i)
+            bench_match(stream, &found[i], check);
+        pos += len;
+    }
+}
+
+
+static int bench_report(const char *name, const bench_stream_t *stream, const bench_check_t *check, double seconds)
+{
+    size_t missing = stream->frames_num - check->found;
+
+    printf("%-12s %8.1f MB/s  found %zu of %zu, missing %zu, wrong %zu\n", name,
+        stream->len / seconds / 1e6, check->found, stream->frames_num, missing, check->wrong);
+    return missing == 0 && check->wrong == 0 ? 0 : 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    uint32_t mb = BENCH_MB_DEFAULT;
+    uint32_t seed = 0x9E3779B9;
+    bench_stream_t stream = {0};
+    bench_check_t check;
+    double start, seconds;
+    int ret = 0;
+    const bench_option_t options[] = {
+        {"--mb", BENCH_OPTION_U32, &mb},
+        {"--seed", BENCH_OPTION_U32, &seed},
+    };
+
+    if(bench_options_parse(argc, argv, options, sizeof(options)/sizeof(options[0])) != 0)
+        return 1;
+
+    if(bench_generate(&stream, (size_t)mb << 20, seed) != 0)
+    {
+        fprintf(stderr, "Fail alloc memory.\n");
+        return 1;
+    }
+    bench_reference(&stream);
+    size_t lost = bench_lost(&stream);
+    printf("stream %.1f MB:", stream.len / 1e6);
+    for(int s=0; s<BENCH_SEGMENTS_NUM; ++s)
+        printf(" %s %llu%s", BENCH_SEGMENT_NAMES[s], (unsigned long long)stream.segments[s], s+1 < BENCH_SEGMENTS_NUM ? "," : "\n");
+    printf("reference    %zu frames, inserted %zu, made by noise %zu, inserted overlapped by them %zu\n", stream.frames_num,
+        stream.inserted_num, stream.frames_num - (stream.inserted_num - lost), lost);
+    if(lost > stream.frames_num - (stream.inserted_num - lost)) // every lost frame needs frame made by noise over it
+        ret = 1;
+
+    memset(&check, 0, sizeof(check));
+    start = bench_now();
+    bench_feed(&stream, &check);
+    seconds = bench_now() - start;
+    ret |= bench_report("feed", &stream, &check, seconds);
+
+    memset(&check, 0, sizeof(check));
+    start = bench_now();
+    bench_feed_buffer(&stream, seed, &check);
+    seconds = bench_now() - start;
+    ret |= bench_report("feed_buffer", &stream, &check, seconds);
+
+    free(stream.data);
+    free(stream.inserted);
+    free(stream.frames);
+    free(stream.offsets);
+    return ret;
+}
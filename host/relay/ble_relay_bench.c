@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Benchmark of relay dedup cache (src/ble_relay.c) - neighbors far above capacity of cache, adv reports in random
+// order with duplicates, selection of relay frames every BENCH_SELECT_MS like in firmware.
+// Payload carries index of neighbor and its cycle, so coverage and freshness of relayed data are checked.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "ble_relay.h"
+
+#define BENCH_REPORTS           (1u<<21)    // adv reports per configuration
+#define BENCH_REPORTS_PER_S     2000        // reports heard by scanner, virtual time
+#define BENCH_SELECT_MS         2000        // BLE_ADV_RELAY_SELECT_MS
+#define BENCH_RELAY_FRAMES      2           // BLE_ADV_RELAY_FRAMES
+#define BENCH_CYCLE_MS          340000      // live payload of neighbor changes once per cycle
+#define BENCH_PAYLOAD_SIZE      25
+
+typedef struct {
+    uint32_t    neighbor;
+    uint32_t    time_ms;
+} bench_report_t;
+
+
+static uint32_t bench_cycle(uint32_t neighbor, uint32_t time_ms) //cycle of neighbor, phases are spread
+{
+    return (time_ms + (neighbor * 2654435761u) % BENCH_CYCLE_MS) / BENCH_CYCLE_MS;
+}
+
+
+static void bench_addr(uint32_t neighbor, uint8_t *addr)
+{
+    uint32_t h = neighbor * 0x9E3779B1u;
+    addr[0] = 0x24; // OUI of Espressif
+    addr[1] = 0x0A;
+    addr[2] = 0xC4;
+    addr[3] = h >> 24;
+    addr[4] = h >> 16;
+    addr[5] = (h >> 8) ^ neighbor;
+}
+
+
+static void bench_payload(uint32_t neighbor, uint32_t cycle, uint8_t *payload)
+{
+    memset(payload, 0, BENCH_PAYLOAD_SIZE);
+    memcpy(payload + 1, &neighbor, sizeof(neighbor));
+    memcpy(payload + 5, &cycle, sizeof(cycle));
+}
+
+
+static int bench_run(uint32_t entries, uint32_t neighbors, const bench_report_t *reports)
+{
+    ble_relay_entry_t *storage = calloc(entries, sizeof(ble_relay_entry_t));
+    uint32_t *last_relay = calloc(neighbors, sizeof(uint32_t)); // cycle + 1 of last relayed payload, 0 - never
+    uint8_t frames[BENCH_RELAY_FRAMES][BENCH_PAYLOAD_SIZE];
+    uint8_t *const dst[BENCH_RELAY_FRAMES] = {frames[0], frames[1]};
+    uint8_t addr[BLE_RELAY_ADDR_LEN];
+    uint8_t payload[BENCH_PAYLOAD_SIZE];
+    ble_relay_cache_t cache = { .entries = storage, .sets = entries / BLE_RELAY_WAYS };
+    uint32_t next_select = BENCH_SELECT_MS;
+    uint32_t selects = 0, stale = 0, covered = 0;
+    double update_time = 0.0, select_time = 0.0, start;
+
+    if(storage == NULL || last_relay == NULL || ble_relay_init(&cache, BENCH_PAYLOAD_SIZE) != BLE_RELAY_OK)
+    {
+        fprintf(stderr, "Fail init cache of %u entries.\n", entries);
+        free(storage);
+        free(last_relay);
+        return 1;
+    }
+
+    for(uint32_t i=0; i<BENCH_REPORTS; )
+    {
+        // reports until next selection are timed together, as they come between rotations in firmware
+        uint32_t end = i;
+        while(end < BENCH_REPORTS && reports[end].time_ms < next_select)
+            ++end;
+
+        start = bench_now();
+        for(; i<end; ++i)
+        {
+            bench_addr(reports[i].neighbor, addr);
+            bench_payload(reports[i].neighbor, bench_cycle(reports[i].neighbor, reports[i].time_ms), payload);
+            ble_relay_update(&cache, addr, -60, payload, reports[i].time_ms);
+        }
+        update_time += bench_now() - start;
+
+        start = bench_now();
+        uint8_t num = ble_relay_select(&cache, next_select, dst, BENCH_RELAY_FRAMES);
+        select_time += bench_now() - start;
+        ++selects;
+
+        for(uint8_t f=0; f<num; ++f)
+        {
+            uint32_t neighbor, cycle;
+            memcpy(&neighbor, frames[f] + 1, sizeof(neighbor));
+            memcpy(&cycle, frames[f] + 5, sizeof(cycle));
+            if(cycle != bench_cycle(neighbor, next_select))
+                ++stale; // newer payload of neighbor was on air before selection
+            if(last_relay[neighbor] == 0)
+                ++covered;
+            last_relay[neighbor] = cycle + 1;
+        }
+        next_select += BENCH_SELECT_MS;
+    }
+
+    const ble_relay_stats_t *stats = &(cache.stats);
+    printf("%7u %9u %8zu B %8.1f ns %8.2f us %6.1f%% %9u %8u %8.1f%% %6u\n",
+        entries, neighbors, (size_t)entries * sizeof(ble_relay_entry_t),
+        update_time / BENCH_REPORTS * 1e9, select_time / selects * 1e6,
+        100.0 * (stats->received - stats->inserts) / stats->received, stats->evictions, stats->relayed,
+        100.0 * covered / neighbors, stale);
+
+    free(storage);
+    free(last_relay);
+    return 0;
+}
+
+
+int main(void)
+{
+    static const uint32_t entries[] = {32, 256, 4096};
+    static const uint32_t neighbors[] = {16, 100, 1000, 5000, 20000};
+    bench_report_t *reports = malloc(BENCH_REPORTS * sizeof(bench_report_t));
+    int ret = 0;
+
+    if(reports == NULL)
+    {
+        fprintf(stderr, "Fail alloc memory.\n");
+        return 1;
+    }
+
+    printf("reports: %u (%u/s), relay frames: %u every %u ms, entry: %zu B, ways: %u\n", BENCH_REPORTS, BENCH_REPORTS_PER_S,
+        BENCH_RELAY_FRAMES, BENCH_SELECT_MS, sizeof(ble_relay_entry_t), BLE_RELAY_WAYS);
+    printf("entries neighbors   memory     update      select    hit evictions  relayed coverage  stale\n");
+    for(size_t n=0; n<sizeof(neighbors)/sizeof(neighbors[0]); ++n)
+    {
+        uint32_t seed = 0x12345678 + n;
+        for(uint32_t i=0; i<BENCH_REPORTS; ++i)
+        {
+            reports[i].neighbor = bench_rand(&seed) % neighbors[n];
+            reports[i].time_ms = (uint64_t)i * 1000 / BENCH_REPORTS_PER_S;
+        }
+        for(size_t e=0; e<sizeof(entries)/sizeof(entries[0]); ++e)
+            ret |= bench_run(entries[e], neighbors[n], reports);
+    }
+
+    free(reports);
+    return ret;
+}
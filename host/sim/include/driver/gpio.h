@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef DRIVER_GPIO_H_
+#define DRIVER_GPIO_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+
+#define GPIO_NUM_MAX    40
+
+typedef int gpio_num_t;
+
+typedef enum {
+    GPIO_MODE_DISABLE           = 0,
+    GPIO_MODE_INPUT             = 1,
+    GPIO_MODE_OUTPUT            = 2,
+    GPIO_MODE_OUTPUT_OD         = 6,
+    GPIO_MODE_INPUT_OUTPUT_OD   = 7,
+    GPIO_MODE_INPUT_OUTPUT      = 3
+} gpio_mode_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE   = 0,
+    GPIO_INTR_POSEDGE   = 1,
+    GPIO_INTR_NEGEDGE   = 2,
+    GPIO_INTR_ANYEDGE   = 3,
+    GPIO_INTR_LOW_LEVEL = 4,
+    GPIO_INTR_HIGH_LEVEL= 5
+} gpio_int_type_t;
+
+typedef void (*gpio_isr_t)(void *parameter);
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num);
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+int gpio_get_level(gpio_num_t gpio_num);
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num);
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num);
+esp_err_t gpio_install_isr_service(int intr_alloc_flags);
+void gpio_uninstall_isr_service(void);
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args);
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num);
+esp_err_t gpio_hold_en(gpio_num_t gpio_num);
+esp_err_t gpio_hold_dis(gpio_num_t gpio_num);
+void gpio_deep_sleep_hold_en(void);
+void gpio_deep_sleep_hold_dis(void);
+
+#endif
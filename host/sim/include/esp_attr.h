@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_ATTR_H_
+#define ESP_ATTR_H_
+
+// host simulator - code runs from one memory, RTC slow memory is a section kept by simulator between deep sleeps
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR       __attribute__((section("sim_rtc_data")))
+#define RTC_NOINIT_ATTR     __attribute__((section("sim_rtc_data")))
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_BT_H_
+#define ESP_BT_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    ESP_BT_MODE_IDLE        = 0x00,
+    ESP_BT_MODE_BLE         = 0x01,
+    ESP_BT_MODE_CLASSIC_BT  = 0x02,
+    ESP_BT_MODE_BTDM        = 0x03
+} esp_bt_mode_t;
+
+typedef struct {
+    uint8_t mode;
+} esp_bt_controller_config_t;
+
+#define BT_CONTROLLER_INIT_CONFIG_DEFAULT() { .mode = ESP_BT_MODE_BTDM }
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg);
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode);
+
+#endif
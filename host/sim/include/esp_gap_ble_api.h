@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_GAP_BLE_API_H_
+#define ESP_GAP_BLE_API_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define ESP_BLE_ADV_DATA_LEN_MAX        31
+#define ESP_BLE_SCAN_RSP_DATA_LEN_MAX   31
+
+#define ESP_BLE_ADV_FLAG_LIMIT_DISC     (0x01 << 0)
+#define ESP_BLE_ADV_FLAG_GEN_DISC       (0x01 << 1)
+#define ESP_BLE_ADV_FLAG_BREDR_NOT_SPT  (0x01 << 2)
+
+typedef enum { // AD types used by firmware
+    ESP_BLE_AD_TYPE_FLAG            = 0x01,
+    ESP_BLE_AD_TYPE_128SRV_CMPL     = 0x07
+} esp_ble_adv_data_type;
+
+typedef enum {
+    ADV_TYPE_IND                = 0x00,
+    ADV_TYPE_DIRECT_IND_HIGH    = 0x01,
+    ADV_TYPE_SCAN_IND           = 0x02,
+    ADV_TYPE_NONCONN_IND        = 0x03,
+    ADV_TYPE_DIRECT_IND_LOW     = 0x04
+} esp_ble_adv_type_t;
+
+typedef enum {
+    ADV_CHNL_37     = 0x01,
+    ADV_CHNL_38     = 0x02,
+    ADV_CHNL_39     = 0x04,
+    ADV_CHNL_ALL    = 0x07
+} esp_ble_adv_channel_t;
+
+typedef enum {
+    ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY = 0x00,
+    ADV_FILTER_ALLOW_SCAN_WLST_CON_ANY,
+    ADV_FILTER_ALLOW_SCAN_ANY_CON_WLST,
+    ADV_FILTER_ALLOW_SCAN_WLST_CON_WLST
+} esp_ble_adv_filter_t;
+
+typedef struct {
+    uint16_t                adv_int_min;        // N * 0.625ms
+    uint16_t                adv_int_max;
+    esp_ble_adv_type_t      adv_type;
+    esp_ble_addr_type_t     own_addr_type;
+    esp_bd_addr_t           peer_addr;
+    esp_ble_addr_type_t     peer_addr_type;
+    esp_ble_adv_channel_t   channel_map;
+    esp_ble_adv_filter_t    adv_filter_policy;
+} esp_ble_adv_params_t;
+
+typedef enum {
+    BLE_SCAN_TYPE_PASSIVE   = 0x0,
+    BLE_SCAN_TYPE_ACTIVE    = 0x1
+} esp_ble_scan_type_t;
+
+typedef enum {
+    BLE_SCAN_FILTER_ALLOW_ALL               = 0x0,
+    BLE_SCAN_FILTER_ALLOW_ONLY_WLST         = 0x1,
+    BLE_SCAN_FILTER_ALLOW_UND_RPA_DIR       = 0x2,
+    BLE_SCAN_FILTER_ALLOW_WLIST_RPA_DIR     = 0x3
+} esp_ble_scan_filter_t;
+
+typedef enum {
+    BLE_SCAN_DUPLICATE_DISABLE  = 0x0,
+    BLE_SCAN_DUPLICATE_ENABLE   = 0x1
+} esp_ble_scan_duplicate_t;
+
+typedef struct {
+    esp_ble_scan_type_t         scan_type;
+    esp_ble_addr_type_t         own_addr_type;
+    esp_ble_scan_filter_t       scan_filter_policy;
+    uint16_t                    scan_interval;      // N * 0.625ms
+    uint16_t                    scan_window;
+    esp_ble_scan_duplicate_t    scan_duplicate;
+} esp_ble_scan_params_t;
+
+typedef enum {
+    ESP_GAP_SEARCH_INQ_RES_EVT          = 0,
+    ESP_GAP_SEARCH_INQ_CMPL_EVT         = 1,
+    ESP_GAP_SEARCH_DISC_RES_EVT         = 2,
+    ESP_GAP_SEARCH_DISC_BLE_RES_EVT     = 3,
+    ESP_GAP_SEARCH_DISC_CMPL_EVT        = 4,
+    ESP_GAP_SEARCH_DI_DISC_CMPL_EVT     = 5,
+    ESP_GAP_SEARCH_SEARCH_CANCEL_CMPL_EVT = 6,
+    ESP_GAP_SEARCH_INQ_DISCARD_NUM_EVT  = 7
+} esp_gap_search_evt_t;
+
+typedef enum {
+    ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT = 0,
+    ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_RESULT_EVT,
+    ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_ADV_START_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_START_COMPLETE_EVT,
+    ESP_GAP_BLE_AUTH_CMPL_EVT,
+    ESP_GAP_BLE_KEY_EVT,
+    ESP_GAP_BLE_SEC_REQ_EVT,
+    ESP_GAP_BLE_PASSKEY_NOTIF_EVT,
+    ESP_GAP_BLE_PASSKEY_REQ_EVT,
+    ESP_GAP_BLE_OOB_REQ_EVT,
+    ESP_GAP_BLE_LOCAL_IR_EVT,
+    ESP_GAP_BLE_LOCAL_ER_EVT,
+    ESP_GAP_BLE_NC_REQ_EVT,
+    ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT,
+    ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_EVT_MAX
+} esp_gap_ble_cb_event_t;
+
+typedef struct {
+    uint16_t        rx_len;
+    uint16_t        tx_len;                 // LL payload of data packet, 27-251
+} esp_ble_pkt_data_length_params_t;
+
+typedef union {
+    struct {
+        esp_bt_status_t status;
+    } adv_data_raw_cmpl;
+    struct {
+        esp_bt_status_t status;
+    } scan_rsp_data_raw_cmpl;
+    struct {
+        esp_bt_status_t status;
+    } adv_start_cmpl;
+    struct {
+        esp_bt_status_t status;
+    } adv_stop_cmpl;
+    struct {
+        esp_bt_status_t status;
+    } scan_param_cmpl;
+    struct {
+        esp_bt_status_t status;
+    } scan_start_cmpl;
+    struct {
+        esp_bt_status_t status;
+    } scan_stop_cmpl;
+    struct {
+        esp_gap_search_evt_t    search_evt;
+        esp_bd_addr_t           bda;
+        esp_ble_addr_type_t     ble_addr_type;
+        int                     rssi;
+        uint8_t                 ble_adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+        uint8_t                 adv_data_len;
+        uint8_t                 scan_rsp_len;
+    } scan_rst;
+    struct {
+        esp_bt_status_t status;
+        esp_bd_addr_t   bda;
+        uint16_t        min_int;
+        uint16_t        max_int;
+        uint16_t        latency;
+        uint16_t        conn_int;           // N * 1.25ms, chosen by central
+        uint16_t        timeout;
+    } update_conn_params;
+    struct {
+        esp_bt_status_t status;
+        esp_ble_pkt_data_length_params_t params;
+        esp_bd_addr_t   remote_addr;
+    } pkt_data_lenth_cmpl;                  // sic, name of ESP-IDF
+} esp_ble_gap_cb_param_t;
+
+typedef struct {
+    esp_bd_addr_t   bda;
+    uint16_t        min_int;                // N * 1.25ms
+    uint16_t        max_int;
+    uint16_t        latency;                // connection events
+    uint16_t        timeout;                // N * 10ms
+} esp_ble_conn_update_params_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback);
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params);
+esp_err_t esp_ble_gap_stop_advertising(void);
+esp_err_t esp_ble_gap_config_adv_data_raw(uint8_t *raw_data, uint32_t raw_data_len);
+esp_err_t esp_ble_gap_config_scan_rsp_data_raw(uint8_t *raw_data, uint32_t raw_data_len);
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params);
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration);    // s, 0 - until stop
+esp_err_t esp_ble_gap_stop_scanning(void);
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params);
+esp_err_t esp_ble_gap_set_pkt_data_len(esp_bd_addr_t remote_device, uint16_t tx_data_length);
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t remote_device);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_GATT_DEFS_H_
+#define ESP_GATT_DEFS_H_
+
+#include "esp_bt_defs.h"
+
+#define ESP_GATT_UUID_PRI_SERVICE           0x2800
+#define ESP_GATT_UUID_CHAR_DECLARE          0x2803
+#define ESP_GATT_UUID_CHAR_CLIENT_CONFIG    0x2902
+
+#define ESP_GATT_PERM_READ                  (1 << 0)
+#define ESP_GATT_PERM_WRITE                 (1 << 4)
+
+#define ESP_GATT_CHAR_PROP_BIT_READ         (1 << 1)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE_NR     (1 << 2)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE        (1 << 3)
+#define ESP_GATT_CHAR_PROP_BIT_NOTIFY       (1 << 4)
+
+#define ESP_GATT_AUTO_RSP                   1
+#define ESP_GATT_RSP_BY_APP                 0
+
+#define ESP_GATT_DEF_BLE_MTU_SIZE           23
+#define ESP_GATT_MAX_MTU_SIZE               517
+#define ESP_GATT_IF_NONE                    0xFF
+
+#define ESP_UUID_LEN_16                     2
+#define ESP_UUID_LEN_128                    16
+
+typedef uint8_t esp_gatt_if_t;
+typedef uint16_t esp_gatt_perm_t;
+typedef uint8_t esp_gatt_char_prop_t;
+
+typedef enum {
+    ESP_GATT_OK             = 0x00,
+    ESP_GATT_INVALID_HANDLE = 0x01,
+    ESP_GATT_NO_RESOURCES   = 0x80,
+    ESP_GATT_ERROR          = 0x85
+} esp_gatt_status_t;
+
+typedef enum {
+    ESP_GATT_CONN_UNKNOWN           = 0,
+    ESP_GATT_CONN_TIMEOUT           = 0x08,
+    ESP_GATT_CONN_TERMINATE_PEER_USER = 0x13,
+    ESP_GATT_CONN_TERMINATE_LOCAL_HOST = 0x16
+} esp_gatt_conn_reason_t;
+
+typedef struct {
+    uint8_t     auto_rsp;
+} esp_attr_control_t;
+
+typedef struct {
+    uint16_t    uuid_length;
+    uint8_t     *uuid_p;
+    uint16_t    perm;
+    uint16_t    max_length;
+    uint16_t    length;
+    uint8_t     *value;
+} esp_attr_desc_t;
+
+typedef struct {
+    esp_attr_control_t  attr_control;
+    esp_attr_desc_t     att_desc;
+} esp_gatts_attr_db_t;
+
+#endif
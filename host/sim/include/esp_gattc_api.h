@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_GATTC_API_H_
+#define ESP_GATTC_API_H_
+
+#include "esp_gatt_defs.h"
+
+#endif
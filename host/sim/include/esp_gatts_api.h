@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_GATTS_API_H_
+#define ESP_GATTS_API_H_
+
+#include "esp_gatt_defs.h"
+
+typedef enum {
+    ESP_GATTS_REG_EVT = 0,
+    ESP_GATTS_READ_EVT,
+    ESP_GATTS_WRITE_EVT,
+    ESP_GATTS_EXEC_WRITE_EVT,
+    ESP_GATTS_MTU_EVT,
+    ESP_GATTS_CONF_EVT,
+    ESP_GATTS_START_EVT,
+    ESP_GATTS_CONNECT_EVT,
+    ESP_GATTS_DISCONNECT_EVT,
+    ESP_GATTS_CONGEST_EVT,
+    ESP_GATTS_CREAT_ATTR_TAB_EVT,
+    ESP_GATTS_SET_ATTR_VAL_EVT
+} esp_gatts_cb_event_t;
+
+typedef union {
+    struct {
+        esp_gatt_status_t   status;
+        uint16_t            app_id;
+    } reg;
+    struct {
+        uint16_t            conn_id;
+        uint32_t            trans_id;
+        esp_bd_addr_t       bda;
+        uint16_t            handle;
+        uint16_t            offset;
+        bool                need_rsp;
+        bool                is_prep;
+        uint16_t            len;
+        uint8_t             *value;
+    } write;
+    struct {
+        uint16_t            conn_id;
+        uint16_t            mtu;
+    } mtu;
+    struct {
+        esp_gatt_status_t   status;
+        uint16_t            service_handle;
+    } start;
+    struct {
+        uint16_t            conn_id;
+        uint8_t             link_role;
+        esp_bd_addr_t       remote_bda;
+    } connect;
+    struct {
+        uint16_t            conn_id;
+        esp_bd_addr_t       remote_bda;
+        esp_gatt_conn_reason_t reason;
+    } disconnect;
+    struct {
+        uint16_t            conn_id;
+        bool                congested;
+    } congest;
+    struct {
+        esp_gatt_status_t   status;
+        uint8_t             svc_inst_id;
+        uint16_t            num_handle;
+        uint16_t            *handles;
+    } add_attr_tab;
+    struct {
+        uint16_t            srvc_handle;
+        uint16_t            attr_handle;
+        esp_gatt_status_t   status;
+    } set_attr_val;
+} esp_ble_gatts_cb_param_t;
+
+typedef void (*esp_gatts_cb_t)(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback);
+esp_err_t esp_ble_gatts_app_register(uint16_t app_id);
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t *gatts_attr_db, esp_gatt_if_t gatts_if, uint8_t max_nb_attr, uint8_t srvc_inst_id);
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle);
+esp_err_t esp_ble_gatts_set_attr_value(uint16_t attr_handle, uint16_t length, const uint8_t *value);
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle, uint16_t value_len, uint8_t *value, bool need_confirm);
+
+#endif
@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_INT_WDT_H_
+#define ESP_INT_WDT_H_
+
+// host simulator - no interrupt watchdog
+
+#endif
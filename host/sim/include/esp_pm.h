@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_PM_H_
+#define ESP_PM_H_
+
+#include "esp_err.h"
+
+esp_err_t esp_pm_configure(const void *config);
+
+#endif
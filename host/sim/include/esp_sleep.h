@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_SLEEP_H_
+#define ESP_SLEEP_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us);
+void esp_deep_sleep_start(void) __attribute__((noreturn)); // host simulator - firmware is reloaded, only RTC_DATA_ATTR is kept
+
+#endif
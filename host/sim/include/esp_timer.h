@@ -0,0 +1,13 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ESP_TIMER_H_
+#define ESP_TIMER_H_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+int64_t esp_timer_get_time(void); // us since boot, virtual clock
+
+#endif
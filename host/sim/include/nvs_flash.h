@@ -0,0 +1,15 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef NVS_FLASH_H_
+#define NVS_FLASH_H_
+
+#include "esp_err.h"
+
+#define ESP_ERR_NVS_NO_FREE_PAGES       0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   0x1110
+
+esp_err_t nvs_flash_init(void);
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef ROM_ETS_SYS_H_
+#define ROM_ETS_SYS_H_
+
+#include <stdint.h>
+
+void ets_delay_us(uint32_t us); // busy wait - moves virtual clock without switching tasks
+uint32_t ets_get_cpu_frequency(void);
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef SDKCONFIG_H_
+#define SDKCONFIG_H_
+
+// host simulator - subset of sdkconfig of ESP32 target used by firmware
+#define CONFIG_IDF_TARGET_ESP32             1
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ   240
+#define CONFIG_FREERTOS_HZ                  100
+
+#endif
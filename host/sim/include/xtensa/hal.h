@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef XTENSA_HAL_H_
+#define XTENSA_HAL_H_
+
+#include <stdint.h>
+
+uint32_t xthal_get_ccount(void); // CPU cycles of virtual clock, overflows like on chip
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef SIM_H_
+#define SIM_H_
+
+// Host simulator of MyAirScanner - firmware from src/ runs unchanged on ESP-IDF API implemented over
+// virtual clock, cooperative scheduler and models of PMS5003, DHT22, LED and BLE radio.
+// Whole simulator is one thread, models and simulated ISRs are callbacks of timed events.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "esp_gap_ble_api.h"
+
+#define SIM_US_PER_TICK         (1000000 / configTICK_RATE_HZ)
+#define SIM_CPU_FREQ_MHZ        CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+#define SIM_TASK_STACK_MIN      (64*1024) // host code needs more stack than xtensa, libc printf
+#define SIM_TASK_STACK_PAINT    0xA5
+#define SIM_TIME_NEVER          INT64_MAX
+#define SIM_MS(ms)              ((int64_t)(ms) * 1000)
+#define SIM_S(s)                ((int64_t)(s) * 1000000)
+#define SIM_HOURS(h)            ((int64_t)(h) * 3600 * 1000000)
+
+typedef void (*sim_event_cb_t)(void *arg);
+
+// KERNEL - virtual clock and timed events (sim_kernel.c)
+int64_t sim_now(void);                                                              // us since start of simulation
+void sim_advance(int64_t us);                                                       // busy wait of running code
+void sim_event_at(int64_t time_us, sim_event_cb_t cb, void *arg, const void *owner);
+void sim_event_after(int64_t delay_us, sim_event_cb_t cb, void *arg, const void *owner);
+void sim_event_cancel(const void *owner);                                          // drop all pending events of owner
+uint32_t sim_rand(uint32_t *state);                                                 // xorshift32, state != 0
+int32_t sim_rand_range(uint32_t *state, int32_t min, int32_t max);                  // uniform [min, max]
+double sim_rand_normal(uint32_t *state);                                            // N(0, 1)
+
+// KERNEL - tasks (sim_kernel.c), used by FreeRTOS API (sim_freertos.c)
+typedef enum {
+    SIM_TASK_READY = 0,
+    SIM_TASK_BLOCKED,
+    SIM_TASK_DELETED
+} sim_task_state_t;
+
+struct sim_task {
+    struct sim_task *next;
+    char name[16];
+    UBaseType_t priority;
+    sim_task_state_t state;
+    uint64_t ready_seq;     // FIFO order of tasks with the same priority
+    const void *wait_obj;   // object which task is blocked on, NULL - delay
+    int64_t wake_time;      // timeout of block
+    bool timed_out;
+    TaskFunction_t function;
+    void *parameter;
+    void *stack;
+    size_t stack_size;
+    void *context;          // ucontext_t
+};
+
+struct sim_task *sim_task_create(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter, UBaseType_t priority);
+void sim_task_delete(struct sim_task *task);
+struct sim_task *sim_task_current(void);                                           // NULL in event callback (ISR)
+bool sim_task_block(const void *obj, int64_t deadline);                             // false on timeout
+void sim_task_wake(const void *obj);                                                // wake all tasks blocked on obj
+int64_t sim_ticks_deadline(TickType_t ticks);
+void *sim_object_alloc(size_t size);                                                // kernel objects are freed at reboot
+void sim_object_free(void *obj);
+
+// KERNEL - power and firmware image
+void sim_firmware_set_path(const char *path);
+void sim_power_on(void);
+void sim_deep_sleep(int64_t sleep_us) __attribute__((noreturn));
+int64_t sim_boot_time(void);
+int sim_reset_reason(void);
+uint32_t sim_boot_count(void);
+void sim_state_checks_get(uint32_t *checks, uint32_t *mismatches);                 // deep sleep - firmware state before sleep vs after boot
+void sim_run(int64_t end_time);                                                     // run until virtual clock reaches end_time
+uint64_t sim_context_switches(void);
+
+// GPIO - pins seen by models (sim_gpio.c)
+typedef void (*sim_gpio_watch_t)(gpio_num_t pin, int level, void *arg);             // level driven by ESP, -1 floating
+void sim_gpio_watch(gpio_num_t pin, sim_gpio_watch_t cb, void *arg);
+int sim_gpio_driven_level(gpio_num_t pin);
+void sim_gpio_drive(gpio_num_t pin, int level);                                     // model drives line, fires ISR
+void sim_gpio_reset(void);                                                          // power down, called by kernel
+
+// UART - device side (sim_uart.c)
+typedef void (*sim_uart_tx_t)(const uint8_t *data, size_t len, void *arg);
+void sim_uart_attach(int uart_num, sim_uart_tx_t tx_cb, void *arg);
+void sim_uart_receive(int uart_num, uint8_t byte);                                  // byte received at sim_now()
+int64_t sim_uart_byte_time(int uart_num);
+void sim_uart_reset(void);
+
+// LEDC (sim_ledc.c)
+uint32_t sim_ledc_duty(int channel);
+uint32_t sim_ledc_changes(void);
+void sim_ledc_reset(void);
+
+// BLE radio (sim_ble.c)
+typedef void (*sim_ble_scanner_t)(int64_t time, const uint8_t *data, uint8_t len, void *arg);
+typedef struct {
+    uint64_t adv_events;
+    uint64_t data_updates;  // HCI set adv data commands
+    uint64_t adv_starts;
+    uint64_t scan_reports;  // adv of neighbors delivered to firmware
+    uint64_t rsp_updates;   // HCI set scan response data commands
+    uint64_t scan_rsp_events; // scan responses delivered to scanner
+} sim_ble_stats_t;
+void sim_ble_set_scanner(sim_ble_scanner_t cb, void *arg);
+void sim_ble_set_neighbors(uint32_t num, uint32_t seed);                            // devices advertising around, heard when scanning
+void sim_ble_get_stats(sim_ble_stats_t *dst);
+void sim_ble_reset(void);
+bool sim_ble_connectable(void);                                                     // connectable adv is on
+void sim_ble_connected(void);                                                       // controller stops adv at connection
+void sim_ble_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param); // GAP event of connection
+
+// GATT server and phone downloading history (sim_gatt.c)
+typedef struct {
+    uint32_t connects;
+    uint64_t records;       // received by phone
+    uint64_t expected;      // records in log at first connection (info characteristic)
+    uint64_t notifications;
+    uint64_t bytes;
+    uint64_t bad;           // wrong length or payload type
+    uint64_t out_of_order;  // records older than resume index
+    uint64_t skipped;       // cycles missing in log
+    uint64_t dropped;       // notifications over TX queue of stack
+    uint64_t truncated;     // notifications longer than ATT_MTU - 3
+    uint64_t congestions;
+    uint64_t conn_events;
+    uint64_t pdus;
+    uint32_t resume_cycle;  // requested after disconnect in the middle
+    uint16_t mtu;
+    uint32_t interval_us;
+    uint16_t ll_len;        // LL payload of data packet
+    int64_t start_time;     // first connection
+    int64_t stream_us;      // from control write to end of stream, both connections
+    int64_t total_us;       // from first connection to end of stream
+    bool done;
+} sim_gatt_stats_t;
+void sim_gatt_set_download(int64_t time_us, uint16_t client_mtu);
+void sim_gatt_get_stats(sim_gatt_stats_t *dst);
+void sim_gatt_reset(void);
+
+// SPI FLASH - data partitions (sim_flash.c)
+typedef struct {
+    uint64_t erases;            // sectors
+    uint64_t writes;
+    uint64_t bytes_written;
+    uint32_t max_sector_erases; // wear of most erased sector
+} sim_flash_stats_t;
+void sim_flash_get_stats(sim_flash_stats_t *dst);
+const uint8_t *sim_flash_data(const char *label, size_t *size);                      // NULL - no partition
+
+// TRACE - capture of firmware (SENSOR_TRACE) played by sensor models, or decoded by firmware image (sim_trace.c)
+#define SIM_TRACE_EDGES_MAX     84
+typedef struct sim_trace sim_trace_t;
+typedef struct {
+    int64_t time;           // us from command to first read of burst by firmware
+    uint16_t first_len;     // bytes of first read, they arrived just before it
+    uint16_t len;
+    const uint8_t *data;
+} sim_trace_burst_t;        // bytes of PMS read close together, sent back to back
+typedef struct {
+    uint8_t edges_num;
+    uint16_t pulses_us[SIM_TRACE_EDGES_MAX - 1]; // rounded up, decode is the same as from CPU cycles
+} sim_trace_dht_t;
+typedef struct {
+    uint32_t chunks;
+    uint32_t bad_chunks;    // CRC or head
+    uint32_t boots;
+    uint64_t records;
+    uint32_t pms_commands;
+    uint32_t pms_wakes;
+    uint64_t pms_bytes;
+    uint64_t pms_frames;    // valid frames found by firmware
+    uint64_t pms_bad;       // bad checksum
+    uint32_t dht_reads;
+    uint32_t dht_ok;
+    uint64_t dropped;       // records which didn't fit to buffer of firmware (SENSOR_TRACE_DROPPED)
+    uint32_t pms_matched;   // replay - commands of firmware found in trace
+    uint32_t pms_unmatched;
+    uint64_t pms_sent;      // replay - bytes sent by models
+    uint32_t dht_played;
+    uint32_t dht_missing;   // replay - start signals after end of trace
+} sim_trace_stats_t;
+typedef struct {
+    uint64_t pms_frames;    // results compared in order
+    uint64_t pms_diff;      // different or missing
+    uint64_t dht_reads;
+    uint64_t dht_diff;
+    uint64_t unpaired;      // results after end of shorter trace (capture stopped, replay ran longer)
+} sim_trace_check_t;
+typedef struct {
+    sim_trace_check_t check; // firmware against results in trace
+    uint64_t pms_bytes;     // all repeats
+    uint64_t dht_reads;
+    double pms_s;           // wall time
+    double dht_s;
+} sim_trace_decode_t;
+sim_trace_t *sim_trace_load(const uint8_t *data, size_t size);                    // partition image, NULL - no memory
+void sim_trace_free(sim_trace_t *trace);
+void sim_trace_get_stats(const sim_trace_t *trace, sim_trace_stats_t *dst);
+void sim_trace_replay(sim_trace_t *trace);                                          // models play trace instead of air
+bool sim_trace_replaying(void);
+bool sim_trace_pms_command(int slot, const uint8_t *command, size_t len);           // false - command not found in trace
+const sim_trace_burst_t *sim_trace_pms_burst(int slot);                             // next answer to command, NULL - none
+const sim_trace_dht_t *sim_trace_dht_read(int slot);                                // NULL - end of trace
+void sim_trace_compare(const sim_trace_t *expected, const sim_trace_t *actual, sim_trace_check_t *dst);
+bool sim_trace_decode(const sim_trace_t *trace, const char *firmware, uint32_t repeat, sim_trace_decode_t *dst);
+
+// SYSTEM (sim_system.c)
+void sim_log_set_level(int level);
+
+// ENVIRONMENT - air around device (sim_env.c)
+typedef struct {
+    double pm25;            // ug/m3
+    double temperature;     // C
+    double humidity;        // %
+} sim_env_t;
+void sim_env_init(uint32_t seed);
+void sim_env_get(sim_env_t *dst);                                                   // state at sim_now()
+
+// SENSOR MODELS
+typedef struct {
+    uint64_t frames;
+    uint64_t corrupted;
+    uint64_t commands;
+    int64_t fan_time;       // us of fan running
+} sim_pms_stats_t;
+int sim_pms_init(int uart_num, gpio_num_t set_gpio, gpio_num_t reset_gpio, uint32_t seed, double fault_rate);
+void sim_pms_get_stats(int unit, sim_pms_stats_t *dst);
+
+typedef struct {
+    uint64_t reads;
+    uint64_t faults;
+    uint64_t ignored;       // start signal too early or sensor not powered
+} sim_dht_stats_t;
+void sim_dht_init(gpio_num_t data_gpio, gpio_num_t vcc_gpio, uint32_t seed, double fault_rate);
+void sim_dht_get_stats(sim_dht_stats_t *dst);
+
+#endif
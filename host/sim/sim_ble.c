@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// BLE controller and Bluedroid GAP - HCI commands complete after short latency with GAP callback like from BTC task,
+// every advertising event delivers current adv data to scanner, scannable adv also scan response (active scanner).
+#include <string.h>
+#include "sim.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+#include "esp_log.h"
+#include "freertos/task.h"
+
+#define SIM_BLE_HCI_LATENCY_MIN_US  500
+#define SIM_BLE_HCI_LATENCY_MAX_US  3000
+#define SIM_BLE_ADV_DELAY_MAX_US    10000 // advDelay 0-10ms added to every interval (Core spec)
+#define SIM_BLE_ADV_UNIT_US         625
+#define SIM_BLE_CONTROLLER_INIT_US  60000   // controller init and RF calibration, runs on calling task
+#define SIM_BLE_BLUEDROID_INIT_MS   250     // host stack startup, calling task waits for BTC task
+#define SIM_BLE_NEIGHBOR_ADV_US     35000   // mean adv interval of neighbor devices
+#define SIM_BLE_NEIGHBOR_CYCLE_US   SIM_MS(340000) // neighbor changes live payload once per measurement cycle
+#define SIM_BLE_NEIGHBOR_LIVE_PCT   33      // part of neighbor adv events with live frame (rotation of frames)
+#define SIM_BLE_CHANNELS            3       // scanner listens on one channel per window
+#define SIM_BLE_SCAN_RSP_US         600     // SCAN_REQ and SCAN_RSP after adv PDU (2x T_IFS + PDUs)
+
+static const char *TAG = "SIM_BLE";
+
+static struct {
+    bool controller;
+    bool bluedroid;
+    esp_gap_ble_cb_t gap_cb;
+    bool advertising;
+    esp_ble_adv_params_t params;
+    uint8_t data[ESP_BLE_ADV_DATA_LEN_MAX];
+    uint8_t data_len;
+    uint8_t rsp[ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+    uint8_t rsp_len;
+    uint32_t rng;
+    sim_ble_scanner_t scanner;
+    void *scanner_arg;
+    bool scanning;
+    esp_ble_scan_params_t scan_params;
+    uint32_t neighbors;     // devices around, state is derived from index (no memory per neighbor)
+    uint32_t neighbors_seed;
+    sim_ble_stats_t stats;
+} sim_ble = { .rng = 0x8BADF00D };
+
+typedef struct {
+    esp_gap_ble_cb_event_t event;
+    esp_bt_status_t status;
+    uint8_t data[ESP_BLE_ADV_DATA_LEN_MAX];
+    uint8_t data_len;
+} sim_ble_command_t;
+
+static sim_ble_command_t sim_ble_commands[16]; // ring of commands in flight
+static uint8_t sim_ble_commands_next = 0;
+
+static void sim_ble_adv_event(void *arg);
+static void sim_ble_scan_event(void *arg);
+
+
+
+void sim_ble_set_scanner(sim_ble_scanner_t cb, void *arg)
+{
+    sim_ble.scanner = cb;
+    sim_ble.scanner_arg = arg;
+}
+
+
+void sim_ble_set_neighbors(uint32_t num, uint32_t seed)
+{
+    sim_ble.neighbors = num;
+    sim_ble.neighbors_seed = seed;
+}
+
+
+void sim_ble_get_stats(sim_ble_stats_t *dst)
+{
+    *dst = sim_ble.stats;
+}
+
+
+void sim_ble_reset(void) //power down - controller is off
+{
+    sim_event_cancel(&sim_ble);
+    sim_event_cancel(&sim_ble.advertising);
+    sim_event_cancel(&sim_ble.scanning);
+    sim_ble.scanning = false;
+    sim_ble.controller = false;
+    sim_ble.bluedroid = false;
+    sim_ble.gap_cb = NULL;
+    sim_ble.advertising = false;
+    sim_ble.data_len = 0;
+    sim_ble.rsp_len = 0;
+}
+
+
+bool sim_ble_connectable(void) //central can connect after adv event, phone ignores connectable adv without Flags AD
+{
+    if(!sim_ble.advertising || sim_ble.params.adv_type != ADV_TYPE_IND)
+        return false;
+    for(uint8_t i=0; i+1 < sim_ble.data_len; i += 1 + sim_ble.data[i])
+    {
+        if(sim_ble.data[i] == 0)
+            break;
+        if(sim_ble.data[i+1] == ESP_BLE_AD_TYPE_FLAG)
+            return true;
+    }
+    return false;
+}
+
+
+void sim_ble_connected(void) //connection created - controller stops advertising, host starts it again
+{
+    sim_ble.advertising = false;
+    sim_event_cancel(&sim_ble.advertising);
+}
+
+
+void sim_ble_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) //event of connection, like from BTC task
+{
+    if(sim_ble.gap_cb != NULL)
+        sim_ble.gap_cb(event, param);
+}
+
+
+static void sim_ble_complete(void *arg) //HCI command complete, callback like from BTC task
+{
+    sim_ble_command_t *command = arg;
+    esp_ble_gap_cb_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    switch(command->event)
+    {
+    case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
+        memcpy(sim_ble.data, command->data, command->data_len);
+        sim_ble.data_len = command->data_len;
+        param.adv_data_raw_cmpl.status = command->status;
+        break;
+    case ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT:
+        memcpy(sim_ble.rsp, command->data, command->data_len);
+        sim_ble.rsp_len = command->data_len;
+        param.scan_rsp_data_raw_cmpl.status = command->status;
+        break;
+    case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+        param.adv_start_cmpl.status = command->status;
+        break;
+    case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
+        param.adv_stop_cmpl.status = command->status;
+        break;
+    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        param.scan_param_cmpl.status = command->status;
+        break;
+    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+        param.scan_start_cmpl.status = command->status;
+        break;
+    case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+        param.scan_stop_cmpl.status = command->status;
+        break;
+    default:
+        break;
+    }
+
+    if(sim_ble.gap_cb != NULL)
+        sim_ble.gap_cb(command->event, &param);
+}
+
+
+static esp_err_t sim_ble_command(esp_gap_ble_cb_event_t event, const uint8_t *data, uint8_t data_len)
+{
+    sim_ble_command_t *command = &sim_ble_commands[sim_ble_commands_next];
+
+    if(!sim_ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+
+    sim_ble_commands_next = (sim_ble_commands_next + 1) % (sizeof(sim_ble_commands)/sizeof(sim_ble_commands[0]));
+    command->event = event;
+    command->status = ESP_BT_STATUS_SUCCESS;
+    command->data_len = data_len;
+    if(data_len > 0)
+        memcpy(command->data, data, data_len);
+
+    sim_event_after(sim_rand_range(&sim_ble.rng, SIM_BLE_HCI_LATENCY_MIN_US, SIM_BLE_HCI_LATENCY_MAX_US),
+                    sim_ble_complete, command, &sim_ble);
+    return ESP_OK;
+}
+
+
+static int64_t sim_ble_adv_interval(void)
+{
+    int32_t interval = sim_rand_range(&sim_ble.rng, sim_ble.params.adv_int_min, sim_ble.params.adv_int_max);
+    return (int64_t)interval * SIM_BLE_ADV_UNIT_US + sim_rand_range(&sim_ble.rng, 0, SIM_BLE_ADV_DELAY_MAX_US);
+}
+
+
+static void sim_ble_adv_event(void *arg) //one advertising event on all channels
+{
+    if(!sim_ble.advertising)
+        return;
+
+    ++sim_ble.stats.adv_events;
+    if(sim_ble.scanner != NULL && sim_ble.data_len > 0)
+        sim_ble.scanner(sim_now(), sim_ble.data, sim_ble.data_len, sim_ble.scanner_arg);
+    if(sim_ble.scanner != NULL && (sim_ble.params.adv_type == ADV_TYPE_SCAN_IND || sim_ble.params.adv_type == ADV_TYPE_IND) &&
+        sim_ble.rsp_len > 0) // both scannable
+    {
+        ++sim_ble.stats.scan_rsp_events;
+        sim_ble.scanner(sim_now() + SIM_BLE_SCAN_RSP_US, sim_ble.rsp, sim_ble.rsp_len, sim_ble.scanner_arg);
+    }
+    sim_event_after(sim_ble_adv_interval(), sim_ble_adv_event, NULL, &sim_ble.advertising);
+}
+
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg)
+{
+    if(sim_ble.controller)
+        return ESP_ERR_INVALID_STATE;
+    sim_advance(SIM_BLE_CONTROLLER_INIT_US);
+    sim_ble.controller = true;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode)
+{
+    return sim_ble.controller ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+
+esp_err_t esp_bluedroid_init(void)
+{
+    if(!sim_ble.controller || sim_ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    sim_ble.bluedroid = true;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_bluedroid_enable(void)
+{
+    if(!sim_ble.bluedroid)
+        return ESP_ERR_INVALID_STATE;
+    vTaskDelay(SIM_BLE_BLUEDROID_INIT_MS / portTICK_RATE_MS);
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback)
+{
+    sim_ble.gap_cb = callback;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params)
+{
+    if(adv_params->adv_int_min < 0x20 || adv_params->adv_int_min > adv_params->adv_int_max)
+    {
+        ESP_LOGE(TAG, "Bad advertising interval");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = sim_ble_command(ESP_GAP_BLE_ADV_START_COMPLETE_EVT, NULL, 0);
+    if(err != ESP_OK)
+        return err;
+
+    sim_ble.params = *adv_params;
+    if(!sim_ble.advertising)
+    {
+        sim_ble.advertising = true;
+        ++sim_ble.stats.adv_starts;
+        sim_event_after(sim_ble_adv_interval(), sim_ble_adv_event, NULL, &sim_ble.advertising);
+    }
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gap_stop_advertising(void)
+{
+    esp_err_t err = sim_ble_command(ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT, NULL, 0);
+    if(err != ESP_OK)
+        return err;
+
+    sim_ble.advertising = false;
+    sim_event_cancel(&sim_ble.advertising);
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gap_config_adv_data_raw(uint8_t *raw_data, uint32_t raw_data_len) //data is copied, applied at command complete
+{
+    if(raw_data == NULL || raw_data_len > ESP_BLE_ADV_DATA_LEN_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    ++sim_ble.stats.data_updates;
+    return sim_ble_command(ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT, raw_data, raw_data_len);
+}
+
+
+esp_err_t esp_ble_gap_config_scan_rsp_data_raw(uint8_t *raw_data, uint32_t raw_data_len) //data is copied, applied at command complete
+{
+    if((raw_data == NULL && raw_data_len > 0) || raw_data_len > ESP_BLE_SCAN_RSP_DATA_LEN_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    ++sim_ble.stats.rsp_updates;
+    return sim_ble_command(ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT, raw_data, raw_data_len);
+}
+
+
+static uint32_t sim_ble_neighbor_hash(uint32_t a, uint32_t b) //state of neighbor without memory
+{
+    uint32_t h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u) * 0x85EBCA77u ^ sim_ble.neighbors_seed;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h;
+}
+
+
+static void sim_ble_neighbor_report(uint32_t index) //one adv of neighbor heard by scanner
+{
+    esp_ble_gap_cb_param_t param;
+    uint32_t cycle = (sim_now() + (int64_t)(sim_ble_neighbor_hash(index, 0) % 340000) * 1000) / SIM_BLE_NEIGHBOR_CYCLE_US;
+    bool live = sim_rand_range(&sim_ble.rng, 0, 99) < SIM_BLE_NEIGHBOR_LIVE_PCT;
+    const uint8_t head[] = {0x1E, 0x06, 0x06, index & 0xFF, (index >> 8) & 0xFF, cycle & 0xFF}; // MyAirScanner measurement frame
+    uint8_t *data = param.scan_rst.ble_adv;
+
+    memset(&param, 0, sizeof(param));
+    param.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_RES_EVT;
+    for(int i=0; i<ESP_BD_ADDR_LEN; ++i)
+        param.scan_rst.bda[i] = sim_ble_neighbor_hash(index, 1 + i / 4) >> (8 * (i % 4));
+    param.scan_rst.rssi = -45 - (int)(sim_ble_neighbor_hash(index, 3) % 50) + sim_rand_range(&sim_ble.rng, -3, 3);
+
+    // payload is opaque for scanner, live frame changes once per cycle of neighbor
+    memcpy(data, head, sizeof(head));
+    for(int i=0; i<25; ++i)
+        data[sizeof(head) + i] = sim_ble_neighbor_hash(index, live ? cycle * 32 + i : sim_rand(&sim_ble.rng));
+    data[sizeof(head)] = (data[sizeof(head)] & ~0x03) | (live ? 0 : 1 + sim_rand_range(&sim_ble.rng, 0, 2));
+    param.scan_rst.adv_data_len = sizeof(head) + 25;
+
+    ++sim_ble.stats.scan_reports;
+    if(sim_ble.gap_cb != NULL)
+        sim_ble.gap_cb(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+}
+
+
+static void sim_ble_scan_event(void *arg) //one scan window - neighbors advertising on scanned channel are heard
+{
+    int64_t window_us = (int64_t)sim_ble.scan_params.scan_window * SIM_BLE_ADV_UNIT_US;
+    double expected = (double)sim_ble.neighbors * window_us / SIM_BLE_NEIGHBOR_ADV_US / SIM_BLE_CHANNELS;
+    uint32_t heard = (uint32_t)expected + (sim_rand(&sim_ble.rng) / 4294967296.0 < expected - (uint32_t)expected ? 1 : 0);
+
+    if(!sim_ble.scanning)
+        return;
+
+    for(uint32_t i=0; i<heard; ++i)
+        sim_ble_neighbor_report(sim_rand(&sim_ble.rng) % sim_ble.neighbors);
+    sim_event_after((int64_t)sim_ble.scan_params.scan_interval * SIM_BLE_ADV_UNIT_US, sim_ble_scan_event, NULL, &sim_ble.scanning);
+}
+
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params)
+{
+    if(scan_params->scan_window == 0 || scan_params->scan_window > scan_params->scan_interval)
+    {
+        ESP_LOGE(TAG, "Bad scan window");
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_ble.scan_params = *scan_params;
+    return sim_ble_command(ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT, NULL, 0);
+}
+
+
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration) //duration is ignored - scan until stop
+{
+    esp_err_t err = sim_ble_command(ESP_GAP_BLE_SCAN_START_COMPLETE_EVT, NULL, 0);
+    if(err != ESP_OK)
+        return err;
+
+    if(!sim_ble.scanning && sim_ble.neighbors > 0)
+        sim_event_after((int64_t)sim_ble.scan_params.scan_interval * SIM_BLE_ADV_UNIT_US, sim_ble_scan_event, NULL, &sim_ble.scanning);
+    sim_ble.scanning = true;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gap_stop_scanning(void)
+{
+    esp_err_t err = sim_ble_command(ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT, NULL, 0);
+    if(err != ESP_OK)
+        return err;
+
+    sim_ble.scanning = false;
+    sim_event_cancel(&sim_ble.scanning);
+    return ESP_OK;
+}
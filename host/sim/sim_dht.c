@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Model of DHT22 - answers start signal (low state >= 1ms) with response and 40 bits as edges on DATA line,
+// every edge fires GPIO ISR of firmware at its own time.
+// Replay of sensor trace (--replay) - every start signal is answered with next captured transmission.
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+
+#define SIM_DHT_START_MIN_US    1000
+#define SIM_DHT_PERIOD_MIN_US   SIM_S(2)    // sensor doesn't answer more often
+#define SIM_DHT_EDGES_NUM       84
+#define SIM_DHT_JITTER_US       4
+
+typedef struct {
+    gpio_num_t data_gpio;
+    gpio_num_t vcc_gpio;
+    bool powered;
+    bool host_low;
+    int64_t low_start;
+    int64_t last_read;
+    int64_t edges[SIM_DHT_EDGES_NUM];
+    uint8_t edges_num;
+    uint8_t edge_pos;
+    uint32_t rng;
+    double fault_rate;
+    sim_dht_stats_t stats;
+} sim_dht_t;
+
+static sim_dht_t sim_dht;
+
+
+
+static void sim_dht_edge_event(void *arg) //odd edges are falling - line is pulled low by sensor
+{
+    sim_dht_t *dht = arg;
+    uint8_t pos = dht->edge_pos++;
+
+    sim_gpio_drive(dht->data_gpio, pos % 2);
+    if(dht->edge_pos < dht->edges_num)
+        sim_event_at(dht->edges[dht->edge_pos], sim_dht_edge_event, dht, dht);
+}
+
+
+static int64_t sim_dht_pulse(sim_dht_t *dht, int64_t us)
+{
+    return us + sim_rand_range(&dht->rng, -SIM_DHT_JITTER_US, SIM_DHT_JITTER_US);
+}
+
+
+static void sim_dht_respond(sim_dht_t *dht) //edges of response and data
+{
+    sim_env_t env;
+    uint8_t data[5];
+    int64_t t = sim_now() + sim_rand_range(&dht->rng, 20, 40);
+    uint16_t humidity, temperature;
+    uint8_t n = 0;
+
+    sim_env_get(&env);
+    humidity = (uint16_t)lround(env.humidity * 10.0);
+    temperature = (uint16_t)lround(fabs(env.temperature) * 10.0) | (env.temperature < 0 ? 0x8000 : 0);
+    data[0] = humidity >> 8;
+    data[1] = humidity & 0xFF;
+    data[2] = temperature >> 8;
+    data[3] = temperature & 0xFF;
+    data[4] = data[0] + data[1] + data[2] + data[3];
+
+    dht->edges_num = SIM_DHT_EDGES_NUM;
+    if(sim_rand(&dht->rng) / 4294967296.0 < dht->fault_rate) // lost bit or truncated transmission
+    {
+        ++dht->stats.faults;
+        if(sim_rand(&dht->rng) & 1)
+            data[sim_rand_range(&dht->rng, 0, 4)] ^= 1 << sim_rand_range(&dht->rng, 0, 7);
+        else
+            dht->edges_num = sim_rand_range(&dht->rng, 0, SIM_DHT_EDGES_NUM - 2);
+    }
+
+    // response: low 80us, high 80us
+    dht->edges[n++] = t;
+    dht->edges[n++] = t += sim_dht_pulse(dht, 80);
+    dht->edges[n++] = t += sim_dht_pulse(dht, 80);
+    // every bit: low 50us, high 26us ("0") or 70us ("1")
+    for(int bit=0; bit<40; ++bit)
+    {
+        bool one = data[bit/8] & (0x80 >> (bit%8));
+        dht->edges[n++] = t += sim_dht_pulse(dht, 50);
+        dht->edges[n++] = t += sim_dht_pulse(dht, one ? 70 : 26);
+    }
+    // release line
+    dht->edges[n++] = t += sim_dht_pulse(dht, 50);
+
+    dht->edge_pos = 0;
+    dht->last_read = sim_now();
+    ++dht->stats.reads;
+    if(dht->edges_num > 0)
+        sim_event_at(dht->edges[0], sim_dht_edge_event, dht, dht);
+}
+
+
+static void sim_dht_replay(sim_dht_t *dht) //edges of next transmission in trace
+{
+    const sim_trace_dht_t *read = sim_trace_dht_read(0);
+    int64_t t = sim_now() + sim_rand_range(&dht->rng, 20, 40);
+
+    dht->edges_num = 0;
+    dht->edge_pos = 0;
+    dht->last_read = sim_now();
+    ++dht->stats.reads;
+    if(read == NULL || read->edges_num == 0)
+        return;
+
+    dht->edges_num = read->edges_num;
+    dht->edges[0] = t;
+    for(uint8_t i=1; i<dht->edges_num; ++i)
+        dht->edges[i] = t += read->pulses_us[i-1];
+    sim_event_at(dht->edges[0], sim_dht_edge_event, dht, dht);
+}
+
+
+static void sim_dht_pin(gpio_num_t pin, int level, void *arg)
+{
+    sim_dht_t *dht = arg;
+
+    if(pin == dht->vcc_gpio)
+    {
+        dht->powered = level == 1;
+        if(!dht->powered)
+            sim_event_cancel(dht);
+        return;
+    }
+
+    if(level == 0 && !dht->host_low) // start signal from host
+    {
+        dht->host_low = true;
+        dht->low_start = sim_now();
+        sim_event_cancel(dht);
+        sim_gpio_drive(dht->data_gpio, 0);
+    }
+    else if(level != 0 && dht->host_low) // line is released or pulled high by host
+    {
+        dht->host_low = false;
+        sim_gpio_drive(dht->data_gpio, 1);
+        if(sim_trace_replaying()) // start signals were checked by real sensor
+        {
+            sim_dht_replay(dht);
+            return;
+        }
+        if(!dht->powered || sim_now() - dht->low_start < SIM_DHT_START_MIN_US ||
+            (dht->stats.reads > 0 && sim_now() - dht->last_read < SIM_DHT_PERIOD_MIN_US))
+        {
+            ++dht->stats.ignored;
+            return;
+        }
+        sim_dht_respond(dht);
+    }
+}
+
+
+void sim_dht_init(gpio_num_t data_gpio, gpio_num_t vcc_gpio, uint32_t seed, double fault_rate)
+{
+    memset(&sim_dht, 0, sizeof(sim_dht));
+    sim_dht.data_gpio = data_gpio;
+    sim_dht.vcc_gpio = vcc_gpio;
+    sim_dht.rng = seed ? seed : 1;
+    sim_dht.fault_rate = fault_rate;
+
+    sim_gpio_watch(data_gpio, sim_dht_pin, &sim_dht);
+    sim_gpio_watch(vcc_gpio, sim_dht_pin, &sim_dht);
+}
+
+
+void sim_dht_get_stats(sim_dht_stats_t *dst)
+{
+    *dst = sim_dht.stats;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Air around device - daily cycle + Ornstein-Uhlenbeck noise, PM2.5 has random pollution episodes (e.g. heating, traffic).
+// State is advanced lazily to sim_now(), so result doesn't depend on how often models ask.
+#include <math.h>
+#include "sim.h"
+
+#define SIM_ENV_DAY_US          SIM_HOURS(24)
+#define SIM_ENV_STEP_US         SIM_S(60)   // resolution of random processes
+#define SIM_ENV_EPISODES_DAY    1.5         // mean number of pollution episodes per day
+#define SIM_ENV_EPISODE_TAU_S   5400.0      // decay of episode
+
+typedef struct {
+    double value;
+    double tau_s;
+    double sigma;
+} sim_env_ou_t;
+
+static struct {
+    uint32_t rng;
+    int64_t time;
+    sim_env_ou_t pm25;
+    sim_env_ou_t temperature;
+    sim_env_ou_t humidity;
+    double episode;         // ug/m3 of current pollution episode
+} sim_env;
+
+
+
+static void sim_env_ou_step(sim_env_ou_t *ou, double dt_s) //exact discretization of OU process with mean 0
+{
+    double decay = exp(-dt_s / ou->tau_s);
+    ou->value = ou->value * decay + ou->sigma * sqrt(1.0 - decay*decay) * sim_rand_normal(&sim_env.rng);
+}
+
+
+void sim_env_init(uint32_t seed)
+{
+    sim_env.rng = seed ? seed : 1;
+    sim_env.time = 0;
+    sim_env.pm25 = (sim_env_ou_t){0.0, 7200.0, 6.0};
+    sim_env.temperature = (sim_env_ou_t){0.0, 10800.0, 1.5};
+    sim_env.humidity = (sim_env_ou_t){0.0, 10800.0, 6.0};
+    sim_env.episode = 0.0;
+}
+
+
+static void sim_env_advance(int64_t now)
+{
+    while(sim_env.time + SIM_ENV_STEP_US <= now)
+    {
+        double dt_s = SIM_ENV_STEP_US / 1e6;
+
+        sim_env_ou_step(&sim_env.pm25, dt_s);
+        sim_env_ou_step(&sim_env.temperature, dt_s);
+        sim_env_ou_step(&sim_env.humidity, dt_s);
+
+        sim_env.episode *= exp(-dt_s / SIM_ENV_EPISODE_TAU_S);
+        if(sim_rand(&sim_env.rng) / 4294967296.0 < SIM_ENV_EPISODES_DAY * dt_s / 86400.0)
+            sim_env.episode += 40.0 + sim_rand_range(&sim_env.rng, 0, 120);
+
+        sim_env.time += SIM_ENV_STEP_US;
+    }
+}
+
+
+void sim_env_get(sim_env_t *dst)
+{
+    int64_t now = sim_now();
+    double day = 2.0 * M_PI * (double)(now % SIM_ENV_DAY_US) / SIM_ENV_DAY_US; // t=0 - midnight
+
+    sim_env_advance(now);
+
+    // warmest at 15:00, highest PM in the evening
+    dst->temperature = 16.0 + 6.0 * cos(day - 2.0*M_PI*15.0/24.0) + sim_env.temperature.value;
+    dst->humidity = 60.0 - 15.0 * cos(day - 2.0*M_PI*15.0/24.0) + sim_env.humidity.value;
+    dst->pm25 = 14.0 + 8.0 * cos(day - 2.0*M_PI*20.0/24.0) + sim_env.pm25.value + sim_env.episode;
+
+    if(dst->humidity < 5.0)
+        dst->humidity = 5.0;
+    if(dst->humidity > 99.0)
+        dst->humidity = 99.0;
+    if(dst->pm25 < 0.5)
+        dst->pm25 = 0.5;
+}
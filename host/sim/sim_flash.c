@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// SPI flash partitions (data partitions of partitions.csv) - NOR semantics: erase sets sector to 0xFF, write only clears bits.
+// Content survives deep sleep and reboots of firmware, it's lost only when simulator exits.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "esp_partition.h"
+
+#define SIM_FLASH_ERASE_US      SIM_MS(45)  // sector erase, typical for 4MB SPI NOR
+#define SIM_FLASH_PAGE_US       700         // page program
+#define SIM_FLASH_PAGE_SIZE     256
+
+typedef struct {
+    esp_partition_t partition;
+    uint8_t *data;
+    uint32_t *erases;   // per sector
+} sim_flash_partition_t;
+
+static sim_flash_partition_t sim_flash[] = {
+    { .partition = { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_NVS, .address = 0x9000, .size = 0x6000, .label = "nvs" } },
+    { .partition = { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_PHY, .address = 0xf000, .size = 0x1000, .label = "phy_init" } },
+    { .partition = { .type = ESP_PARTITION_TYPE_DATA, .subtype = 0x40, .address = 0x190000, .size = 0x20000, .label = "history" } },
+    { .partition = { .type = ESP_PARTITION_TYPE_DATA, .subtype = 0x41, .address = 0x1B0000, .size = 0x40000, .label = "trace" } },
+};
+#define SIM_FLASH_PARTITIONS_NUM    (sizeof(sim_flash) / sizeof(sim_flash[0]))
+
+static sim_flash_stats_t sim_flash_stats;
+
+
+
+static sim_flash_partition_t *sim_flash_get(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    for(size_t i=0; i<SIM_FLASH_PARTITIONS_NUM; ++i)
+    {
+        sim_flash_partition_t *flash = &sim_flash[i];
+        if(partition != &flash->partition)
+            continue;
+        if(offset > partition->size || size > partition->size - offset)
+            return NULL;
+        if(flash->data == NULL) // first access - chip is erased
+        {
+            flash->data = malloc(partition->size);
+            flash->erases = calloc(partition->size / SPI_FLASH_SEC_SIZE, sizeof(uint32_t));
+            if(flash->data == NULL || flash->erases == NULL)
+            {
+                fprintf(stderr, "sim: out of memory for flash\n");
+                exit(1);
+            }
+            memset(flash->data, 0xFF, partition->size);
+        }
+        return flash;
+    }
+    return NULL;
+}
+
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    for(size_t i=0; i<SIM_FLASH_PARTITIONS_NUM; ++i)
+    {
+        const esp_partition_t *partition = &sim_flash[i].partition;
+        if(partition->type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || partition->subtype == subtype) &&
+            (label == NULL || strcmp(partition->label, label) == 0))
+            return partition;
+    }
+    return NULL;
+}
+
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    sim_flash_partition_t *flash = sim_flash_get(partition, src_offset, size);
+
+    if(flash == NULL || dst == NULL)
+        return ESP_ERR_INVALID_ARG;
+    memcpy(dst, flash->data + src_offset, size);
+    return ESP_OK;
+}
+
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    sim_flash_partition_t *flash = sim_flash_get(partition, dst_offset, size);
+    const uint8_t *bytes = src;
+
+    if(flash == NULL || src == NULL)
+        return ESP_ERR_INVALID_ARG;
+
+    for(size_t i=0; i<size; ++i)
+        flash->data[dst_offset + i] &= bytes[i];
+
+    ++sim_flash_stats.writes;
+    sim_flash_stats.bytes_written += size;
+    sim_advance(SIM_FLASH_PAGE_US * ((size + SIM_FLASH_PAGE_SIZE - 1) / SIM_FLASH_PAGE_SIZE));
+    return ESP_OK;
+}
+
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    sim_flash_partition_t *flash = sim_flash_get(partition, offset, size);
+
+    if(flash == NULL || offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0)
+        return ESP_ERR_INVALID_ARG;
+
+    memset(flash->data + offset, 0xFF, size);
+    for(size_t sector=offset/SPI_FLASH_SEC_SIZE; sector<(offset+size)/SPI_FLASH_SEC_SIZE; ++sector)
+    {
+        ++sim_flash_stats.erases;
+        if(++flash->erases[sector] > sim_flash_stats.max_sector_erases)
+            sim_flash_stats.max_sector_erases = flash->erases[sector];
+    }
+    sim_advance(SIM_FLASH_ERASE_US * (size / SPI_FLASH_SEC_SIZE));
+    return ESP_OK;
+}
+
+
+void sim_flash_get_stats(sim_flash_stats_t *dst)
+{
+    *dst = sim_flash_stats;
+}
+
+
+const uint8_t *sim_flash_data(const char *label, size_t *size) //content of partition, like parttool.py read_partition
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    sim_flash_partition_t *flash = partition != NULL ? sim_flash_get(partition, 0, 0) : NULL;
+
+    if(flash == NULL)
+        return NULL;
+    *size = partition->size;
+    return flash->data;
+}
@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// FreeRTOS API used by firmware - tasks, queues, semaphores and event groups over sim_kernel.c.
+// Semaphores are queues with items of size 0 like in FreeRTOS.
+// Static variants take memory from firmware only to keep its API, objects and stacks are allocated by simulator
+// (host stacks are much bigger than stacks of target).
+#include <string.h>
+#include "sim.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+typedef enum {
+    SIM_QUEUE_QUEUE = 0,
+    SIM_QUEUE_BINARY,
+    SIM_QUEUE_COUNTING,
+    SIM_QUEUE_MUTEX
+} sim_queue_kind_t;
+
+struct sim_queue {
+    sim_queue_kind_t kind;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;       // index of oldest item
+    uint8_t *items;
+};
+
+struct sim_event_group {
+    EventBits_t bits;
+};
+
+
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter, UBaseType_t priority, TaskHandle_t *handle)
+{
+    struct sim_task *task = sim_task_create(function, name, stack_depth, parameter, priority);
+
+    if(handle != NULL)
+        *handle = task;
+    return task != NULL ? pdPASS : pdFAIL;
+}
+
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter, UBaseType_t priority, StackType_t *stack, StaticTask_t *tcb)
+{
+    if(stack == NULL || tcb == NULL)
+        return NULL;
+    return sim_task_create(function, name, stack_depth, parameter, priority);
+}
+
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id)
+{
+    return xTaskCreate(function, name, stack_depth, parameter, priority, handle);
+}
+
+
+void vTaskDelete(TaskHandle_t task)
+{
+    sim_task_delete(task);
+}
+
+
+void vTaskDelay(TickType_t ticks)
+{
+    if(ticks > 0)
+        sim_task_block(NULL, sim_ticks_deadline(ticks));
+}
+
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment)
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wake = *previous_wake + increment;
+    TickType_t elapsed = now - *previous_wake;
+
+    *previous_wake = wake;
+    if(elapsed < increment) // wake time is in the future, tick counter can overflow
+        vTaskDelay(wake - now);
+}
+
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)((sim_now() - sim_boot_time()) / SIM_US_PER_TICK);
+}
+
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+    return xTaskGetTickCount();
+}
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return sim_task_current();
+}
+
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) //bytes never used, host stack (at least SIM_TASK_STACK_MIN)
+{
+    const uint8_t *stack;
+    UBaseType_t free_bytes = 0;
+
+    if(task == NULL)
+        task = sim_task_current();
+    if(task == NULL)
+        return 0;
+
+    stack = task->stack; // grows down, bottom is painted until deepest use
+    while(free_bytes < task->stack_size && stack[free_bytes] == SIM_TASK_STACK_PAINT)
+        ++free_bytes;
+    return free_bytes;
+}
+
+
+char *pcTaskGetTaskName(TaskHandle_t task)
+{
+    if(task == NULL)
+        task = sim_task_current();
+    return task != NULL ? task->name : NULL;
+}
+
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    if(task == NULL)
+        task = sim_task_current();
+    return task != NULL ? task->priority : 0;
+}
+
+
+void taskYIELD(void)
+{
+    sim_task_block(NULL, sim_now() + 1);
+}
+
+
+static QueueHandle_t sim_queue_create(sim_queue_kind_t kind, UBaseType_t length, UBaseType_t item_size)
+{
+    if(length == 0)
+        return NULL;
+
+    struct sim_queue *queue = sim_object_alloc(sizeof(struct sim_queue) + (size_t)length * item_size);
+    if(queue == NULL)
+        return NULL;
+
+    queue->kind = kind;
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->items = (uint8_t*)(queue + 1);
+    return queue;
+}
+
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    return sim_queue_create(SIM_QUEUE_QUEUE, length, item_size);
+}
+
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *queue_buffer)
+{
+    if(queue_buffer == NULL || (item_size > 0 && storage == NULL))
+        return NULL;
+    return xQueueCreate(length, item_size);
+}
+
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    sim_object_free(queue);
+}
+
+
+static void sim_queue_put(QueueHandle_t queue, const void *item, bool front)
+{
+    UBaseType_t pos;
+
+    if(front)
+    {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        pos = queue->head;
+    }
+    else
+    {
+        pos = (queue->head + queue->count) % queue->length;
+    }
+
+    if(queue->item_size > 0 && item != NULL)
+        memcpy(queue->items + (size_t)pos * queue->item_size, item, queue->item_size);
+    ++queue->count;
+}
+
+
+static BaseType_t sim_queue_send(QueueHandle_t queue, const void *item, TickType_t ticks, bool front)
+{
+    int64_t deadline = sim_ticks_deadline(ticks);
+
+    if(queue == NULL)
+        return pdFAIL;
+
+    while(queue->count >= queue->length)
+    {
+        if(ticks == 0 || !sim_task_block(&(queue->head), deadline)) // head - waiting for space
+            return errQUEUE_FULL;
+    }
+
+    sim_queue_put(queue, item, front);
+    sim_task_wake(&(queue->count)); // count - waiting for item
+    return pdPASS;
+}
+
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return sim_queue_send(queue, item, ticks, false);
+}
+
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return sim_queue_send(queue, item, ticks, false);
+}
+
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return sim_queue_send(queue, item, ticks, true);
+}
+
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *task_woken)
+{
+    if(task_woken != NULL)
+        *task_woken = pdFALSE;
+    return sim_queue_send(queue, item, 0, false);
+}
+
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item) //queue of length 1
+{
+    if(queue == NULL)
+        return pdFAIL;
+
+    queue->count = 0;
+    queue->head = 0;
+    sim_queue_put(queue, item, false);
+    sim_task_wake(&(queue->count));
+    return pdPASS;
+}
+
+
+static BaseType_t sim_queue_receive(QueueHandle_t queue, void *item, TickType_t ticks, bool remove)
+{
+    int64_t deadline = sim_ticks_deadline(ticks);
+
+    if(queue == NULL)
+        return pdFAIL;
+
+    while(queue->count == 0)
+    {
+        if(ticks == 0 || !sim_task_block(&(queue->count), deadline))
+            return pdFALSE;
+    }
+
+    if(queue->item_size > 0 && item != NULL)
+        memcpy(item, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+    if(remove)
+    {
+        queue->head = (queue->head + 1) % queue->length;
+        --queue->count;
+        sim_task_wake(&(queue->head));
+    }
+    return pdTRUE;
+}
+
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    return sim_queue_receive(queue, item, ticks, true);
+}
+
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    return sim_queue_receive(queue, item, ticks, false);
+}
+
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    if(queue == NULL)
+        return pdFAIL;
+
+    queue->count = 0;
+    queue->head = 0;
+    sim_task_wake(&(queue->head));
+    return pdPASS;
+}
+
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue != NULL ? queue->count : 0;
+}
+
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    return queue != NULL ? queue->length - queue->count : 0;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) //created empty, like in FreeRTOS
+{
+    return sim_queue_create(SIM_QUEUE_BINARY, 1, 0);
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) //created available, no priority inheritance
+{
+    SemaphoreHandle_t mutex = sim_queue_create(SIM_QUEUE_MUTEX, 1, 0);
+
+    if(mutex != NULL)
+        mutex->count = 1;
+    return mutex;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *semaphore_buffer)
+{
+    return semaphore_buffer != NULL ? xSemaphoreCreateBinary() : NULL;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *semaphore_buffer)
+{
+    return semaphore_buffer != NULL ? xSemaphoreCreateMutex() : NULL;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    SemaphoreHandle_t semaphore = sim_queue_create(SIM_QUEUE_COUNTING, max_count, 0);
+
+    if(semaphore != NULL)
+        semaphore->count = initial_count;
+    return semaphore;
+}
+
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    return sim_queue_receive(semaphore, NULL, ticks, true);
+}
+
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return sim_queue_send(semaphore, NULL, 0, false);
+}
+
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *task_woken)
+{
+    return xQueueSendFromISR(semaphore, NULL, task_woken);
+}
+
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return sim_object_alloc(sizeof(struct sim_event_group));
+}
+
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *event_group_buffer)
+{
+    return event_group_buffer != NULL ? xEventGroupCreate() : NULL;
+}
+
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    sim_object_free(group);
+}
+
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    group->bits |= bits;
+    sim_task_wake(group);
+    return group->bits;
+}
+
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t previous = group->bits;
+
+    group->bits &= ~bits;
+    return previous;
+}
+
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    return group->bits;
+}
+
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks)
+{
+    int64_t deadline = sim_ticks_deadline(ticks);
+
+    while(1)
+    {
+        EventBits_t value = group->bits;
+        bool done = wait_for_all ? (value & bits) == bits : (value & bits) != 0;
+
+        if(done)
+        {
+            if(clear_on_exit)
+                group->bits &= ~bits;
+            return value;
+        }
+        if(ticks == 0 || !sim_task_block(group, deadline))
+            return group->bits;
+    }
+}
@@ -0,0 +1,591 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Bluedroid GATT server with one connection and phone downloading history (--download): phone connects to
+// connectable adv, discovers service, exchanges MTU, reads info, enables notifications and writes control.
+// Notifications wait in TX queue of stack (congestion events) and go on air in connection events - packets per
+// event, LL data length and interval limit throughput. Phone disconnects in the middle and resumes from next cycle.
+#include <string.h>
+#include "sim.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+#include "esp_gatt_common_api.h"
+#include "esp_log.h"
+#include "payload.h"
+#include "ble_adv.h"
+
+#define SIM_GATT_IF                 3
+#define SIM_GATT_CONN_ID            0
+#define SIM_GATT_HANDLE_FIRST       0x28
+#define SIM_GATT_ATTR_MAX           16
+#define SIM_GATT_VALUE_MAX          32      // stored value of attribute, only small values are kept by stack
+#define SIM_GATT_STACK_US           1000    // GATT API call to event like from BTC task
+#define SIM_GATT_CONNECT_US         40000   // connect request after adv event heard by phone
+#define SIM_GATT_RETRY_US           30000   // phone scans again when device is not connectable, shorter than slot of rotation
+#define SIM_GATT_RETRIES            30000
+#define SIM_GATT_RECONNECT_US       SIM_S(2) // phone reconnects after disconnect or link loss
+#define SIM_GATT_INTERVAL_INIT      24      // 30ms, N * 1.25ms, until connection update
+#define SIM_GATT_INTERVAL_MIN       12      // 15ms, lowest interval accepted by phone
+#define SIM_GATT_INTERVAL_UNIT_US   1250
+#define SIM_GATT_UPDATE_EVENTS      6       // connection update takes effect at instant
+#define SIM_GATT_DISCOVERY_EVENTS   10      // service discovery of phone before MTU exchange
+#define SIM_GATT_PDUS_PER_EVENT     6       // packets from server in one connection event, limit of phone
+#define SIM_GATT_EVENT_MARGIN_US    1250    // end of connection event before next one
+#define SIM_GATT_LL_LEN_DEFAULT     27
+#define SIM_GATT_LL_LEN_MAX         251
+#define SIM_GATT_PDU_OVERHEAD_US    (10 * 8 + 150 + 80 + 150) // preamble, AA, header, CRC, T_IFS, empty ack, T_IFS at 1M PHY
+#define SIM_GATT_TXQ_SIZE           24      // notifications in L2CAP queue of stack, more are dropped
+#define SIM_GATT_TXQ_CONGEST        12
+#define SIM_GATT_TXQ_UNCONGEST      4
+
+static const char *TAG = "SIM_GATT";
+
+typedef enum {
+    SIM_GATT_IDLE = 0,      // phone waits for connectable adv
+    SIM_GATT_DISCOVERY,
+    SIM_GATT_MTU,
+    SIM_GATT_READ_INFO,
+    SIM_GATT_ENABLE,
+    SIM_GATT_REQUEST,
+    SIM_GATT_STREAM,
+    SIM_GATT_DONE
+} sim_gatt_phase_t;
+
+typedef struct {
+    uint16_t len;
+    uint8_t data[ESP_GATT_MAX_MTU_SIZE];
+} sim_gatt_packet_t;
+
+static struct {
+    // server of firmware, cleared at power down
+    esp_gatts_cb_t gatts_cb;
+    bool registered;
+    bool started;
+    uint16_t local_mtu;
+    uint8_t attrs_num;
+    uint16_t uuid[SIM_GATT_ATTR_MAX];          // 16-bit UUID, 0 - 128-bit
+    uint8_t uuid128[SIM_GATT_ATTR_MAX][ESP_UUID_LEN_128];
+    uint16_t handles[SIM_GATT_ATTR_MAX];
+    uint8_t values[SIM_GATT_ATTR_MAX][SIM_GATT_VALUE_MAX];
+    uint16_t lengths[SIM_GATT_ATTR_MAX];
+    uint16_t max_lengths[SIM_GATT_ATTR_MAX];
+    // link
+    bool connected;
+    uint16_t mtu;
+    uint16_t interval;                          // N * 1.25ms
+    uint16_t ll_len;
+    uint16_t pending_ll_len;                    // LL length update in next connection event, 0 - none
+    uint16_t pending_interval;                  // connection update at instant, 0 - none
+    uint8_t update_events;
+    bool congested;
+    sim_gatt_packet_t txq[SIM_GATT_TXQ_SIZE];
+    uint8_t txq_head;
+    uint8_t txq_num;
+    uint8_t txq_pdus_sent;                      // fragments of head notification already on air
+    // phone
+    sim_gatt_phase_t phase;
+    int64_t download_time;                      // SIM_TIME_NEVER - no download
+    uint16_t client_mtu;
+    uint32_t retries;
+    uint8_t discovery_events;
+    uint32_t next_cycle;                        // resume index - cycle after last received record
+    bool resumed;
+    int64_t stream_start;
+    sim_gatt_stats_t stats;
+} sim_gatt = { .download_time = SIM_TIME_NEVER, .client_mtu = ESP_GATT_MAX_MTU_SIZE };
+
+static void sim_gatt_client_connect(void *arg);
+static void sim_gatt_conn_event(void *arg);
+
+
+
+void sim_gatt_set_download(int64_t time_us, uint16_t client_mtu)
+{
+    sim_gatt.download_time = time_us;
+    sim_gatt.client_mtu = client_mtu;
+    sim_event_at(time_us, sim_gatt_client_connect, NULL, &sim_gatt.phase);
+}
+
+
+void sim_gatt_get_stats(sim_gatt_stats_t *dst)
+{
+    *dst = sim_gatt.stats;
+}
+
+
+static void sim_gatt_link_lost(void) //connection is gone, phone reconnects if download is not finished
+{
+    sim_event_cancel(&sim_gatt.connected);
+    sim_gatt.connected = false;
+    sim_gatt.congested = false;
+    sim_gatt.txq_num = 0;
+    sim_gatt.txq_pdus_sent = 0;
+    sim_gatt.pending_interval = 0;
+    sim_gatt.pending_ll_len = 0;
+    if(sim_gatt.phase == SIM_GATT_STREAM)
+        sim_gatt.stats.stream_us += sim_now() - sim_gatt.stream_start;
+    if(sim_gatt.phase != SIM_GATT_DONE)
+    {
+        sim_gatt.phase = SIM_GATT_IDLE;
+        sim_gatt.retries = 0;
+        sim_event_after(SIM_GATT_RECONNECT_US, sim_gatt_client_connect, NULL, &sim_gatt.phase);
+    }
+}
+
+
+void sim_gatt_reset(void) //power down - stack of firmware is gone, phone sees link loss
+{
+    if(sim_gatt.connected)
+        sim_gatt_link_lost();
+    sim_event_cancel(&sim_gatt);
+    sim_gatt.gatts_cb = NULL;
+    sim_gatt.registered = false;
+    sim_gatt.started = false;
+    sim_gatt.attrs_num = 0;
+    sim_gatt.local_mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+}
+
+
+static int sim_gatt_attr(uint16_t handle)
+{
+    for(int i=0; i<sim_gatt.attrs_num; ++i)
+    {
+        if(sim_gatt.handles[i] == handle)
+            return i;
+    }
+    return -1;
+}
+
+
+static int sim_gatt_find(uint8_t uuid_id) //value of characteristic of history service, found by phone in discovery
+{
+    const uint8_t uuid[ESP_UUID_LEN_128] = BLE_ADV_HISTORY_UUID(0);
+
+    for(int i=0; i<sim_gatt.attrs_num; ++i)
+    {
+        if(sim_gatt.uuid[i] == 0 && memcmp(sim_gatt.uuid128[i] + 1, uuid + 1, ESP_UUID_LEN_128 - 1) == 0 &&
+            sim_gatt.uuid128[i][0] == uuid_id)
+            return i;
+    }
+    return -1;
+}
+
+
+static void sim_gatt_server_event(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t *param)
+{
+    if(sim_gatt.gatts_cb != NULL)
+        sim_gatt.gatts_cb(event, SIM_GATT_IF, param);
+}
+
+
+static void sim_gatt_client_write(int attr, const uint8_t *value, uint16_t len) //write request of phone, value kept by stack (auto response)
+{
+    esp_ble_gatts_cb_param_t param;
+
+    if(attr < 0)
+        return;
+    if(len <= sim_gatt.max_lengths[attr] && len <= SIM_GATT_VALUE_MAX)
+    {
+        memcpy(sim_gatt.values[attr], value, len);
+        sim_gatt.lengths[attr] = len;
+    }
+    memset(&param, 0, sizeof(param));
+    param.write.conn_id = SIM_GATT_CONN_ID;
+    param.write.handle = sim_gatt.handles[attr];
+    param.write.need_rsp = true;
+    param.write.len = len;
+    param.write.value = (uint8_t*)value;
+    sim_gatt_server_event(ESP_GATTS_WRITE_EVT, &param);
+}
+
+
+static void sim_gatt_client_connect(void *arg) //phone heard connectable adv of device with service
+{
+    esp_ble_gatts_cb_param_t param;
+
+    if(sim_gatt.connected || sim_gatt.phase != SIM_GATT_IDLE)
+        return;
+    if(!sim_ble_connectable() || !sim_gatt.started)
+    {
+        if(++sim_gatt.retries < SIM_GATT_RETRIES)
+            sim_event_after(SIM_GATT_RETRY_US, sim_gatt_client_connect, NULL, &sim_gatt.phase);
+        else
+            ESP_LOGE(TAG, "Device is not connectable, download given up");
+        return;
+    }
+
+    if(sim_gatt.stats.connects == 0)
+        sim_gatt.stats.start_time = sim_now() + SIM_GATT_CONNECT_US;
+    ++sim_gatt.stats.connects;
+    sim_ble_connected();
+    sim_gatt.connected = true;
+    sim_gatt.mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+    sim_gatt.interval = SIM_GATT_INTERVAL_INIT;
+    sim_gatt.ll_len = SIM_GATT_LL_LEN_DEFAULT;
+    sim_gatt.phase = SIM_GATT_DISCOVERY;
+    sim_gatt.discovery_events = 0;
+
+    memset(&param, 0, sizeof(param));
+    param.connect.conn_id = SIM_GATT_CONN_ID;
+    param.connect.remote_bda[0] = 0x5A;
+    sim_event_after(SIM_GATT_CONNECT_US, sim_gatt_conn_event, NULL, &sim_gatt.connected);
+    sim_gatt_server_event(ESP_GATTS_CONNECT_EVT, &param);
+}
+
+
+static void sim_gatt_client_disconnect(esp_gatt_conn_reason_t reason) //terminate by phone or server
+{
+    esp_ble_gatts_cb_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    param.disconnect.conn_id = SIM_GATT_CONN_ID;
+    param.disconnect.reason = reason;
+    sim_gatt_link_lost();
+    sim_gatt_server_event(ESP_GATTS_DISCONNECT_EVT, &param);
+}
+
+
+static void sim_gatt_disconnect_event(void *arg)
+{
+    sim_gatt_client_disconnect((esp_gatt_conn_reason_t)(uintptr_t)arg);
+}
+
+
+static void sim_gatt_client_receive(const uint8_t *data, uint16_t len) //notification of history data
+{
+    ble_adv_history_head_t head;
+    const uint8_t *payload = data + sizeof(head);
+    uint8_t size = payload_measurement_schema.size;
+
+    ++sim_gatt.stats.notifications;
+    sim_gatt.stats.bytes += len;
+    if(sim_gatt.phase != SIM_GATT_STREAM || len < sizeof(head))
+    {
+        ++sim_gatt.stats.bad;
+        return;
+    }
+    memcpy(&head, data, sizeof(head));
+    uint32_t cycle = head.cycle;
+    uint8_t count = head.count;
+
+    if(count == 0) // end of stream, cycle is resume index
+    {
+        sim_gatt.next_cycle = cycle;
+        sim_gatt.stats.stream_us += sim_now() - sim_gatt.stream_start;
+        sim_gatt.stats.total_us = sim_now() - sim_gatt.stats.start_time;
+        sim_gatt.stats.done = true;
+        sim_gatt.phase = SIM_GATT_DONE;
+        sim_event_after(SIM_GATT_STACK_US, sim_gatt_disconnect_event, (void*)ESP_GATT_CONN_TERMINATE_PEER_USER, &sim_gatt);
+        return;
+    }
+
+    if(len != sizeof(head) + count * size)
+        ++sim_gatt.stats.bad;
+    if(cycle < sim_gatt.next_cycle)
+        sim_gatt.stats.out_of_order += count;
+    else
+        sim_gatt.stats.skipped += cycle - sim_gatt.next_cycle;
+    for(uint8_t i=0; i<count && sizeof(head) + (i + 1) * size <= len; ++i)
+    {
+        if(PAYLOAD_MEASUREMENT_TYPE(payload + i * size) != 0)
+            ++sim_gatt.stats.bad;
+    }
+    sim_gatt.stats.records += count;
+    sim_gatt.next_cycle = cycle + count;
+
+    // link loss in the middle of download, phone resumes from next cycle
+    if(!sim_gatt.resumed && sim_gatt.stats.records >= sim_gatt.stats.expected / 2)
+    {
+        sim_gatt.resumed = true;
+        sim_gatt.stats.resume_cycle = sim_gatt.next_cycle;
+        sim_event_after(0, sim_gatt_disconnect_event, (void*)ESP_GATT_CONN_TERMINATE_PEER_USER, &sim_gatt);
+    }
+}
+
+
+static void sim_gatt_client_step(void) //one ATT procedure of phone per connection event
+{
+    esp_ble_gatts_cb_param_t param;
+    int attr;
+
+    switch(sim_gatt.phase)
+    {
+    case SIM_GATT_DISCOVERY:
+        if(++sim_gatt.discovery_events >= SIM_GATT_DISCOVERY_EVENTS)
+            sim_gatt.phase = SIM_GATT_MTU;
+        break;
+    case SIM_GATT_MTU:
+        sim_gatt.mtu = sim_gatt.client_mtu < sim_gatt.local_mtu ? sim_gatt.client_mtu : sim_gatt.local_mtu;
+        sim_gatt.stats.mtu = sim_gatt.mtu;
+        memset(&param, 0, sizeof(param));
+        param.mtu.conn_id = SIM_GATT_CONN_ID;
+        param.mtu.mtu = sim_gatt.mtu;
+        sim_gatt.phase = SIM_GATT_READ_INFO;
+        sim_gatt_server_event(ESP_GATTS_MTU_EVT, &param);
+        break;
+    case SIM_GATT_READ_INFO:
+        attr = sim_gatt_find(BLE_ADV_HISTORY_UUID_INFO);
+        if(attr >= 0 && sim_gatt.lengths[attr] == sizeof(ble_adv_history_info_t) && sim_gatt.stats.connects == 1)
+        {
+            ble_adv_history_info_t info;
+            memcpy(&info, sim_gatt.values[attr], sizeof(info));
+            sim_gatt.stats.expected = info.next_cycle - info.first_cycle;
+            sim_gatt.next_cycle = info.first_cycle;
+        }
+        sim_gatt.phase = SIM_GATT_ENABLE;
+        break;
+    case SIM_GATT_ENABLE: // CCCD follows value of data characteristic
+    {
+        const uint8_t notify[2] = {0x01, 0x00};
+        attr = sim_gatt_find(BLE_ADV_HISTORY_UUID_DATA);
+        sim_gatt.phase = SIM_GATT_REQUEST;
+        if(attr >= 0 && attr + 1 < sim_gatt.attrs_num && sim_gatt.uuid[attr + 1] == ESP_GATT_UUID_CHAR_CLIENT_CONFIG)
+            sim_gatt_client_write(attr + 1, notify, sizeof(notify));
+        break;
+    }
+    case SIM_GATT_REQUEST: // from resume index to the newest record
+    {
+        const ble_adv_history_request_t request = { .cycle = sim_gatt.next_cycle, .count = 0 };
+        sim_gatt.phase = SIM_GATT_STREAM;
+        sim_gatt.stream_start = sim_now();
+        sim_gatt_client_write(sim_gatt_find(BLE_ADV_HISTORY_UUID_CONTROL), (const uint8_t*)&request, sizeof(request));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+
+static void sim_gatt_conn_event(void *arg) //connection event - phone procedure, then notifications of server
+{
+    esp_ble_gatts_cb_param_t param;
+    int64_t budget = (int64_t)sim_gatt.interval * SIM_GATT_INTERVAL_UNIT_US - SIM_GATT_EVENT_MARGIN_US;
+    int64_t pdu_us = ((int64_t)sim_gatt.ll_len) * 8 + SIM_GATT_PDU_OVERHEAD_US;
+    uint8_t pdus = 0;
+
+    if(!sim_gatt.connected)
+        return;
+    ++sim_gatt.stats.conn_events;
+
+    if(sim_gatt.pending_interval != 0 && ++sim_gatt.update_events >= SIM_GATT_UPDATE_EVENTS) // instant
+    {
+        esp_ble_gap_cb_param_t gap_param;
+        memset(&gap_param, 0, sizeof(gap_param));
+        sim_gatt.interval = sim_gatt.pending_interval;
+        sim_gatt.pending_interval = 0;
+        gap_param.update_conn_params.status = ESP_BT_STATUS_SUCCESS;
+        gap_param.update_conn_params.conn_int = sim_gatt.interval;
+        sim_ble_gap_event(ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT, &gap_param);
+    }
+    if(sim_gatt.pending_ll_len != 0) // LL_LENGTH_REQ / RSP, phone supports DLE
+    {
+        esp_ble_gap_cb_param_t gap_param;
+        memset(&gap_param, 0, sizeof(gap_param));
+        sim_gatt.ll_len = sim_gatt.pending_ll_len;
+        sim_gatt.pending_ll_len = 0;
+        pdu_us = ((int64_t)sim_gatt.ll_len) * 8 + SIM_GATT_PDU_OVERHEAD_US;
+        gap_param.pkt_data_lenth_cmpl.status = ESP_BT_STATUS_SUCCESS;
+        gap_param.pkt_data_lenth_cmpl.params.rx_len = sim_gatt.ll_len;
+        gap_param.pkt_data_lenth_cmpl.params.tx_len = sim_gatt.ll_len;
+        sim_ble_gap_event(ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT, &gap_param);
+    }
+    sim_gatt.stats.interval_us = sim_gatt.interval * SIM_GATT_INTERVAL_UNIT_US;
+    sim_gatt.stats.ll_len = sim_gatt.ll_len;
+
+    sim_gatt_client_step();
+    if(!sim_gatt.connected)
+        return;
+
+    // L2CAP fragments of notifications in order, notification is delivered with its last fragment
+    while(sim_gatt.txq_num > 0 && pdus < SIM_GATT_PDUS_PER_EVENT && budget >= pdu_us)
+    {
+        sim_gatt_packet_t *packet = &sim_gatt.txq[sim_gatt.txq_head];
+        uint8_t fragments = (packet->len + 3 + 4 + sim_gatt.ll_len - 1) / sim_gatt.ll_len; // ATT and L2CAP headers
+
+        ++pdus;
+        budget -= pdu_us;
+        if(++sim_gatt.txq_pdus_sent < fragments)
+            continue;
+        sim_gatt.txq_pdus_sent = 0;
+        sim_gatt.txq_head = (sim_gatt.txq_head + 1) % SIM_GATT_TXQ_SIZE;
+        --sim_gatt.txq_num;
+        sim_gatt_client_receive(packet->data, packet->len);
+        if(!sim_gatt.connected)
+            return;
+    }
+    sim_gatt.stats.pdus += pdus;
+
+    if(sim_gatt.congested && sim_gatt.txq_num <= SIM_GATT_TXQ_UNCONGEST)
+    {
+        sim_gatt.congested = false;
+        memset(&param, 0, sizeof(param));
+        param.congest.conn_id = SIM_GATT_CONN_ID;
+        param.congest.congested = false;
+        sim_gatt_server_event(ESP_GATTS_CONGEST_EVT, &param);
+    }
+    sim_event_after((int64_t)sim_gatt.interval * SIM_GATT_INTERVAL_UNIT_US, sim_gatt_conn_event, NULL, &sim_gatt.connected);
+}
+
+
+static void sim_gatt_registered(void *arg)
+{
+    esp_ble_gatts_cb_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    param.reg.status = ESP_GATT_OK;
+    param.reg.app_id = (uint16_t)(uintptr_t)arg;
+    sim_gatt_server_event(ESP_GATTS_REG_EVT, &param);
+}
+
+
+static void sim_gatt_table_created(void *arg)
+{
+    esp_ble_gatts_cb_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    param.add_attr_tab.status = ESP_GATT_OK;
+    param.add_attr_tab.num_handle = sim_gatt.attrs_num;
+    param.add_attr_tab.handles = sim_gatt.handles;
+    sim_gatt_server_event(ESP_GATTS_CREAT_ATTR_TAB_EVT, &param);
+}
+
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback)
+{
+    sim_gatt.gatts_cb = callback;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gatts_app_register(uint16_t app_id)
+{
+    if(sim_gatt.registered)
+        return ESP_ERR_INVALID_STATE;
+    sim_gatt.registered = true;
+    sim_event_after(SIM_GATT_STACK_US, sim_gatt_registered, (void*)(uintptr_t)app_id, &sim_gatt);
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu)
+{
+    if(mtu < ESP_GATT_DEF_BLE_MTU_SIZE || mtu > ESP_GATT_MAX_MTU_SIZE)
+        return ESP_ERR_INVALID_ARG;
+    sim_gatt.local_mtu = mtu;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t *gatts_attr_db, esp_gatt_if_t gatts_if, uint8_t max_nb_attr, uint8_t srvc_inst_id) //handles from SIM_GATT_HANDLE_FIRST in order of table
+{
+    if(gatts_if != SIM_GATT_IF || max_nb_attr > SIM_GATT_ATTR_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    sim_gatt.attrs_num = max_nb_attr;
+    for(uint8_t i=0; i<max_nb_attr; ++i)
+    {
+        const esp_attr_desc_t *desc = &gatts_attr_db[i].att_desc;
+        sim_gatt.handles[i] = SIM_GATT_HANDLE_FIRST + i;
+        sim_gatt.uuid[i] = desc->uuid_length == ESP_UUID_LEN_16 ? desc->uuid_p[0] | (desc->uuid_p[1] << 8) : 0;
+        memset(sim_gatt.uuid128[i], 0, ESP_UUID_LEN_128);
+        if(desc->uuid_length == ESP_UUID_LEN_128)
+            memcpy(sim_gatt.uuid128[i], desc->uuid_p, ESP_UUID_LEN_128);
+        sim_gatt.max_lengths[i] = desc->max_length;
+        sim_gatt.lengths[i] = desc->length <= SIM_GATT_VALUE_MAX ? desc->length : 0;
+        if(desc->value != NULL && sim_gatt.lengths[i] > 0)
+            memcpy(sim_gatt.values[i], desc->value, sim_gatt.lengths[i]);
+    }
+    sim_event_after(SIM_GATT_STACK_US, sim_gatt_table_created, NULL, &sim_gatt);
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle)
+{
+    int attr = sim_gatt_attr(service_handle);
+
+    if(attr < 0 || sim_gatt.uuid[attr] != ESP_GATT_UUID_PRI_SERVICE)
+        return ESP_ERR_INVALID_ARG;
+    sim_gatt.started = true;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gatts_set_attr_value(uint16_t attr_handle, uint16_t length, const uint8_t *value)
+{
+    int attr = sim_gatt_attr(attr_handle);
+
+    if(attr < 0 || length > sim_gatt.max_lengths[attr] || length > SIM_GATT_VALUE_MAX)
+        return ESP_ERR_INVALID_ARG;
+    memcpy(sim_gatt.values[attr], value, length);
+    sim_gatt.lengths[attr] = length;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle, uint16_t value_len, uint8_t *value, bool need_confirm) //notification is copied to TX queue of stack
+{
+    if(gatts_if != SIM_GATT_IF || conn_id != SIM_GATT_CONN_ID || !sim_gatt.connected || sim_gatt_attr(attr_handle) < 0)
+        return ESP_FAIL;
+
+    if(value_len > sim_gatt.mtu - 3) // Bluedroid truncates to ATT_MTU
+    {
+        ++sim_gatt.stats.truncated;
+        value_len = sim_gatt.mtu - 3;
+    }
+    if(sim_gatt.txq_num >= SIM_GATT_TXQ_SIZE)
+    {
+        ++sim_gatt.stats.dropped;
+        return ESP_OK;
+    }
+
+    sim_gatt_packet_t *packet = &sim_gatt.txq[(sim_gatt.txq_head + sim_gatt.txq_num) % SIM_GATT_TXQ_SIZE];
+    packet->len = value_len;
+    memcpy(packet->data, value, value_len);
+    // BTC task has higher priority than application - event comes before caller sends next notification
+    if(++sim_gatt.txq_num >= SIM_GATT_TXQ_CONGEST && !sim_gatt.congested)
+    {
+        esp_ble_gatts_cb_param_t param;
+        sim_gatt.congested = true;
+        ++sim_gatt.stats.congestions;
+        memset(&param, 0, sizeof(param));
+        param.congest.conn_id = SIM_GATT_CONN_ID;
+        param.congest.congested = true;
+        sim_gatt_server_event(ESP_GATTS_CONGEST_EVT, &param);
+    }
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params) //phone chooses interval in range, not below own limit
+{
+    if(!sim_gatt.connected || params->min_int < 6 || params->min_int > params->max_int)
+        return ESP_ERR_INVALID_ARG;
+
+    sim_gatt.pending_interval = params->min_int > SIM_GATT_INTERVAL_MIN ? params->min_int :
+        params->max_int < SIM_GATT_INTERVAL_MIN ? params->max_int : SIM_GATT_INTERVAL_MIN;
+    sim_gatt.update_events = 0;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gap_set_pkt_data_len(esp_bd_addr_t remote_device, uint16_t tx_data_length)
+{
+    if(!sim_gatt.connected)
+        return ESP_ERR_INVALID_STATE;
+    sim_gatt.pending_ll_len = tx_data_length < SIM_GATT_LL_LEN_MAX ? tx_data_length : SIM_GATT_LL_LEN_MAX;
+    if(sim_gatt.pending_ll_len < SIM_GATT_LL_LEN_DEFAULT)
+        sim_gatt.pending_ll_len = SIM_GATT_LL_LEN_DEFAULT;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t remote_device)
+{
+    if(!sim_gatt.connected)
+        return ESP_ERR_INVALID_STATE;
+    sim_event_after(SIM_GATT_STACK_US, sim_gatt_disconnect_event, (void*)ESP_GATT_CONN_TERMINATE_LOCAL_HOST, &sim_gatt);
+    return ESP_OK;
+}
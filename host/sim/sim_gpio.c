@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// GPIO driver - pins are shared by firmware (driver API) and models (sim_gpio_watch, sim_gpio_drive).
+#include "sim.h"
+#include "driver/gpio.h"
+
+typedef struct {
+    gpio_mode_t mode;
+    int level;              // output register
+    int line;               // level driven by model
+    gpio_int_type_t intr_type;
+    bool intr_enabled;
+    gpio_isr_t isr;
+    void *isr_arg;
+    bool hold;
+    sim_gpio_watch_t watch;
+    void *watch_arg;
+} sim_gpio_t;
+
+static sim_gpio_t sim_gpio[GPIO_NUM_MAX];
+static bool sim_gpio_isr_service = false;
+static bool sim_gpio_deep_sleep_hold = false;
+
+
+
+static bool sim_gpio_valid(gpio_num_t pin)
+{
+    return pin >= 0 && pin < GPIO_NUM_MAX;
+}
+
+
+int sim_gpio_driven_level(gpio_num_t pin) //-1 - ESP doesn't drive line
+{
+    if(!sim_gpio_valid(pin))
+        return -1;
+    if(sim_gpio[pin].mode & GPIO_MODE_OUTPUT)
+        return sim_gpio[pin].level;
+    return -1;
+}
+
+
+static void sim_gpio_notify(gpio_num_t pin)
+{
+    if(sim_gpio[pin].watch != NULL)
+        sim_gpio[pin].watch(pin, sim_gpio_driven_level(pin), sim_gpio[pin].watch_arg);
+}
+
+
+void sim_gpio_watch(gpio_num_t pin, sim_gpio_watch_t cb, void *arg)
+{
+    if(!sim_gpio_valid(pin))
+        return;
+    sim_gpio[pin].watch = cb;
+    sim_gpio[pin].watch_arg = arg;
+    sim_gpio[pin].line = 1;
+}
+
+
+void sim_gpio_drive(gpio_num_t pin, int level) //edge from model, ISR is called like from interrupt
+{
+    if(!sim_gpio_valid(pin))
+        return;
+
+    sim_gpio_t *gpio = &sim_gpio[pin];
+    int previous = gpio->line;
+    gpio->line = level;
+
+    if(!(gpio->mode & GPIO_MODE_INPUT) || !gpio->intr_enabled || gpio->isr == NULL || !sim_gpio_isr_service)
+        return;
+
+    bool fire = false;
+    switch(gpio->intr_type)
+    {
+    case GPIO_INTR_POSEDGE:     fire = !previous && level;  break;
+    case GPIO_INTR_NEGEDGE:     fire = previous && !level;  break;
+    case GPIO_INTR_ANYEDGE:     fire = previous != level;   break;
+    case GPIO_INTR_LOW_LEVEL:   fire = !level;              break;
+    case GPIO_INTR_HIGH_LEVEL:  fire = level;               break;
+    default:                    break;
+    }
+    if(fire)
+        gpio->isr(gpio->isr_arg);
+}
+
+
+void sim_gpio_reset(void) //deep sleep - pins are floating except held pins
+{
+    for(gpio_num_t pin=0; pin<GPIO_NUM_MAX; ++pin)
+    {
+        sim_gpio_t *gpio = &sim_gpio[pin];
+        gpio->intr_enabled = false;
+        gpio->intr_type = GPIO_INTR_DISABLE;
+        gpio->isr = NULL;
+        if(gpio->hold && sim_gpio_deep_sleep_hold)
+            continue;
+        gpio->mode = GPIO_MODE_DISABLE;
+        gpio->hold = false;
+        sim_gpio_notify(pin);
+    }
+    sim_gpio_isr_service = false;
+    sim_gpio_deep_sleep_hold = false;
+}
+
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+
+    sim_gpio[gpio_num].intr_enabled = false;
+    sim_gpio[gpio_num].intr_type = GPIO_INTR_DISABLE;
+    return gpio_set_direction(gpio_num, GPIO_MODE_INPUT);
+}
+
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+    if(sim_gpio[gpio_num].hold)
+        return ESP_OK;
+
+    sim_gpio[gpio_num].mode = mode;
+    sim_gpio_notify(gpio_num);
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+    if(sim_gpio[gpio_num].hold)
+        return ESP_OK;
+
+    sim_gpio[gpio_num].level = level ? 1 : 0;
+    sim_gpio_notify(gpio_num);
+    return ESP_OK;
+}
+
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return 0;
+    return sim_gpio_driven_level(gpio_num) >= 0 ? sim_gpio[gpio_num].level : sim_gpio[gpio_num].line;
+}
+
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+
+    sim_gpio[gpio_num].intr_type = intr_type;
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+
+    sim_gpio[gpio_num].intr_enabled = true;
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+
+    sim_gpio[gpio_num].intr_enabled = false;
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    if(sim_gpio_isr_service)
+        return ESP_ERR_INVALID_STATE;
+
+    sim_gpio_isr_service = true;
+    return ESP_OK;
+}
+
+
+void gpio_uninstall_isr_service(void)
+{
+    sim_gpio_isr_service = false;
+}
+
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+    if(!sim_gpio_isr_service)
+        return ESP_ERR_INVALID_STATE;
+
+    sim_gpio[gpio_num].isr = isr_handler;
+    sim_gpio[gpio_num].isr_arg = args;
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+
+    sim_gpio[gpio_num].isr = NULL;
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_hold_en(gpio_num_t gpio_num)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+
+    sim_gpio[gpio_num].hold = true;
+    return ESP_OK;
+}
+
+
+esp_err_t gpio_hold_dis(gpio_num_t gpio_num)
+{
+    if(!sim_gpio_valid(gpio_num))
+        return ESP_ERR_INVALID_ARG;
+
+    sim_gpio[gpio_num].hold = false;
+    return ESP_OK;
+}
+
+
+void gpio_deep_sleep_hold_en(void)
+{
+    sim_gpio_deep_sleep_hold = true;
+}
+
+
+void gpio_deep_sleep_hold_dis(void)
+{
+    sim_gpio_deep_sleep_hold = false;
+}
@@ -0,0 +1,602 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Virtual clock, timed events and cooperative scheduler of firmware tasks.
+// Clock jumps to the nearest event or timeout when no task is ready, so idle time costs nothing.
+// Tasks are switched only in blocking calls or when a woken task has higher priority (like preemption).
+// Firmware is a shared module loaded at every boot - deep sleep resets all its statics except RTC_DATA_ATTR.
+// Deep sleep firmware built with LOW_POWER_STATE_CHECK exports low_power_state_crc, its state is compared before sleep
+// and after boot (first idle after app_main returned - tasks created by app_main have restored or reset their state).
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <ucontext.h>
+#include "sim.h"
+#include "esp_system.h"
+
+#define SIM_RTC_SIZE_MAX    (8*1024) // RTC slow memory of ESP32
+
+typedef struct {
+    int64_t time;
+    uint64_t seq;           // FIFO order of events with the same time
+    sim_event_cb_t cb;      // NULL - cancelled
+    void *arg;
+    const void *owner;
+} sim_event_t;
+
+typedef struct sim_object {
+    struct sim_object *next;
+    struct sim_object *prev;
+    max_align_t data[];
+} sim_object_t;
+
+typedef void (*sim_app_main_t)(void);
+typedef void (*sim_rtc_region_t)(uint8_t **start, size_t *size);
+typedef uint16_t (*sim_state_crc_t)(void);
+
+static int64_t sim_time = 0;
+static uint64_t sim_event_seq = 0;
+static sim_event_t *sim_events = NULL; // binary heap
+static size_t sim_events_num = 0;
+static size_t sim_events_size = 0;
+
+static ucontext_t sim_scheduler_context;
+static struct sim_task *sim_tasks = NULL;
+static struct sim_task *sim_current = NULL;
+static uint64_t sim_ready_seq = 0;
+static uint64_t sim_switches = 0;
+static sim_object_t sim_objects = {&sim_objects, &sim_objects};
+
+static const char *sim_firmware_path = NULL;
+static void *sim_firmware = NULL;
+static sim_app_main_t sim_app_main = NULL;
+static uint8_t sim_rtc_memory[SIM_RTC_SIZE_MAX];
+static size_t sim_rtc_size = 0;
+static int64_t sim_boot = 0;
+static int sim_reason = ESP_RST_POWERON;
+static uint32_t sim_boots = 0;
+static bool sim_sleep_pending = false;
+static int64_t sim_wake_time = 0;
+static bool sim_sleep_crc_valid = false;
+static bool sim_state_check_pending = false;
+static uint16_t sim_sleep_crc = 0;         // state of firmware when it went to deep sleep
+static uint32_t sim_state_checks = 0;
+static uint32_t sim_state_mismatches = 0;
+
+static void sim_boot_event(void *arg);
+
+
+
+int64_t sim_now(void)
+{
+    return sim_time;
+}
+
+
+void sim_advance(int64_t us) //busy wait, events which are due meanwhile fire at next switch
+{
+    if(us > 0)
+        sim_time += us;
+}
+
+
+static bool sim_event_before(const sim_event_t *a, const sim_event_t *b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+
+void sim_event_at(int64_t time_us, sim_event_cb_t cb, void *arg, const void *owner) //schedule callback, past time fires at next switch
+{
+    if(sim_events_num == sim_events_size)
+    {
+        sim_events_size = sim_events_size ? 2*sim_events_size : 256;
+        sim_events = realloc(sim_events, sim_events_size * sizeof(sim_event_t));
+        if(sim_events == NULL)
+        {
+            fprintf(stderr, "sim: out of memory for events\n");
+            exit(1);
+        }
+    }
+
+    size_t i = sim_events_num++;
+    sim_event_t event = {time_us, sim_event_seq++, cb, arg, owner};
+    while(i > 0 && sim_event_before(&event, &sim_events[(i-1)/2]))
+    {
+        sim_events[i] = sim_events[(i-1)/2];
+        i = (i-1)/2;
+    }
+    sim_events[i] = event;
+}
+
+
+void sim_event_after(int64_t delay_us, sim_event_cb_t cb, void *arg, const void *owner)
+{
+    sim_event_at(sim_time + delay_us, cb, arg, owner);
+}
+
+
+void sim_event_cancel(const void *owner) //events stay in heap, callback is cleared
+{
+    for(size_t i=0; i<sim_events_num; ++i)
+    {
+        if(sim_events[i].owner == owner)
+            sim_events[i].cb = NULL;
+    }
+}
+
+
+static sim_event_t sim_event_pop(void)
+{
+    sim_event_t top = sim_events[0];
+    sim_event_t last = sim_events[--sim_events_num];
+    size_t i = 0;
+
+    while(1)
+    {
+        size_t child = 2*i + 1;
+        if(child >= sim_events_num)
+            break;
+        if(child + 1 < sim_events_num && sim_event_before(&sim_events[child+1], &sim_events[child]))
+            ++child;
+        if(!sim_event_before(&sim_events[child], &last))
+            break;
+        sim_events[i] = sim_events[child];
+        i = child;
+    }
+    if(sim_events_num > 0)
+        sim_events[i] = last;
+    return top;
+}
+
+
+uint32_t sim_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+
+int32_t sim_rand_range(uint32_t *state, int32_t min, int32_t max)
+{
+    return min + (int32_t)(sim_rand(state) % (uint32_t)(max - min + 1));
+}
+
+
+double sim_rand_normal(uint32_t *state) //Box-Muller
+{
+    double u1 = (sim_rand(state) + 1.0) / 4294967297.0;
+    double u2 = sim_rand(state) / 4294967296.0;
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+void *sim_object_alloc(size_t size)
+{
+    sim_object_t *obj = calloc(1, sizeof(sim_object_t) + size);
+    if(obj == NULL)
+        return NULL;
+
+    obj->next = sim_objects.next;
+    obj->prev = &sim_objects;
+    sim_objects.next->prev = obj;
+    sim_objects.next = obj;
+    return obj->data;
+}
+
+
+void sim_object_free(void *data)
+{
+    if(data == NULL)
+        return;
+
+    sim_object_t *obj = (sim_object_t*)((uint8_t*)data - offsetof(sim_object_t, data));
+    obj->prev->next = obj->next;
+    obj->next->prev = obj->prev;
+    free(obj);
+}
+
+
+static void sim_task_entry(void) //first function on stack of task
+{
+    struct sim_task *task = sim_current;
+
+    task->function(task->parameter);
+    sim_task_delete(task); // IDF main task returns from app_main
+}
+
+
+struct sim_task *sim_task_create(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameter, UBaseType_t priority)
+{
+    struct sim_task *task = calloc(1, sizeof(struct sim_task));
+    ucontext_t *context = calloc(1, sizeof(ucontext_t));
+
+    if(task == NULL || context == NULL)
+    {
+        free(task);
+        free(context);
+        return NULL;
+    }
+
+    task->stack_size = stack_depth < SIM_TASK_STACK_MIN ? SIM_TASK_STACK_MIN : stack_depth;
+    task->stack = malloc(task->stack_size);
+    if(task->stack == NULL)
+    {
+        free(task);
+        free(context);
+        return NULL;
+    }
+    memset(task->stack, SIM_TASK_STACK_PAINT, task->stack_size); // for stack high water mark
+
+    snprintf(task->name, sizeof(task->name), "%s", name ? name : "");
+    task->priority = priority;
+    task->function = function;
+    task->parameter = parameter;
+    task->context = context;
+    task->state = SIM_TASK_READY;
+    task->ready_seq = ++sim_ready_seq;
+
+    getcontext(context);
+    context->uc_stack.ss_sp = task->stack;
+    context->uc_stack.ss_size = task->stack_size;
+    context->uc_link = &sim_scheduler_context;
+    makecontext(context, sim_task_entry, 0);
+
+    task->next = sim_tasks;
+    sim_tasks = task;
+    return task;
+}
+
+
+static void sim_task_switch_out(void) //save running task, continue scheduler
+{
+    struct sim_task *task = sim_current;
+    swapcontext((ucontext_t*)task->context, &sim_scheduler_context);
+}
+
+
+void sim_task_delete(struct sim_task *task) //stack is freed by scheduler, task can delete itself
+{
+    if(task == NULL)
+        task = sim_current;
+    if(task == NULL)
+        return;
+
+    task->state = SIM_TASK_DELETED;
+    if(task == sim_current)
+    {
+        sim_task_switch_out();
+        abort(); // deleted task is never resumed
+    }
+}
+
+
+struct sim_task *sim_task_current(void)
+{
+    return sim_current;
+}
+
+
+bool sim_task_block(const void *obj, int64_t deadline) //block running task until sim_task_wake(obj) or deadline
+{
+    struct sim_task *task = sim_current;
+
+    if(task == NULL)
+    {
+        fprintf(stderr, "sim: blocking call from ISR or event callback\n");
+        abort();
+    }
+    if(deadline <= sim_time)
+        return false;
+
+    task->state = SIM_TASK_BLOCKED;
+    task->wait_obj = obj;
+    task->wake_time = deadline;
+    task->timed_out = false;
+    sim_task_switch_out();
+    return !task->timed_out;
+}
+
+
+void sim_task_wake(const void *obj) //woken task with higher priority preempts running task
+{
+    bool preempt = false;
+
+    for(struct sim_task *task = sim_tasks; task != NULL; task = task->next)
+    {
+        if(task->state == SIM_TASK_BLOCKED && task->wait_obj == obj && obj != NULL)
+        {
+            task->state = SIM_TASK_READY;
+            task->ready_seq = ++sim_ready_seq;
+            if(sim_current != NULL && task->priority > sim_current->priority)
+                preempt = true;
+        }
+    }
+
+    if(preempt)
+        sim_task_switch_out(); // running task stays ready
+}
+
+
+int64_t sim_ticks_deadline(TickType_t ticks) //FreeRTOS wakes tasks at tick interrupt
+{
+    if(ticks == portMAX_DELAY)
+        return SIM_TIME_NEVER;
+
+    int64_t tick = (sim_time - sim_boot) / SIM_US_PER_TICK;
+    return sim_boot + (tick + ticks) * SIM_US_PER_TICK;
+}
+
+
+uint64_t sim_context_switches(void)
+{
+    return sim_switches;
+}
+
+
+static void sim_fire_due(void) //events and timeouts which are due at current time
+{
+    while(sim_events_num > 0 && sim_events[0].time <= sim_time)
+    {
+        sim_event_t event = sim_event_pop();
+        if(event.cb != NULL)
+            event.cb(event.arg);
+    }
+
+    for(struct sim_task *task = sim_tasks; task != NULL; task = task->next)
+    {
+        if(task->state == SIM_TASK_BLOCKED && task->wake_time <= sim_time)
+        {
+            task->state = SIM_TASK_READY;
+            task->timed_out = true;
+            task->ready_seq = ++sim_ready_seq;
+        }
+    }
+}
+
+
+static struct sim_task *sim_pick(void) //highest priority, FIFO inside priority
+{
+    struct sim_task *best = NULL;
+
+    for(struct sim_task *task = sim_tasks; task != NULL; task = task->next)
+    {
+        if(task->state != SIM_TASK_READY)
+            continue;
+        if(best == NULL || task->priority > best->priority ||
+            (task->priority == best->priority && task->ready_seq < best->ready_seq))
+            best = task;
+    }
+    return best;
+}
+
+
+static int64_t sim_next_time(void)
+{
+    int64_t next = sim_events_num > 0 ? sim_events[0].time : SIM_TIME_NEVER;
+
+    for(struct sim_task *task = sim_tasks; task != NULL; task = task->next)
+    {
+        if(task->state == SIM_TASK_BLOCKED && task->wake_time < next)
+            next = task->wake_time;
+    }
+    return next;
+}
+
+
+static void sim_sweep_tasks(void) //free deleted tasks, scheduler runs on its own stack
+{
+    struct sim_task **link = &sim_tasks;
+
+    while(*link != NULL)
+    {
+        struct sim_task *task = *link;
+        if(task->state == SIM_TASK_DELETED)
+        {
+            *link = task->next;
+            free(task->stack);
+            free(task->context);
+            free(task);
+        }
+        else
+        {
+            link = &(task->next);
+        }
+    }
+}
+
+
+void sim_firmware_set_path(const char *path)
+{
+    sim_firmware_path = path;
+}
+
+
+static void sim_firmware_load(void) //fresh copy of firmware statics, RTC memory is restored after deep sleep
+{
+    sim_rtc_region_t rtc_region;
+    uint8_t *rtc_start = NULL;
+    size_t rtc_size = 0;
+
+    sim_firmware = dlopen(sim_firmware_path, RTLD_NOW | RTLD_LOCAL);
+    if(sim_firmware == NULL)
+    {
+        fprintf(stderr, "sim: can't load firmware: %s\n", dlerror());
+        exit(1);
+    }
+
+    sim_app_main = (sim_app_main_t)dlsym(sim_firmware, "app_main");
+    rtc_region = (sim_rtc_region_t)dlsym(sim_firmware, "sim_rtc_region");
+    if(sim_app_main == NULL || rtc_region == NULL)
+    {
+        fprintf(stderr, "sim: firmware without app_main or sim_rtc_region\n");
+        exit(1);
+    }
+
+    rtc_region(&rtc_start, &rtc_size);
+    if(rtc_size > SIM_RTC_SIZE_MAX)
+    {
+        fprintf(stderr, "sim: RTC_DATA_ATTR uses %zu bytes, max %d\n", rtc_size, SIM_RTC_SIZE_MAX);
+        exit(1);
+    }
+    if(sim_reason == ESP_RST_DEEPSLEEP && rtc_size == sim_rtc_size && rtc_size > 0)
+        memcpy(rtc_start, sim_rtc_memory, rtc_size);
+}
+
+
+static void sim_firmware_unload(void)
+{
+    sim_rtc_region_t rtc_region = (sim_rtc_region_t)dlsym(sim_firmware, "sim_rtc_region");
+    sim_state_crc_t state_crc = (sim_state_crc_t)dlsym(sim_firmware, "low_power_state_crc");
+    uint8_t *rtc_start = NULL;
+
+    sim_sleep_crc_valid = state_crc != NULL;
+    if(state_crc != NULL)
+        sim_sleep_crc = state_crc();
+
+    rtc_region(&rtc_start, &sim_rtc_size);
+    if(sim_rtc_size > 0)
+        memcpy(sim_rtc_memory, rtc_start, sim_rtc_size);
+
+    dlclose(sim_firmware);
+    sim_firmware = NULL;
+    sim_app_main = NULL;
+}
+
+
+static void sim_main_task(void *parameter) //IDF main task
+{
+    sim_app_main();
+    sim_state_check_pending = sim_reason == ESP_RST_DEEPSLEEP && sim_sleep_crc_valid;
+}
+
+
+static void sim_state_check(void) //state after wake up must be the same as before deep sleep
+{
+    sim_state_crc_t state_crc = (sim_state_crc_t)dlsym(sim_firmware, "low_power_state_crc");
+
+    sim_state_check_pending = false;
+    if(state_crc == NULL)
+        return;
+
+    uint16_t crc = state_crc();
+    ++sim_state_checks;
+    if(crc != sim_sleep_crc && sim_state_mismatches++ == 0)
+        fprintf(stderr, "sim: boot %u - state after deep sleep differs (crc %04x, before sleep %04x)\n",
+            sim_boots, crc, sim_sleep_crc);
+}
+
+
+static void sim_boot_event(void *arg)
+{
+    sim_firmware_load();
+    sim_boot = sim_time;
+    ++sim_boots;
+    sim_task_create(sim_main_task, "main", 3584, NULL, 1);
+}
+
+
+void sim_power_on(void)
+{
+    sim_reason = ESP_RST_POWERON;
+    sim_event_at(sim_time, sim_boot_event, NULL, NULL);
+}
+
+
+void sim_deep_sleep(int64_t sleep_us) //stop all tasks, power down is done by scheduler
+{
+    sim_sleep_pending = true;
+    sim_wake_time = sim_time + (sleep_us > 0 ? sleep_us : 0);
+    sim_task_delete(NULL);
+    abort();
+}
+
+
+static void sim_power_down(void) //deep sleep - CPU, peripherals and RAM are off
+{
+    for(struct sim_task *task = sim_tasks; task != NULL; task = task->next)
+        task->state = SIM_TASK_DELETED;
+    sim_sweep_tasks();
+
+    sim_uart_reset();
+    sim_gatt_reset();
+    sim_ble_reset();
+    sim_ledc_reset();
+    sim_gpio_reset();
+
+    while(sim_objects.next != &sim_objects)
+        sim_object_free(sim_objects.next->data);
+
+    sim_firmware_unload();
+    sim_reason = ESP_RST_DEEPSLEEP;
+    sim_sleep_pending = false;
+    sim_event_at(sim_wake_time, sim_boot_event, NULL, NULL);
+}
+
+
+int64_t sim_boot_time(void)
+{
+    return sim_boot;
+}
+
+
+int sim_reset_reason(void)
+{
+    return sim_reason;
+}
+
+
+uint32_t sim_boot_count(void)
+{
+    return sim_boots;
+}
+
+
+void sim_state_checks_get(uint32_t *checks, uint32_t *mismatches)
+{
+    *checks = sim_state_checks;
+    *mismatches = sim_state_mismatches;
+}
+
+
+void sim_run(int64_t end_time) //main loop of simulator
+{
+    while(1)
+    {
+        sim_fire_due();
+
+        struct sim_task *task = sim_pick();
+        if(task != NULL)
+        {
+            sim_current = task;
+            ++sim_switches;
+            swapcontext(&sim_scheduler_context, (ucontext_t*)task->context);
+            sim_current = NULL;
+
+            if(sim_sleep_pending)
+                sim_power_down();
+            sim_sweep_tasks();
+            continue;
+        }
+
+        if(sim_state_check_pending) // idle - firmware has booted
+            sim_state_check();
+
+        int64_t next = sim_next_time();
+        if(next > end_time)
+        {
+            if(sim_time < end_time)
+                sim_time = end_time;
+            return;
+        }
+        if(next > sim_time)
+            sim_time = next;
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// LEDC driver - duty of channels is kept for report, fade ends immediately.
+#include "sim.h"
+#include "driver/ledc.h"
+
+static uint32_t sim_ledc_duties[LEDC_CHANNEL_MAX];
+static uint32_t sim_ledc_changes_num = 0;
+static bool sim_ledc_fade = false;
+
+
+
+uint32_t sim_ledc_duty(int channel)
+{
+    return channel >= 0 && channel < LEDC_CHANNEL_MAX ? sim_ledc_duties[channel] : 0;
+}
+
+
+uint32_t sim_ledc_changes(void)
+{
+    return sim_ledc_changes_num;
+}
+
+
+void sim_ledc_reset(void) //power down - LED is off
+{
+    for(int i=0; i<LEDC_CHANNEL_MAX; ++i)
+        sim_ledc_duties[i] = 0;
+    sim_ledc_fade = false;
+}
+
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf)
+{
+    return timer_conf != NULL && timer_conf->timer_num < LEDC_TIMER_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf)
+{
+    if(ledc_conf == NULL || ledc_conf->channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    sim_ledc_duties[ledc_conf->channel] = ledc_conf->duty;
+    return ESP_OK;
+}
+
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags)
+{
+    if(sim_ledc_fade)
+        return ESP_ERR_INVALID_STATE;
+
+    sim_ledc_fade = true;
+    return ESP_OK;
+}
+
+
+esp_err_t ledc_set_fade_time_and_start(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t target_duty, uint32_t max_fade_time_ms, ledc_fade_mode_t fade_mode)
+{
+    if(channel >= LEDC_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+    if(!sim_ledc_fade)
+        return ESP_ERR_INVALID_STATE;
+
+    if(sim_ledc_duties[channel] != target_duty)
+        ++sim_ledc_changes_num;
+    sim_ledc_duties[channel] = target_duty;
+    return ESP_OK;
+}
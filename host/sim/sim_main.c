@@ -0,0 +1,573 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// myairscanner_sim - runs firmware image (src/ built for host) against models of sensors and air for days of
+// virtual time, adv frames caught by simulated scanner are decoded in batches by adv_decoder.
+// Sensor trace captured by firmware (SENSOR_TRACE) replaces models of air (--replay), results of drivers are checked
+// against trace when replayed firmware captures again.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+#include "esp_log.h"
+#include "adv_decoder.h"
+#include "pms.h"
+#include "dht.h"
+#include "sensor.h"
+#include "ble_adv.h"
+#include "diag.h"
+#include "payload.h"
+#include "sensor_trace.h"
+
+#define SIM_SCAN_STRIDE     32
+#define SIM_SCAN_CHUNK      4096    // frames decoded at once
+#define SIM_SCAN_TYPES      4       // live, avg, 1h, 24h
+#define SIM_SCAN_ID_OFFSET  1       // id in head of adv frame
+#define SIM_PMS_MAX         2       // --pms, second unit has SENSOR_PM2_xxx wiring
+
+typedef struct {
+    uint8_t frames[SIM_SCAN_CHUNK * SIM_SCAN_STRIDE];
+    int64_t times[SIM_SCAN_CHUNK];
+    size_t num;
+    uint64_t frames_total;
+    uint64_t frames_valid;
+    uint64_t frames_foreign;
+    uint64_t events[SIM_SCAN_TYPES];
+    uint64_t updates[SIM_SCAN_TYPES];   // sequence of frame differs from previous frame of the same type (new cycle)
+    uint64_t missed[SIM_SCAN_TYPES];    // cycles between updates never heard
+    uint8_t last_seq[SIM_SCAN_TYPES];
+    bool last_valid[SIM_SCAN_TYPES];
+    bool dataset_valid;
+    uint8_t dataset_seq;                    // cycle of live and avg data being collected
+    uint8_t dataset_mask;                   // bit of type seen with dataset_seq
+    int64_t dataset_start;                  // first frame of cycle
+    uint64_t dataset_num;                   // cycles with both live and avg data heard
+    int64_t dataset_sum;                    // us from first frame of cycle to both data
+    int64_t dataset_max;
+    uint64_t diag_events;
+    uint64_t instance_events[SENSOR_INSTANCES_MAX]; // instance frames (SENSOR_ADV_ID), type = instance
+    uint64_t relay_events;                  // relayed frames of neighbors (BLE_ADV_RELAY_ID)
+    uint64_t relay_updates;
+    uint8_t relay_last[ADV_DECODER_FRAME_LEN];
+    uint32_t boot_seen;                     // boot of last first frame
+    uint32_t boot_frames;                   // boots with at least one frame
+    int64_t boot_first_sum;                 // us from boot to first frame
+    int64_t boot_first_max;
+    int64_t power_on_first;                 // first boot, -1 - no frame yet
+    int32_t diag[PAYLOAD_DIAG_FIELDS_NUM];  // last diagnostics frame
+    int64_t diag_total[PAYLOAD_DIAG_FIELDS_NUM]; // counters - sum of deltas of frames modulo width of field
+    FILE *csv;
+    adv_decoder_path_t path;
+} sim_scan_t;
+
+static sim_scan_t sim_scan;
+
+static uint8_t sim_res_valid[SIM_SCAN_CHUNK];
+static uint16_t sim_res_device[SIM_SCAN_CHUNK];
+static uint8_t sim_res_seq[SIM_SCAN_CHUNK];
+static uint8_t sim_res_type[SIM_SCAN_CHUNK];
+static int16_t sim_res_temperature[SIM_SCAN_CHUNK];
+static uint16_t sim_res_humidity[SIM_SCAN_CHUNK];
+static uint16_t sim_res_pm[ADV_DECODER_PM_NUM][SIM_SCAN_CHUNK];
+static uint16_t sim_res_um[ADV_DECODER_UM_NUM][SIM_SCAN_CHUNK];
+static uint8_t sim_res_esp_temperature[SIM_SCAN_CHUNK];
+
+
+
+static void sim_scan_dataset(sim_scan_t *scan, uint8_t seq, uint8_t type, int64_t time) //latency of full dataset (live + avg) of new cycle
+{
+    if(!scan->dataset_valid || seq != scan->dataset_seq)
+    {
+        scan->dataset_valid = true;
+        scan->dataset_seq = seq;
+        scan->dataset_mask = 0;
+        scan->dataset_start = time;
+    }
+    if(scan->dataset_mask == 0x3)
+        return;
+
+    scan->dataset_mask |= 1 << type;
+    if(scan->dataset_mask == 0x3)
+    {
+        int64_t latency = time - scan->dataset_start;
+        ++scan->dataset_num;
+        scan->dataset_sum += latency;
+        if(latency > scan->dataset_max)
+            scan->dataset_max = latency;
+    }
+}
+
+
+static void sim_scan_flush(sim_scan_t *scan)
+{
+    adv_decoder_result_t res = {
+        .valid = sim_res_valid,
+        .device = sim_res_device,
+        .seq = sim_res_seq,
+        .type = sim_res_type,
+        .temperature = sim_res_temperature,
+        .humidity = sim_res_humidity,
+        .esp_temperature = sim_res_esp_temperature
+    };
+    for(int i=0; i<ADV_DECODER_PM_NUM; ++i)
+        res.pm[i] = sim_res_pm[i];
+    for(int i=0; i<ADV_DECODER_UM_NUM; ++i)
+        res.um[i] = sim_res_um[i];
+
+    scan->frames_valid += adv_decoder_decode(scan->frames, SIM_SCAN_STRIDE, scan->num, &res, scan->path);
+
+    for(size_t i=0; i<scan->num; ++i)
+    {
+        const uint8_t *frame = &scan->frames[i * SIM_SCAN_STRIDE];
+        uint8_t type = res.type[i];
+
+        if(!res.valid[i] && frame[SIM_SCAN_ID_OFFSET] == (DIAG_ADV_ID & 0xFF) && frame[SIM_SCAN_ID_OFFSET+1] == (DIAG_ADV_ID >> 8))
+        {
+            int32_t diag[PAYLOAD_DIAG_FIELDS_NUM];
+            payload_decode(&payload_diag_schema, frame + ADV_DECODER_HEAD_LEN, diag);
+            for(int f=0; f<PAYLOAD_DIAG_FIELDS_NUM; ++f)
+            {
+                if(PAYLOAD_DIAG_COUNTER(f))
+                    scan->diag_total[f] += scan->diag_events == 0 ? diag[f] :
+                        (diag[f] - scan->diag[f]) & ((1 << payload_diag_schema.fields[f].bits) - 1);
+                scan->diag[f] = diag[f];
+            }
+            ++scan->diag_events;
+            continue;
+        }
+        if(!res.valid[i] && frame[SIM_SCAN_ID_OFFSET] == (SENSOR_ADV_ID & 0xFF) && frame[SIM_SCAN_ID_OFFSET+1] == (SENSOR_ADV_ID >> 8))
+        {
+            int32_t values[PAYLOAD_MEASUREMENT_FIELDS_NUM];
+            payload_decode(&payload_measurement_schema, frame + ADV_DECODER_HEAD_LEN, values);
+            ++scan->instance_events[values[PAYLOAD_FIELD_TYPE] % SENSOR_INSTANCES_MAX];
+            continue;
+        }
+        if(!res.valid[i] && frame[SIM_SCAN_ID_OFFSET] == (BLE_ADV_RELAY_ID & 0xFF) && frame[SIM_SCAN_ID_OFFSET+1] == (BLE_ADV_RELAY_ID >> 8))
+        {
+            ++scan->relay_events;
+            if(memcmp(scan->relay_last, frame, ADV_DECODER_FRAME_LEN) != 0)
+                ++scan->relay_updates;
+            memcpy(scan->relay_last, frame, ADV_DECODER_FRAME_LEN);
+            continue;
+        }
+        if(!res.valid[i] || type >= SIM_SCAN_TYPES)
+        {
+            ++scan->frames_foreign;
+            continue;
+        }
+        ++scan->events[type];
+        if(type <= 1)
+            sim_scan_dataset(scan, res.seq[i], type, scan->times[i]);
+        // repeat of frame in rotation - the same cycle of device, or older cycle (scan response and adv data
+        // are set by two HCI commands, one adv event can carry both cycles) - serial number arithmetic
+        if(scan->last_valid[type] && (int8_t)(res.seq[i] - scan->last_seq[type]) <= 0)
+            continue;
+
+        if(scan->last_valid[type])
+            scan->missed[type] += (uint8_t)(res.seq[i] - scan->last_seq[type] - 1);
+        scan->last_seq[type] = res.seq[i];
+        scan->last_valid[type] = true;
+        ++scan->updates[type];
+        if(scan->csv != NULL)
+        {
+            fprintf(scan->csv, "%.3f,%u,%.1f,%.1f", scan->times[i] / 1e6, type,
+                res.temperature[i] / 10.0, res.humidity[i] / 10.0);
+            for(int j=0; j<ADV_DECODER_PM_NUM; ++j)
+                fprintf(scan->csv, ",%u", res.pm[j][i]);
+            for(int j=0; j<ADV_DECODER_UM_NUM; ++j)
+                fprintf(scan->csv, ",%u", res.um[j][i]);
+            fprintf(scan->csv, ",%u\n", res.esp_temperature[i]);
+        }
+    }
+    scan->num = 0;
+}
+
+
+static void sim_scan_frame(int64_t time, const uint8_t *data, uint8_t len, void *arg) //adv event seen by scanner
+{
+    sim_scan_t *scan = arg;
+    uint8_t *dst = &scan->frames[scan->num * SIM_SCAN_STRIDE];
+
+    ++scan->frames_total;
+    if(scan->boot_seen != sim_boot_count()) // time to first adv after every boot
+    {
+        int64_t first = time - sim_boot_time();
+
+        scan->boot_seen = sim_boot_count();
+        ++scan->boot_frames;
+        scan->boot_first_sum += first;
+        if(first > scan->boot_first_max)
+            scan->boot_first_max = first;
+        if(scan->boot_seen == 1)
+            scan->power_on_first = first;
+    }
+    memset(dst, 0, SIM_SCAN_STRIDE);
+    memcpy(dst, data, len < ADV_DECODER_FRAME_LEN ? len : ADV_DECODER_FRAME_LEN);
+    scan->times[scan->num++] = time;
+    if(scan->num == SIM_SCAN_CHUNK)
+        sim_scan_flush(scan);
+}
+
+
+static int sim_log_level(const char *arg)
+{
+    switch(arg[0])
+    {
+    case 'N': return ESP_LOG_NONE;
+    case 'E': return ESP_LOG_ERROR;
+    case 'W': return ESP_LOG_WARN;
+    case 'I': return ESP_LOG_INFO;
+    case 'D': return ESP_LOG_DEBUG;
+    case 'V': return ESP_LOG_VERBOSE;
+    default:  return -1;
+    }
+}
+
+
+static uint8_t *sim_read_file(const char *path, size_t *size) //whole file, NULL - fail
+{
+    FILE *file = fopen(path, "rb");
+    uint8_t *data = NULL;
+    long len;
+
+    if(file == NULL)
+        return NULL;
+    if(fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0)
+    {
+        data = malloc(len > 0 ? len : 1);
+        if(data != NULL && fread(data, 1, len, file) != (size_t)len)
+        {
+            free(data);
+            data = NULL;
+        }
+        *size = len;
+    }
+    fclose(file);
+    return data;
+}
+
+
+static bool sim_write_file(const char *path, const uint8_t *data, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    bool ok;
+
+    if(file == NULL)
+        return false;
+    ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+
+static void sim_print_trace(const char *name, const sim_trace_t *trace)
+{
+    sim_trace_stats_t st;
+
+    sim_trace_get_stats(trace, &st);
+    printf("%-16schunks %u (bad %u), boots %u, records %llu, pms commands %u, bytes %llu, frames %llu (bad %llu), dht reads %u (ok %u), dropped %llu\n",
+        name, st.chunks, st.bad_chunks, st.boots, (unsigned long long)st.records, st.pms_commands,
+        (unsigned long long)st.pms_bytes, (unsigned long long)st.pms_frames, (unsigned long long)st.pms_bad,
+        st.dht_reads, st.dht_ok, (unsigned long long)st.dropped);
+}
+
+
+static void sim_print_check(const sim_trace_check_t *check)
+{
+    printf("  check         pms results %llu, differ %llu, dht results %llu, differ %llu, unpaired %llu\n",
+        (unsigned long long)check->pms_frames, (unsigned long long)check->pms_diff,
+        (unsigned long long)check->dht_reads, (unsigned long long)check->dht_diff, (unsigned long long)check->unpaired);
+}
+
+
+static void sim_usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --days N          simulated days (default 1)\n"
+        "  --hours N         simulated hours, added to days\n"
+        "  --seed N          seed of environment and sensor models (default 1)\n"
+        "  --fault-rate X    probability of corrupted PMS frame / DHT transmission (default 0)\n"
+        "  --neighbors N     devices advertising around, heard in relay mode (BLE_ADV_RELAY, default 0)\n"
+        "  --pms N           number of PMS units, 2 - second on SENSOR_PM2 wiring (default 1)\n"
+        "  --log E|W|I|D|V   firmware log level (default W)\n"
+        "  --csv FILE        decoded frames, one line per new cycle on air\n"
+        "  --download H      phone downloads history at hour H (BLE_ADV_HISTORY)\n"
+        "  --mtu N           ATT_MTU requested by phone (default 517)\n"
+        "  --replay FILE     sensor trace (SENSOR_TRACE partition) played by PMS and DHT models instead of air\n"
+        "  --replay-fast N   with --replay - only decode trace N times by firmware parser and decoder, no simulation\n"
+        "  --trace-out FILE  trace partition at end of simulation (SENSOR_TRACE)\n"
+        "  --firmware PATH   firmware image (default %s)\n",
+        name, SIM_FIRMWARE_PATH);
+}
+
+
+int main(int argc, char **argv)
+{
+    double days = 0.0, hours = 0.0;
+    uint32_t seed = 1;
+    double fault_rate = 0.0;
+    int pms_num = 1;
+    uint32_t neighbors = 0;
+    const char *csv_path = NULL;
+    double download = -1.0;
+    int mtu = ESP_GATT_MAX_MTU_SIZE;
+    const char *firmware = SIM_FIRMWARE_PATH;
+    const char *replay_path = NULL;
+    const char *trace_out = NULL;
+    uint32_t replay_fast = 0;
+    sim_trace_t *replay = NULL;
+
+    for(int i=1; i<argc; ++i)
+    {
+        const char *opt = argv[i];
+        const char *val = (i+1 < argc) ? argv[i+1] : NULL;
+
+        if(val == NULL)
+        {
+            sim_usage(argv[0]);
+            return 1;
+        }
+        if(strcmp(opt, "--days") == 0)
+            days = atof(val);
+        else if(strcmp(opt, "--hours") == 0)
+            hours = atof(val);
+        else if(strcmp(opt, "--seed") == 0)
+            seed = strtoul(val, NULL, 0);
+        else if(strcmp(opt, "--fault-rate") == 0)
+            fault_rate = atof(val);
+        else if(strcmp(opt, "--pms") == 0 && atoi(val) >= 1 && atoi(val) <= SIM_PMS_MAX)
+            pms_num = atoi(val);
+        else if(strcmp(opt, "--neighbors") == 0)
+            neighbors = strtoul(val, NULL, 0);
+        else if(strcmp(opt, "--csv") == 0)
+            csv_path = val;
+        else if(strcmp(opt, "--download") == 0 && atof(val) >= 0.0)
+            download = atof(val);
+        else if(strcmp(opt, "--mtu") == 0 && atoi(val) >= ESP_GATT_DEF_BLE_MTU_SIZE && atoi(val) <= ESP_GATT_MAX_MTU_SIZE)
+            mtu = atoi(val);
+        else if(strcmp(opt, "--replay") == 0)
+            replay_path = val;
+        else if(strcmp(opt, "--replay-fast") == 0 && strtoul(val, NULL, 0) > 0)
+            replay_fast = strtoul(val, NULL, 0);
+        else if(strcmp(opt, "--trace-out") == 0)
+            trace_out = val;
+        else if(strcmp(opt, "--firmware") == 0)
+            firmware = val;
+        else if(strcmp(opt, "--log") == 0 && sim_log_level(val) >= 0)
+            sim_log_set_level(sim_log_level(val));
+        else
+        {
+            sim_usage(argv[0]);
+            return 1;
+        }
+        ++i;
+    }
+    if(days <= 0.0 && hours <= 0.0)
+        days = 1.0;
+    if(replay_fast > 0 && replay_path == NULL)
+    {
+        sim_usage(argv[0]);
+        return 1;
+    }
+
+    if(replay_path != NULL)
+    {
+        size_t size = 0;
+        uint8_t *data = sim_read_file(replay_path, &size);
+        if(data == NULL)
+        {
+            perror(replay_path);
+            return 1;
+        }
+        replay = sim_trace_load(data, size);
+        free(data);
+        if(replay == NULL)
+        {
+            fprintf(stderr, "Fail load trace %s.\n", replay_path);
+            return 1;
+        }
+    }
+    if(replay_fast > 0) // parser and decoder of firmware as fast as possible
+    {
+        sim_trace_decode_t decode;
+        sim_print_trace("trace", replay);
+        if(!sim_trace_decode(replay, firmware, replay_fast, &decode))
+            return 1;
+        printf("decode x%-8upms %.1f MB/s (%.1f ns/byte), dht %.2f M reads/s (%.1f ns/read)\n", replay_fast,
+            decode.pms_s > 0 ? decode.pms_bytes / decode.pms_s / 1e6 : 0.0,
+            decode.pms_bytes ? decode.pms_s * 1e9 / decode.pms_bytes : 0.0,
+            decode.dht_s > 0 ? decode.dht_reads / decode.dht_s / 1e6 : 0.0,
+            decode.dht_reads ? decode.dht_s * 1e9 / decode.dht_reads : 0.0);
+        sim_print_check(&decode.check);
+        sim_trace_free(replay);
+        return decode.check.pms_diff == 0 && decode.check.dht_diff == 0 ? 0 : 1;
+    }
+    if(replay != NULL)
+        sim_trace_replay(replay);
+
+    sim_scan.path = adv_decoder_best_path();
+    sim_scan.power_on_first = -1;
+    if(csv_path != NULL)
+    {
+        sim_scan.csv = fopen(csv_path, "w");
+        if(sim_scan.csv == NULL)
+        {
+            perror(csv_path);
+            return 1;
+        }
+        fprintf(sim_scan.csv, "time_s,type,temperature,humidity,sm_pm10,sm_pm25,sm_pm100,ae_pm10,ae_pm25,ae_pm100,"
+            "um3,um5,um10,um25,um50,um100,esp_temperature\n");
+    }
+
+    sim_env_init(seed);
+    sim_pms_init(PMS_UART_NUM, PMS_SET_GPIO, PMS_RESET_GPIO, seed * 2654435761u + 1, fault_rate);
+    if(pms_num > 1)
+        sim_pms_init(SENSOR_PM2_UART_NUM, SENSOR_PM2_SET_GPIO, SENSOR_PM2_RESET_GPIO, seed * 2654435761u + 5, fault_rate);
+    sim_dht_init(DHT_DATA_GPIO, DHT_VCC_GPIO, seed * 2246822519u + 3, fault_rate);
+    sim_ble_set_scanner(sim_scan_frame, &sim_scan);
+    sim_ble_set_neighbors(neighbors, seed * 3266489917u + 7);
+    sim_firmware_set_path(firmware);
+    if(download >= 0.0)
+        sim_gatt_set_download((int64_t)(download * 3600.0 * 1e6), mtu);
+
+    int64_t end = (int64_t)((days * 24.0 + hours) * 3600.0 * 1e6);
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    sim_power_on();
+    sim_run(end);
+    sim_scan_flush(&sim_scan);
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+    double wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+    sim_pms_stats_t pms[SIM_PMS_MAX];
+    sim_dht_stats_t dht;
+    sim_ble_stats_t ble;
+    sim_flash_stats_t flash;
+    sim_gatt_stats_t gatt;
+    for(int i=0; i<pms_num; ++i)
+        sim_pms_get_stats(i, &pms[i]);
+    sim_dht_get_stats(&dht);
+    sim_ble_get_stats(&ble);
+    sim_flash_get_stats(&flash);
+    sim_gatt_get_stats(&gatt);
+
+    printf("simulated       %.2f h in %.3f s wall (x%.0f)\n", sim_now() / 3.6e9, wall, wall > 0 ? sim_now() / 1e6 / wall : 0.0);
+    printf("boots           %u\n", sim_boot_count());
+    uint32_t state_checks, state_mismatches;
+    sim_state_checks_get(&state_checks, &state_mismatches);
+    if(state_checks > 0)
+        printf("  deep sleep    state checks %u (windows, rollups, rtc_state), mismatches %u\n", state_checks, state_mismatches);
+    for(int i=0; i<pms_num; ++i)
+        printf("%-16sframes %llu (corrupted %llu), commands %llu, fan duty %.2f%%\n", i == 0 ? "pms" : "pms2",
+            (unsigned long long)pms[i].frames, (unsigned long long)pms[i].corrupted, (unsigned long long)pms[i].commands,
+            sim_now() > 0 ? 100.0 * pms[i].fan_time / sim_now() : 0.0);
+    printf("dht             reads %llu (faults %llu), ignored start signals %llu\n",
+        (unsigned long long)dht.reads, (unsigned long long)dht.faults, (unsigned long long)dht.ignored);
+    printf("first adv       after power on %.1f ms, per boot avg %.1f ms, max %.1f ms\n",
+        sim_scan.power_on_first / 1e3, sim_scan.boot_frames ? sim_scan.boot_first_sum / 1e3 / sim_scan.boot_frames : 0.0,
+        sim_scan.boot_first_max / 1e3);
+    printf("ble             adv events %llu, data updates %llu, adv starts %llu, neighbor reports %llu\n",
+        (unsigned long long)ble.adv_events, (unsigned long long)ble.data_updates, (unsigned long long)ble.adv_starts,
+        (unsigned long long)ble.scan_reports);
+    if(ble.rsp_updates > 0)
+        printf("  scan rsp      events %llu, data updates %llu\n", (unsigned long long)ble.scan_rsp_events,
+            (unsigned long long)ble.rsp_updates);
+    printf("dataset         live+avg of new cycle heard after avg %.1f ms, max %.1f ms (%llu cycles)\n",
+        sim_scan.dataset_num ? sim_scan.dataset_sum / 1e3 / sim_scan.dataset_num : 0.0, sim_scan.dataset_max / 1e3,
+        (unsigned long long)sim_scan.dataset_num);
+    printf("scanner         frames %llu, valid %llu, foreign %llu, decoder %s\n",
+        (unsigned long long)sim_scan.frames_total, (unsigned long long)sim_scan.frames_valid,
+        (unsigned long long)sim_scan.frames_foreign, adv_decoder_path_name(sim_scan.path));
+    for(int t=0; t<SIM_SCAN_TYPES; ++t)
+        printf("  type %d        events %llu, new cycles %llu, missed %llu\n", t,
+            (unsigned long long)sim_scan.events[t], (unsigned long long)sim_scan.updates[t], (unsigned long long)sim_scan.missed[t]);
+    if(sim_scan.relay_events > 0)
+        printf("  relay         events %llu, new data %llu\n", (unsigned long long)sim_scan.relay_events,
+            (unsigned long long)sim_scan.relay_updates);
+    for(int t=0; t<SENSOR_INSTANCES_MAX; ++t)
+    {
+        if(sim_scan.instance_events[t] > 0)
+            printf("  instance %d    events %llu\n", t, (unsigned long long)sim_scan.instance_events[t]);
+    }
+    if(sim_scan.diag_events > 0)
+    {
+        const int32_t *d = sim_scan.diag;
+        const int64_t *c = sim_scan.diag_total;
+        printf("  diag          events %llu, cycles %lld\n", (unsigned long long)sim_scan.diag_events, (long long)c[PAYLOAD_DIAG_FIELD_CYCLES]);
+        printf("    latency     dht p50/p95 bin %d/%d max %d us, pms %d/%d max %d us, adv %d/%d max %d us\n",
+            d[PAYLOAD_DIAG_FIELD_DHT_P50], d[PAYLOAD_DIAG_FIELD_DHT_P95], d[PAYLOAD_DIAG_FIELD_DHT_MAX],
+            d[PAYLOAD_DIAG_FIELD_PMS_P50], d[PAYLOAD_DIAG_FIELD_PMS_P95], d[PAYLOAD_DIAG_FIELD_PMS_MAX],
+            d[PAYLOAD_DIAG_FIELD_ADV_P50], d[PAYLOAD_DIAG_FIELD_ADV_P95], d[PAYLOAD_DIAG_FIELD_ADV_MAX]);
+        printf("    dht         ok %lld, timeout start %lld, timeout data %lld, bad checksum %lld\n",
+            (long long)c[PAYLOAD_DIAG_FIELD_DHT_OK], (long long)c[PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_START],
+            (long long)c[PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_DATA], (long long)c[PAYLOAD_DIAG_FIELD_DHT_BAD_CHECKSUM]);
+        printf("    pms         ok %lld, bad checksum %lld, timeout %lld, other %lld\n",
+            (long long)c[PAYLOAD_DIAG_FIELD_PMS_OK], (long long)c[PAYLOAD_DIAG_FIELD_PMS_BAD_CHECKSUM],
+            (long long)c[PAYLOAD_DIAG_FIELD_PMS_TIMEOUT], (long long)(c[PAYLOAD_DIAG_FIELD_PMS_LOW_DATA] +
+            c[PAYLOAD_DIAG_FIELD_PMS_NOT_FULL] + c[PAYLOAD_DIAG_FIELD_PMS_NOT_FIND] + c[PAYLOAD_DIAG_FIELD_PMS_OTHER]));
+        printf("    resources   retries max %d, heap min %d B, stack min %d B (slot %d), boot to adv %d us\n",
+            d[PAYLOAD_DIAG_FIELD_RETRIES_MAX], d[PAYLOAD_DIAG_FIELD_HEAP_MIN],
+            d[PAYLOAD_DIAG_FIELD_STACK_MIN], d[PAYLOAD_DIAG_FIELD_STACK_SLOT], d[PAYLOAD_DIAG_FIELD_BOOT_ADV]);
+    }
+    if(download >= 0.0)
+    {
+        printf("gatt            %s, records %llu of %llu, %.0f records/s, stream %.2f s, total %.2f s\n",
+            gatt.done ? "download done" : "download not finished", (unsigned long long)gatt.records,
+            (unsigned long long)gatt.expected, gatt.stream_us > 0 ? gatt.records * 1e6 / gatt.stream_us : 0.0,
+            gatt.stream_us / 1e6, gatt.total_us / 1e6);
+        printf("  link          connects %u, mtu %u, LL length %u, interval %.2f ms, conn events %llu, packets %llu, resumed at cycle %u\n",
+            gatt.connects, gatt.mtu, gatt.ll_len, gatt.interval_us / 1e3, (unsigned long long)gatt.conn_events,
+            (unsigned long long)gatt.pdus, gatt.resume_cycle);
+        printf("  notifications %llu (%llu B), congestions %llu, dropped %llu, truncated %llu, bad %llu, out of order %llu, skipped %llu\n",
+            (unsigned long long)gatt.notifications, (unsigned long long)gatt.bytes, (unsigned long long)gatt.congestions,
+            (unsigned long long)gatt.dropped, (unsigned long long)gatt.truncated, (unsigned long long)gatt.bad,
+            (unsigned long long)gatt.out_of_order, (unsigned long long)gatt.skipped);
+    }
+    printf("flash           sector erases %llu (max per sector %u), writes %llu, bytes %llu\n",
+        (unsigned long long)flash.erases, flash.max_sector_erases, (unsigned long long)flash.writes,
+        (unsigned long long)flash.bytes_written);
+    printf("scheduler       context switches %llu\n", (unsigned long long)sim_context_switches());
+    printf("led             duty changes %u\n", sim_ledc_changes());
+
+    size_t trace_size = 0;
+    const uint8_t *trace_data = sim_flash_data(SENSOR_TRACE_PARTITION_LABEL, &trace_size);
+    sim_trace_t *captured = trace_data != NULL ? sim_trace_load(trace_data, trace_size) : NULL;
+    int ret = state_mismatches == 0 ? 0 : 1;
+    if(replay != NULL)
+    {
+        sim_trace_stats_t st;
+        sim_print_trace("replay", replay);
+        sim_trace_get_stats(replay, &st);
+        printf("  played        pms commands matched %u, unmatched %u, bytes %llu, dht reads %u, after end %u\n",
+            st.pms_matched, st.pms_unmatched, (unsigned long long)st.pms_sent, st.dht_played, st.dht_missing);
+    }
+    if(captured != NULL)
+    {
+        sim_trace_stats_t st;
+        sim_trace_get_stats(captured, &st);
+        if(st.records > 0)
+        {
+            sim_print_trace("trace", captured);
+            if(replay != NULL) // firmware captured replayed streams, its results should be the same
+            {
+                sim_trace_check_t check;
+                sim_trace_compare(replay, captured, &check);
+                sim_print_check(&check);
+                ret |= check.pms_diff == 0 && check.dht_diff == 0 ? 0 : 1;
+            }
+        }
+    }
+    if(trace_out != NULL && (trace_data == NULL || !sim_write_file(trace_out, trace_data, trace_size)))
+    {
+        perror(trace_out);
+        ret = 1;
+    }
+    sim_trace_free(captured);
+    sim_trace_free(replay);
+
+    if(sim_scan.csv != NULL)
+        fclose(sim_scan.csv);
+    return ret;
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Model of Plantower PMS5003 - SET pin (sleep/fan), commands on UART, frames in active and passive mode.
+// Readings after wake up overestimate concentration until fan stabilizes the flow (warm-up).
+// Replay of sensor trace (--replay) - commands are answered with bytes captured after the same command.
+#include <math.h>
+#include <string.h>
+#include "sim.h"
+
+#define SIM_PMS_BAUD_BYTE_US        1042    // 9600 baud, 10 bits per byte
+#define SIM_PMS_FRAME_LEN           32
+#define SIM_PMS_FIRST_FRAME_US      SIM_MS(1200)
+#define SIM_PMS_PERIOD_STABLE_US    SIM_MS(2300) // in doc -> stable mode
+#define SIM_PMS_PERIOD_FAST_US      SIM_MS(800)  // in doc -> fast mode 200-800ms, when readings change
+#define SIM_PMS_FAST_CHANGE         0.1     // relative change of PM2.5 to switch to fast mode
+#define SIM_PMS_PASSIVE_REPLY_US    SIM_MS(20)
+#define SIM_PMS_WARMUP_BIAS         0.6     // relative overestimation just after wake up
+#define SIM_PMS_WARMUP_TAU_S        6.0
+#define SIM_PMS_NOISE               0.04    // relative noise of reading
+#define SIM_PMS_UNITS_MAX           2       // PMS units on own UART each
+
+typedef struct {
+    int uart_num;
+    gpio_num_t set_gpio;
+    gpio_num_t reset_gpio;
+    int set_level;          // -1 floating - pulled up inside PMS
+    int reset_level;
+    bool awake;
+    bool active_mode;
+    int64_t wake_time;
+    double last_pm25;
+    uint8_t command[7];
+    uint8_t command_len;
+    uint8_t tx[SIM_PMS_FRAME_LEN];
+    const uint8_t *tx_data; // frame or burst of trace
+    uint16_t tx_len;
+    uint16_t tx_pos;
+    bool tx_busy;
+    int64_t command_time;   // replay - bursts are timed from command
+    uint32_t rng;
+    double fault_rate;
+    sim_pms_stats_t stats;
+} sim_pms_t;
+
+static sim_pms_t sim_pms[SIM_PMS_UNITS_MAX];
+static int sim_pms_num = 0;
+
+static void sim_pms_frame_event(void *arg);
+static void sim_pms_replay_next(sim_pms_t *pms);
+
+
+
+static uint16_t sim_pms_clamp(double value)
+{
+    if(value < 0.0)
+        return 0;
+    if(value > 65535.0)
+        return 65535;
+    return (uint16_t)lround(value);
+}
+
+
+static void sim_pms_put16(uint8_t *dst, uint16_t value)
+{
+    dst[0] = value >> 8;
+    dst[1] = value & 0xFF;
+}
+
+
+static void sim_pms_build_frame(sim_pms_t *pms) //32bytes frame from current state of air
+{
+    sim_env_t env;
+    double since_wake = (sim_now() - pms->wake_time) / 1e6;
+    double bias = 1.0 + SIM_PMS_WARMUP_BIAS * exp(-since_wake / SIM_PMS_WARMUP_TAU_S);
+    double ae25, ae10, ae100, um3;
+    uint16_t checksum = 0;
+
+    sim_env_get(&env);
+    ae25 = env.pm25 * bias * (1.0 + SIM_PMS_NOISE * sim_rand_normal(&pms->rng));
+    ae10 = ae25 * (0.68 + 0.02 * sim_rand_normal(&pms->rng));
+    ae100 = ae25 * (1.25 + 0.04 * sim_rand_normal(&pms->rng));
+    um3 = ae25 * 70.0 * (1.0 + SIM_PMS_NOISE * sim_rand_normal(&pms->rng));
+    pms->last_pm25 = ae25;
+
+    memset(pms->tx, 0, sizeof(pms->tx));
+    pms->tx[0] = 0x42;
+    pms->tx[1] = 0x4D;
+    sim_pms_put16(&pms->tx[2], SIM_PMS_FRAME_LEN - 4);
+    // CF=1 (standard particle) is higher than atmospheric environment for high concentration
+    sim_pms_put16(&pms->tx[4], sim_pms_clamp(ae10 * (1.0 + fmin(ae10, 100.0) / 200.0)));
+    sim_pms_put16(&pms->tx[6], sim_pms_clamp(ae25 * (1.0 + fmin(ae25, 100.0) / 200.0)));
+    sim_pms_put16(&pms->tx[8], sim_pms_clamp(ae100 * (1.0 + fmin(ae100, 100.0) / 200.0)));
+    sim_pms_put16(&pms->tx[10], sim_pms_clamp(ae10));
+    sim_pms_put16(&pms->tx[12], sim_pms_clamp(ae25));
+    sim_pms_put16(&pms->tx[14], sim_pms_clamp(ae100));
+    sim_pms_put16(&pms->tx[16], sim_pms_clamp(um3));
+    sim_pms_put16(&pms->tx[18], sim_pms_clamp(um3 * 0.3));
+    sim_pms_put16(&pms->tx[20], sim_pms_clamp(um3 * 0.06));
+    sim_pms_put16(&pms->tx[22], sim_pms_clamp(um3 * 0.006));
+    sim_pms_put16(&pms->tx[24], sim_pms_clamp(um3 * 0.0018));
+    sim_pms_put16(&pms->tx[26], sim_pms_clamp(um3 * 0.0005));
+    pms->tx[28] = 0x97; // version
+    pms->tx[29] = 0x00; // error code
+
+    for(int i=0; i<SIM_PMS_FRAME_LEN-2; ++i)
+        checksum += pms->tx[i];
+    sim_pms_put16(&pms->tx[30], checksum);
+
+    if(sim_rand(&pms->rng) / 4294967296.0 < pms->fault_rate) // noise on line
+    {
+        pms->tx[sim_rand_range(&pms->rng, 4, SIM_PMS_FRAME_LEN-1)] ^= 1 << sim_rand_range(&pms->rng, 0, 7);
+        ++pms->stats.corrupted;
+    }
+}
+
+
+static void sim_pms_byte_event(void *arg) //send next byte of frame
+{
+    sim_pms_t *pms = arg;
+
+    sim_uart_receive(pms->uart_num, pms->tx_data[pms->tx_pos++]);
+    if(pms->tx_pos < pms->tx_len)
+        sim_event_after(SIM_PMS_BAUD_BYTE_US, sim_pms_byte_event, pms, pms);
+    else
+    {
+        pms->tx_busy = false;
+        if(sim_trace_replaying())
+            sim_pms_replay_next(pms);
+    }
+}
+
+
+static void sim_pms_send_frame(sim_pms_t *pms)
+{
+    if(pms->tx_busy)
+        return;
+
+    sim_pms_build_frame(pms);
+    pms->tx_data = pms->tx;
+    pms->tx_len = SIM_PMS_FRAME_LEN;
+    pms->tx_pos = 0;
+    pms->tx_busy = true;
+    ++pms->stats.frames;
+    sim_event_after(SIM_PMS_BAUD_BYTE_US, sim_pms_byte_event, pms, pms);
+}
+
+
+static void sim_pms_frame_event(void *arg) //active mode - periodic frames
+{
+    sim_pms_t *pms = arg;
+    double previous = pms->last_pm25;
+
+    sim_pms_send_frame(pms);
+    bool fast = fabs(pms->last_pm25 - previous) > SIM_PMS_FAST_CHANGE * fmax(previous, 1.0);
+    sim_event_after(fast ? SIM_PMS_PERIOD_FAST_US : SIM_PMS_PERIOD_STABLE_US, sim_pms_frame_event, pms, pms);
+}
+
+
+static void sim_pms_reply_event(void *arg) //passive mode - answer to read command
+{
+    sim_pms_send_frame(arg);
+}
+
+
+static void sim_pms_replay_event(void *arg) //start of burst
+{
+    sim_pms_t *pms = arg;
+
+    pms->tx_pos = 0;
+    pms->tx_busy = true;
+    sim_pms_byte_event(pms);
+}
+
+
+static void sim_pms_replay_next(sim_pms_t *pms) //schedule next burst of trace, its last byte comes just before recorded read
+{
+    const sim_trace_burst_t *burst = sim_trace_pms_burst(pms - sim_pms);
+    int64_t start;
+
+    if(burst == NULL || burst->len == 0)
+        return;
+    pms->tx_data = burst->data;
+    pms->tx_len = burst->len;
+    start = pms->command_time + burst->time - (int64_t)burst->first_len * SIM_PMS_BAUD_BYTE_US;
+    sim_event_at(start > sim_now() ? start : sim_now() + SIM_PMS_BAUD_BYTE_US, sim_pms_replay_event, pms, pms);
+}
+
+
+static void sim_pms_update(sim_pms_t *pms) //state after change of pins or mode
+{
+    bool awake = pms->set_level != 0 && pms->reset_level != 0;
+
+    if(pms->reset_level == 0)
+        pms->active_mode = true; // default after reset
+
+    if(awake && !pms->awake)
+    {
+        pms->wake_time = sim_now();
+        pms->last_pm25 = 0.0;
+    }
+    else if(!awake && pms->awake)
+    {
+        pms->stats.fan_time += sim_now() - pms->wake_time;
+    }
+    pms->awake = awake;
+
+    sim_event_cancel(pms);
+    pms->tx_busy = false;
+    pms->command_len = 0;
+    if(awake && pms->active_mode && !sim_trace_replaying())
+    {
+        int64_t first = pms->wake_time + SIM_PMS_FIRST_FRAME_US;
+        sim_event_at(first > sim_now() ? first : sim_now() + SIM_PMS_PERIOD_FAST_US, sim_pms_frame_event, pms, pms);
+    }
+}
+
+
+static void sim_pms_pin(gpio_num_t pin, int level, void *arg)
+{
+    sim_pms_t *pms = arg;
+    int set_level = pms->set_level;
+    int reset_level = pms->reset_level;
+
+    if(pin == pms->set_gpio)
+        pms->set_level = level;
+    else
+        pms->reset_level = level;
+
+    if((pms->set_level != 0) != (set_level != 0) || (pms->reset_level != 0) != (reset_level != 0))
+        sim_pms_update(pms);
+}
+
+
+static void sim_pms_command(sim_pms_t *pms) //7bytes: 0x42 0x4D CMD DATAH DATAL LRCH LRCL
+{
+    const uint8_t *cmd = pms->command;
+    uint16_t checksum = 0;
+
+    for(int i=0; i<5; ++i)
+        checksum += cmd[i];
+    if(checksum != (((uint16_t)cmd[5] << 8) | cmd[6]))
+        return;
+
+    ++pms->stats.commands;
+    switch(cmd[2])
+    {
+    case 0xE1: // change mode
+        if(pms->active_mode != (cmd[4] != 0))
+        {
+            pms->active_mode = cmd[4] != 0;
+            sim_pms_update(pms);
+        }
+        break;
+    case 0xE2: // read in passive mode
+        if(!pms->active_mode && !sim_trace_replaying())
+            sim_event_after(SIM_PMS_PASSIVE_REPLY_US, sim_pms_reply_event, pms, pms);
+        break;
+    default:
+        break;
+    }
+
+    if(sim_trace_replaying()) // answer from trace replaces frames of model
+    {
+        sim_event_cancel(pms);
+        pms->tx_busy = false;
+        pms->command_time = sim_now() - (int64_t)sizeof(pms->command) * SIM_PMS_BAUD_BYTE_US; // firmware traced write, not end of line
+        if(sim_trace_pms_command(pms - sim_pms, cmd, sizeof(pms->command)))
+            sim_pms_replay_next(pms);
+    }
+}
+
+
+static void sim_pms_rx(const uint8_t *data, size_t len, void *arg) //bytes sent by ESP
+{
+    sim_pms_t *pms = arg;
+
+    if(!pms->awake)
+        return;
+
+    for(size_t i=0; i<len; ++i)
+    {
+        uint8_t pos = pms->command_len;
+        if((pos == 0 && data[i] != 0x42) || (pos == 1 && data[i] != 0x4D))
+        {
+            pms->command_len = data[i] == 0x42 ? 1 : 0;
+            continue;
+        }
+        pms->command[pos] = data[i];
+        pms->command_len = pos + 1;
+        if(pms->command_len == sizeof(pms->command))
+        {
+            pms->command_len = 0;
+            sim_pms_command(pms);
+        }
+    }
+}
+
+
+int sim_pms_init(int uart_num, gpio_num_t set_gpio, gpio_num_t reset_gpio, uint32_t seed, double fault_rate) //return unit, -1 - too many
+{
+    sim_pms_t *pms;
+
+    if(sim_pms_num >= SIM_PMS_UNITS_MAX)
+        return -1;
+    pms = &sim_pms[sim_pms_num];
+    memset(pms, 0, sizeof(sim_pms_t));
+    pms->uart_num = uart_num;
+    pms->set_gpio = set_gpio;
+    pms->reset_gpio = reset_gpio;
+    pms->set_level = -1;
+    pms->reset_level = -1;
+    pms->active_mode = true;
+    pms->rng = seed ? seed : 1;
+    pms->fault_rate = fault_rate;
+
+    sim_uart_attach(uart_num, sim_pms_rx, pms);
+    sim_gpio_watch(set_gpio, sim_pms_pin, pms);
+    sim_gpio_watch(reset_gpio, sim_pms_pin, pms);
+    sim_pms_update(pms); // pins are floating at power on - PMS is running
+    return sim_pms_num++;
+}
+
+
+void sim_pms_get_stats(int unit, sim_pms_stats_t *dst)
+{
+    const sim_pms_t *pms = &sim_pms[unit];
+
+    *dst = pms->stats;
+    if(pms->awake)
+        dst->fan_time += sim_now() - pms->wake_time;
+}
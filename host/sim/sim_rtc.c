@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Linked into firmware image - tells kernel where RTC_DATA_ATTR variables are, so they survive deep sleep
+// while the rest of firmware statics is loaded fresh at every boot.
+#include <stdint.h>
+#include <stddef.h>
+
+extern uint8_t __start_sim_rtc_data[] __attribute__((weak)); // provided by linker for section "sim_rtc_data"
+extern uint8_t __stop_sim_rtc_data[] __attribute__((weak));
+
+void sim_rtc_region(uint8_t **start, size_t *size);
+
+
+
+void sim_rtc_region(uint8_t **start, size_t *size)
+{
+    *start = __start_sim_rtc_data;
+    *size = (__start_sim_rtc_data != NULL) ? (size_t)(__stop_sim_rtc_data - __start_sim_rtc_data) : 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// System services of ESP-IDF - log, timers, sleep, reset reason, ROM functions and internal temperature sensor.
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "sim.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_pm.h"
+#include "nvs_flash.h"
+#include "xtensa/hal.h"
+
+#define SIM_HEAP_SIZE           (300*1024) // free heap reported to firmware, simulator doesn't count allocations
+#define SIM_DIE_TEMP_OFFSET     20.0 // C, chip is warmer than air around
+
+static const uint8_t sim_base_mac[6] = {0x24, 0x0A, 0xC4, 0x5A, 0x1D, 0x40}; // factory MAC in eFuse, Espressif OUI
+
+static esp_log_level_t sim_log_level = ESP_LOG_WARN;
+static uint64_t sim_sleep_us = 0;
+
+
+
+void sim_log_set_level(int level)
+{
+    sim_log_level = level;
+}
+
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    sim_log_level = level;
+}
+
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    va_list args;
+
+    if(level > sim_log_level)
+        return;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)((sim_now() - sim_boot_time()) / 1000);
+}
+
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch(code)
+    {
+    case ESP_OK:                return "ESP_OK";
+    case ESP_FAIL:              return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+    default:                    return "UNKNOWN ERROR";
+    }
+}
+
+
+int64_t esp_timer_get_time(void)
+{
+    return sim_now() - sim_boot_time();
+}
+
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return sim_reset_reason();
+}
+
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) //universal MACs - base + type, as with 4 universal MACs
+{
+    memcpy(mac, sim_base_mac, sizeof(sim_base_mac));
+    mac[5] += type;
+    return ESP_OK;
+}
+
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return SIM_HEAP_SIZE;
+}
+
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return SIM_HEAP_SIZE;
+}
+
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    sim_sleep_us = time_in_us;
+    return ESP_OK;
+}
+
+
+void esp_deep_sleep_start(void)
+{
+    sim_deep_sleep((int64_t)sim_sleep_us);
+}
+
+
+esp_err_t esp_pm_configure(const void *config) //light sleep is not simulated, CPU time is not modelled
+{
+    return ESP_OK;
+}
+
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+
+void ets_delay_us(uint32_t us)
+{
+    sim_advance(us);
+}
+
+
+uint32_t ets_get_cpu_frequency(void)
+{
+    return SIM_CPU_FREQ_MHZ;
+}
+
+
+uint32_t xthal_get_ccount(void)
+{
+    return (uint32_t)(sim_now() * SIM_CPU_FREQ_MHZ);
+}
+
+
+uint8_t temprature_sens_read(void) //raw value in F, like ROM function of ESP32
+{
+    sim_env_t env;
+
+    sim_env_get(&env);
+    return (uint8_t)((env.temperature + SIM_DIE_TEMP_OFFSET) * 9.0 / 5.0 + 32.0);
+}
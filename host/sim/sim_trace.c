@@ -0,0 +1,680 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Replay of sensor trace captured by firmware (SENSOR_TRACE, see sensor_trace.h) - bytes read by PMS driver and
+// edges seen by DHT driver go back to firmware through models of sensors at recorded speed (--replay), or straight
+// to parser and decoder of firmware image as fast as possible (--replay-fast).
+// PMS bytes are replayed as answers to commands: firmware flushes UART before every command, so bytes read after
+// command belong to it. Reads close in time form one burst, sent back to back to end just before recorded read.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+#include "sim.h"
+#include "esp_log.h"
+#include "sensor_trace.h"
+
+#define SIM_TRACE_SLOTS         4       // instances of driver
+#define SIM_TRACE_BURST_GAP_US  SIM_MS(100) // reads closer than gap are one transmission of PMS
+#define SIM_TRACE_LOOKAHEAD     8       // commands skipped to find command of model
+#define SIM_TRACE_COMMAND_LEN   7
+#define SIM_TRACE_DHT_VALUE     offsetof(sensor_trace_dht_t, result) // result and values are compared
+
+typedef struct {
+    uint8_t type;
+    uint8_t slot;
+    uint8_t len;
+    uint32_t time;
+    const uint8_t *payload;
+} sim_trace_record_t;
+
+typedef struct { // command sent to PMS and bursts answering it
+    uint8_t command[SIM_TRACE_COMMAND_LEN];
+    uint8_t command_len;
+    uint32_t time;
+    uint32_t first_burst;
+    uint32_t bursts_num;
+} sim_trace_anchor_t;
+
+typedef struct {
+    sim_trace_anchor_t *anchors;
+    uint32_t anchors_num;
+    sim_trace_burst_t *bursts;
+    uint32_t bursts_num;
+    uint8_t *bytes;
+    size_t bytes_num;
+    sim_trace_dht_t *dht;
+    uint32_t dht_num;
+    // replay
+    uint32_t next_anchor;
+    int32_t anchor;         // -1 - last command not found, nothing to send
+    uint32_t next_burst;
+    uint32_t next_dht;
+} sim_trace_slot_t;
+
+struct sim_trace {
+    uint8_t *image;
+    size_t size;
+    sim_trace_record_t *records;
+    size_t records_num;
+    sim_trace_slot_t slots[SIM_TRACE_SLOTS];
+    sim_trace_stats_t stats;
+};
+
+typedef void (*sim_trace_parser_reset_t)(pms_parser_t *parser);
+typedef pms_error_t (*sim_trace_parser_feed_t)(pms_parser_t *parser, uint8_t byte, pms_measurement_t *dst);
+typedef void (*sim_trace_pack_values_t)(const pms_measurement_t *value, int32_t *values);
+typedef dht_error_t (*sim_trace_decode_edges_t)(const uint32_t *edges, uint8_t edges_num, uint32_t ticks_per_us, dht_measurement_t *dst);
+
+typedef struct { // functions of firmware image
+    sim_trace_parser_reset_t parser_reset;
+    sim_trace_parser_feed_t parser_feed;
+    sim_trace_pack_values_t pack_values;
+    sim_trace_decode_edges_t decode_edges;
+} sim_trace_firmware_t;
+
+typedef struct { // DHT transmission as seen by driver
+    uint32_t edges[DHT_EDGES_NUM];
+    uint8_t edges_num;
+    uint8_t ticks_per_us;
+    const uint8_t *expected; // record
+} sim_trace_edges_t;
+
+static sim_trace_t *sim_trace_replayed = NULL;
+
+
+
+static uint16_t sim_trace_crc(const uint8_t *data, size_t len) //CRC-16/CCITT-FALSE, the same as firmware
+{
+    uint16_t crc = 0xFFFF;
+
+    for(size_t i=0; i<len; ++i)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for(uint8_t bit=0; bit<8; ++bit)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+
+static bool sim_trace_blank(const uint8_t *data, size_t len)
+{
+    for(size_t i=0; i<len; ++i)
+    {
+        if(data[i] != 0xFF)
+            return false;
+    }
+    return true;
+}
+
+
+static size_t sim_trace_parse(sim_trace_t *trace, bool store) //walk chunks, return number of records
+{
+    size_t offset = 0, num = 0;
+    sensor_trace_chunk_t chunk;
+
+    while(offset + sizeof(chunk) <= trace->size && !sim_trace_blank(trace->image + offset, sizeof(chunk)))
+    {
+        memcpy(&chunk, trace->image + offset, sizeof(chunk));
+        if(chunk.magic != SENSOR_TRACE_MAGIC || chunk.len > SENSOR_TRACE_BUFFER_SIZE || offset + sizeof(chunk) + chunk.len > trace->size)
+        {
+            if(store) // chunks after damaged head can't be found
+                ++trace->stats.bad_chunks;
+            break;
+        }
+
+        const uint8_t *data = trace->image + offset + sizeof(chunk);
+        if(sim_trace_crc(data, chunk.len) != chunk.crc) // torn by power loss
+        {
+            if(store)
+                ++trace->stats.bad_chunks;
+        }
+        else
+        {
+            size_t pos = 0;
+            if(store)
+                ++trace->stats.chunks;
+            while(pos + sizeof(sensor_trace_record_t) <= chunk.len)
+            {
+                sensor_trace_record_t head;
+                memcpy(&head, data + pos, sizeof(head));
+                if(pos + sizeof(head) + head.len > chunk.len)
+                    break;
+                if(store)
+                {
+                    sim_trace_record_t *record = &trace->records[num];
+                    record->type = head.type;
+                    record->slot = head.slot;
+                    record->len = head.len;
+                    record->time = head.time;
+                    record->payload = data + pos + sizeof(head);
+                }
+                ++num;
+                pos += sizeof(head) + head.len;
+            }
+        }
+        offset = (offset + sizeof(chunk) + chunk.len + SENSOR_TRACE_ALIGN - 1) / SENSOR_TRACE_ALIGN * SENSOR_TRACE_ALIGN;
+    }
+    return num;
+}
+
+
+static void sim_trace_dht_payload(const sim_trace_record_t *record, sensor_trace_dht_t *head, uint8_t *pulses_num) //head of DHT record, pulses present in payload
+{
+    memset(head, 0, sizeof(*head));
+    *pulses_num = 0;
+    if(record->len < sizeof(*head))
+        return;
+    memcpy(head, record->payload, sizeof(*head));
+    if(head->edges_num > DHT_EDGES_NUM)
+        head->edges_num = DHT_EDGES_NUM;
+    *pulses_num = head->edges_num > 0 ? head->edges_num - 1 : 0;
+    if(*pulses_num > (record->len - sizeof(*head)) / sizeof(uint16_t))
+        *pulses_num = (record->len - sizeof(*head)) / sizeof(uint16_t);
+}
+
+
+static uint16_t sim_trace_pulse(const sim_trace_record_t *record, uint8_t index)
+{
+    uint16_t pulse;
+
+    memcpy(&pulse, record->payload + sizeof(sensor_trace_dht_t) + index * sizeof(uint16_t), sizeof(pulse));
+    return pulse;
+}
+
+
+static bool sim_trace_build(sim_trace_t *trace) //anchors, bursts and DHT transmissions of slots, false - no memory
+{
+    int64_t last_rx[SIM_TRACE_SLOTS];
+
+    for(size_t i=0; i<trace->records_num; ++i) // upper bounds of arrays
+    {
+        const sim_trace_record_t *r = &trace->records[i];
+        sim_trace_slot_t *slot = &trace->slots[r->slot % SIM_TRACE_SLOTS];
+
+        if(r->slot >= SIM_TRACE_SLOTS)
+            continue;
+        if(r->type == SENSOR_TRACE_PMS_TX)
+            ++slot->anchors_num;
+        else if(r->type == SENSOR_TRACE_PMS_RX)
+        {
+            ++slot->bursts_num;
+            slot->bytes_num += r->len;
+        }
+        else if(r->type == SENSOR_TRACE_DHT)
+            ++slot->dht_num;
+    }
+    for(int s=0; s<SIM_TRACE_SLOTS; ++s)
+    {
+        sim_trace_slot_t *slot = &trace->slots[s];
+        slot->anchors = calloc(slot->anchors_num + 1, sizeof(sim_trace_anchor_t));
+        slot->bursts = calloc(slot->bursts_num + 1, sizeof(sim_trace_burst_t));
+        slot->bytes = malloc(slot->bytes_num + 1);
+        slot->dht = calloc(slot->dht_num + 1, sizeof(sim_trace_dht_t));
+        if(slot->anchors == NULL || slot->bursts == NULL || slot->bytes == NULL || slot->dht == NULL)
+            return false;
+        slot->anchors_num = slot->bursts_num = slot->dht_num = 0;
+        slot->bytes_num = 0;
+        slot->anchor = -1;
+        last_rx[s] = -1;
+    }
+
+    for(size_t i=0; i<trace->records_num; ++i)
+    {
+        const sim_trace_record_t *r = &trace->records[i];
+        sim_trace_slot_t *slot = &trace->slots[r->slot % SIM_TRACE_SLOTS];
+        sim_trace_stats_t *stats = &trace->stats;
+
+        if(r->type == SENSOR_TRACE_BOOT) // relative times don't cross boots
+        {
+            ++stats->boots;
+            for(int s=0; s<SIM_TRACE_SLOTS; ++s)
+                trace->slots[s].anchor = -1;
+            continue;
+        }
+        if(r->slot >= SIM_TRACE_SLOTS)
+            continue;
+
+        switch(r->type)
+        {
+        case SENSOR_TRACE_PMS_WAKE:
+            ++stats->pms_wakes;
+            break;
+        case SENSOR_TRACE_PMS_TX:
+        {
+            sim_trace_anchor_t *anchor = &slot->anchors[slot->anchors_num];
+            anchor->command_len = r->len < SIM_TRACE_COMMAND_LEN ? r->len : SIM_TRACE_COMMAND_LEN;
+            memcpy(anchor->command, r->payload, anchor->command_len);
+            anchor->time = r->time;
+            anchor->first_burst = slot->bursts_num;
+            slot->anchor = slot->anchors_num++;
+            last_rx[r->slot] = -1;
+            ++stats->pms_commands;
+            break;
+        }
+        case SENSOR_TRACE_PMS_RX:
+        {
+            stats->pms_bytes += r->len;
+            if(slot->anchor < 0 || r->len == 0) // bytes without command, not expected after flush of UART
+                break;
+            sim_trace_anchor_t *anchor = &slot->anchors[slot->anchor];
+            int64_t since = (uint32_t)(r->time - anchor->time);
+            if(last_rx[r->slot] < 0 || since - last_rx[r->slot] > SIM_TRACE_BURST_GAP_US)
+            {
+                sim_trace_burst_t *burst = &slot->bursts[slot->bursts_num++];
+                burst->time = since;
+                burst->first_len = r->len;
+                burst->len = 0;
+                burst->data = slot->bytes + slot->bytes_num;
+                ++anchor->bursts_num;
+            }
+            sim_trace_burst_t *burst = &slot->bursts[slot->bursts_num - 1];
+            memcpy(slot->bytes + slot->bytes_num, r->payload, r->len);
+            slot->bytes_num += r->len;
+            burst->len += r->len;
+            last_rx[r->slot] = since;
+            break;
+        }
+        case SENSOR_TRACE_PMS_RESULT:
+            if(r->len > 0 && (int8_t)r->payload[0] == PMS_OK)
+                ++stats->pms_frames;
+            else
+                ++stats->pms_bad;
+            break;
+        case SENSOR_TRACE_DHT:
+        {
+            sensor_trace_dht_t head;
+            uint8_t pulses_num;
+            sim_trace_dht_t *dht = &slot->dht[slot->dht_num++];
+
+            sim_trace_dht_payload(r, &head, &pulses_num);
+            dht->edges_num = pulses_num + (head.edges_num > 0 ? 1 : 0);
+            for(uint8_t p=0; p<pulses_num; ++p) // rounded up - pulse is above threshold of driver in us as in CPU cycles
+                dht->pulses_us[p] = (sim_trace_pulse(r, p) + head.ticks_per_us - 1) / (head.ticks_per_us ? head.ticks_per_us : 1);
+            ++stats->dht_reads;
+            if(head.result == DHT_OK)
+                ++stats->dht_ok;
+            break;
+        }
+        case SENSOR_TRACE_DROPPED:
+        {
+            uint16_t dropped = 0;
+            if(r->len >= sizeof(dropped))
+                memcpy(&dropped, r->payload, sizeof(dropped));
+            stats->dropped += dropped;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    for(int s=0; s<SIM_TRACE_SLOTS; ++s)
+        trace->slots[s].anchor = -1;
+    return true;
+}
+
+
+sim_trace_t *sim_trace_load(const uint8_t *data, size_t size) //copy of partition image, NULL - no memory
+{
+    sim_trace_t *trace = calloc(1, sizeof(sim_trace_t));
+
+    if(trace == NULL)
+        return NULL;
+    trace->image = malloc(size ? size : 1);
+    if(trace->image == NULL)
+    {
+        free(trace);
+        return NULL;
+    }
+    memcpy(trace->image, data, size);
+    trace->size = size;
+
+    trace->records_num = sim_trace_parse(trace, false);
+    trace->records = calloc(trace->records_num + 1, sizeof(sim_trace_record_t));
+    if(trace->records == NULL)
+    {
+        sim_trace_free(trace);
+        return NULL;
+    }
+    sim_trace_parse(trace, true);
+    trace->stats.records = trace->records_num;
+    if(!sim_trace_build(trace))
+    {
+        sim_trace_free(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+
+void sim_trace_free(sim_trace_t *trace)
+{
+    if(trace == NULL)
+        return;
+    if(sim_trace_replayed == trace)
+        sim_trace_replayed = NULL;
+    for(int s=0; s<SIM_TRACE_SLOTS; ++s)
+    {
+        free(trace->slots[s].anchors);
+        free(trace->slots[s].bursts);
+        free(trace->slots[s].bytes);
+        free(trace->slots[s].dht);
+    }
+    free(trace->records);
+    free(trace->image);
+    free(trace);
+}
+
+
+void sim_trace_get_stats(const sim_trace_t *trace, sim_trace_stats_t *dst)
+{
+    *dst = trace->stats;
+}
+
+
+void sim_trace_replay(sim_trace_t *trace)
+{
+    sim_trace_replayed = trace;
+}
+
+
+bool sim_trace_replaying(void)
+{
+    return sim_trace_replayed != NULL;
+}
+
+
+bool sim_trace_pms_command(int slot, const uint8_t *command, size_t len) //model got command, answer is following bursts
+{
+    sim_trace_t *trace = sim_trace_replayed;
+    sim_trace_slot_t *s;
+
+    if(trace == NULL || slot < 0 || slot >= SIM_TRACE_SLOTS)
+        return false;
+    s = &trace->slots[slot];
+    s->anchor = -1;
+    for(uint32_t i=s->next_anchor; i<s->anchors_num && i<s->next_anchor+SIM_TRACE_LOOKAHEAD; ++i)
+    {
+        const sim_trace_anchor_t *anchor = &s->anchors[i];
+        if(anchor->command_len == len && memcmp(anchor->command, command, len) == 0)
+        {
+            s->anchor = i;
+            s->next_anchor = i + 1;
+            s->next_burst = anchor->first_burst;
+            ++trace->stats.pms_matched;
+            return true;
+        }
+    }
+    ++trace->stats.pms_unmatched;
+    return false;
+}
+
+
+const sim_trace_burst_t *sim_trace_pms_burst(int slot) //next burst answering last command
+{
+    sim_trace_t *trace = sim_trace_replayed;
+    sim_trace_slot_t *s;
+    const sim_trace_burst_t *burst;
+
+    if(trace == NULL || slot < 0 || slot >= SIM_TRACE_SLOTS || trace->slots[slot].anchor < 0)
+        return NULL;
+    s = &trace->slots[slot];
+    if(s->next_burst >= s->anchors[s->anchor].first_burst + s->anchors[s->anchor].bursts_num)
+        return NULL;
+    burst = &s->bursts[s->next_burst++];
+    trace->stats.pms_sent += burst->len;
+    return burst;
+}
+
+
+const sim_trace_dht_t *sim_trace_dht_read(int slot) //next transmission, NULL - end of trace
+{
+    sim_trace_t *trace = sim_trace_replayed;
+    sim_trace_slot_t *s;
+
+    if(trace == NULL || slot < 0 || slot >= SIM_TRACE_SLOTS)
+        return NULL;
+    s = &trace->slots[slot];
+    if(s->next_dht >= s->dht_num)
+    {
+        ++trace->stats.dht_missing;
+        return NULL;
+    }
+    ++trace->stats.dht_played;
+    return &s->dht[s->next_dht++];
+}
+
+
+static size_t sim_trace_next(const sim_trace_t *trace, size_t from, uint8_t type, uint8_t slot) //index of next record, records_num - none
+{
+    for(size_t i=from; i<trace->records_num; ++i)
+    {
+        if(trace->records[i].type == type && trace->records[i].slot == slot)
+            return i;
+    }
+    return trace->records_num;
+}
+
+
+static bool sim_trace_equal(const sim_trace_record_t *a, const sim_trace_record_t *b)
+{
+    if(a->type == SENSOR_TRACE_DHT)
+        return a->len >= sizeof(sensor_trace_dht_t) && b->len >= sizeof(sensor_trace_dht_t) &&
+            memcmp(a->payload + SIM_TRACE_DHT_VALUE, b->payload + SIM_TRACE_DHT_VALUE, sizeof(sensor_trace_dht_t) - SIM_TRACE_DHT_VALUE) == 0;
+    return a->len == b->len && memcmp(a->payload, b->payload, a->len) == 0;
+}
+
+
+void sim_trace_compare(const sim_trace_t *expected, const sim_trace_t *actual, sim_trace_check_t *dst) //results of drivers in order, per slot
+{
+    const uint8_t types[2] = {SENSOR_TRACE_PMS_RESULT, SENSOR_TRACE_DHT};
+
+    memset(dst, 0, sizeof(*dst));
+    for(int t=0; t<2; ++t)
+    {
+        for(uint8_t slot=0; slot<SIM_TRACE_SLOTS; ++slot)
+        {
+            size_t i = sim_trace_next(expected, 0, types[t], slot);
+            size_t j = sim_trace_next(actual, 0, types[t], slot);
+            while(i < expected->records_num && j < actual->records_num)
+            {
+                bool diff = !sim_trace_equal(&expected->records[i], &actual->records[j]);
+                if(t == 0)
+                {
+                    ++dst->pms_frames;
+                    dst->pms_diff += diff;
+                }
+                else
+                {
+                    ++dst->dht_reads;
+                    dst->dht_diff += diff;
+                }
+                i = sim_trace_next(expected, i + 1, types[t], slot);
+                j = sim_trace_next(actual, j + 1, types[t], slot);
+            }
+            for(; i<expected->records_num; i=sim_trace_next(expected, i + 1, types[t], slot))
+                ++dst->unpaired;
+            for(; j<actual->records_num; j=sim_trace_next(actual, j + 1, types[t], slot))
+                ++dst->unpaired;
+        }
+    }
+}
+
+
+static bool sim_trace_pms_equal(const sim_trace_firmware_t *fw, const sim_trace_record_t *expected, pms_error_t status, const pms_measurement_t *value) //result of parser as record of firmware
+{
+    uint8_t payload[1 + PMS_WINDOW_CHANNELS * sizeof(uint16_t)];
+    int32_t values[PMS_WINDOW_CHANNELS];
+    uint8_t len = 1;
+
+    payload[0] = (uint8_t)(int8_t)status;
+    if(status == PMS_OK)
+    {
+        fw->pack_values(value, values);
+        for(uint8_t i=0; i<PMS_WINDOW_CHANNELS; ++i)
+        {
+            uint16_t v = values[i];
+            memcpy(&payload[len], &v, sizeof(v));
+            len += sizeof(v);
+        }
+    }
+    return expected->len == len && memcmp(expected->payload, payload, len) == 0;
+}
+
+
+static uint64_t sim_trace_decode_pms(const sim_trace_t *trace, const sim_trace_firmware_t *fw, sim_trace_check_t *check) //feed parser with bytes of trace, return bytes
+{
+    pms_parser_t parsers[SIM_TRACE_SLOTS];
+    size_t expected[SIM_TRACE_SLOTS];
+    pms_measurement_t value;
+    uint64_t bytes = 0;
+
+    for(uint8_t s=0; s<SIM_TRACE_SLOTS; ++s)
+    {
+        fw->parser_reset(&parsers[s]);
+        expected[s] = sim_trace_next(trace, 0, SENSOR_TRACE_PMS_RESULT, s);
+    }
+    for(size_t i=0; i<trace->records_num; ++i)
+    {
+        const sim_trace_record_t *r = &trace->records[i];
+        if(r->slot >= SIM_TRACE_SLOTS)
+            continue;
+        if(r->type == SENSOR_TRACE_PMS_RESET)
+            fw->parser_reset(&parsers[r->slot]);
+        else if(r->type == SENSOR_TRACE_BOOT)
+        {
+            for(uint8_t s=0; s<SIM_TRACE_SLOTS; ++s)
+                fw->parser_reset(&parsers[s]);
+        }
+        else if(r->type == SENSOR_TRACE_PMS_RX)
+        {
+            bytes += r->len;
+            for(uint8_t b=0; b<r->len; ++b)
+            {
+                pms_error_t status = fw->parser_feed(&parsers[r->slot], r->payload[b], &value);
+                if(check == NULL || (status != PMS_OK && status != PMS_BAD_CHECKSUM))
+                    continue;
+                size_t *e = &expected[r->slot];
+                ++check->pms_frames;
+                if(*e >= trace->records_num || !sim_trace_pms_equal(fw, &trace->records[*e], status, &value))
+                    ++check->pms_diff;
+                *e = sim_trace_next(trace, *e + (*e < trace->records_num), SENSOR_TRACE_PMS_RESULT, r->slot);
+            }
+        }
+    }
+    if(check != NULL) // results in trace not found by parser
+    {
+        for(uint8_t s=0; s<SIM_TRACE_SLOTS; ++s)
+        {
+            for(size_t e=expected[s]; e<trace->records_num; e=sim_trace_next(trace, e + 1, SENSOR_TRACE_PMS_RESULT, s))
+            {
+                ++check->pms_frames;
+                ++check->pms_diff;
+            }
+        }
+    }
+    return bytes;
+}
+
+
+static sim_trace_edges_t *sim_trace_edges(const sim_trace_t *trace, size_t *num) //DHT records as timestamps in CPU cycles, counter starts near overflow
+{
+    sim_trace_edges_t *edges = calloc(trace->stats.dht_reads + 1, sizeof(sim_trace_edges_t));
+    size_t n = 0;
+
+    if(edges == NULL)
+        return NULL;
+    for(size_t i=0; i<trace->records_num; ++i)
+    {
+        const sim_trace_record_t *r = &trace->records[i];
+        sensor_trace_dht_t head;
+        uint8_t pulses_num;
+
+        if(r->type != SENSOR_TRACE_DHT || r->slot >= SIM_TRACE_SLOTS)
+            continue;
+        sim_trace_dht_payload(r, &head, &pulses_num);
+        edges[n].edges_num = head.edges_num;
+        edges[n].ticks_per_us = head.ticks_per_us;
+        edges[n].expected = r->payload;
+        edges[n].edges[0] = UINT32_MAX - 50000 + (uint32_t)i;
+        for(uint8_t p=0; p<pulses_num; ++p)
+            edges[n].edges[p+1] = edges[n].edges[p] + sim_trace_pulse(r, p);
+        ++n;
+    }
+    *num = n;
+    return edges;
+}
+
+
+static double sim_trace_wall(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+
+bool sim_trace_decode(const sim_trace_t *trace, const char *firmware, uint32_t repeat, sim_trace_decode_t *dst) //parser and decoder of firmware image without simulation
+{
+    sim_trace_firmware_t fw;
+    sim_trace_edges_t *edges;
+    size_t edges_num = 0;
+    dht_measurement_t value;
+    void *image;
+    double start;
+
+    memset(dst, 0, sizeof(*dst));
+    image = dlopen(firmware, RTLD_NOW | RTLD_LOCAL);
+    if(image == NULL)
+    {
+        fprintf(stderr, "sim: can't load firmware: %s\n", dlerror());
+        return false;
+    }
+    fw.parser_reset = (sim_trace_parser_reset_t)dlsym(image, "pms_parser_reset");
+    fw.parser_feed = (sim_trace_parser_feed_t)dlsym(image, "pms_parser_feed");
+    fw.pack_values = (sim_trace_pack_values_t)dlsym(image, "pms_pack_values");
+    fw.decode_edges = (sim_trace_decode_edges_t)dlsym(image, "dht_decode_edges");
+    edges = sim_trace_edges(trace, &edges_num);
+    if(fw.parser_reset == NULL || fw.parser_feed == NULL || fw.pack_values == NULL || fw.decode_edges == NULL || edges == NULL)
+    {
+        fprintf(stderr, "sim: firmware without PMS parser or DHT decoder\n");
+        free(edges);
+        dlclose(image);
+        return false;
+    }
+
+    sim_log_set_level(ESP_LOG_NONE); // errors of bad frames and transmissions are expected
+    sim_trace_decode_pms(trace, &fw, &dst->check);
+    for(size_t i=0; i<edges_num; ++i)
+    {
+        const sim_trace_edges_t *e = &edges[i];
+        dht_error_t result = fw.decode_edges(e->edges, e->edges_num, e->ticks_per_us, &value);
+        sensor_trace_dht_t head;
+        memcpy(&head, e->expected, sizeof(head));
+        ++dst->check.dht_reads;
+        if(result != head.result || (result == DHT_OK && (value.temperature != head.temperature || value.humidity != head.humidity)))
+            ++dst->check.dht_diff;
+    }
+
+    start = sim_trace_wall();
+    for(uint32_t r=0; r<repeat; ++r)
+        dst->pms_bytes += sim_trace_decode_pms(trace, &fw, NULL);
+    dst->pms_s = sim_trace_wall() - start;
+
+    start = sim_trace_wall();
+    for(uint32_t r=0; r<repeat; ++r)
+    {
+        for(size_t i=0; i<edges_num; ++i)
+            fw.decode_edges(edges[i].edges, edges[i].edges_num, edges[i].ticks_per_us, &value);
+        dst->dht_reads += edges_num;
+    }
+    dst->dht_s = sim_trace_wall() - start;
+
+    free(edges);
+    dlclose(image);
+    return true;
+}
@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// UART driver - RX ring buffer, event queue and pattern detection like ESP-IDF driver, bytes come from model
+// at line rate. UART_DATA is posted when RX FIFO reaches threshold or line is idle (RX timeout).
+#include <string.h>
+#include "sim.h"
+#include "driver/uart.h"
+
+#define SIM_UART_FULL_THRESH    120 // ESP-IDF default rxfifo_full_thresh
+#define SIM_UART_TOUT_SYMBOLS   10  // ESP-IDF default rx_timeout_thresh
+
+typedef struct {
+    bool installed;
+    int baud_rate;
+    QueueHandle_t event_queue;
+    uint8_t *rx;
+    int rx_size;
+    int rx_head;
+    int rx_len;
+    int fifo_len;           // received bytes not reported by event
+    int64_t last_rx;
+    bool pattern_enabled;
+    uint8_t pattern_chr;
+    int pattern_pre_idle;   // baud cycles
+    int *pattern_pos;       // positions of pattern in RX buffer, relative to read pointer
+    int pattern_size;
+    int pattern_num;
+    sim_uart_tx_t tx_cb;
+    void *tx_arg;
+} sim_uart_t;
+
+static sim_uart_t sim_uart[UART_NUM_MAX] = {
+    [0 ... UART_NUM_MAX-1] = { .baud_rate = 115200 }
+};
+
+
+
+static bool sim_uart_valid(uart_port_t uart_num)
+{
+    return uart_num >= 0 && uart_num < UART_NUM_MAX;
+}
+
+
+void sim_uart_attach(int uart_num, sim_uart_tx_t tx_cb, void *arg) //model of device connected to UART
+{
+    if(!sim_uart_valid(uart_num))
+        return;
+    sim_uart[uart_num].tx_cb = tx_cb;
+    sim_uart[uart_num].tx_arg = arg;
+}
+
+
+int64_t sim_uart_byte_time(int uart_num) //start + 8 data + stop bits
+{
+    return 10 * 1000000LL / sim_uart[uart_num].baud_rate;
+}
+
+
+static void sim_uart_post(sim_uart_t *uart, uart_event_type_t type, size_t size, bool timeout_flag)
+{
+    uart_event_t event = { .type = type, .size = size, .timeout_flag = timeout_flag };
+    xQueueSendFromISR(uart->event_queue, &event, NULL); // full queue - event is lost like in driver
+}
+
+
+static void sim_uart_timeout(void *arg) //line idle after last byte
+{
+    sim_uart_t *uart = arg;
+
+    if(!uart->installed || uart->fifo_len == 0)
+        return;
+    if(sim_now() - uart->last_rx < SIM_UART_TOUT_SYMBOLS * sim_uart_byte_time(uart - sim_uart))
+        return; // next byte came meanwhile, its own timeout is pending
+
+    sim_uart_post(uart, UART_DATA, uart->fifo_len, true);
+    uart->fifo_len = 0;
+}
+
+
+void sim_uart_receive(int uart_num, uint8_t byte) //stop bit of byte is received now
+{
+    if(!sim_uart_valid(uart_num) || !sim_uart[uart_num].installed)
+        return;
+
+    sim_uart_t *uart = &sim_uart[uart_num];
+    int64_t byte_time = sim_uart_byte_time(uart_num);
+    int64_t idle = sim_now() - byte_time - uart->last_rx;
+    bool pattern = false;
+
+    if(uart->pattern_enabled && byte == uart->pattern_chr &&
+        idle * uart->baud_rate >= (int64_t)uart->pattern_pre_idle * 1000000)
+    {
+        if(uart->pattern_num < uart->pattern_size)
+            uart->pattern_pos[uart->pattern_num++] = uart->rx_len;
+        pattern = true;
+    }
+    uart->last_rx = sim_now();
+
+    if(uart->rx_len >= uart->rx_size)
+    {
+        sim_uart_post(uart, UART_BUFFER_FULL, uart->fifo_len, false);
+        uart->fifo_len = 0;
+        return;
+    }
+    uart->rx[(uart->rx_head + uart->rx_len) % uart->rx_size] = byte;
+    ++uart->rx_len;
+    ++uart->fifo_len;
+    sim_task_wake(uart);
+
+    if(pattern)
+    {
+        sim_uart_post(uart, UART_PATTERN_DET, uart->fifo_len, false);
+        uart->fifo_len = 0;
+    }
+    else if(uart->fifo_len >= SIM_UART_FULL_THRESH)
+    {
+        sim_uart_post(uart, UART_DATA, uart->fifo_len, false);
+        uart->fifo_len = 0;
+    }
+    else
+    {
+        sim_event_after(SIM_UART_TOUT_SYMBOLS * byte_time, sim_uart_timeout, uart, uart);
+    }
+}
+
+
+static void sim_uart_consume(sim_uart_t *uart, int len) //positions of pattern are relative to read pointer
+{
+    int kept = 0;
+
+    uart->rx_head = (uart->rx_head + len) % uart->rx_size;
+    uart->rx_len -= len;
+    for(int i=0; i<uart->pattern_num; ++i)
+    {
+        if(uart->pattern_pos[i] - len >= 0)
+            uart->pattern_pos[kept++] = uart->pattern_pos[i] - len;
+    }
+    uart->pattern_num = kept;
+}
+
+
+void sim_uart_reset(void) //power down - drivers are uninstalled
+{
+    for(uart_port_t i=0; i<UART_NUM_MAX; ++i)
+        uart_driver_delete(i);
+}
+
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config)
+{
+    if(!sim_uart_valid(uart_num) || uart_config == NULL || uart_config->baud_rate <= 0)
+        return ESP_ERR_INVALID_ARG;
+
+    sim_uart[uart_num].baud_rate = uart_config->baud_rate;
+    return ESP_OK;
+}
+
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+    return sim_uart_valid(uart_num) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, QueueHandle_t *uart_queue, int intr_alloc_flags)
+{
+    if(!sim_uart_valid(uart_num) || rx_buffer_size <= UART_FIFO_LEN)
+        return ESP_ERR_INVALID_ARG;
+    if(sim_uart[uart_num].installed)
+        return ESP_FAIL;
+
+    sim_uart_t *uart = &sim_uart[uart_num];
+    uart->rx = sim_object_alloc(rx_buffer_size);
+    uart->event_queue = queue_size > 0 ? xQueueCreate(queue_size, sizeof(uart_event_t)) : NULL;
+    if(uart->rx == NULL || (queue_size > 0 && uart->event_queue == NULL))
+        return ESP_ERR_NO_MEM;
+
+    uart->rx_size = rx_buffer_size;
+    uart->rx_head = 0;
+    uart->rx_len = 0;
+    uart->fifo_len = 0;
+    uart->last_rx = 0;
+    uart->pattern_enabled = false;
+    uart->installed = true;
+    if(uart_queue != NULL)
+        *uart_queue = uart->event_queue;
+    return ESP_OK;
+}
+
+
+esp_err_t uart_driver_delete(uart_port_t uart_num)
+{
+    if(!sim_uart_valid(uart_num))
+        return ESP_ERR_INVALID_ARG;
+
+    sim_uart_t *uart = &sim_uart[uart_num];
+    if(!uart->installed)
+        return ESP_OK;
+
+    sim_event_cancel(uart);
+    sim_object_free(uart->rx);
+    sim_object_free(uart->pattern_pos);
+    vQueueDelete(uart->event_queue);
+    uart->rx = NULL;
+    uart->pattern_pos = NULL;
+    uart->pattern_size = 0;
+    uart->pattern_num = 0;
+    uart->event_queue = NULL;
+    uart->installed = false;
+    return ESP_OK;
+}
+
+
+bool uart_is_driver_installed(uart_port_t uart_num)
+{
+    return sim_uart_valid(uart_num) && sim_uart[uart_num].installed;
+}
+
+
+int uart_tx_chars(uart_port_t uart_num, const char *buffer, uint32_t len) //bytes are delivered to model at once
+{
+    if(!uart_is_driver_installed(uart_num))
+        return -1;
+
+    if(sim_uart[uart_num].tx_cb != NULL)
+        sim_uart[uart_num].tx_cb((const uint8_t*)buffer, len, sim_uart[uart_num].tx_arg);
+    return len;
+}
+
+
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size)
+{
+    return uart_tx_chars(uart_num, src, size);
+}
+
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    if(!uart_is_driver_installed(uart_num))
+        return -1;
+
+    sim_uart_t *uart = &sim_uart[uart_num];
+    int64_t deadline = sim_ticks_deadline(ticks_to_wait);
+    uint32_t copied = 0;
+
+    while(copied < length)
+    {
+        while(uart->rx_len > 0 && copied < length)
+        {
+            int chunk = uart->rx_size - uart->rx_head;
+            if(chunk > uart->rx_len)
+                chunk = uart->rx_len;
+            if((uint32_t)chunk > length - copied)
+                chunk = length - copied;
+
+            memcpy((uint8_t*)buf + copied, uart->rx + uart->rx_head, chunk);
+            sim_uart_consume(uart, chunk);
+            copied += chunk;
+        }
+        if(copied >= length || ticks_to_wait == 0 || !sim_task_block(uart, deadline))
+            break;
+    }
+    return copied;
+}
+
+
+esp_err_t uart_flush_input(uart_port_t uart_num)
+{
+    if(!uart_is_driver_installed(uart_num))
+        return ESP_FAIL;
+
+    sim_uart_consume(&sim_uart[uart_num], sim_uart[uart_num].rx_len);
+    sim_uart[uart_num].fifo_len = 0;
+    return ESP_OK;
+}
+
+
+esp_err_t uart_flush(uart_port_t uart_num)
+{
+    return uart_flush_input(uart_num);
+}
+
+
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t *size)
+{
+    if(!uart_is_driver_installed(uart_num))
+        return ESP_FAIL;
+
+    *size = sim_uart[uart_num].rx_len;
+    return ESP_OK;
+}
+
+
+esp_err_t uart_enable_pattern_det_baud_intr(uart_port_t uart_num, char pattern_chr, uint8_t chr_num, int chr_tout, int post_idle, int pre_idle)
+{
+    if(!uart_is_driver_installed(uart_num) || chr_num != 1)
+        return ESP_ERR_INVALID_ARG; // simulator - only one character patterns
+
+    sim_uart[uart_num].pattern_chr = pattern_chr;
+    sim_uart[uart_num].pattern_pre_idle = pre_idle;
+    sim_uart[uart_num].pattern_enabled = true;
+    return ESP_OK;
+}
+
+
+esp_err_t uart_disable_pattern_det_intr(uart_port_t uart_num)
+{
+    if(!uart_is_driver_installed(uart_num))
+        return ESP_ERR_INVALID_ARG;
+
+    sim_uart[uart_num].pattern_enabled = false;
+    return ESP_OK;
+}
+
+
+esp_err_t uart_pattern_queue_reset(uart_port_t uart_num, int queue_length)
+{
+    if(!uart_is_driver_installed(uart_num) || queue_length <= 0)
+        return ESP_ERR_INVALID_ARG;
+
+    sim_uart_t *uart = &sim_uart[uart_num];
+    sim_object_free(uart->pattern_pos);
+    uart->pattern_pos = sim_object_alloc(queue_length * sizeof(int));
+    if(uart->pattern_pos == NULL)
+        return ESP_ERR_NO_MEM;
+    uart->pattern_size = queue_length;
+    uart->pattern_num = 0;
+    return ESP_OK;
+}
+
+
+int uart_pattern_pop_pos(uart_port_t uart_num)
+{
+    if(!uart_is_driver_installed(uart_num) || sim_uart[uart_num].pattern_num == 0)
+        return -1;
+
+    sim_uart_t *uart = &sim_uart[uart_num];
+    int pos = uart->pattern_pos[0];
+    memmove(uart->pattern_pos, uart->pattern_pos + 1, (uart->pattern_num - 1) * sizeof(int));
+    --uart->pattern_num;
+    return pos;
+}
+
+
+int uart_pattern_get_pos(uart_port_t uart_num)
+{
+    if(!uart_is_driver_installed(uart_num) || sim_uart[uart_num].pattern_num == 0)
+        return -1;
+    return sim_uart[uart_num].pattern_pos[0];
+}
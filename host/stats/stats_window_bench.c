@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Test and benchmark of sliding window (src/stats_window.c) - random samples pushed to windows of several capacities
+// (1 included) and numbers of channels, many times over capacity so head wraps around. After every push count, sum,
+// avg, min and max of every channel must be the same as of brute force recomputation over last samples, also after
+// reset in the middle of stream. Exit code 1 on any difference.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "stats_window.h"
+
+#define BENCH_PUSHES_DEFAULT    4000000
+#define BENCH_CHANNELS_MAX      12      // PMS_WINDOW_CHANNELS
+#define BENCH_RESET_EVERY       5000    // pushes, window is reset sometimes to check it starts from empty again
+
+static const uint16_t BENCH_CAPACITIES[] = {1, 2, 10, 24, 255, 1440}; // 10, 24 - HISTORY_WINDOW_LEN, ROLLUP_DAY_HOURS
+
+typedef struct {
+    stats_window_t  window;
+    int32_t         *history;   // [capacity][channels], reference ring - same order of slots as window
+    uint32_t        pushes;     // since reset
+} bench_window_t;
+
+typedef struct {
+    uint64_t checks;
+    uint64_t wrong;
+} bench_check_t;
+
+
+static int bench_alloc(bench_window_t *w, uint8_t channels, uint16_t capacity)
+{
+    memset(w, 0, sizeof(*w));
+    w->window.channels = channels;
+    w->window.capacity = capacity;
+    w->window.samples = malloc(sizeof(int32_t) * capacity * channels);
+    w->window.min_deque = malloc(sizeof(uint16_t) * channels * capacity);
+    w->window.max_deque = malloc(sizeof(uint16_t) * channels * capacity);
+    w->window.channel = malloc(sizeof(stats_window_channel_t) * channels);
+    w->history = malloc(sizeof(int32_t) * capacity * channels);
+    if(w->window.samples == NULL || w->window.min_deque == NULL || w->window.max_deque == NULL ||
+        w->window.channel == NULL || w->history == NULL)
+        return -1;
+    stats_window_reset(&(w->window));
+    return 0;
+}
+
+
+static void bench_free(bench_window_t *w)
+{
+    free(w->window.samples);
+    free(w->window.min_deque);
+    free(w->window.max_deque);
+    free(w->window.channel);
+    free(w->history);
+}
+
+
+static int32_t bench_value(uint32_t *seed) //small values mostly, extremes and runs of equal values sometimes
+{
+    switch(bench_rand(seed) % 8)
+    {
+    case 0:
+        return (int32_t)bench_rand(seed);
+    case 1:
+        return bench_rand(seed) % 2 ? INT32_MAX : INT32_MIN;
+    case 2:
+        return 7;
+    default:
+        return (int32_t)(bench_rand(seed) % 1000) - 200;
+    }
+}
+
+
+static void bench_push(bench_window_t *w, const int32_t *values)
+{
+    uint16_t capacity = w->window.capacity;
+
+    memcpy(&(w->history[(w->pushes % capacity) * w->window.channels]), values, sizeof(int32_t) * w->window.channels);
+    ++w->pushes;
+    stats_window_push(&(w->window), values);
+}
+
+
+static void bench_verify(const bench_window_t *w, bench_check_t *check) //window against brute force over last samples
+{
+    const stats_window_t *window = &(w->window);
+    uint16_t count = w->pushes < window->capacity ? w->pushes : window->capacity;
+    int32_t avg[BENCH_CHANNELS_MAX], min[BENCH_CHANNELS_MAX], max[BENCH_CHANNELS_MAX];
+    bool wrong = stats_window_count(window) != count;
+
+    ++check->checks;
+    if(count == 0)
+    {
+        wrong |= stats_window_get(window, STATS_WINDOW_AVG, avg) != STATS_WINDOW_EMPTY;
+        check->wrong += wrong;
+        return;
+    }
+    wrong |= stats_window_get(window, STATS_WINDOW_AVG, avg) != STATS_WINDOW_OK;
+    wrong |= stats_window_get(window, STATS_WINDOW_MIN, min) != STATS_WINDOW_OK;
+    wrong |= stats_window_get(window, STATS_WINDOW_MAX, max) != STATS_WINDOW_OK;
+
+    for(uint8_t c=0; c<window->channels; ++c)
+    {
+        int64_t sum = 0;
+        int32_t ref_min = INT32_MAX, ref_max = INT32_MIN;
+
+        for(uint16_t i=0; i<count; ++i)
+        {
+            int32_t value = w->history[i * window->channels + c];
+            sum += value;
+            if(value < ref_min)
+                ref_min = value;
+            if(value > ref_max)
+                ref_max = value;
+        }
+        wrong |= window->channel[c].sum != sum || avg[c] != (int32_t)(sum / count) || min[c] != ref_min || max[c] != ref_max;
+    }
+    if(wrong && check->wrong == 0)
+        fprintf(stderr, "wrong result - capacity %u, channels %u, push %u\n", window->capacity, window->channels, w->pushes);
+    check->wrong += wrong;
+}
+
+
+static int bench_check(uint64_t pushes, uint32_t seed) //every push of every configuration is verified
+{
+    bench_check_t check = {0};
+    bench_window_t w;
+    int32_t values[BENCH_CHANNELS_MAX];
+    const size_t configs = sizeof(BENCH_CAPACITIES)/sizeof(BENCH_CAPACITIES[0]);
+
+    for(size_t k=0; k<configs; ++k)
+    {
+        uint8_t channels = k % 2 ? 1 : BENCH_CHANNELS_MAX;
+        uint64_t config_pushes = pushes / configs / (BENCH_CAPACITIES[k] / 64 + 1); // verify costs capacity, keep time even
+
+        if(bench_alloc(&w, channels, BENCH_CAPACITIES[k]) != 0)
+        {
+            fprintf(stderr, "Fail alloc memory.\n");
+            return 1;
+        }
+        bench_verify(&w, &check);
+        for(uint64_t i=0; i<config_pushes; ++i)
+        {
+            if(i % BENCH_RESET_EVERY == BENCH_RESET_EVERY - 1)
+            {
+                stats_window_reset(&(w.window));
+                w.pushes = 0;
+                bench_verify(&w, &check);
+            }
+            for(uint8_t c=0; c<channels; ++c)
+                values[c] = bench_value(&seed);
+            bench_push(&w, values);
+            bench_verify(&w, &check);
+        }
+        bench_free(&w);
+    }
+    printf("check         %llu states, wrong %llu\n", (unsigned long long)check.checks, (unsigned long long)check.wrong);
+    return check.wrong == 0 ? 0 : 1;
+}
+
+
+static int bench_speed(uint64_t pushes, uint32_t seed) //push and get of long window, cost of both must not depend on capacity
+{
+    static int32_t values[1024][BENCH_CHANNELS_MAX];
+    int32_t result[BENCH_CHANNELS_MAX];
+    int64_t checksum = 0;
+    bench_window_t w;
+
+    if(bench_alloc(&w, BENCH_CHANNELS_MAX, 1440) != 0)
+    {
+        fprintf(stderr, "Fail alloc memory.\n");
+        return 1;
+    }
+    for(size_t i=0; i<sizeof(values)/sizeof(values[0]); ++i)
+        for(uint8_t c=0; c<BENCH_CHANNELS_MAX; ++c)
+            values[i][c] = bench_value(&seed);
+
+    double start = bench_now();
+    for(uint64_t i=0; i<pushes; ++i)
+    {
+        stats_window_push(&(w.window), values[i % 1024]);
+        stats_window_get(&(w.window), (stats_window_stat_t)(i % 3), result);
+        checksum += result[i % BENCH_CHANNELS_MAX];
+    }
+    double seconds = bench_now() - start;
+    printf("push+get      %.2f M/s (%u channels, capacity %u, checksum %lld)\n", pushes / seconds * 1e-6,
+        BENCH_CHANNELS_MAX, w.window.capacity, (long long)checksum);
+    bench_free(&w);
+    return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+    uint64_t pushes = BENCH_PUSHES_DEFAULT;
+    uint32_t seed = 0x9E3779B9;
+    const bench_option_t options[] = {
+        {"--pushes", BENCH_OPTION_U64, &pushes},
+        {"--seed", BENCH_OPTION_U32, &seed},
+    };
+
+    if(bench_options_parse(argc, argv, options, sizeof(options)/sizeof(options[0])) != 0)
+        return 1;
+
+    int ret = bench_check(pushes, seed);
+    ret |= bench_speed(pushes, seed);
+    return ret;
+}
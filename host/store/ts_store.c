@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ts_store.h"
+
+// Block in PATH.dat:
+//  int64 first time, int32 first value of every field, uint8 bits of time column and of every field column,
+//  then columns (time, fields in ts_store_field_t order) - count-1 deltas, LSB first, every column starts at byte,
+//  then TS_STORE_PAD zero bytes.
+// Time delta is unsigned ms (up to 32 bits, longer gap starts new block), field delta is zigzag of int32 difference.
+
+#define TS_STORE_SERIES_GROW    16      // first capacity of pending samples, doubled up to TS_STORE_BLOCK_SAMPLES
+
+static uint32_t ts_store_zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+
+static int32_t ts_store_unzigzag(uint32_t value)
+{
+    return (int32_t)((value >> 1) ^ (0u - (value & 1)));
+}
+
+
+static uint8_t ts_store_bits(uint32_t value)
+{
+    return value ? 32 - __builtin_clz(value) : 0;
+}
+
+
+static size_t ts_store_column_len(uint16_t count, uint8_t bits)
+{
+    return ((size_t)(count - 1) * bits + 7) / 8;
+}
+
+
+static void ts_store_pack(const uint32_t *src, uint16_t num, uint8_t bits, uint8_t *dst) //dst zeroed
+{
+    uint64_t pos = 0;
+    for(uint16_t i=0; i<num; ++i, pos+=bits)
+    {
+        uint64_t word = (uint64_t)src[i] << (pos & 7);
+        for(uint8_t b=0; b<(bits + (pos & 7) + 7)/8; ++b)
+            dst[pos/8 + b] |= word >> (8*b);
+    }
+}
+
+
+static void ts_store_unpack(const uint8_t *src, uint16_t num, uint8_t bits, uint32_t *dst) //reads up to 8 bytes after last value
+{
+    uint64_t mask = bits ? (~0ull >> (64 - bits)) : 0;
+    uint64_t pos = 0;
+    for(uint16_t i=0; i<num; ++i, pos+=bits)
+    {
+        uint64_t word;
+        memcpy(&word, src + pos/8, sizeof(word));
+        dst[i] = (word >> (pos & 7)) & mask;
+    }
+}
+
+
+static uint64_t ts_store_series_hash(uint64_t device, uint8_t type)
+{
+    return ((device << 2 | type) * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+
+static ts_store_error_t ts_store_write_head(FILE *file, const char *magic)
+{
+    uint8_t head[TS_STORE_HEAD_LEN] = {0};
+    uint32_t info[3] = {TS_STORE_VERSION, TS_STORE_FIELDS_NUM, sizeof(ts_store_block_t)};
+
+    memcpy(head, magic, 8);
+    memcpy(head + 8, info, sizeof(info));
+    return fwrite(head, sizeof(head), 1, file) == 1 ? TS_STORE_OK : TS_STORE_FAIL_WRITE;
+}
+
+
+static int ts_store_check_head(const uint8_t *head, size_t size, const char *magic)
+{
+    uint32_t info[3] = {TS_STORE_VERSION, TS_STORE_FIELDS_NUM, sizeof(ts_store_block_t)};
+    return size >= TS_STORE_HEAD_LEN && memcmp(head, magic, 8) == 0 && memcmp(head + 8, info, sizeof(info)) == 0;
+}
+
+
+static FILE *ts_store_open_file(const char *path, const char *ext, const char *magic, uint64_t *size) //open for append,
+{                                                                                                     //write head of new file
+    char name[4096];
+    snprintf(name, sizeof(name), "%s%s", path, ext);
+
+    FILE *file = fopen(name, "ab+");
+    if(file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+
+    uint8_t head[TS_STORE_HEAD_LEN];
+    if(len == 0)
+    {
+        if(ts_store_write_head(file, magic) != TS_STORE_OK)
+        {
+            fclose(file);
+            return NULL;
+        }
+        len = TS_STORE_HEAD_LEN;
+    }
+    else if(fseek(file, 0, SEEK_SET) != 0 || fread(head, 1, sizeof(head), file) != sizeof(head)
+        || !ts_store_check_head(head, sizeof(head), magic))
+    {
+        fclose(file);
+        return NULL;
+    }
+    *size = len;
+    return file;
+}
+
+
+ts_store_error_t ts_store_writer_open(ts_store_writer_t *writer, const char *path) //new store or append to existing
+{
+    uint64_t idx_size;
+
+    memset(writer, 0, sizeof(*writer));
+    writer->idx = ts_store_open_file(path, ".idx", TS_STORE_IDX_MAGIC, &idx_size);
+    writer->dat = ts_store_open_file(path, ".dat", TS_STORE_DAT_MAGIC, &(writer->dat_size));
+    if(writer->idx == NULL || writer->dat == NULL)
+    {
+        ts_store_writer_close(writer);
+        return TS_STORE_FAIL_OPEN;
+    }
+    // block written without index entry (writer killed) is lost, data file keeps only its bytes
+    writer->series_size = TS_STORE_SERIES_MIN;
+    writer->series = calloc(writer->series_size, sizeof(ts_store_series_t));
+    if(writer->series == NULL)
+    {
+        ts_store_writer_close(writer);
+        return TS_STORE_NO_MEMORY;
+    }
+    return TS_STORE_OK;
+}
+
+
+static ts_store_error_t ts_store_write_block(ts_store_writer_t *writer, ts_store_series_t *s) //encode pending samples of series
+{
+    uint8_t block[TS_STORE_BLOCK_HEAD_LEN + (TS_STORE_FIELDS_NUM + 1) * TS_STORE_BLOCK_SAMPLES * 4 + TS_STORE_PAD];
+    uint32_t deltas[TS_STORE_FIELDS_NUM + 1][TS_STORE_BLOCK_SAMPLES];
+    uint8_t bits[TS_STORE_FIELDS_NUM + 1];
+    ts_store_block_t entry = {0};
+
+    if(s->count == 0)
+        return TS_STORE_OK;
+    entry.device = s->device;
+    entry.time_min_ms = s->time_ms[0];
+    entry.time_max_ms = s->time_ms[s->count - 1];
+    entry.offset = writer->dat_size;
+    entry.count = s->count;
+    entry.type = s->type;
+
+    uint32_t max = 0;
+    for(uint16_t i=1; i<s->count; ++i)
+    {
+        deltas[0][i - 1] = s->time_ms[i] - s->time_ms[i - 1];
+        max |= deltas[0][i - 1];
+    }
+    bits[0] = ts_store_bits(max);
+
+    for(int f=0; f<TS_STORE_FIELDS_NUM; ++f)
+    {
+        const int32_t *v = s->values + (size_t)f * s->capacity;
+        entry.min[f] = entry.max[f] = v[0];
+        max = 0;
+        for(uint16_t i=1; i<s->count; ++i)
+        {
+            deltas[f + 1][i - 1] = ts_store_zigzag((int32_t)((uint32_t)v[i] - (uint32_t)v[i - 1]));
+            max |= deltas[f + 1][i - 1];
+            if(v[i] < entry.min[f])
+                entry.min[f] = v[i];
+            if(v[i] > entry.max[f])
+                entry.max[f] = v[i];
+        }
+        bits[f + 1] = ts_store_bits(max);
+    }
+
+    memcpy(block, &(s->time_ms[0]), 8);
+    for(int f=0; f<TS_STORE_FIELDS_NUM; ++f)
+        memcpy(block + 8 + 4*f, s->values + (size_t)f * s->capacity, 4);
+    memcpy(block + 8 + 4*TS_STORE_FIELDS_NUM, bits, sizeof(bits));
+
+    size_t len = TS_STORE_BLOCK_HEAD_LEN;
+    for(int c=0; c<TS_STORE_FIELDS_NUM + 1; ++c)
+    {
+        size_t column = ts_store_column_len(s->count, bits[c]);
+        memset(block + len, 0, column);
+        ts_store_pack(deltas[c], s->count - 1, bits[c], block + len);
+        len += column;
+    }
+    memset(block + len, 0, TS_STORE_PAD);
+    len += TS_STORE_PAD;
+    entry.size = len;
+
+    if(fwrite(block, len, 1, writer->dat) != 1 || fwrite(&entry, sizeof(entry), 1, writer->idx) != 1)
+        return TS_STORE_FAIL_WRITE;
+    writer->dat_size += len;
+    ++writer->blocks;
+    s->count = 0;
+    return TS_STORE_OK;
+}
+
+
+static ts_store_series_t *ts_store_series(ts_store_writer_t *writer, uint64_t device, uint8_t type) //find or add series
+{
+    if(writer->series_num * 2 >= writer->series_size) // keep load below 1/2
+    {
+        uint32_t size = writer->series_size * 2;
+        ts_store_series_t *table = calloc(size, sizeof(ts_store_series_t));
+        if(table == NULL)
+            return NULL;
+        for(uint32_t i=0; i<writer->series_size; ++i)
+        {
+            if(!writer->series[i].used)
+                continue;
+            uint32_t slot = ts_store_series_hash(writer->series[i].device, writer->series[i].type) & (size - 1);
+            while(table[slot].used)
+                slot = (slot + 1) & (size - 1);
+            table[slot] = writer->series[i];
+        }
+        free(writer->series);
+        writer->series = table;
+        writer->series_size = size;
+    }
+
+    uint32_t slot = ts_store_series_hash(device, type) & (writer->series_size - 1);
+    while(writer->series[slot].used)
+    {
+        if(writer->series[slot].device == device && writer->series[slot].type == type)
+            return &(writer->series[slot]);
+        slot = (slot + 1) & (writer->series_size - 1);
+    }
+    ts_store_series_t *s = &(writer->series[slot]);
+    s->device = device;
+    s->type = type;
+    s->used = 1;
+    s->last_ms = INT64_MIN;
+    ++writer->series_num;
+    return s;
+}
+
+
+static ts_store_error_t ts_store_series_grow(ts_store_series_t *s) //double capacity, columns are moved
+{
+    uint16_t capacity = s->capacity ? s->capacity * 2 : TS_STORE_SERIES_GROW;
+    int64_t *time_ms = realloc(s->time_ms, capacity * sizeof(int64_t));
+    int32_t *values = time_ms ? malloc((size_t)capacity * TS_STORE_FIELDS_NUM * sizeof(int32_t)) : NULL;
+    if(time_ms == NULL || values == NULL)
+    {
+        if(time_ms != NULL)
+            s->time_ms = time_ms;
+        return TS_STORE_NO_MEMORY;
+    }
+    for(int f=0; f<TS_STORE_FIELDS_NUM && s->count > 0; ++f)
+        memcpy(values + (size_t)f * capacity, s->values + (size_t)f * s->capacity, s->count * sizeof(int32_t));
+    free(s->values);
+    s->time_ms = time_ms;
+    s->values = values;
+    s->capacity = capacity;
+    return TS_STORE_OK;
+}
+
+
+ts_store_error_t ts_store_append(ts_store_writer_t *writer, uint64_t device, uint8_t type, int64_t time_ms, const int32_t *values)
+{                                                                                   //values[TS_STORE_FIELDS_NUM], block is written when full
+    ts_store_series_t *s = ts_store_series(writer, device, type);
+    ts_store_error_t err;
+
+    if(s == NULL)
+        return TS_STORE_NO_MEMORY;
+    if(time_ms < s->last_ms)
+        return TS_STORE_OUT_OF_ORDER;
+    if(s->count > 0 && time_ms - s->time_ms[s->count - 1] > UINT32_MAX && (err = ts_store_write_block(writer, s)) != TS_STORE_OK)
+        return err;
+    if(s->count == s->capacity && (err = ts_store_series_grow(s)) != TS_STORE_OK)
+        return err;
+
+    s->time_ms[s->count] = time_ms;
+    for(int f=0; f<TS_STORE_FIELDS_NUM; ++f)
+        s->values[(size_t)f * s->capacity + s->count] = values[f];
+    s->last_ms = time_ms;
+    ++writer->samples;
+    if(++s->count == TS_STORE_BLOCK_SAMPLES)
+        return ts_store_write_block(writer, s);
+    return TS_STORE_OK;
+}
+
+
+ts_store_error_t ts_store_flush(ts_store_writer_t *writer) //write partial blocks of all series, free pending buffers
+{
+    ts_store_error_t err = TS_STORE_OK;
+
+    for(uint32_t i=0; i<writer->series_size; ++i)
+    {
+        ts_store_series_t *s = &(writer->series[i]);
+        if(!s->used)
+            continue;
+        if(err == TS_STORE_OK)
+            err = ts_store_write_block(writer, s);
+        free(s->time_ms);
+        free(s->values);
+        s->time_ms = NULL;
+        s->values = NULL;
+        s->capacity = 0;
+        s->count = 0;
+    }
+    // data first - index entry never points past end of data file
+    if(fflush(writer->dat) != 0 || fflush(writer->idx) != 0)
+        return TS_STORE_FAIL_WRITE;
+    return err;
+}
+
+
+ts_store_error_t ts_store_writer_close(ts_store_writer_t *writer)
+{
+    ts_store_error_t err = TS_STORE_OK;
+
+    if(writer->series != NULL && writer->idx != NULL && writer->dat != NULL)
+        err = ts_store_flush(writer);
+    if(writer->dat != NULL && fclose(writer->dat) != 0)
+        err = TS_STORE_FAIL_WRITE;
+    if(writer->idx != NULL && fclose(writer->idx) != 0)
+        err = TS_STORE_FAIL_WRITE;
+    free(writer->series);
+    memset(writer, 0, sizeof(*writer));
+    return err;
+}
+
+
+static const uint8_t *ts_store_map(const char *path, const char *ext, size_t *size)
+{
+    char name[4096];
+    struct stat st;
+    snprintf(name, sizeof(name), "%s%s", path, ext);
+
+    int fd = open(name, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &st) != 0 || st.st_size < TS_STORE_HEAD_LEN)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return NULL;
+    *size = st.st_size;
+    return map;
+}
+
+
+ts_store_error_t ts_store_reader_open(ts_store_reader_t *reader, const char *path) //mmap of store, entries of index are not copied
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->idx_map = ts_store_map(path, ".idx", &(reader->idx_size));
+    reader->data = ts_store_map(path, ".dat", &(reader->data_size));
+    if(reader->idx_map == NULL || reader->data == NULL)
+    {
+        ts_store_reader_close(reader);
+        return TS_STORE_FAIL_OPEN;
+    }
+    if(!ts_store_check_head(reader->idx_map, reader->idx_size, TS_STORE_IDX_MAGIC)
+        || !ts_store_check_head(reader->data, reader->data_size, TS_STORE_DAT_MAGIC))
+    {
+        ts_store_reader_close(reader);
+        return TS_STORE_BAD_FILE;
+    }
+
+    reader->blocks = (const ts_store_block_t*)(reader->idx_map + TS_STORE_HEAD_LEN);
+    reader->blocks_num = (reader->idx_size - TS_STORE_HEAD_LEN) / sizeof(ts_store_block_t); // partial entry of killed writer is ignored
+    while(reader->blocks_num > 0 && reader->blocks[reader->blocks_num - 1].offset + reader->blocks[reader->blocks_num - 1].size > reader->data_size)
+        --reader->blocks_num;
+    return TS_STORE_OK;
+}
+
+
+void ts_store_reader_close(ts_store_reader_t *reader)
+{
+    if(reader->idx_map != NULL)
+        munmap((void*)reader->idx_map, reader->idx_size);
+    if(reader->data != NULL)
+        munmap((void*)reader->data, reader->data_size);
+    memset(reader, 0, sizeof(*reader));
+}
+
+
+uint16_t ts_store_block_decode(const ts_store_reader_t *reader, const ts_store_block_t *block, ts_store_field_t field, int64_t *time_ms, int32_t *values)
+{                                                                                   //time and one field of block, NULL - column is not decoded
+    const uint8_t *src = reader->data + block->offset;
+    const uint8_t *bits = src + 8 + 4*TS_STORE_FIELDS_NUM;
+    uint32_t deltas[TS_STORE_BLOCK_SAMPLES];
+
+    if(time_ms != NULL)
+    {
+        memcpy(&time_ms[0], src, 8);
+        ts_store_unpack(src + TS_STORE_BLOCK_HEAD_LEN, block->count - 1, bits[0], deltas);
+        for(uint16_t i=1; i<block->count; ++i)
+            time_ms[i] = time_ms[i - 1] + deltas[i - 1];
+    }
+    if(values != NULL && field < TS_STORE_FIELDS_NUM)
+    {
+        size_t offset = TS_STORE_BLOCK_HEAD_LEN;
+        for(int c=0; c<=(int)field; ++c)
+            offset += ts_store_column_len(block->count, bits[c]);
+
+        memcpy(&values[0], src + 8 + 4*field, 4);
+        ts_store_unpack(src + offset, block->count - 1, bits[field + 1], deltas);
+        for(uint16_t i=1; i<block->count; ++i)
+            values[i] = (int32_t)((uint32_t)values[i - 1] + (uint32_t)ts_store_unzigzag(deltas[i - 1]));
+    }
+    return block->count;
+}
+
+
+static int32_t ts_store_find(const uint64_t *devices, uint32_t num, uint64_t device) //index in sorted devices, -1 - not found
+{
+    uint32_t lo = 0, hi = num;
+    while(lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if(devices[mid] < device)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < num && devices[lo] == device) ? (int32_t)lo : -1;
+}
+
+
+ts_store_error_t ts_store_query_max(const ts_store_reader_t *reader, const uint64_t *devices, uint32_t devices_num, uint8_t type,
+                                    ts_store_field_t field, int64_t from_ms, int64_t to_ms, int32_t *dst)
+{                                                           //max of field in [from_ms, to_ms] for every device (devices sorted),
+    int64_t time_ms[TS_STORE_BLOCK_SAMPLES];                //INT32_MIN - no sample
+    int32_t values[TS_STORE_BLOCK_SAMPLES];
+
+    if(field >= TS_STORE_FIELDS_NUM)
+        return TS_STORE_BAD_FIELD;
+    for(uint32_t i=0; i<devices_num; ++i)
+        dst[i] = INT32_MIN;
+
+    for(size_t b=0; b<reader->blocks_num; ++b)
+    {
+        const ts_store_block_t *block = &(reader->blocks[b]);
+        if(block->type != type || block->time_max_ms < from_ms || block->time_min_ms > to_ms)
+            continue;
+        int32_t d = ts_store_find(devices, devices_num, block->device);
+        if(d < 0 || block->max[field] <= dst[d])
+            continue;
+
+        if(block->time_min_ms >= from_ms && block->time_max_ms <= to_ms)
+        {
+            dst[d] = block->max[field]; // whole block in range - index only
+            continue;
+        }
+        uint16_t num = ts_store_block_decode(reader, block, field, time_ms, values);
+        for(uint16_t i=0; i<num; ++i)
+        {
+            if(time_ms[i] >= from_ms && time_ms[i] <= to_ms && values[i] > dst[d])
+                dst[d] = values[i];
+        }
+    }
+    return TS_STORE_OK;
+}
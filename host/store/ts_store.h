@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef TS_STORE_H_
+#define TS_STORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Append-only columnar store of decoded measurements, one series per device (BD address) and measurement type.
+// Two files: PATH.dat - blocks of up to TS_STORE_BLOCK_SAMPLES samples of one series, every column (time + fields)
+// delta coded (zigzag) and bitpacked with own width; PATH.idx - fixed size entry per block with time range and
+// min/max of every field. Reader mmaps both files - query reads index in place and decodes only columns it needs
+// of blocks which are not fully inside time range (min/max of whole block answers the rest).
+// Numbers are little endian, files are written by host tools only.
+
+//CONFIG
+#define TS_STORE_BLOCK_SAMPLES      256     // samples of block, live data of device: 24h
+#define TS_STORE_SERIES_MIN         1024    // slots of writer series table, power of 2
+
+#define TS_STORE_VERSION            1
+#define TS_STORE_IDX_MAGIC          "MASIDX01"
+#define TS_STORE_DAT_MAGIC          "MASDAT01"
+#define TS_STORE_HEAD_LEN           32
+#define TS_STORE_PAD                8       // after every block, unpack reads 8 bytes at once
+#define TS_STORE_BLOCK_HEAD_LEN     (8 + 4*TS_STORE_FIELDS_NUM + TS_STORE_FIELDS_NUM + 1) // first time, first values, bits of columns
+
+//ERROR
+typedef enum {
+    TS_STORE_OK             = 0,
+    TS_STORE_FAIL_OPEN      = -1,
+    TS_STORE_BAD_FILE       = -2,   // bad magic, version or size of index
+    TS_STORE_FAIL_WRITE     = -3,
+    TS_STORE_NO_MEMORY      = -4,
+    TS_STORE_OUT_OF_ORDER   = -5,   // sample older than last sample of series
+    TS_STORE_BAD_FIELD      = -6
+} ts_store_error_t;
+
+typedef enum { // fields of payload_measurement_schema without type, in the same order
+    TS_STORE_FIELD_TEMPERATURE = 0,     // 0.1 C
+    TS_STORE_FIELD_HUMIDITY,            // 0.1 %
+    TS_STORE_FIELD_SM_PM10,
+    TS_STORE_FIELD_SM_PM25,
+    TS_STORE_FIELD_SM_PM100,
+    TS_STORE_FIELD_AE_PM10,
+    TS_STORE_FIELD_AE_PM25,
+    TS_STORE_FIELD_AE_PM100,
+    TS_STORE_FIELD_UM3,
+    TS_STORE_FIELD_UM5,
+    TS_STORE_FIELD_UM10,
+    TS_STORE_FIELD_UM25,
+    TS_STORE_FIELD_UM50,
+    TS_STORE_FIELD_UM100,
+    TS_STORE_FIELD_ESP_TEMPERATURE,
+    TS_STORE_FIELDS_NUM
+} ts_store_field_t;
+
+typedef struct { // entry of PATH.idx, read in place from mmap
+    uint64_t    device;                         // BD address
+    int64_t     time_min_ms;                    // unix time of first and last sample
+    int64_t     time_max_ms;
+    uint64_t    offset;                         // of block in PATH.dat
+    uint32_t    size;                           // bytes of block with TS_STORE_PAD
+    uint16_t    count;                          // samples
+    uint8_t     type;                           // 0 - live, 1 - avg, 2 - 1h avg, 3 - 24h avg
+    uint8_t     reserved;
+    int32_t     min[TS_STORE_FIELDS_NUM];
+    int32_t     max[TS_STORE_FIELDS_NUM];
+} ts_store_block_t;
+
+typedef struct { // pending samples of one series, column-major
+    uint64_t    device;
+    uint8_t     type;
+    uint8_t     used;
+    uint16_t    count;
+    uint16_t    capacity;
+    int64_t     last_ms;                        // samples of series are appended in time order
+    int64_t     *time_ms;
+    int32_t     *values;                        // [TS_STORE_FIELDS_NUM][capacity]
+} ts_store_series_t;
+
+typedef struct {
+    FILE                *idx;
+    FILE                *dat;
+    uint64_t            dat_size;
+    ts_store_series_t   *series;                // open addressing by device and type
+    uint32_t            series_size;
+    uint32_t            series_num;
+    uint64_t            samples;
+    uint64_t            blocks;
+} ts_store_writer_t;
+
+typedef struct {
+    const ts_store_block_t  *blocks;            // points into mmap of PATH.idx
+    size_t                  blocks_num;
+    const uint8_t           *data;              // mmap of PATH.dat
+    size_t                  data_size;
+    size_t                  idx_size;
+    const uint8_t           *idx_map;
+} ts_store_reader_t;
+
+
+ts_store_error_t ts_store_writer_open(ts_store_writer_t *writer, const char *path);
+ts_store_error_t ts_store_append(ts_store_writer_t *writer, uint64_t device, uint8_t type, int64_t time_ms, const int32_t *values);
+ts_store_error_t ts_store_flush(ts_store_writer_t *writer);
+ts_store_error_t ts_store_writer_close(ts_store_writer_t *writer);
+
+ts_store_error_t ts_store_reader_open(ts_store_reader_t *reader, const char *path);
+void ts_store_reader_close(ts_store_reader_t *reader);
+uint16_t ts_store_block_decode(const ts_store_reader_t *reader, const ts_store_block_t *block, ts_store_field_t field, int64_t *time_ms, int32_t *values);
+ts_store_error_t ts_store_query_max(const ts_store_reader_t *reader, const uint64_t *devices, uint32_t devices_num, uint8_t type,
+                                   ts_store_field_t field, int64_t from_ms, int64_t to_ms, int32_t *dst);
+
+#endif
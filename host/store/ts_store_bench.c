@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+// Benchmark of ts_store against row-oriented baseline (file of fixed size rows in time order, mmap, binary search
+// of time range): ingest rate, size of files and latency of "max PM2.5 over week for every device" query.
+// Results of both stores are compared, exit code 1 on mismatch.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bench.h"
+#include "ts_store.h"
+
+#define BENCH_CYCLE_MS      340000          // new live data of device
+#define BENCH_WEEK_MS       (7 * 24 * 3600 * 1000ll)
+#define BENCH_START_MS      1640995200000ll // 2022-01-01 00:00:00 UTC
+#define BENCH_REPEAT        21              // median of query latency
+
+typedef struct { // row of baseline
+    int64_t     time_ms;
+    uint64_t    device;
+    uint8_t     type;
+    uint8_t     reserved;
+    int16_t     values[TS_STORE_FIELDS_NUM];
+} bench_row_t;
+
+
+static int bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+static uint64_t bench_device(uint32_t index) //BD address, sorted by index
+{
+    return 0x240AC4000000ull | index;
+}
+
+
+static void bench_sample(uint32_t *state, int32_t *values) //random walk of measurement
+{
+    int32_t pm = values[TS_STORE_FIELD_SM_PM25] + (int32_t)(bench_rand(state) % 7) - 3;
+    if(pm < 0)
+        pm = 0;
+    if(pm > 999)
+        pm = 999;
+    values[TS_STORE_FIELD_TEMPERATURE] += (int32_t)(bench_rand(state) % 5) - 2;
+    values[TS_STORE_FIELD_HUMIDITY] += (int32_t)(bench_rand(state) % 9) - 4;
+    values[TS_STORE_FIELD_SM_PM10] = values[TS_STORE_FIELD_AE_PM10] = pm * 2 / 3;
+    values[TS_STORE_FIELD_SM_PM25] = values[TS_STORE_FIELD_AE_PM25] = pm;
+    values[TS_STORE_FIELD_SM_PM100] = values[TS_STORE_FIELD_AE_PM100] = pm * 4 / 3;
+    for(int j=TS_STORE_FIELD_UM3; j<=TS_STORE_FIELD_UM100; ++j)
+        values[j] = (pm * 300 + bench_rand(state) % 64) >> (2 * (j - TS_STORE_FIELD_UM3));
+    values[TS_STORE_FIELD_ESP_TEMPERATURE] = 110 + bench_rand(state) % 4;
+}
+
+
+static void bench_query_rows(const bench_row_t *rows, size_t num, const uint64_t *devices, uint32_t devices_num,
+                             int64_t from_ms, int64_t to_ms, int32_t *dst)
+{
+    size_t lo = 0, hi = num;
+    while(lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if(rows[mid].time_ms < from_ms)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for(uint32_t i=0; i<devices_num; ++i)
+        dst[i] = INT32_MIN;
+    for(size_t r=lo; r<num && rows[r].time_ms <= to_ms; ++r)
+    {
+        if(rows[r].type != 0)
+            continue;
+        // devices are dense in bench, baseline gets the same binary search as ts_store
+        uint32_t a = 0, b = devices_num;
+        while(a < b)
+        {
+            uint32_t mid = (a + b) / 2;
+            if(devices[mid] < rows[r].device)
+                a = mid + 1;
+            else
+                b = mid;
+        }
+        if(a < devices_num && devices[a] == rows[r].device && rows[r].values[TS_STORE_FIELD_SM_PM25] > dst[a])
+            dst[a] = rows[r].values[TS_STORE_FIELD_SM_PM25];
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    uint32_t devices_num = 1000;
+    double days = 30.0;
+    const char *dir = "/tmp";
+    const bench_option_t options[] = {
+        {"--devices", BENCH_OPTION_U32, &devices_num},
+        {"--days", BENCH_OPTION_DOUBLE, &days},
+        {"--dir", BENCH_OPTION_STRING, &dir},
+    };
+
+    if(bench_options_parse(argc, argv, options, sizeof(options)/sizeof(options[0])) != 0)
+        return 1;
+
+    char store_path[4096], rows_path[4096], name[4200];
+    snprintf(store_path, sizeof(store_path), "%s/ts_store_bench", dir);
+    snprintf(rows_path, sizeof(rows_path), "%s/ts_store_bench.rows", dir);
+    snprintf(name, sizeof(name), "%s.idx", store_path);
+    unlink(name);
+    snprintf(name, sizeof(name), "%s.dat", store_path);
+    unlink(name);
+
+    uint64_t *devices = malloc(devices_num * sizeof(uint64_t));
+    int32_t *values = malloc((size_t)devices_num * TS_STORE_FIELDS_NUM * sizeof(int32_t));
+    int32_t *max_store = malloc(devices_num * sizeof(int32_t));
+    int32_t *max_rows = malloc(devices_num * sizeof(int32_t));
+    FILE *rows_file = fopen(rows_path, "wb");
+    ts_store_writer_t writer;
+    if(devices == NULL || values == NULL || max_store == NULL || max_rows == NULL || rows_file == NULL
+        || ts_store_writer_open(&writer, store_path) != TS_STORE_OK)
+    {
+        fprintf(stderr, "Fail create store in %s.\n", dir);
+        return 1;
+    }
+    setvbuf(rows_file, NULL, _IOFBF, 1 << 20);
+
+    uint32_t seed = 0x12345678;
+    for(uint32_t d=0; d<devices_num; ++d)
+    {
+        devices[d] = bench_device(d);
+        int32_t *v = values + (size_t)d * TS_STORE_FIELDS_NUM;
+        v[TS_STORE_FIELD_TEMPERATURE] = 150 + bench_rand(&seed) % 100;
+        v[TS_STORE_FIELD_HUMIDITY] = 300 + bench_rand(&seed) % 400;
+        v[TS_STORE_FIELD_SM_PM25] = 5 + bench_rand(&seed) % 80;
+    }
+
+    // samples in time order of all devices, as from gateway
+    uint64_t cycles = days * 24 * 3600 * 1000 / BENCH_CYCLE_MS;
+    uint64_t samples = 0;
+    double store_time = 0.0, rows_time = 0.0, start;
+    int ret = 0;
+    for(uint64_t c=0; c<cycles && ret == 0; ++c)
+    {
+        for(uint32_t d=0; d<devices_num; ++d)
+        {
+            int32_t *v = values + (size_t)d * TS_STORE_FIELDS_NUM;
+            int64_t time_ms = BENCH_START_MS + c * BENCH_CYCLE_MS + (uint64_t)d * BENCH_CYCLE_MS / devices_num;
+            bench_sample(&seed, v);
+
+            start = bench_now();
+            if(ts_store_append(&writer, devices[d], 0, time_ms, v) != TS_STORE_OK)
+                ret = 1;
+            store_time += bench_now() - start;
+
+            bench_row_t row = { .time_ms = time_ms, .device = devices[d] };
+            for(int f=0; f<TS_STORE_FIELDS_NUM; ++f)
+                row.values[f] = v[f];
+            start = bench_now();
+            if(fwrite(&row, sizeof(row), 1, rows_file) != 1)
+                ret = 1;
+            rows_time += bench_now() - start;
+            ++samples;
+        }
+    }
+    start = bench_now();
+    uint64_t blocks = writer.blocks;
+    if(ts_store_writer_close(&writer) != TS_STORE_OK)
+        ret = 1;
+    store_time += bench_now() - start;
+    start = bench_now();
+    if(fclose(rows_file) != 0)
+        ret = 1;
+    rows_time += bench_now() - start;
+    if(ret != 0)
+    {
+        fprintf(stderr, "Fail write stores.\n");
+        return 1;
+    }
+
+    ts_store_reader_t reader;
+    struct stat st;
+    int fd = open(rows_path, O_RDONLY);
+    if(ts_store_reader_open(&reader, store_path) != TS_STORE_OK || fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Fail open stores.\n");
+        return 1;
+    }
+    const bench_row_t *rows = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    size_t rows_num = st.st_size / sizeof(bench_row_t);
+    if(rows == MAP_FAILED)
+    {
+        perror(rows_path);
+        return 1;
+    }
+
+    printf("devices %u, days %.0f, samples %llu (%zu B raw row), blocks %llu+%llu partial\n", devices_num, days,
+        (unsigned long long)samples, sizeof(bench_row_t), (unsigned long long)blocks,
+        (unsigned long long)(reader.blocks_num - blocks));
+    printf("%-10s %10s %12s %10s %10s %12s %12s\n", "store", "ingest", "rate", "size", "B/sample", "week end", "week mid");
+    int64_t end_ms = BENCH_START_MS + cycles * BENCH_CYCLE_MS;
+    int64_t ranges[2][2] = {{end_ms - BENCH_WEEK_MS, end_ms}, {end_ms / 2 + BENCH_START_MS / 2 - BENCH_WEEK_MS / 2 + 12345, 0}};
+    ranges[1][1] = ranges[1][0] + BENCH_WEEK_MS;
+    double latency[2][2];
+
+    for(int q=0; q<2; ++q)
+    {
+        double t[2][BENCH_REPEAT];
+        for(int r=0; r<BENCH_REPEAT; ++r)
+        {
+            start = bench_now();
+            ts_store_query_max(&reader, devices, devices_num, 0, TS_STORE_FIELD_SM_PM25, ranges[q][0], ranges[q][1], max_store);
+            t[0][r] = bench_now() - start;
+            start = bench_now();
+            bench_query_rows(rows, rows_num, devices, devices_num, ranges[q][0], ranges[q][1], max_rows);
+            t[1][r] = bench_now() - start;
+        }
+        for(int s=0; s<2; ++s)
+        {
+            qsort(t[s], BENCH_REPEAT, sizeof(double), bench_cmp_double);
+            latency[s][q] = t[s][BENCH_REPEAT / 2];
+        }
+        if(memcmp(max_store, max_rows, devices_num * sizeof(int32_t)) != 0)
+        {
+            fprintf(stderr, "Mismatch of query results (range %d).\n", q);
+            ret = 1;
+        }
+    }
+
+    size_t store_size = reader.idx_size + reader.data_size;
+    printf("%-10s %8.3f s %7.2f M/s %7.1f MB %10.2f %9.3f ms %9.3f ms\n", "ts_store", store_time, samples / store_time * 1e-6,
+        store_size / 1e6, (double)store_size / samples, latency[0][0] * 1e3, latency[0][1] * 1e3);
+    printf("%-10s %8.3f s %7.2f M/s %7.1f MB %10.2f %9.3f ms %9.3f ms\n", "rows", rows_time, samples / rows_time * 1e-6,
+        st.st_size / 1e6, (double)st.st_size / samples, latency[1][0] * 1e3, latency[1][1] * 1e3);
+
+    munmap((void*)rows, st.st_size);
+    close(fd);
+    ts_store_reader_close(&reader);
+    free(devices);
+    free(values);
+    free(max_store);
+    free(max_rows);
+    return ret;
+}
@@ -3,15 +3,18 @@
  * Slawomir Krzykala. All rights reserved.
  */ 
 #include "ble_adv.h"
+#include "payload.h"
 
 static const char *TAG = "BLE_ADV";
 
 static esp_bt_controller_config_t ble_adv_bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
 
+#define BLE_ADV_FRAMES_TYPE (BLE_ADV_SCAN_RSP ? ADV_TYPE_SCAN_IND : ADV_TYPE_NONCONN_IND) // frames have no Flags AD, never connectable
+
 static esp_ble_adv_params_t ble_adv_params = {
     .adv_int_min        = 0x20,
     .adv_int_max        = 0x40,
-    .adv_type           = ADV_TYPE_NONCONN_IND, 
+    .adv_type           = BLE_ADV_FRAMES_TYPE,
     .own_addr_type      = BLE_ADDR_TYPE_PUBLIC,
     .channel_map        = ADV_CHNL_ALL,
     .adv_filter_policy  = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY
@@ -19,18 +22,168 @@ static esp_ble_adv_params_t ble_adv_params = {
 
 //Constant part of  data
 static ble_adv_head_t ble_adv_head = {
-    .len            =0x02,
-    .type           =0x01,
-    .flags          =0x06,
-    .len_payload    =0x1B, 
-    .id             =0x0606
+    .len_payload    =0x1E,
+    .id             =0x0606,
+    .device         =0,
+    .sequence       =0
 };
+#define BLE_ADV_NEIGHBOR_OFFSET offsetof(ble_adv_head_t, device) // relayed part of neighbor frame - device, sequence, payload
+
+typedef struct { // one adv frame, double buffered - rotator reads published buffer, ble_adv_set_data writes staging buffer
+    uint8_t     *buffer[2];
+    uint8_t     published;  // index of published buffer
+    bool        pending;    // staging buffer has new data
+    uint8_t     weight;     // number of slots in one round, 0 - frame is not advertised
+    int16_t     current;    // smooth weighted round robin state
+    uint8_t     response;   // frame in scan response while this frame is aired, BLE_ADV_RESPONSE_NONE - empty
+} ble_adv_frame_t;
 
-static uint8_t **ble_adv_data=NULL; 
+static ble_adv_frame_t *ble_adv_data=NULL; // points to ble_adv_frames when initialized, own frames then relay frames
+static ble_adv_frame_t ble_adv_frames[BLE_ADV_FRAMES_MAX];
+static uint8_t ble_adv_buffers[BLE_ADV_FRAMES_MAX][2][ESP_BLE_ADV_DATA_LEN_MAX];
 
-static uint8_t ble_adv_payload_num=0;
+static uint8_t ble_adv_payload_num=0; // own frames, set by application
+static uint8_t ble_adv_frames_num=0; // own and relay frames in rotation
 static uint8_t ble_adv_payload_size=0;
 
+static SemaphoreHandle_t ble_adv_data_mutex=NULL; // guards ble_adv_data, flip of buffers and HCI call
+static SemaphoreHandle_t ble_adv_set_complete=NULL; // given by ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT
+static TaskHandle_t ble_adv_changer_task=NULL;
+MEM_SEMAPHORE_DEFINE(ble_adv_data_mutex);
+MEM_SEMAPHORE_DEFINE(ble_adv_set_complete);
+MEM_TASK_DEFINE(ble_adv_changer_task, BLE_ADV_TASK_STACK);
+typedef struct { // data held by controller, HCI command is sent only if data to air differs
+    uint8_t     data[ESP_BLE_ADV_DATA_LEN_MAX];
+    uint8_t     len;
+    bool        valid;      // false - unknown (nothing set yet, HCI command failed)
+} ble_adv_aired_t;
+
+static ble_adv_aired_t ble_adv_aired; // adv data in controller
+static int64_t ble_adv_first_us=-1; // time from boot to first adv data in controller
+
+#if BLE_ADV_SCAN_RSP
+static SemaphoreHandle_t ble_adv_rsp_complete=NULL; // given by ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT
+MEM_SEMAPHORE_DEFINE(ble_adv_rsp_complete);
+static uint8_t ble_adv_rsp_empty[1]; // scan response without data
+static ble_adv_aired_t ble_adv_rsp_aired; // scan response in controller
+
+static const uint8_t *ble_adv_response(ble_adv_frame_t *frame);
+#endif
+
+#if BLE_ADV_RELAY
+static esp_ble_scan_params_t ble_adv_scan_params = {
+    .scan_type          = BLE_SCAN_TYPE_PASSIVE,
+    .own_addr_type      = BLE_ADDR_TYPE_PUBLIC,
+    .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
+    .scan_interval      = BLE_ADV_RELAY_SCAN_INTERVAL,
+    .scan_window        = BLE_ADV_RELAY_SCAN_WINDOW,
+    .scan_duplicate     = BLE_SCAN_DUPLICATE_DISABLE // every adv - neighbors change payload
+};
+
+static SemaphoreHandle_t ble_adv_relay_mutex=NULL; // guards cache, scan results come from BTC task
+MEM_SEMAPHORE_DEFINE(ble_adv_relay_mutex);
+BLE_RELAY_CACHE_DEFINE(ble_adv_relay_cache, BLE_ADV_RELAY_CACHE_SIZE);
+static uint32_t ble_adv_relay_refreshed_ms[BLE_ADV_FRAMES_MAX]; // last new payload of relay frame, index from first relay frame
+
+static ble_adv_error_t ble_adv_relay_start(void);
+static void ble_adv_relay_receive(const uint8_t *addr, int rssi, const uint8_t *data, uint8_t len);
+static void ble_adv_relay_publish(void);
+#endif
+
+#if BLE_ADV_HISTORY
+enum { // attributes of history service, handles in the same order
+    BLE_ADV_HISTORY_IDX_SERVICE = 0,
+    BLE_ADV_HISTORY_IDX_INFO_CHAR,
+    BLE_ADV_HISTORY_IDX_INFO,
+    BLE_ADV_HISTORY_IDX_CONTROL_CHAR,
+    BLE_ADV_HISTORY_IDX_CONTROL,
+    BLE_ADV_HISTORY_IDX_DATA_CHAR,
+    BLE_ADV_HISTORY_IDX_DATA,
+    BLE_ADV_HISTORY_IDX_DATA_CCCD,
+    BLE_ADV_HISTORY_IDX_NUM
+};
+
+typedef struct { // connected client, only one at a time, written from BTC task
+    bool            connected;
+    bool            notify;     // client enabled notifications of data
+    bool            congested;  // TX queue of stack is full
+    uint16_t        conn_id;
+    uint16_t        mtu;
+    uint16_t        data_len;   // LL payload of data packet, 27 until DLE
+} ble_adv_history_conn_t;
+
+#define BLE_ADV_HISTORY_L2CAP_HEAD  7 // L2CAP (4) and ATT (3) headers of notification on air
+
+static const uint8_t ble_adv_history_uuid_service[ESP_UUID_LEN_128] = BLE_ADV_HISTORY_UUID(BLE_ADV_HISTORY_UUID_SERVICE);
+static const uint8_t ble_adv_history_uuid_info[ESP_UUID_LEN_128] = BLE_ADV_HISTORY_UUID(BLE_ADV_HISTORY_UUID_INFO);
+static const uint8_t ble_adv_history_uuid_control[ESP_UUID_LEN_128] = BLE_ADV_HISTORY_UUID(BLE_ADV_HISTORY_UUID_CONTROL);
+static const uint8_t ble_adv_history_uuid_data[ESP_UUID_LEN_128] = BLE_ADV_HISTORY_UUID(BLE_ADV_HISTORY_UUID_DATA);
+static const uint16_t ble_adv_history_uuid_primary = ESP_GATT_UUID_PRI_SERVICE;
+static const uint16_t ble_adv_history_uuid_char = ESP_GATT_UUID_CHAR_DECLARE;
+static const uint16_t ble_adv_history_uuid_cccd = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+static const uint8_t ble_adv_history_prop_read = ESP_GATT_CHAR_PROP_BIT_READ;
+static const uint8_t ble_adv_history_prop_write = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+static const uint8_t ble_adv_history_prop_notify = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t ble_adv_history_cccd_off[2] = {0x00, 0x00};
+static const ble_adv_history_info_t ble_adv_history_info_init = { .version = BLE_ADV_HISTORY_VERSION };
+static const ble_adv_history_request_t ble_adv_history_request_init = {0};
+
+// values are kept by stack (ESP_GATT_AUTO_RSP), data is only notified
+static const esp_gatts_attr_db_t ble_adv_history_db[BLE_ADV_HISTORY_IDX_NUM] = {
+    [BLE_ADV_HISTORY_IDX_SERVICE]       = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&ble_adv_history_uuid_primary, ESP_GATT_PERM_READ,
+                                           ESP_UUID_LEN_128, ESP_UUID_LEN_128, (uint8_t*)ble_adv_history_uuid_service}},
+    [BLE_ADV_HISTORY_IDX_INFO_CHAR]     = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&ble_adv_history_uuid_char, ESP_GATT_PERM_READ,
+                                           1, 1, (uint8_t*)&ble_adv_history_prop_read}},
+    [BLE_ADV_HISTORY_IDX_INFO]          = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t*)ble_adv_history_uuid_info, ESP_GATT_PERM_READ,
+                                           sizeof(ble_adv_history_info_t), sizeof(ble_adv_history_info_t), (uint8_t*)&ble_adv_history_info_init}},
+    [BLE_ADV_HISTORY_IDX_CONTROL_CHAR]  = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&ble_adv_history_uuid_char, ESP_GATT_PERM_READ,
+                                           1, 1, (uint8_t*)&ble_adv_history_prop_write}},
+    [BLE_ADV_HISTORY_IDX_CONTROL]       = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t*)ble_adv_history_uuid_control, ESP_GATT_PERM_WRITE,
+                                           sizeof(ble_adv_history_request_t), sizeof(ble_adv_history_request_t), (uint8_t*)&ble_adv_history_request_init}},
+    [BLE_ADV_HISTORY_IDX_DATA_CHAR]     = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&ble_adv_history_uuid_char, ESP_GATT_PERM_READ,
+                                           1, 1, (uint8_t*)&ble_adv_history_prop_notify}},
+    [BLE_ADV_HISTORY_IDX_DATA]          = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t*)ble_adv_history_uuid_data, 0,
+                                           0, 0, NULL}},
+    [BLE_ADV_HISTORY_IDX_DATA_CCCD]     = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&ble_adv_history_uuid_cccd, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                                           sizeof(ble_adv_history_cccd_off), sizeof(ble_adv_history_cccd_off), (uint8_t*)ble_adv_history_cccd_off}}
+};
+
+static esp_gatt_if_t ble_adv_history_if=ESP_GATT_IF_NONE;
+static uint16_t ble_adv_history_handles[BLE_ADV_HISTORY_IDX_NUM];
+static ble_adv_history_conn_t ble_adv_history_conn;
+static QueueHandle_t ble_adv_history_requests=NULL; // written by client, new request replaces waiting one and stops stream
+static SemaphoreHandle_t ble_adv_history_uncongested=NULL; // given by ESP_GATTS_CONGEST_EVT and disconnect
+static TaskHandle_t ble_adv_history_task=NULL;
+MEM_QUEUE_DEFINE(ble_adv_history_requests, 1, sizeof(ble_adv_history_request_t));
+MEM_SEMAPHORE_DEFINE(ble_adv_history_uncongested);
+MEM_TASK_DEFINE(ble_adv_history_task, BLE_ADV_HISTORY_TASK_STACK);
+static uint8_t ble_adv_history_buffer[BLE_ADV_HISTORY_MTU - 3]; // notification, ATT header takes 3 bytes of ATT_MTU
+
+typedef struct __attribute__((__packed__)) { // adv data of connectable slot, phone finds device by service UUID
+    uint8_t     flags[3];   // Flags AD, needed in connectable adv
+    uint8_t     uuid_len;
+    uint8_t     uuid_type;
+    uint8_t     uuid[ESP_UUID_LEN_128];
+} ble_adv_history_adv_t;//21bytes
+
+static const ble_adv_history_adv_t ble_adv_history_adv = {
+    .flags      = {2, ESP_BLE_AD_TYPE_FLAG, ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT},
+    .uuid_len   = 1 + ESP_UUID_LEN_128,
+    .uuid_type  = ESP_BLE_AD_TYPE_128SRV_CMPL,
+    .uuid       = BLE_ADV_HISTORY_UUID(BLE_ADV_HISTORY_UUID_SERVICE)
+};
+
+static ble_adv_error_t ble_adv_history_init(void);
+static uint8_t ble_adv_history_records_max(void);
+static void ble_adv_history_update_info(void);
+static void ble_adv_history_gatts_cb(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+static void ble_adv_history_stream_task(void *parameter);
+static void ble_adv_history_set_type(esp_ble_adv_type_t type);
+#endif
+
+static ble_adv_error_t ble_adv_start(void);
+static bool ble_adv_aired_same(const ble_adv_aired_t *aired, const uint8_t *data, uint8_t len);
+static void ble_adv_aired_set(ble_adv_aired_t *aired, const uint8_t *data, uint8_t len, bool valid);
 static void ble_adv_data_changer_task(void *parameter);
 void __attribute__((weak)) ble_adv_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
 
@@ -66,77 +219,246 @@ ble_adv_error_t ble_adv_bt_init(void) //init BLE, register callback event functi
         return BLE_ADV_FAIL_REG_CALLBACK; 
     }
 
+#if BLE_ADV_HISTORY
+    return ble_adv_history_init();
+#else
     return BLE_ADV_OK;
+#endif
 }
 
 
-ble_adv_error_t ble_adv_data_init(uint8_t payload_num, uint8_t payload_size) //init data (only alloc memory and set head frames,
+ble_adv_error_t ble_adv_data_init(uint8_t payload_num, uint8_t payload_size) //init data (only set head of static frames,
 {                                                                            // dont set payload (data)) ble adv and create new task - cyclic changing adv frame 
     ble_adv_data_deinit();
 
+    if(payload_num>BLE_ADV_FRAMES_MAX)
+    {
+        ESP_LOGE(TAG, "Fail init data, number of frames (%u) is to large - max %u.", payload_num, BLE_ADV_FRAMES_MAX);
+        return BLE_ADV_TOO_MANY_FRAMES;
+    }
+
     if(sizeof(ble_adv_head)+payload_size>ESP_BLE_ADV_DATA_LEN_MAX)
     {
         ESP_LOGE(TAG, "Fail init data, size head+payload = (%u) is to large - max 31bytes.", sizeof(ble_adv_head)+payload_size);
         return BLE_ADV_DATA_TOO_SIZE;
     }
+
+    if(ble_adv_data_mutex==NULL)
+        ble_adv_data_mutex=MEM_SEMAPHORE_CREATE_MUTEX(ble_adv_data_mutex);
+    if(ble_adv_set_complete==NULL)
+        ble_adv_set_complete=MEM_SEMAPHORE_CREATE_BINARY(ble_adv_set_complete);
+#if BLE_ADV_SCAN_RSP
+    if(ble_adv_rsp_complete==NULL)
+        ble_adv_rsp_complete=MEM_SEMAPHORE_CREATE_BINARY(ble_adv_rsp_complete);
+#endif
     
+    xSemaphoreTake(ble_adv_data_mutex, portMAX_DELAY);
     ble_adv_payload_num=payload_num;
+    ble_adv_frames_num=payload_num;
+#if BLE_ADV_RELAY
+    ble_adv_frames_num+=BLE_ADV_RELAY_FRAMES; // relay takes only spare frames
+    if(ble_adv_frames_num>BLE_ADV_FRAMES_MAX)
+        ble_adv_frames_num=BLE_ADV_FRAMES_MAX;
+#endif
     ble_adv_payload_size=payload_size;
-    ble_adv_head.len_payload=payload_size+2;// 2=size id from head
+    ble_adv_head.len_payload=payload_size+sizeof(ble_adv_head)-1;// all after len
+    ble_adv_head.device=ble_adv_device_id();
 
-    ble_adv_data=malloc(sizeof(uint8_t*) * payload_num);
+    ble_adv_data=ble_adv_frames;
 
-    for(uint8_t i=0; i<payload_num; ++i)
+    for(uint8_t i=0; i<ble_adv_frames_num; ++i)
     {
-        ble_adv_data[i]=calloc(payload_size+sizeof(ble_adv_head), 1);
-        memcpy(ble_adv_data[i], &ble_adv_head, sizeof(ble_adv_head));
+        for(uint8_t j=0; j<2; ++j)
+        {
+            ble_adv_data[i].buffer[j]=ble_adv_buffers[i][j];
+            memcpy(ble_adv_data[i].buffer[j], &ble_adv_head, sizeof(ble_adv_head));
+        }
+        ble_adv_data[i].weight=1;
+        ble_adv_data[i].response=BLE_ADV_RESPONSE_NONE;
     }
-
-    xTaskCreate(ble_adv_data_changer_task, "adv data changer", 1024, NULL, 1, NULL);
-
-    if(esp_ble_gap_start_advertising(&ble_adv_params)!=0)
+#if BLE_ADV_RELAY
+    for(uint8_t i=ble_adv_payload_num; i<ble_adv_frames_num; ++i)
     {
-        ESP_LOGE(TAG, "Fail fail start advertising");
-        return BLE_ADV_FAIL_START_ADV; 
+        const uint16_t id = BLE_ADV_RELAY_ID;
+        for(uint8_t j=0; j<2; ++j)
+            memcpy(ble_adv_data[i].buffer[j]+offsetof(ble_adv_head_t, id), &id, sizeof(id));
+        ble_adv_data[i].weight=0; // aired since first neighbor
     }
+#endif
+    xSemaphoreGive(ble_adv_data_mutex);
+
+    if(ble_adv_changer_task==NULL)
+        MEM_TASK_CREATE(ble_adv_changer_task, ble_adv_data_changer_task, "adv data changer", NULL, BLE_ADV_TASK_PRIO, &ble_adv_changer_task);
+
+    if(ble_adv_start()!=BLE_ADV_OK)
+        return BLE_ADV_FAIL_START_ADV;
+#if BLE_ADV_RELAY
+    return ble_adv_relay_start();
+#else
     return BLE_ADV_OK;
+#endif
 }
 
 
-ble_adv_error_t ble_adv_data_deinit(void) //delete adv frames and free memory
+ble_adv_error_t ble_adv_data_deinit(void) //delete adv frames, memory is static - only cleared
 {
     esp_ble_gap_stop_advertising();
+#if BLE_ADV_RELAY
+    esp_ble_gap_stop_scanning();
+#endif
 
-    if(ble_adv_data!=NULL)
-    {
-        for(uint8_t i=0; i<ble_adv_payload_num; ++i)
-        {
-            free(ble_adv_data[i]);
-            ble_adv_data[i]=NULL;
-        }
-        free(ble_adv_data);
-        ble_adv_data=NULL;
-    }
+    if(ble_adv_data_mutex!=NULL)
+        xSemaphoreTake(ble_adv_data_mutex, portMAX_DELAY);
+
+    ble_adv_data=NULL;
+    memset(ble_adv_frames, 0, sizeof(ble_adv_frames));
+    memset(ble_adv_buffers, 0, sizeof(ble_adv_buffers));
 
     ble_adv_payload_num=0;
+    ble_adv_frames_num=0;
     ble_adv_payload_size=0;
+    ble_adv_aired.valid=false;
+#if BLE_ADV_SCAN_RSP
+    ble_adv_rsp_aired.valid=false;
+#endif
+
+    if(ble_adv_data_mutex!=NULL)
+        xSemaphoreGive(ble_adv_data_mutex);
     return BLE_ADV_OK;
 }
 
 
-ble_adv_error_t ble_adv_set_data(const uint8_t *payload, uint8_t num) //set/change payload (data) adv frame
+ble_adv_error_t ble_adv_set_data(const uint8_t *payload, uint8_t num) //set/change payload (data) adv frame, published at next slot of frame
 {   
+    uint8_t *staging = ble_adv_data_acquire(num);
+    if(staging==NULL)
+        return BLE_ADV_FAIL_SET_DATA;
+
+    memcpy(staging, payload, ble_adv_payload_size);
+    return ble_adv_data_commit(num);
+}
+
+
+uint8_t *ble_adv_data_acquire(uint8_t num) //lock frames and return staging payload of frame - to encode data directly in place,
+{                                          //must be followed by ble_adv_data_commit
+    if(num>=ble_adv_payload_num)
+    {
+        ESP_LOGE(TAG, "Acquire payload fail, num (%u) is bad number of data.", num);
+        return NULL;
+    }
+
+    xSemaphoreTake(ble_adv_data_mutex, portMAX_DELAY);
+    ble_adv_frame_t *frame = &(ble_adv_data[num]);
+    return frame->buffer[frame->published^1]+sizeof(ble_adv_head);
+}
+
+
+ble_adv_error_t ble_adv_data_commit(uint8_t num) //unlock frames, staging payload is published at next slot of frame if it differs,
+{                                                  //sequence of data is set in head of staging buffer
+    ble_adv_frame_t *frame = &(ble_adv_data[num]);
+
+    frame->buffer[frame->published^1][offsetof(ble_adv_head_t, sequence)] = ble_adv_head.sequence;
+    frame->pending = memcmp(frame->buffer[frame->published], frame->buffer[frame->published^1],
+                            sizeof(ble_adv_head)+ble_adv_payload_size) != 0;
+    xSemaphoreGive(ble_adv_data_mutex);
+    return BLE_ADV_OK;
+}
+
+
+ble_adv_error_t ble_adv_set_weight(uint8_t num, uint8_t weight) //set number of slots of frame in one round of rotation
+{
+    if(num>=ble_adv_payload_num)
+    {
+        ESP_LOGE(TAG, "Set weight fail, num (%u) is bad number of data.", num);
+        return BLE_ADV_FAIL_SET_DATA;
+    }
+
+    xSemaphoreTake(ble_adv_data_mutex, portMAX_DELAY);
+    ble_adv_data[num].weight = weight;
+    ble_adv_data[num].current = 0;
+    xSemaphoreGive(ble_adv_data_mutex);
+    return BLE_ADV_OK;
+}
+
+
+int64_t ble_adv_first_time(void) //us from boot to first adv data in controller, -1 - nothing aired yet
+{
+    return ble_adv_first_us;
+}
+
+
+const ble_relay_stats_t *ble_adv_relay_stats(void) //counters of relay cache, NULL - relay mode is off
+{
+#if BLE_ADV_RELAY
+    return &(ble_adv_relay_cache.stats);
+#else
+    return NULL;
+#endif
+}
+
+
+ble_adv_error_t ble_adv_set_id(uint8_t num, uint16_t id) //set id in head of frame - other kind of payload than measurement
+{
     if(num>=ble_adv_payload_num)
     {
-        ESP_LOGE(TAG, "Copy payload fail, num (%u) is bad number of data.", num);
+        ESP_LOGE(TAG, "Set id fail, num (%u) is bad number of data.", num);
+        return BLE_ADV_FAIL_SET_DATA;
+    }
+
+    xSemaphoreTake(ble_adv_data_mutex, portMAX_DELAY);
+    for(uint8_t j=0; j<2; ++j)
+        memcpy(ble_adv_data[num].buffer[j]+offsetof(ble_adv_head_t, id), &id, sizeof(id));
+    xSemaphoreGive(ble_adv_data_mutex);
+    return BLE_ADV_OK;
+}
+
+
+ble_adv_error_t ble_adv_set_sequence(uint8_t sequence) //set cycle of data committed from now on, frame keeps sequence of its data
+{                                                       //until next commit (relay frames keep sequence of neighbor)
+    if(ble_adv_data==NULL)
+    {
+        ESP_LOGE(TAG, "Set sequence fail, data are not initialized.");
+        return BLE_ADV_FAIL_SET_DATA;
+    }
+
+    xSemaphoreTake(ble_adv_data_mutex, portMAX_DELAY);
+    ble_adv_head.sequence = sequence;
+    xSemaphoreGive(ble_adv_data_mutex);
+    return BLE_ADV_OK;
+}
+
+
+ble_adv_error_t ble_adv_set_response(uint8_t num, uint8_t response) //frame aired in scan response together with frame num (BLE_ADV_SCAN_RSP),
+{                                                                   //response frame is used since its first data (weight > 0)
+    if(num>=ble_adv_payload_num || (response>=ble_adv_payload_num && response!=BLE_ADV_RESPONSE_NONE))
+    {
+        ESP_LOGE(TAG, "Set response fail, num (%u) or response (%u) is bad number of data.", num, response);
         return BLE_ADV_FAIL_SET_DATA;
     }
 
-    memcpy(ble_adv_data[num]+sizeof(ble_adv_head), payload, ble_adv_payload_size);
+    xSemaphoreTake(ble_adv_data_mutex, portMAX_DELAY);
+    ble_adv_data[num].response = response;
+    xSemaphoreGive(ble_adv_data_mutex);
     return BLE_ADV_OK;
 }
 
 
+uint16_t ble_adv_device_id(void) //id of device in head of frames
+{
+#if BLE_ADV_DEVICE_ID
+    return BLE_ADV_DEVICE_ID;
+#else
+    uint8_t mac[6];
+    if(esp_read_mac(mac, ESP_MAC_BT) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Fail read BT MAC, device id 0");
+        return 0;
+    }
+    return (mac[4] << 8) | mac[5];
+#endif
+}
+
+
 void __attribute__((weak)) ble_adv_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) //only inform in log status event BLE 
 {
     esp_err_t err;
@@ -152,7 +474,19 @@ void __attribute__((weak)) ble_adv_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_
         {
             ESP_LOGV(TAG, "Adv set data raw successfully");
         }
+        if(ble_adv_set_complete!=NULL)
+            xSemaphoreGive(ble_adv_set_complete); // rotator can send next frame
+        break;
+#if BLE_ADV_SCAN_RSP
+    case ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT:
+        if ((err = param->scan_rsp_data_raw_cmpl.status) != ESP_BT_STATUS_SUCCESS)
+        {
+            ESP_LOGE(TAG, "Scan response set data raw failed: %s", esp_err_to_name(err));
+        }
+        if(ble_adv_rsp_complete!=NULL)
+            xSemaphoreGive(ble_adv_rsp_complete);
         break;
+#endif
     case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
         if ((err = param->adv_start_cmpl.status) != ESP_BT_STATUS_SUCCESS) 
         {
@@ -164,6 +498,57 @@ void __attribute__((weak)) ble_adv_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_
         }
         break;
 
+#if BLE_ADV_RELAY
+    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        if ((err = param->scan_param_cmpl.status) != ESP_BT_STATUS_SUCCESS)
+        {
+            ESP_LOGE(TAG, "Scan params failed: %s", esp_err_to_name(err));
+        }
+        else if (esp_ble_gap_start_scanning(0) != ESP_OK) // scan until ble_adv_data_deinit
+        {
+            ESP_LOGE(TAG, "Fail start scanning");
+        }
+        break;
+
+    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+        if ((err = param->scan_start_cmpl.status) != ESP_BT_STATUS_SUCCESS)
+        {
+            ESP_LOGE(TAG, "Scan start failed: %s", esp_err_to_name(err));
+        }
+        else
+        {
+            ESP_LOGI(TAG, "Scan of neighbors started");
+        }
+        break;
+
+    case ESP_GAP_BLE_SCAN_RESULT_EVT:
+        if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT)
+            ble_adv_relay_receive(param->scan_rst.bda, param->scan_rst.rssi, param->scan_rst.ble_adv, param->scan_rst.adv_data_len);
+        break;
+#endif
+
+#if BLE_ADV_HISTORY
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+        if ((err = param->update_conn_params.status) != ESP_BT_STATUS_SUCCESS)
+        {
+            ESP_LOGW(TAG, "Update of connection params failed: %s", esp_err_to_name(err));
+        }
+        else
+        {
+            ESP_LOGI(TAG, "Connection interval %u x 1.25ms", param->update_conn_params.conn_int);
+        }
+        break;
+
+    case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+        if (param->pkt_data_lenth_cmpl.status == ESP_BT_STATUS_SUCCESS && param->pkt_data_lenth_cmpl.params.tx_len >= 27)
+        {
+            ble_adv_history_conn.data_len = param->pkt_data_lenth_cmpl.params.tx_len;
+            ble_adv_history_update_info();
+            ESP_LOGI(TAG, "Data length %u", ble_adv_history_conn.data_len);
+        }
+        break;
+#endif
+
     case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
         if ((err = param->adv_stop_cmpl.status) != ESP_BT_STATUS_SUCCESS)
         {
@@ -180,16 +565,514 @@ void __attribute__((weak)) ble_adv_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_
     }
 }
 
-static void ble_adv_data_changer_task(void *parameter) //task cyclic changing frames, period 100ms
+static ble_adv_error_t ble_adv_start(void) //start advertising, also again when history client connects (controller stops it)
+{
+    if(esp_ble_gap_start_advertising(&ble_adv_params)!=0)
+    {
+        ESP_LOGE(TAG, "Fail fail start advertising");
+        return BLE_ADV_FAIL_START_ADV; 
+    }
+    return BLE_ADV_OK;
+}
+
+static bool ble_adv_aired_same(const ble_adv_aired_t *aired, const uint8_t *data, uint8_t len) //controller holds the same bytes
+{
+    return aired->valid && aired->len==len && memcmp(aired->data, data, len)==0;
+}
+
+static void ble_adv_aired_set(ble_adv_aired_t *aired, const uint8_t *data, uint8_t len, bool valid) //copy of data sent by HCI command
+{
+    aired->valid = valid;
+    aired->len = len;
+    memcpy(aired->data, data, len);
+}
+
+#if BLE_ADV_SCAN_RSP
+static const uint8_t *ble_adv_response(ble_adv_frame_t *frame) //published buffer of response frame, ble_adv_data_mutex is taken
+{
+    if(frame->response>=ble_adv_frames_num || ble_adv_data[frame->response].weight==0)
+        return ble_adv_rsp_empty; // response frame has no data yet
+
+    ble_adv_frame_t *response = &(ble_adv_data[frame->response]);
+    if(response->pending) // the freshest data also in scan response
+    {
+        response->published ^= 1;
+        response->pending = false;
+    }
+    return response->buffer[response->published];
+}
+#endif
+
+static int ble_adv_next_frame(void) //smooth weighted round robin, frames with higher weight are spread over round
+{
+    int16_t total=0;
+    int best=-1;
+
+    for(uint8_t i=0; i<ble_adv_frames_num; ++i)
+    {
+        if(ble_adv_data[i].weight==0)
+            continue;
+        ble_adv_data[i].current += ble_adv_data[i].weight;
+        total += ble_adv_data[i].weight;
+        if(best<0 || ble_adv_data[i].current > ble_adv_data[best].current)
+            best=i;
+    }
+    if(best>=0)
+        ble_adv_data[best].current -= total;
+    return best;
+}
+
+static void ble_adv_data_changer_task(void *parameter) //task cyclic changing frames, period BLE_ADV_SLOT_MS
 {
+    TickType_t slot_start = xTaskGetTickCount();
+    int64_t set_start = 0;
+    bool set_data;
+#if BLE_ADV_SCAN_RSP
+    bool set_rsp;
+#endif
+#if BLE_ADV_RELAY
+    uint32_t relay_slots = 0;
+#endif
+#if BLE_ADV_HISTORY
+    uint32_t history_slots = 0;
+    bool connectable;
+#endif
+
     while(1)
     {
-        for(uint8_t i=0; i<ble_adv_payload_num; ++i)
+        xSemaphoreTake(ble_adv_data_mutex, portMAX_DELAY);
+#if BLE_ADV_RELAY
+        if(ble_adv_data!=NULL && ++relay_slots >= BLE_ADV_RELAY_SELECT_MS / BLE_ADV_SLOT_MS)
+        {
+            relay_slots = 0;
+            ble_adv_relay_publish();
+        }
+#endif
+#if BLE_ADV_HISTORY
+        // every BLE_ADV_HISTORY_CONN_SLOTS slot announces service, no new client while one is connected
+        connectable = ble_adv_data!=NULL && !ble_adv_history_conn.connected && ++history_slots >= BLE_ADV_HISTORY_CONN_SLOTS;
+        if(connectable)
+            history_slots = 0;
+        int num = ble_adv_data!=NULL && !connectable ? ble_adv_next_frame() : -1;
+#else
+        int num = ble_adv_data!=NULL ? ble_adv_next_frame() : -1;
+#endif
+        set_data = false;
+#if BLE_ADV_SCAN_RSP
+        set_rsp = false;
+#endif
+        set_start = esp_timer_get_time();
+#if BLE_ADV_HISTORY
+        if(num>=0)
+            ble_adv_history_set_type(BLE_ADV_FRAMES_TYPE); // before frame data, it is never aired connectable
+#endif
+        if(num>=0)
+        {
+            ble_adv_frame_t *frame = &(ble_adv_data[num]);
+            if(frame->pending) // flip buffers, staging become published
+            {
+                frame->published ^= 1;
+                frame->pending = false;
+            }
+
+#if BLE_ADV_SCAN_RSP
+            const uint8_t *rsp = ble_adv_response(frame);
+            uint8_t rsp_len = rsp==ble_adv_rsp_empty ? 0 : sizeof(ble_adv_head)+ble_adv_payload_size;
+            if(!ble_adv_aired_same(&ble_adv_rsp_aired, rsp, rsp_len))
+            {
+                set_rsp = true;
+                xSemaphoreTake(ble_adv_rsp_complete, 0);
+                ble_adv_aired_set(&ble_adv_rsp_aired, rsp, rsp_len,
+                    esp_ble_gap_config_scan_rsp_data_raw((uint8_t*)rsp, rsp_len) == ESP_OK);
+            }
+#endif
+            const uint8_t *data = frame->buffer[frame->published];
+            uint8_t data_len = sizeof(ble_adv_head)+ble_adv_payload_size;
+            if(!ble_adv_aired_same(&ble_adv_aired, data, data_len)) // the same bytes in controller - skip HCI update
+            {
+                set_data = true;
+                xSemaphoreTake(ble_adv_set_complete, 0);
+                ble_adv_aired_set(&ble_adv_aired, data, data_len,
+                    esp_ble_gap_config_adv_data_raw((uint8_t*)data, data_len) == ESP_OK);
+            }
+        }
+#if BLE_ADV_HISTORY
+        if(connectable)
+        {
+            const uint8_t *data = (const uint8_t*)&ble_adv_history_adv;
+            if(!ble_adv_aired_same(&ble_adv_aired, data, sizeof(ble_adv_history_adv)))
+            {
+                set_data = true;
+                xSemaphoreTake(ble_adv_set_complete, 0);
+                ble_adv_aired_set(&ble_adv_aired, data, sizeof(ble_adv_history_adv),
+                    esp_ble_gap_config_adv_data_raw((uint8_t*)data, sizeof(ble_adv_history_adv)) == ESP_OK);
+            }
+            ble_adv_history_set_type(ADV_TYPE_IND); // after data with Flags
+        }
+#endif
+        xSemaphoreGive(ble_adv_data_mutex);
+
+#if BLE_ADV_SCAN_RSP
+        if(set_rsp && xSemaphoreTake(ble_adv_rsp_complete, BLE_ADV_SET_TIMEOUT_MS / portTICK_RATE_MS) == pdTRUE && !set_data)
+            diag_latency(DIAG_STAGE_ADV_UPDATE, esp_timer_get_time() - set_start);
+#endif
+        if(set_data && xSemaphoreTake(ble_adv_set_complete, BLE_ADV_SET_TIMEOUT_MS / portTICK_RATE_MS) == pdTRUE)
+        {
+            int64_t now = esp_timer_get_time();
+            diag_latency(DIAG_STAGE_ADV_UPDATE, now - set_start);
+            if(ble_adv_first_us < 0)
+            {
+                ble_adv_first_us = now;
+                diag_boot_adv(now);
+                ESP_LOGI(TAG, "First adv data after %u ms from boot", (uint32_t)(now / 1000));
+            }
+        }
+        vTaskDelayUntil(&slot_start, BLE_ADV_SLOT_MS / portTICK_RATE_MS);
+    }
+}
+
+#if BLE_ADV_RELAY
+static ble_adv_error_t ble_adv_relay_start(void) //clear cache and set scan params, scanning starts in GAP callback
+{
+    if(ble_adv_relay_mutex==NULL)
+        ble_adv_relay_mutex=MEM_SEMAPHORE_CREATE_MUTEX(ble_adv_relay_mutex);
+
+    xSemaphoreTake(ble_adv_relay_mutex, portMAX_DELAY);
+    ble_relay_error_t result = ble_relay_init(&ble_adv_relay_cache, sizeof(ble_adv_head) - BLE_ADV_NEIGHBOR_OFFSET + ble_adv_payload_size);
+    xSemaphoreGive(ble_adv_relay_mutex);
+    if(result != BLE_RELAY_OK)
+    {
+        ESP_LOGE(TAG, "Fail init relay cache (%d)", result);
+        return BLE_ADV_FAIL_SCAN;
+    }
+
+    if(esp_ble_gap_set_scan_params(&ble_adv_scan_params)!=ESP_OK)
+    {
+        ESP_LOGE(TAG, "Fail set scan params");
+        return BLE_ADV_FAIL_SCAN;
+    }
+    return BLE_ADV_OK;
+}
+
+static void ble_adv_relay_receive(const uint8_t *addr, int rssi, const uint8_t *data, uint8_t len) //adv of neighbor, called from BTC task
+{
+    // only live measurement frames - relayed, diagnostics, rollups and foreign frames are dropped (no relay loops)
+    if(ble_adv_payload_size==0 || len!=sizeof(ble_adv_head)+ble_adv_payload_size ||
+        memcmp(data, &ble_adv_head, BLE_ADV_NEIGHBOR_OFFSET)!=0 || PAYLOAD_MEASUREMENT_TYPE(data+sizeof(ble_adv_head))!=0)
+        return;
+
+    xSemaphoreTake(ble_adv_relay_mutex, portMAX_DELAY);
+    ble_relay_update(&ble_adv_relay_cache, addr, rssi, data+BLE_ADV_NEIGHBOR_OFFSET, esp_timer_get_time() / 1000);
+    xSemaphoreGive(ble_adv_relay_mutex);
+}
+
+static void ble_adv_relay_publish(void) //payloads of chosen neighbors to staging buffers of relay frames, ble_adv_data_mutex is taken
+{
+    uint8_t *staging[BLE_ADV_FRAMES_MAX];
+    uint8_t frames = ble_adv_frames_num - ble_adv_payload_num;
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    uint8_t num;
+
+    for(uint8_t i=0; i<frames; ++i)
+    {
+        ble_adv_frame_t *frame = &(ble_adv_data[ble_adv_payload_num + i]);
+        staging[i] = frame->buffer[frame->published^1]+BLE_ADV_NEIGHBOR_OFFSET;
+    }
+
+    xSemaphoreTake(ble_adv_relay_mutex, portMAX_DELAY);
+    num = ble_relay_select(&ble_adv_relay_cache, now_ms, staging, frames);
+    xSemaphoreGive(ble_adv_relay_mutex);
+
+    for(uint8_t i=0; i<num; ++i)
+    {
+        ble_adv_frame_t *frame = &(ble_adv_data[ble_adv_payload_num + i]);
+        frame->pending = memcmp(frame->buffer[frame->published]+BLE_ADV_NEIGHBOR_OFFSET, staging[i],
+                                sizeof(ble_adv_head)-BLE_ADV_NEIGHBOR_OFFSET+ble_adv_payload_size) != 0;
+        frame->weight = 1;
+        ble_adv_relay_refreshed_ms[i] = now_ms;
+    }
+    for(uint8_t i=num; i<frames; ++i) // payload of neighbor gone or out of range is not aired forever
+    {
+        if(now_ms - ble_adv_relay_refreshed_ms[i] > BLE_RELAY_TTL_MS)
+            ble_adv_data[ble_adv_payload_num + i].weight = 0;
+    }
+}
+#endif
+
+#if BLE_ADV_HISTORY
+static void ble_adv_history_set_type(esp_ble_adv_type_t type) //restart advertising with other type, ble_adv_data_mutex is taken
+{
+    if(ble_adv_params.adv_type == type)
+        return;
+    ble_adv_params.adv_type = type;
+    ble_adv_start(); // stack stops running advertising before new params
+}
+
+static ble_adv_error_t ble_adv_history_init(void) //register GATT server app, attribute table is created in ESP_GATTS_REG_EVT
+{
+    if(ble_adv_history_requests==NULL)
+        ble_adv_history_requests=MEM_QUEUE_CREATE(ble_adv_history_requests);
+    if(ble_adv_history_uncongested==NULL)
+        ble_adv_history_uncongested=MEM_SEMAPHORE_CREATE_BINARY(ble_adv_history_uncongested);
+
+    if(esp_ble_gatts_register_callback(ble_adv_history_gatts_cb)!=ESP_OK ||
+    esp_ble_gatts_app_register(BLE_ADV_HISTORY_APP_ID)!=ESP_OK)
+    {
+        ESP_LOGE(TAG, "Fail register history GATT server");
+        return BLE_ADV_FAIL_HISTORY;
+    }
+
+    if(esp_ble_gatt_set_local_mtu(BLE_ADV_HISTORY_MTU)!=ESP_OK)
+    {
+        ESP_LOGE(TAG, "Fail set local MTU %u", BLE_ADV_HISTORY_MTU);
+        return BLE_ADV_FAIL_HISTORY;
+    }
+
+    if(ble_adv_history_task==NULL)
+        MEM_TASK_CREATE(ble_adv_history_task, ble_adv_history_stream_task, "adv history", NULL, BLE_ADV_HISTORY_TASK_PRIO, &ble_adv_history_task);
+    return BLE_ADV_OK;
+}
+
+static uint8_t ble_adv_history_records_max(void) //records in one notification at current ATT_MTU,
+{                                                  // fewer if they fill whole LL packets better (no short last packet)
+    uint16_t mtu = ble_adv_history_conn.mtu < BLE_ADV_HISTORY_MTU ? ble_adv_history_conn.mtu : BLE_ADV_HISTORY_MTU;
+    uint16_t head = BLE_ADV_HISTORY_L2CAP_HEAD + sizeof(ble_adv_history_head_t);
+    uint16_t num = (mtu - 3 - sizeof(ble_adv_history_head_t)) / payload_measurement_schema.size;
+    uint16_t packets = (head + num * payload_measurement_schema.size) / ble_adv_history_conn.data_len;
+    uint16_t fit = packets > 0 ? (packets * ble_adv_history_conn.data_len - head) / payload_measurement_schema.size : 0;
+
+    // num takes packets+1 LL packets (or exactly packets when fit == num)
+    if(fit * (packets + 1) > num * packets)
+        num = fit;
+    return num < UINT8_MAX ? num : UINT8_MAX;
+}
+
+static void ble_adv_history_update_info(void) //range of log and records per notification for next read of client
+{
+    ble_adv_history_info_t info = {
+        .first_cycle    = history_log_first_cycle(),
+        .next_cycle     = history_log_next_cycle(),
+        .version        = BLE_ADV_HISTORY_VERSION,
+        .records_max    = ble_adv_history_records_max()
+    };
+
+    esp_ble_gatts_set_attr_value(ble_adv_history_handles[BLE_ADV_HISTORY_IDX_INFO], sizeof(info), (const uint8_t*)&info);
+}
+
+static void ble_adv_history_gatts_cb(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) //GATT server events, called from BTC task
+{
+    ble_adv_history_request_t request;
+
+    switch (event)
+    {
+    case ESP_GATTS_REG_EVT:
+        if (param->reg.status != ESP_GATT_OK)
+        {
+            ESP_LOGE(TAG, "History app register failed: %d", param->reg.status);
+            break;
+        }
+        ble_adv_history_if = gatts_if;
+        if (esp_ble_gatts_create_attr_tab(ble_adv_history_db, gatts_if, BLE_ADV_HISTORY_IDX_NUM, 0) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Fail create history attributes");
+        }
+        break;
+
+    case ESP_GATTS_CREAT_ATTR_TAB_EVT:
+        if (param->add_attr_tab.status != ESP_GATT_OK || param->add_attr_tab.num_handle != BLE_ADV_HISTORY_IDX_NUM)
+        {
+            ESP_LOGE(TAG, "History attributes failed: %d", param->add_attr_tab.status);
+            break;
+        }
+        memcpy(ble_adv_history_handles, param->add_attr_tab.handles, sizeof(ble_adv_history_handles));
+        if (esp_ble_gatts_start_service(ble_adv_history_handles[BLE_ADV_HISTORY_IDX_SERVICE]) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Fail start history service");
+        }
+        break;
+
+    case ESP_GATTS_CONNECT_EVT:
+        if (ble_adv_history_conn.connected) // one download at a time
+        {
+            ESP_LOGW(TAG, "History client already connected");
+            esp_ble_gap_disconnect(param->connect.remote_bda);
+            break;
+        }
+        ble_adv_history_conn = (ble_adv_history_conn_t){
+            .connected  = true,
+            .conn_id    = param->connect.conn_id,
+            .mtu        = ESP_GATT_DEF_BLE_MTU_SIZE,
+            .data_len   = 27
+        };
+        ble_adv_history_update_info();
+
+        // short interval and long packets - throughput is packets per connection event x events per second
+        esp_ble_conn_update_params_t conn_params = {
+            .min_int    = BLE_ADV_HISTORY_CONN_MIN,
+            .max_int    = BLE_ADV_HISTORY_CONN_MAX,
+            .latency    = 0,
+            .timeout    = BLE_ADV_HISTORY_CONN_TIMEOUT
+        };
+        memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+        esp_ble_gap_update_conn_params(&conn_params);
+        esp_ble_gap_set_pkt_data_len(param->connect.remote_bda, BLE_ADV_HISTORY_DATA_LEN);
+        ESP_LOGI(TAG, "History client connected");
+        if (ble_adv_data != NULL)
+            ble_adv_start(); // frames are broadcast during download
+        break;
+
+    case ESP_GATTS_DISCONNECT_EVT:
+        if (!ble_adv_history_conn.connected || param->disconnect.conn_id != ble_adv_history_conn.conn_id)
+            break;
+        ble_adv_history_conn.connected = false;
+        ble_adv_history_conn.notify = false;
+        ble_adv_history_conn.congested = false;
+        xSemaphoreGive(ble_adv_history_uncongested); // stream stops
+        ESP_LOGI(TAG, "History client disconnected, reason 0x%x", param->disconnect.reason);
+        if (ble_adv_data != NULL)
+            ble_adv_start();
+        break;
+
+    case ESP_GATTS_MTU_EVT:
+        if (param->mtu.conn_id != ble_adv_history_conn.conn_id)
+            break;
+        ble_adv_history_conn.mtu = param->mtu.mtu;
+        ble_adv_history_update_info();
+        ESP_LOGI(TAG, "History MTU %u, %u records per notification", param->mtu.mtu, ble_adv_history_records_max());
+        break;
+
+    case ESP_GATTS_WRITE_EVT:
+        if (param->write.is_prep || param->write.conn_id != ble_adv_history_conn.conn_id)
+            break;
+        if (param->write.handle == ble_adv_history_handles[BLE_ADV_HISTORY_IDX_DATA_CCCD] && param->write.len == 2)
+        {
+            ble_adv_history_conn.notify = (param->write.value[0] & 0x01) != 0;
+        }
+        else if (param->write.handle == ble_adv_history_handles[BLE_ADV_HISTORY_IDX_CONTROL] &&
+            param->write.len >= sizeof(request.cycle))
         {
-            esp_ble_gap_config_adv_data_raw(ble_adv_data[i], sizeof(ble_adv_head)+ble_adv_payload_size);
-            vTaskDelay(100 / portTICK_RATE_MS);
-            
+            memset(&request, 0, sizeof(request));
+            memcpy(&request, param->write.value, param->write.len < sizeof(request) ? param->write.len : sizeof(request));
+            xQueueOverwrite(ble_adv_history_requests, &request);
         }
+        break;
+
+    case ESP_GATTS_CONGEST_EVT:
+        ble_adv_history_conn.congested = param->congest.congested;
+        if (!param->congest.congested)
+            xSemaphoreGive(ble_adv_history_uncongested);
+        break;
+
+    default:
+        break;
     }
 }
 
+static uint8_t ble_adv_history_pack(uint8_t *dst, uint32_t *cycle, uint32_t end, uint8_t records_max) //consecutive records from cycle to end,
+{                                                                                                    // cycle is moved after them
+    history_log_record_t record;
+    int32_t values[PAYLOAD_MEASUREMENT_FIELDS_NUM];
+    ble_adv_history_head_t head = { .cycle = *cycle, .count = 0 };
+
+    for(; *cycle<end && head.count<records_max; ++*cycle)
+    {
+        if(history_log_read(*cycle, &record) != HISTORY_LOG_OK)
+        {
+            if(head.count > 0) // gap ends notification, next one carries own first cycle
+            {
+                ++*cycle;
+                break;
+            }
+            continue; // torn or overwritten record
+        }
+        if(head.count == 0)
+            head.cycle = *cycle;
+
+        values[PAYLOAD_FIELD_TYPE] = 0; // live data of cycle
+        values[PAYLOAD_FIELD_TEMPERATURE] = record.temperature;
+        values[PAYLOAD_FIELD_HUMIDITY] = record.humidity;
+        for(uint8_t i=0; i<HISTORY_LOG_PM_NUM; ++i)
+            values[PAYLOAD_FIELD_SM_PM10 + i] = record.pm[i];
+        for(uint8_t i=0; i<HISTORY_LOG_UM_NUM; ++i)
+            values[PAYLOAD_FIELD_UM3 + i] = record.um[i];
+        values[PAYLOAD_FIELD_ESP_TEMPERATURE] = record.esp_temp;
+        payload_encode(&payload_measurement_schema, values, dst + sizeof(head) + head.count * payload_measurement_schema.size);
+        ++head.count;
+    }
+    memcpy(dst, &head, sizeof(head));
+    return head.count;
+}
+
+static ble_adv_error_t ble_adv_history_notify(uint16_t conn_id, uint8_t *data, uint16_t len) //send when TX queue of stack has space
+{
+    while(ble_adv_history_conn.congested && ble_adv_history_conn.connected)
+    {
+        if(xSemaphoreTake(ble_adv_history_uncongested, BLE_ADV_HISTORY_CONGEST_MS / portTICK_RATE_MS) != pdTRUE)
+        {
+            ESP_LOGE(TAG, "History stream stalled");
+            return BLE_ADV_FAIL_NOTIFY;
+        }
+    }
+
+    if(!ble_adv_history_conn.connected || ble_adv_history_conn.conn_id != conn_id)
+        return BLE_ADV_FAIL_NOTIFY; // client is gone
+    if(esp_ble_gatts_send_indicate(ble_adv_history_if, conn_id, ble_adv_history_handles[BLE_ADV_HISTORY_IDX_DATA], len, data, false) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Fail notify history");
+        return BLE_ADV_FAIL_NOTIFY;
+    }
+    return BLE_ADV_OK;
+}
+
+static void ble_adv_history_stream_task(void *parameter) //records of request as back-to-back notifications, then end of stream
+{
+    ble_adv_history_request_t request;
+    ble_adv_history_head_t end_head;
+
+    while(1)
+    {
+        if(xQueueReceive(ble_adv_history_requests, &request, portMAX_DELAY) != pdTRUE)
+            continue;
+        if(!ble_adv_history_conn.connected || !ble_adv_history_conn.notify)
+        {
+            ESP_LOGW(TAG, "History request without notifications");
+            continue;
+        }
+
+        uint16_t conn_id = ble_adv_history_conn.conn_id;
+        uint8_t records_max = ble_adv_history_records_max();
+        uint32_t cycle = history_log_first_cycle();
+        uint32_t end = history_log_next_cycle();
+        uint32_t sent = 0;
+        int64_t start = esp_timer_get_time();
+
+        if(request.cycle > cycle)
+            cycle = request.cycle < end ? request.cycle : end;
+        if(request.count > 0 && request.count < end - cycle)
+            end = cycle + request.count;
+        if(records_max == 0)
+        {
+            ESP_LOGE(TAG, "MTU %u too small for history record", ble_adv_history_conn.mtu);
+            end = cycle;
+        }
+
+        // new request stops stream, records of flash are read one by one - stack copies notification
+        while(cycle < end && uxQueueMessagesWaiting(ble_adv_history_requests) == 0)
+        {
+            uint8_t num = ble_adv_history_pack(ble_adv_history_buffer, &cycle, end, records_max);
+            if(num == 0)
+                break; // rest of range is missing
+            if(ble_adv_history_notify(conn_id, ble_adv_history_buffer, sizeof(ble_adv_history_head_t) + num * payload_measurement_schema.size) != BLE_ADV_OK)
+                break;
+            sent += num;
+        }
+
+        end_head.cycle = cycle;
+        end_head.count = 0;
+        memcpy(ble_adv_history_buffer, &end_head, sizeof(end_head));
+        ble_adv_history_notify(conn_id, ble_adv_history_buffer, sizeof(end_head));
+        ble_adv_history_update_info();
+        ESP_LOGI(TAG, "History %u records sent in %u ms, next cycle %u", sent, (uint32_t)((esp_timer_get_time() - start) / 1000), cycle);
+    }
+}
+#endif
@@ -6,25 +6,81 @@
 #define BLE_ADV_H_
 
 #include "nvs_flash.h"
+#include "esp_system.h"
 #include "esp_log.h"
 #include <memory.h>
 #include "esp_bt.h"
 #include "esp_gap_ble_api.h"
 #include "esp_gattc_api.h"
+#include "esp_gatts_api.h"
+#include "esp_gatt_common_api.h"
 #include "esp_gatt_defs.h"
 #include "esp_bt_main.h"
 #include "esp_bt_defs.h"
 #include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include "diag.h"
+#include "mem_budget.h"
+#include "ble_relay.h"
+#include "history_log.h"
 
+//CONFIG
+#define BLE_ADV_SLOT_MS             100 // time of one rotation slot
+#define BLE_ADV_SET_TIMEOUT_MS      50  // max wait for ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT
+#define BLE_ADV_TASK_STACK          2048
+#define BLE_ADV_TASK_PRIO           1
+#define BLE_ADV_FRAMES_MAX          8   // static frames, each 2 x ESP_BLE_ADV_DATA_LEN_MAX bytes
+#define BLE_ADV_DEVICE_ID           0   // id of device in head of every frame, 0 - two lowest bytes of BT MAC
 
-//max data BLE adv len = 31bytes
+//SCAN RESPONSE - scannable adv (ADV_TYPE_SCAN_IND), active scanners get second frame (ble_adv_set_response) in the same adv event
+#ifndef BLE_ADV_SCAN_RSP // switches of this file can be set by -D without edit (variants of host simulator)
+#define BLE_ADV_SCAN_RSP            0
+#endif
+#define BLE_ADV_RESPONSE_NONE       0xFF // frame without scan response data
+
+//RELAY - neighbors (live frames with id 0x0606) are scanned between own adv events and re-advertised in spare frames
+#ifndef BLE_ADV_RELAY
+#define BLE_ADV_RELAY               0
+#endif
+#define BLE_ADV_RELAY_ID            0x0689 // id in head of relayed frame (low byte is AD type - unassigned one), device, sequence and payload of neighbor are not changed (never relayed again)
+#define BLE_ADV_RELAY_FRAMES        2   // spare frames (BLE_ADV_FRAMES_MAX - own frames) with payloads of neighbors, weight 1
+#define BLE_ADV_RELAY_CACHE_SIZE    32  // neighbors in dedup cache, BLE_RELAY_WAYS x power of 2
+#define BLE_ADV_RELAY_SELECT_MS     2000 // period of choosing neighbors for relay frames
+#define BLE_ADV_RELAY_SCAN_INTERVAL 0x50 // 50ms, N * 0.625ms
+#define BLE_ADV_RELAY_SCAN_WINDOW   0x10 // 10ms, controller scans between adv events
+
+//HISTORY - GATT service announced in connectable slot (ADV_TYPE_IND, Flags and service UUID instead of frame), one client
+//downloads history log as notifications: enables notifications of data, writes ble_adv_history_request_t to control,
+//gets records up to the newest one
+#ifndef BLE_ADV_HISTORY
+#define BLE_ADV_HISTORY             0
+#endif
+#define BLE_ADV_HISTORY_APP_ID      0x55
+#define BLE_ADV_HISTORY_CONN_SLOTS  10  // every N-th rotation slot is connectable (1s), skipped while client is connected
+#define BLE_ADV_HISTORY_MTU         517 // local MTU, ATT_MTU is the lower of client and local one
+#define BLE_ADV_HISTORY_DATA_LEN    251 // LL data length (DLE), notification is sized to whole packets
+#define BLE_ADV_HISTORY_TASK_STACK  2560
+#define BLE_ADV_HISTORY_TASK_PRIO   1
+#define BLE_ADV_HISTORY_CONGEST_MS  2000 // max wait for drained TX queue of stack, stream stops after it
+#define BLE_ADV_HISTORY_CONN_MIN    0x06 // 7.5ms, N * 1.25ms, requested after connect - more packets per second
+#define BLE_ADV_HISTORY_CONN_MAX    0x0C // 15ms
+#define BLE_ADV_HISTORY_CONN_TIMEOUT 400 // 4s, N * 10ms
+#define BLE_ADV_HISTORY_VERSION     1
+#define BLE_ADV_HISTORY_UUID(n)     {n, 0x48, 0x53, 0x41, 0x4D, 0x9A, 0x5E, 0x8B, 0x4C, 0x47, 0x2E, 0x1D, 0x06, 0x06, 0x41, 0x4D} // 128-bit, little endian
+#define BLE_ADV_HISTORY_UUID_SERVICE 0x00
+#define BLE_ADV_HISTORY_UUID_INFO   0x01
+#define BLE_ADV_HISTORY_UUID_CONTROL 0x02
+#define BLE_ADV_HISTORY_UUID_DATA   0x03
+
+
+//max data BLE adv len = 31bytes, no Flags AD - optional for non-connectable adv, its 3 bytes carry device and sequence
+//(frames are never aired connectable, connectable slot of BLE_ADV_HISTORY has own data with Flags)
 typedef struct __attribute__((__packed__)) {
-    uint8_t     len;
-    uint8_t     type;   
-    uint8_t     flags;
-    //=================================
-    uint8_t     len_payload;//27bytes <= id + ble_adv_payload_t
+    uint8_t     len_payload;//30bytes <= id + device + sequence + ble_adv_payload_t
     uint16_t    id;
+    uint16_t    device;     // BLE_ADV_DEVICE_ID, receiver tells devices apart without MAC (also in relayed frames)
+    uint8_t     sequence;   // wrapping cycle of data, the same in repeats of rotation - receiver drops them by one compare
 } ble_adv_head_t;//6bytes
 
 typedef enum {
@@ -35,14 +91,46 @@ typedef enum {
     BLE_ADV_FAIL_REG_CALLBACK   = -4,
     BLE_ADV_DATA_TOO_SIZE       = -5,
     BLE_ADV_FAIL_START_ADV      = -6,
-    BLE_ADV_FAIL_SET_DATA       = -7
+    BLE_ADV_FAIL_SET_DATA       = -7,
+    BLE_ADV_TOO_MANY_FRAMES     = -8,
+    BLE_ADV_FAIL_SCAN           = -9,
+    BLE_ADV_FAIL_HISTORY        = -10,
+    BLE_ADV_FAIL_NOTIFY         = -11
 
 } ble_adv_error_t;
 
+//notification of history data: head + count x payload_measurement_schema (type 0) of consecutive cycles, missing
+//record starts next notification, count 0 - end of stream, cycle = resume index (next cycle to request)
+typedef struct __attribute__((__packed__)) {
+    uint32_t    cycle;      // cycle of first record, little endian like all numbers of service
+    uint8_t     count;
+} ble_adv_history_head_t;//5bytes
+
+typedef struct __attribute__((__packed__)) { // value of info characteristic (read)
+    uint32_t    first_cycle;    // oldest record in log
+    uint32_t    next_cycle;     // not in log yet
+    uint8_t     version;
+    uint8_t     records_max;    // records in one notification at current ATT_MTU
+} ble_adv_history_info_t;//10bytes
+
+typedef struct __attribute__((__packed__)) { // value of control characteristic (write) - starts stream
+    uint32_t    cycle;      // first cycle, older than first_cycle - from first_cycle
+    uint32_t    count;      // optional, 0 - up to the newest record
+} ble_adv_history_request_t;//8bytes
+
 
 ble_adv_error_t ble_adv_bt_init(void);
 ble_adv_error_t ble_adv_data_init(uint8_t payload_num, uint8_t payload_size);
 ble_adv_error_t ble_adv_set_data(const uint8_t *payload, uint8_t num);
+uint8_t *ble_adv_data_acquire(uint8_t num);
+ble_adv_error_t ble_adv_data_commit(uint8_t num);
+ble_adv_error_t ble_adv_set_weight(uint8_t num, uint8_t weight);
+ble_adv_error_t ble_adv_set_id(uint8_t num, uint16_t id);
+ble_adv_error_t ble_adv_set_sequence(uint8_t sequence);
+ble_adv_error_t ble_adv_set_response(uint8_t num, uint8_t response);
+uint16_t ble_adv_device_id(void);
+int64_t ble_adv_first_time(void);
+const ble_relay_stats_t *ble_adv_relay_stats(void);
 ble_adv_error_t ble_adv_data_deinit(void);
 
 #endif
\ No newline at end of file
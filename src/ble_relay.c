@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#include <string.h>
+#include "ble_relay.h"
+
+#define BLE_RELAY_SELECT_MAX    8   // relay frames chosen at once, at most BLE_ADV_FRAMES_MAX
+
+static uint32_t ble_relay_hash(const uint8_t *addr) //FNV-1a of BD address
+{
+    uint32_t hash = 2166136261u;
+    for(uint8_t i=0; i<BLE_RELAY_ADDR_LEN; ++i)
+    {
+        hash ^= addr[i];
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 16);
+}
+
+
+ble_relay_error_t ble_relay_init(ble_relay_cache_t *cache, uint8_t payload_size) //clear cache, storage is kept
+{
+    if(cache->sets == 0 || (cache->sets & (cache->sets - 1)) != 0 || payload_size > BLE_RELAY_PAYLOAD_MAX)
+        return BLE_RELAY_BAD_SIZE;
+
+    memset(cache->entries, 0, sizeof(ble_relay_entry_t) * cache->sets * BLE_RELAY_WAYS);
+    memset(&(cache->stats), 0, sizeof(cache->stats));
+    cache->payload_size = payload_size;
+    return BLE_RELAY_OK;
+}
+
+
+void ble_relay_update(ble_relay_cache_t *cache, const uint8_t *addr, int8_t rssi, const uint8_t *payload, uint32_t now_ms) //adv of neighbor received
+{
+    ble_relay_entry_t *set = &(cache->entries[(ble_relay_hash(addr) & (cache->sets - 1)) * BLE_RELAY_WAYS]);
+    ble_relay_entry_t *entry = NULL;
+    ble_relay_entry_t *victim = NULL;
+
+    ++cache->stats.received;
+    for(uint8_t i=0; i<BLE_RELAY_WAYS; ++i)
+    {
+        if(set[i].used && memcmp(set[i].addr, addr, BLE_RELAY_ADDR_LEN) == 0)
+        {
+            entry = &set[i];
+            break;
+        }
+        // free entry first, then least recently seen
+        if(victim == NULL || (victim->used && (!set[i].used || (int32_t)(set[i].seen_ms - victim->seen_ms) < 0)))
+            victim = &set[i];
+    }
+
+    if(entry == NULL)
+    {
+        if(victim->used)
+            ++cache->stats.evictions;
+        ++cache->stats.inserts;
+        entry = victim;
+        memcpy(entry->addr, addr, BLE_RELAY_ADDR_LEN);
+        entry->used = true;
+        entry->pending = false;
+        memset(entry->payload, 0, sizeof(entry->payload));
+    }
+    else if(memcmp(entry->payload, payload, cache->payload_size) == 0)
+    {
+        // the same frame again (rotation of neighbor or other channel) - only refresh
+        ++cache->stats.duplicates;
+        entry->seen_ms = now_ms;
+        entry->rssi = rssi;
+        return;
+    }
+
+    memcpy(entry->payload, payload, cache->payload_size);
+    entry->seen_ms = now_ms;
+    entry->rssi = rssi;
+    if(!entry->pending)
+    {
+        entry->pending = true;
+        entry->pending_ms = now_ms;
+    }
+}
+
+
+static bool ble_relay_before(const ble_relay_entry_t *a, const ble_relay_entry_t *b, uint32_t now_ms) //a is relayed before b
+{
+    uint32_t wait_a = now_ms - a->pending_ms;
+    uint32_t wait_b = now_ms - b->pending_ms;
+
+    if(wait_a != wait_b)
+        return wait_a > wait_b;
+    return a->rssi < b->rssi; // weak neighbor is probably out of range of receivers
+}
+
+
+uint8_t ble_relay_select(ble_relay_cache_t *cache, uint32_t now_ms, uint8_t *const *dst, uint8_t num) //copy payloads of up to num neighbors to dst,
+{                                                                                                      //return number of copied payloads
+    ble_relay_entry_t *best[BLE_RELAY_SELECT_MAX];
+    uint8_t best_num = 0;
+    uint32_t entries = cache->sets * BLE_RELAY_WAYS;
+
+    if(num == 0)
+        return 0;
+    if(num > BLE_RELAY_SELECT_MAX)
+        num = BLE_RELAY_SELECT_MAX;
+
+    // top num candidates by insertion into short sorted list
+    for(uint32_t i=0; i<entries; ++i)
+    {
+        ble_relay_entry_t *entry = &(cache->entries[i]);
+        if(!entry->used || !entry->pending || now_ms - entry->seen_ms > BLE_RELAY_TTL_MS)
+            continue;
+        if(best_num == num && !ble_relay_before(entry, best[best_num - 1], now_ms))
+            continue;
+
+        uint8_t pos = best_num < num ? best_num++ : best_num - 1;
+        while(pos > 0 && ble_relay_before(entry, best[pos - 1], now_ms))
+        {
+            best[pos] = best[pos - 1];
+            --pos;
+        }
+        best[pos] = entry;
+    }
+
+    for(uint8_t i=0; i<best_num; ++i)
+    {
+        memcpy(dst[i], best[i]->payload, cache->payload_size);
+        best[i]->pending = false;
+    }
+    cache->stats.relayed += best_num;
+    return best_num;
+}
+
+
+uint32_t ble_relay_count(const ble_relay_cache_t *cache, uint32_t now_ms) //neighbors seen within BLE_RELAY_TTL_MS
+{
+    uint32_t count = 0;
+    for(uint32_t i=0; i<cache->sets * BLE_RELAY_WAYS; ++i)
+    {
+        if(cache->entries[i].used && now_ms - cache->entries[i].seen_ms <= BLE_RELAY_TTL_MS)
+            ++count;
+    }
+    return count;
+}
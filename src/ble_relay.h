@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef BLE_RELAY_H_
+#define BLE_RELAY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Dedup cache of neighbor devices for relay mode - freshest payload of every neighbor (by BD address).
+// Set associative: hash of address selects set of BLE_RELAY_WAYS entries, full set evicts least recently seen entry,
+// so memory is fixed (entries x sizeof(ble_relay_entry_t)) for any number of neighbors around and update is O(1).
+// Selection for relay frames is O(entries): neighbors with new payload, the longest waiting first (FIFO, no starvation).
+// No ESP-IDF dependencies - benchmarked on host (host/relay).
+
+//CONFIG
+#define BLE_RELAY_WAYS              4       // entries of one set, number of entries = sets * BLE_RELAY_WAYS
+#define BLE_RELAY_PAYLOAD_MAX       28      // device, sequence and payload of measurement frame
+#define BLE_RELAY_ADDR_LEN          6
+#define BLE_RELAY_TTL_MS            600000  // neighbor not seen for this time is not relayed (gone or out of range)
+
+//ERROR
+typedef enum {
+    BLE_RELAY_OK                = 0,
+    BLE_RELAY_BAD_SIZE          = -1    // sets not power of 2 or payload too long
+} ble_relay_error_t;
+
+typedef struct { // one neighbor
+    uint8_t     addr[BLE_RELAY_ADDR_LEN];
+    int8_t      rssi;
+    bool        used;
+    bool        pending;        // payload changed since neighbor was relayed last time
+    uint32_t    seen_ms;        // last adv of neighbor
+    uint32_t    pending_ms;     // since payload waits for relay - order of selection
+    uint8_t     payload[BLE_RELAY_PAYLOAD_MAX];
+} ble_relay_entry_t;
+
+typedef struct {
+    uint32_t    received;       // adv of neighbors
+    uint32_t    duplicates;     // payload already in cache
+    uint32_t    inserts;        // new neighbor
+    uint32_t    evictions;      // neighbor dropped from full set
+    uint32_t    relayed;        // payloads selected for relay frames
+} ble_relay_stats_t;
+
+typedef struct { // cache, storage is given by BLE_RELAY_CACHE_DEFINE or by caller
+    ble_relay_entry_t   *entries;   // [sets * BLE_RELAY_WAYS]
+    uint32_t            sets;       // power of 2
+    uint8_t             payload_size;
+    ble_relay_stats_t   stats;
+} ble_relay_cache_t;
+
+// static storage and cache, entries_num - multiple of BLE_RELAY_WAYS, entries_num / BLE_RELAY_WAYS power of 2
+#define BLE_RELAY_CACHE_DEFINE(name, entries_num) \
+    static ble_relay_entry_t name##_entries[(entries_num)]; \
+    static ble_relay_cache_t name = { \
+        .entries = name##_entries, \
+        .sets = (entries_num) / BLE_RELAY_WAYS \
+    }
+
+
+ble_relay_error_t ble_relay_init(ble_relay_cache_t *cache, uint8_t payload_size);
+void ble_relay_update(ble_relay_cache_t *cache, const uint8_t *addr, int8_t rssi, const uint8_t *payload, uint32_t now_ms);
+uint8_t ble_relay_select(ble_relay_cache_t *cache, uint32_t now_ms, uint8_t *const *dst, uint8_t num);
+uint32_t ble_relay_count(const ble_relay_cache_t *cache, uint32_t now_ms);
+
+#endif
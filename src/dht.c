@@ -2,112 +2,162 @@
  * Copyright (c) 2021, 2022 by
  * Slawomir Krzykala. All rights reserved.
  */ 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <xtensa/hal.h>
 #include "dht.h"
+#include "mem_budget.h"
+#include "sensor_trace.h"
 
 static const char *TAG = "DHT";
 
-static inline void dht_get_state_time_us(const int state, const int_fast16_t usTimeOut, int_fast16_t *usTime);
+static dht_t dht_instances[DHT_INSTANCES_MAX]; // slot of instance = index, also slot of static memory below
+static uint8_t dht_instances_num = 0;
+MEM_SEMAPHORE_DEFINE_ARRAY(dht_edges_done, DHT_INSTANCES_MAX);
 
+static void dht_edge_isr(void *parameter);
+static void dht_parse_data(const uint8_t *received_data, dht_measurement_t *dst);
 
 
-dht_error_t dht_init(void) //GPIO VCC DHT set high state
-{
-    if(gpio_reset_pin(DHT_VCC_GPIO)  !=0 ||
-        gpio_set_direction(DHT_VCC_GPIO, GPIO_MODE_OUTPUT)  !=0 ||
-        gpio_set_level(DHT_VCC_GPIO, 1) !=0)
+
+dht_error_t dht_init(const dht_config_t *config, dht_t **dst) //GPIO VCC DHT set high state, install ISR to capture edges on GPIO DATA,
+{                                                              //instance is found by GPIO DATA or new one is taken from static pool
+    dht_t *dht = NULL;
+
+    for(uint8_t i=0; i<dht_instances_num; ++i)
+        if(dht_instances[i].config.data_gpio == config->data_gpio)
+            dht = &(dht_instances[i]);
+    if(dht == NULL)
+    {
+        if(dht_instances_num >= DHT_INSTANCES_MAX)
+        {
+            ESP_LOGE(TAG, "Too many DHT, max %u", DHT_INSTANCES_MAX);
+            return DHT_FAIL_INIT;
+        }
+        dht = &(dht_instances[dht_instances_num]);
+        dht->slot = dht_instances_num++;
+    }
+    dht->config = *config;
+    *dst = dht;
+
+    if(gpio_reset_pin(dht->config.vcc_gpio)  !=0 ||
+        gpio_set_direction(dht->config.vcc_gpio, GPIO_MODE_OUTPUT)  !=0 ||
+        gpio_set_level(dht->config.vcc_gpio, 1) !=0)
     {
-        return DHT_FAIL_INIT;
         ESP_LOGE(TAG, "Fail init GPIO VCC");
+        return DHT_FAIL_INIT;
+    }
+
+    if(dht->edges_done == NULL)
+        dht->edges_done = MEM_SEMAPHORE_CREATE_BINARY_AT(dht_edges_done, dht->slot);
+
+    esp_err_t err = gpio_install_isr_service(0);
+    if(dht->edges_done == NULL ||
+        (err != ESP_OK && err != ESP_ERR_INVALID_STATE) || // ESP_ERR_INVALID_STATE -> service is already installed
+        gpio_set_intr_type(dht->config.data_gpio, GPIO_INTR_ANYEDGE) != 0 ||
+        gpio_intr_disable(dht->config.data_gpio) != 0 ||
+        gpio_isr_handler_add(dht->config.data_gpio, dht_edge_isr, dht) != 0)
+    {
+        ESP_LOGE(TAG, "Fail init ISR GPIO DATA");
+        return DHT_FAIL_INIT_ISR;
     }
 
     return DHT_OK;
 }
 
-static inline void dht_get_state_time_us(const int state, const int_fast16_t usTimeOut, int_fast16_t *usTime)
+static void IRAM_ATTR dht_edge_isr(void *parameter) //save timestamp of edge, give semaphore after last expected edge
 {
-    *usTime = 0;
-    while (gpio_get_level(DHT_DATA_GPIO) == state)
+    dht_t *dht = parameter;
+    BaseType_t task_woken = pdFALSE;
+    uint8_t num = dht->edges_num;
+
+    if(num < DHT_EDGES_NUM)
     {
-        ets_delay_us(1);
-        if ((++(*usTime)) > usTimeOut)
-        {
-            *usTime=-1;
-            return;
-        }
+        dht->edges[num] = xthal_get_ccount();
+        dht->edges_num = ++num;
+        if(num == DHT_EDGES_NUM)
+            xSemaphoreGiveFromISR(dht->edges_done, &task_woken);
     }
-    return;
+
+    if(task_woken == pdTRUE)
+        portYIELD_FROM_ISR();
 }
 
-dht_error_t dht_read(dht_measurement_t *dst)//read temp and hum
+dht_error_t dht_read(dht_t *dht, dht_measurement_t *dst)//read temp and hum
 {
-    int_fast16_t usTimeState = 0;
-    uint_fast8_t received_data[5]={0};    // DHT send 5bytes
-
 // send start signal to DHT
     
     if(//gpio_reset_pin(DHT_DATA_GPIO) !=0 ||
-        gpio_set_direction(DHT_DATA_GPIO, GPIO_MODE_OUTPUT) != 0)
+        gpio_set_direction(dht->config.data_gpio, GPIO_MODE_OUTPUT) != 0)
     {
-        return DHT_FAIL_INIT;
         ESP_LOGE(TAG, "Fail init GPIO DATA");
+        return DHT_FAIL_INIT;
     }
-    // low state form 2ms (in doc -> 1-10ms)
-    gpio_set_level(DHT_DATA_GPIO, 0);
-    ets_delay_us(8600);	
+    // low state (in doc -> 1-10ms, DHT22 accept longer), no busy wait
+    gpio_set_level(dht->config.data_gpio, 0);
+    vTaskDelay(DHT_START_SIGNAL_MS / portTICK_RATE_MS + 1);
 
-    // high state for 26us (in doc -> 20-40us)
-    gpio_set_level(DHT_DATA_GPIO, 1);
-    ets_delay_us(26);
 
+// capture response and data by edge ISR, armed before line is released - response starts 20-40us after release
+    dht->edges_num = 0;
+    xSemaphoreTake(dht->edges_done, 0);
+    gpio_intr_enable(dht->config.data_gpio);
 
-// wait for response DHT
-    //gpio_reset_pin(DHT_DATA_GPIO);
-    gpio_set_direction(DHT_DATA_GPIO, GPIO_MODE_INPUT);
-    //gpio_set_pull_mode(DHT_DATA_GPIO, GPIO_FLOATING);
+    // release line, pull-up sets high state, its rising edge can be captured too
+    uint32_t release = xthal_get_ccount();
+    gpio_set_direction(dht->config.data_gpio, GPIO_MODE_INPUT);
 
-    // wait for high state (in doc -> low state 80us)
-    dht_get_state_time_us(0, 260, &usTimeState);
-    if(usTimeState < 0)
+    // semaphore is given after last edge, on timeout try decode what was captured (last edge is not needed)
+    xSemaphoreTake(dht->edges_done, DHT_READ_TIMEOUT_MS / portTICK_RATE_MS + 1);
+    gpio_intr_disable(dht->config.data_gpio);
+
+    uint32_t ticks_per_us = ets_get_cpu_frequency();
+    uint8_t first = 0;
+    while(first < dht->edges_num && (uint32_t)(dht->edges[first] - release) < DHT_RELEASE_EDGE_US * ticks_per_us)
+        ++first;
+
+    dht_error_t result = dht_decode_edges(dht->edges + first, dht->edges_num - first, ticks_per_us, dst);
+    sensor_trace_dht(dht->slot, dht->edges + first, dht->edges_num - first, ticks_per_us, result, dst);
+    return result;
+}
+
+dht_error_t dht_decode_edges(const uint32_t *edges, uint8_t edges_num, uint32_t ticks_per_us, dht_measurement_t *dst)//decode 40bits from timestamps of edges
+{                                                                                                                    //edges[0] - falling edge, start response DHT
+    uint8_t received_data[5]={0};    // DHT send 5bytes
+    uint32_t pulse_timeout = DHT_PULSE_TIMEOUT_US * ticks_per_us;
+    uint32_t bit_threshold = DHT_BIT_THRESHOLD_US * ticks_per_us;
+
+// response DHT (in doc -> low state 80us, high state 80us)
+    if(edges_num < 3 ||
+        (uint32_t)(edges[1] - edges[0]) > pulse_timeout ||
+        (uint32_t)(edges[2] - edges[1]) > pulse_timeout)
     {
-        ESP_LOGE(TAG, "Timeout waiting for high state.");
+        ESP_LOGE(TAG, "Timeout waiting for response (%u edges).", edges_num);
         return DHT_TIMEOUT_START_TRANS;
-    }  
+    }
 
-    // wait for low signal (in doc -> high state 80us)
-    dht_get_state_time_us(1, 260, &usTimeState);
-    if(usTimeState < 0)
+    if(edges_num < DHT_EDGES_MIN_NUM)
     {
-        ESP_LOGE(TAG, "Timeout waiting for low state.");
-        return DHT_TIMEOUT_START_TRANS;
-    }  
+        ESP_LOGE(TAG, "Timeout during receiving data (%u edges).", edges_num);
+        return DHT_TIMEOUT_RECEIVE_DATA;
+    }
 
-// receive data from DHT
-    for (uint_fast8_t nByte = 0; nByte < 5; ++nByte) // iteration for 5bytes data
+// receive data, every bit is low state (in doc -> 50us) and high state, length of high state is value of bit
+    for (uint8_t nBit = 0; nBit < 40; ++nBit)
     {
-        for (int_fast8_t nBit = 7; nBit >= 0; --nBit) // iteration for 8bits every byte
+        const uint32_t *bit_edges = &(edges[2 + 2*nBit]); // falling, rising, falling
+        uint32_t low_time = bit_edges[1] - bit_edges[0];  // unsigned subtraction, CPU cycle counter can overflow
+        uint32_t high_time = bit_edges[2] - bit_edges[1];
+
+        if(low_time > pulse_timeout || high_time > pulse_timeout)
         {
-            // every bits is preceded by low state (in doc-> 50us)
-            dht_get_state_time_us(0, 260, &usTimeState);
-            if(usTimeState < 0)
-            {
-                ESP_LOGE(TAG, "Timeout waiting for high state during receiving data.");
-                return DHT_TIMEOUT_RECEIVE_DATA;
-            }  
-
-            // in doc -> bit receive "0" if high state timme 26-28us, "1" if high state is 70us
-            dht_get_state_time_us(1, 260, &usTimeState);
-            if(usTimeState < 0)
-            {
-                ESP_LOGE(TAG, "Timeout waiting for low state during receiving data.");
-                return DHT_TIMEOUT_RECEIVE_DATA;
-            }
-
-            // save received data, on start all bits are "0"
-            // if receive "1", "1" is shift to nBit position and OR with nByte data
-            // if receive "0" do nothing
-            if (usTimeState > 46)
-                received_data[nByte] |= (1 << (nBit));
+            ESP_LOGE(TAG, "Timeout during receiving data (bit %u).", nBit);
+            return DHT_TIMEOUT_RECEIVE_DATA;
         }
+
+        // in doc -> bit receive "0" if high state timme 26-28us, "1" if high state is 70us
+        if (high_time > bit_threshold)
+            received_data[nBit/8] |= (1 << (7 - nBit%8));
     }
 
     
@@ -120,7 +170,12 @@ dht_error_t dht_read(dht_measurement_t *dst)//read temp and hum
         return DHT_BAD_CHECKSUM;
     }
 
+    dht_parse_data(received_data, dst);
+    return DHT_OK;
+}
 
+static void dht_parse_data(const uint8_t *received_data, dht_measurement_t *dst)
+{
     // receiveData[2] and receiveData[3] to temperature, in real this is temperature/10 
     dst->temperature = ((((uint16_t)(received_data[2]&0x7F))<<8) | ((uint16_t)received_data[3]));
     // if negative temp, firt bit is 1
@@ -130,8 +185,6 @@ dht_error_t dht_read(dht_measurement_t *dst)//read temp and hum
 
     // receiveData[0] and receiveData[1] to humidity, in real this is humidity/10 
     dst->humidity = ((((uint16_t)received_data[0])<<8) | ((uint16_t)received_data[1]));
-
-    return DHT_OK;
 }
 
 dht_error_t dht_calc_avg(const dht_measurement_t *arr_src, dht_measurement_t *dst, uint8_t arr_size)//calc avg
@@ -154,5 +207,39 @@ dht_error_t dht_calc_avg(const dht_measurement_t *arr_src, dht_measurement_t *ds
     dst->temperature = temperature / arr_size;
     dst->humidity = humidity / arr_size;
 
+    return DHT_OK;
+}
+
+void dht_pack_values(const dht_measurement_t *value, int32_t *values) //measurement as DHT_WINDOW_CHANNELS channels of stats
+{
+    values[0] = value->temperature;
+    values[1] = value->humidity;
+}
+
+void dht_unpack_values(const int32_t *values, dht_measurement_t *dst)
+{
+    dst->temperature = values[0];
+    dst->humidity = values[1];
+}
+
+void dht_window_push(stats_window_t *window, const dht_measurement_t *value) //add measurement to rolling window (DHT_WINDOW_CHANNELS channels)
+{
+    int32_t values[DHT_WINDOW_CHANNELS];
+
+    dht_pack_values(value, values);
+    stats_window_push(window, values);
+}
+
+dht_error_t dht_window_get(const stats_window_t *window, stats_window_stat_t stat, dht_measurement_t *dst) //avg/min/max of rolling window
+{
+    int32_t values[DHT_WINDOW_CHANNELS];
+
+    if(stats_window_get(window, stat, values) != STATS_WINDOW_OK)
+    {
+        ESP_LOGE(TAG, "Rolling window is empty.");
+        return DHT_BAD_AVG_ARR_SIZE;
+    }
+
+    dht_unpack_values(values, dst);
     return DHT_OK;
 }
\ No newline at end of file
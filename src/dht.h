@@ -7,10 +7,25 @@
 
 #include "esp_log.h"
 #include "driver/gpio.h"
+#include "stats_window.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
-//CONFIG
+//CONFIG - wiring of first DHT (DHT_CONFIG_DEFAULT), next ones are passed to dht_init
 #define DHT_DATA_GPIO   23
 #define DHT_VCC_GPIO    22
+#define DHT_INSTANCES_MAX   2 // static memory of driver for each DHT
+
+//TIMING
+#define DHT_START_SIGNAL_MS     20  // low state from host (in doc -> min 1ms), task is sleeping meanwhile
+#define DHT_READ_TIMEOUT_MS     20  // whole transmission takes ~5ms
+#define DHT_PULSE_TIMEOUT_US    260 // max length of single low or high state
+#define DHT_BIT_THRESHOLD_US    48  // high state 26-28us -> "0", 70us -> "1"
+#define DHT_EDGES_NUM           84  // response low/high (3 edges) + 40bits * 2 edges + release line
+#define DHT_EDGES_MIN_NUM       83  // last edge (release line) is not needed to decode
+#define DHT_RELEASE_EDGE_US     10  // edges earlier after host released line are from pull-up, response starts after 20-40us
+
+#define DHT_WINDOW_CHANNELS     2   // number of fields in dht_measurement_t
 
 //ERROR
 typedef enum {
@@ -19,7 +34,8 @@ typedef enum {
     DHT_TIMEOUT_RECEIVE_DATA    = -2,
     DHT_BAD_CHECKSUM            = -3,
     DHT_FAIL_INIT               = -4,
-    DHT_BAD_AVG_ARR_SIZE        = -5
+    DHT_BAD_AVG_ARR_SIZE        = -5,
+    DHT_FAIL_INIT_ISR           = -6
 } dht_error_t;
 
 
@@ -28,9 +44,30 @@ typedef struct {
     uint_least16_t humidity;
 } dht_measurement_t;
 
+typedef struct { // wiring of one DHT
+    gpio_num_t data_gpio;
+    gpio_num_t vcc_gpio;
+} dht_config_t;
+
+#define DHT_CONFIG_DEFAULT() { .data_gpio = DHT_DATA_GPIO, .vcc_gpio = DHT_VCC_GPIO }
+
+typedef struct { // one DHT - state of driver, instances are owned by driver (dht_init)
+    dht_config_t config;
+    uint8_t slot; // index of instance and its static memory
+    // timestamps (CPU cycles) of every edge on data line, saved by ISR during transmission
+    uint32_t edges[DHT_EDGES_NUM];
+    volatile uint8_t edges_num;
+    SemaphoreHandle_t edges_done;
+} dht_t;
+
 
-dht_error_t dht_init(void);
-dht_error_t dht_read(dht_measurement_t *dst);
+dht_error_t dht_init(const dht_config_t *config, dht_t **dht);
+dht_error_t dht_read(dht_t *dht, dht_measurement_t *dst);
+dht_error_t dht_decode_edges(const uint32_t *edges, uint8_t edges_num, uint32_t ticks_per_us, dht_measurement_t *dst);
 dht_error_t dht_calc_avg(const dht_measurement_t *arr_src, dht_measurement_t *dst, uint8_t arr_size);
+void dht_pack_values(const dht_measurement_t *value, int32_t *values);
+void dht_unpack_values(const int32_t *values, dht_measurement_t *dst);
+void dht_window_push(stats_window_t *window, const dht_measurement_t *value);
+dht_error_t dht_window_get(const stats_window_t *window, stats_window_stat_t stat, dht_measurement_t *dst);
 
 #endif
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#include <string.h>
+#include <esp_log.h>
+#include "diag.h"
+
+static const char *TAG = "DIAG";
+
+RTC_DATA_ATTR static diag_stats_t diag_stats;
+
+static inline void diag_add(uint32_t *counter, uint32_t value);
+static inline void diag_max(uint32_t *counter, uint32_t value);
+static inline void diag_min(uint32_t *counter, uint32_t value);
+static inline uint8_t diag_bin(uint32_t us);
+static uint8_t diag_percentile(const uint32_t *hist, uint8_t percent);
+static inline int32_t diag_value(uint32_t value);
+static inline int32_t diag_counter(uint32_t value, payload_diag_field_t field);
+
+
+
+static inline void diag_add(uint32_t *counter, uint32_t value) //relaxed - counters are independent, readers accept skew
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+
+static inline void diag_max(uint32_t *counter, uint32_t value)
+{
+    uint32_t cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+    while(value > cur && !__atomic_compare_exchange_n(counter, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+static inline void diag_min(uint32_t *counter, uint32_t value) //0 = not set yet
+{
+    uint32_t cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+    while((cur == 0 || value < cur) && !__atomic_compare_exchange_n(counter, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+static inline uint8_t diag_bin(uint32_t us) //log2 bin, see DIAG_HIST_BINS
+{
+    if(us < (1u << DIAG_HIST_MIN_SHIFT))
+        return 0;
+
+    uint8_t bin = (31 - __builtin_clz(us)) - DIAG_HIST_MIN_SHIFT + 1;
+    return bin < DIAG_HIST_BINS ? bin : DIAG_HIST_BINS - 1;
+}
+
+
+static uint8_t diag_percentile(const uint32_t *hist, uint8_t percent) //bin where percent of samples is reached
+{
+    uint64_t total = 0, sum = 0;
+
+    for(uint8_t i=0; i<DIAG_HIST_BINS; ++i)
+        total += hist[i];
+    if(total == 0)
+        return 0;
+
+    for(uint8_t i=0; i<DIAG_HIST_BINS; ++i)
+    {
+        sum += hist[i];
+        if(sum * 100 >= total * percent)
+            return i;
+    }
+    return DIAG_HIST_BINS - 1;
+}
+
+
+static inline int32_t diag_value(uint32_t value) //payload clamps to width of field, only keep it positive
+{
+    return value > INT32_MAX ? INT32_MAX : (int32_t)value;
+}
+
+
+static inline int32_t diag_counter(uint32_t value, payload_diag_field_t field) //counter modulo 2^bits of field, receiver sums deltas
+{
+    uint8_t bits = payload_diag_schema.fields[field].bits;
+    return (int32_t)(value & ((1u << bits) - 1));
+}
+
+
+void diag_init(void) //stats survive deep sleep, cleared on power on
+{
+    if(esp_reset_reason() != ESP_RST_DEEPSLEEP || diag_stats.magic != DIAG_MAGIC)
+    {
+        memset(&diag_stats, 0, sizeof(diag_stats));
+        diag_stats.magic = DIAG_MAGIC;
+        ESP_LOGI(TAG, "Stats cleared");
+    }
+}
+
+
+void diag_latency(diag_stage_t stage, uint32_t us)
+{
+    if(stage >= DIAG_STAGES_NUM)
+        return;
+    diag_add(&diag_stats.latency_hist[stage][diag_bin(us)], 1);
+    diag_max(&diag_stats.latency_max_us[stage], us);
+}
+
+
+void diag_dht_result(dht_error_t result)
+{
+    uint32_t idx = (uint32_t)(-result);
+
+    if(idx < DIAG_DHT_ERRORS_NUM)
+        diag_add(&diag_stats.dht_results[idx], 1);
+}
+
+
+void diag_pms_result(pms_error_t result)
+{
+    uint32_t idx = (uint32_t)(-result);
+
+    if(idx < DIAG_PMS_ERRORS_NUM)
+        diag_add(&diag_stats.pms_results[idx], 1);
+}
+
+
+void diag_burst(uint32_t retries) //end of measurement burst with number of failed tries
+{
+    diag_add(&diag_stats.bursts, 1);
+    diag_add(&diag_stats.retries, retries);
+    diag_max(&diag_stats.retries_max, retries);
+}
+
+
+void diag_stack_check(uint8_t slot) //free stack of calling task
+{
+    if(slot < DIAG_TASKS_MAX)
+        diag_min(&diag_stats.stack_free_min[slot], uxTaskGetStackHighWaterMark(NULL) + 1); //+1 - 0 is not set
+}
+
+
+void diag_heap_check(void)
+{
+    diag_min(&diag_stats.heap_free_min, esp_get_minimum_free_heap_size());
+}
+
+
+void diag_cycle(void)
+{
+    diag_add(&diag_stats.cycles, 1);
+}
+
+
+void diag_boot_adv(uint32_t us)
+{
+    __atomic_store_n(&diag_stats.boot_adv_us, us, __ATOMIC_RELAXED);
+}
+
+
+void diag_get(diag_stats_t *dst) //snapshot, counters can be skewed by concurrent updates
+{
+    memcpy(dst, &diag_stats, sizeof(diag_stats_t));
+}
+
+
+payload_error_t diag_encode(uint8_t *dst) //stats -> payload_diag_schema
+{
+    diag_stats_t stats;
+    int32_t values[PAYLOAD_DIAG_FIELDS_NUM];
+    uint32_t stack_min = 0;
+    uint8_t stack_slot = 0;
+
+    diag_get(&stats);
+
+    values[PAYLOAD_DIAG_FIELD_VERSION] = PAYLOAD_DIAG_VERSION;
+    values[PAYLOAD_DIAG_FIELD_CYCLES] = diag_counter(stats.cycles, PAYLOAD_DIAG_FIELD_CYCLES);
+    for(uint8_t i=0; i<DIAG_STAGES_NUM; ++i)
+    {
+        values[PAYLOAD_DIAG_FIELD_DHT_P50 + 3*i] = diag_percentile(stats.latency_hist[i], 50);
+        values[PAYLOAD_DIAG_FIELD_DHT_P95 + 3*i] = diag_percentile(stats.latency_hist[i], 95);
+        values[PAYLOAD_DIAG_FIELD_DHT_MAX + 3*i] = diag_value(stats.latency_max_us[i]);
+    }
+    values[PAYLOAD_DIAG_FIELD_DHT_OK] = diag_counter(stats.dht_results[-DHT_OK], PAYLOAD_DIAG_FIELD_DHT_OK);
+    values[PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_START] = diag_counter(stats.dht_results[-DHT_TIMEOUT_START_TRANS], PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_START);
+    values[PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_DATA] = diag_counter(stats.dht_results[-DHT_TIMEOUT_RECEIVE_DATA], PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_DATA);
+    values[PAYLOAD_DIAG_FIELD_DHT_BAD_CHECKSUM] = diag_counter(stats.dht_results[-DHT_BAD_CHECKSUM], PAYLOAD_DIAG_FIELD_DHT_BAD_CHECKSUM);
+
+    values[PAYLOAD_DIAG_FIELD_PMS_OK] = diag_counter(stats.pms_results[-PMS_OK], PAYLOAD_DIAG_FIELD_PMS_OK);
+    values[PAYLOAD_DIAG_FIELD_PMS_LOW_DATA] = diag_counter(stats.pms_results[-PMS_LOW_DATA_BUFOR], PAYLOAD_DIAG_FIELD_PMS_LOW_DATA);
+    values[PAYLOAD_DIAG_FIELD_PMS_NOT_FULL] = diag_counter(stats.pms_results[-PMS_NOT_FULL_FRAME], PAYLOAD_DIAG_FIELD_PMS_NOT_FULL);
+    values[PAYLOAD_DIAG_FIELD_PMS_NOT_FIND] = diag_counter(stats.pms_results[-PMS_NOT_FIND_FRAME], PAYLOAD_DIAG_FIELD_PMS_NOT_FIND);
+    values[PAYLOAD_DIAG_FIELD_PMS_BAD_CHECKSUM] = diag_counter(stats.pms_results[-PMS_BAD_CHECKSUM], PAYLOAD_DIAG_FIELD_PMS_BAD_CHECKSUM);
+    values[PAYLOAD_DIAG_FIELD_PMS_TIMEOUT] = diag_counter(stats.pms_results[-PMS_TIMEOUT], PAYLOAD_DIAG_FIELD_PMS_TIMEOUT);
+    uint32_t other = 0;
+    for(uint8_t i=-PMS_FAIL_SEND_FRAME; i<-PMS_TIMEOUT; ++i)
+        other += stats.pms_results[i];
+    values[PAYLOAD_DIAG_FIELD_PMS_OTHER] = diag_counter(other, PAYLOAD_DIAG_FIELD_PMS_OTHER);
+
+    values[PAYLOAD_DIAG_FIELD_RETRIES_MAX] = diag_value(stats.retries_max);
+    values[PAYLOAD_DIAG_FIELD_HEAP_MIN] = diag_value(stats.heap_free_min);
+    for(uint8_t i=0; i<DIAG_TASKS_MAX; ++i)
+    {
+        if(stats.stack_free_min[i] != 0 && (stack_min == 0 || stats.stack_free_min[i] < stack_min))
+        {
+            stack_min = stats.stack_free_min[i];
+            stack_slot = i;
+        }
+    }
+    values[PAYLOAD_DIAG_FIELD_STACK_MIN] = diag_value(stack_min ? stack_min - 1 : 0);
+    values[PAYLOAD_DIAG_FIELD_STACK_SLOT] = stack_slot;
+    values[PAYLOAD_DIAG_FIELD_BOOT_ADV] = diag_value(stats.boot_adv_us);
+
+    return payload_encode(&payload_diag_schema, values, dst);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef DIAG_H_
+#define DIAG_H_
+
+#include <stdint.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "pms.h"
+#include "dht.h"
+#include "payload.h"
+
+// Diagnostics - fixed size stats block updated from hot paths with atomic operations (no locks, also from callbacks),
+// published as diagnostics adv frame (id DIAG_ADV_ID, payload_diag_schema). Block is kept in RTC memory during deep sleep.
+
+//CONFIG
+#define DIAG_ADV_ID             0x0687  // id in head of adv frame, low byte is AD type for scanners - unassigned one (0x87)
+#define DIAG_HIST_BINS          16      // log2 bins: 0 - <256us, k - [2^(7+k), 2^(8+k)) us, 15 - >=4.2s
+#define DIAG_HIST_MIN_SHIFT     8
+#define DIAG_TASKS_MAX          8       // slots of stack high water marks
+#define DIAG_DHT_ERRORS_NUM     (1 - DHT_FAIL_INIT_ISR)     // index = -dht_error_t, [0] - DHT_OK
+#define DIAG_PMS_ERRORS_NUM     (1 - PMS_TIMEOUT)           // index = -pms_error_t, [0] - PMS_OK
+#define DIAG_MAGIC              0x4741494D // "MIAG"
+
+typedef enum {
+    DIAG_STAGE_DHT_READ     = 0,    // start signal to decoded data
+    DIAG_STAGE_PMS_FRAME    = 1,    // request of frame to frame in queue
+    DIAG_STAGE_ADV_UPDATE   = 2,    // HCI set adv data to complete event
+    DIAG_STAGES_NUM
+} diag_stage_t;
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    cycles;
+    uint32_t    latency_hist[DIAG_STAGES_NUM][DIAG_HIST_BINS];
+    uint32_t    latency_max_us[DIAG_STAGES_NUM];
+    uint32_t    dht_results[DIAG_DHT_ERRORS_NUM];
+    uint32_t    pms_results[DIAG_PMS_ERRORS_NUM];
+    uint32_t    bursts;
+    uint32_t    retries;                        // failed tries in all bursts
+    uint32_t    retries_max;                    // failed tries in one burst
+    uint32_t    heap_free_min;                  // bytes
+    uint32_t    stack_free_min[DIAG_TASKS_MAX]; // bytes + 1, 0 - slot not used
+    uint32_t    boot_adv_us;                    // time from boot to first adv data, last boot
+} diag_stats_t;
+
+
+void diag_init(void);
+void diag_latency(diag_stage_t stage, uint32_t us);
+void diag_dht_result(dht_error_t result);
+void diag_pms_result(pms_error_t result);
+void diag_burst(uint32_t retries);
+void diag_stack_check(uint8_t slot);
+void diag_heap_check(void);
+void diag_cycle(void);
+void diag_boot_adv(uint32_t us);
+void diag_get(diag_stats_t *dst);
+payload_error_t diag_encode(uint8_t *dst);
+
+#endif
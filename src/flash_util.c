@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#include "flash_util.h"
+
+
+
+uint16_t flash_util_crc_update(uint16_t crc, const void *data, size_t len) //CRC-16/CCITT-FALSE continued over next bytes, bitwise
+{
+    const uint8_t *bytes = data;
+
+    for(size_t i=0; i<len; ++i)
+    {
+        crc ^= (uint16_t)bytes[i] << 8;
+        for(uint8_t bit=0; bit<8; ++bit)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+
+uint16_t flash_util_crc(const void *data, size_t len) //CRC-16/CCITT-FALSE of one block
+{
+    return flash_util_crc_update(FLASH_UTIL_CRC_INIT, data, len);
+}
+
+
+bool flash_util_blank(const void *data, size_t len) //erased flash
+{
+    const uint8_t *bytes = data;
+
+    for(size_t i=0; i<len; ++i)
+    {
+        if(bytes[i] != 0xFF)
+            return false;
+    }
+    return true;
+}
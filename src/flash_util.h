@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef FLASH_UTIL_H_
+#define FLASH_UTIL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Checks of records kept in flash (history_log, sensor_trace) - CRC of record and erased (0xFF) state.
+
+#define FLASH_UTIL_CRC_INIT     0xFFFF  // CRC-16/CCITT-FALSE: poly 0x1021, init 0xFFFF, no reflection, no final xor
+
+uint16_t flash_util_crc_update(uint16_t crc, const void *data, size_t len);
+uint16_t flash_util_crc(const void *data, size_t len);
+bool flash_util_blank(const void *data, size_t len);
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "flash_util.h"
+#include "history_log.h"
+
+static const char *TAG = "HISTORY_LOG";
+
+typedef struct { // state of ring, rebuilt from sector headers at init
+    const esp_partition_t   *partition;
+    uint8_t                 sectors_num;
+    uint32_t                seq[HISTORY_LOG_SECTORS_MAX];           // 0 - sector without valid header (free or torn)
+    uint32_t                first_cycle[HISTORY_LOG_SECTORS_MAX];
+    uint8_t                 head;       // sector written now
+    uint16_t                head_slot;  // next free record slot in head sector
+    uint32_t                next_cycle; // cycle of next record written to flash
+} history_log_t;
+
+typedef struct { // records waiting for batch write, kept during deep sleep
+    uint32_t                magic;
+    uint8_t                 num;
+    history_log_record_t    records[HISTORY_LOG_BATCH_NUM];
+} history_log_pending_t;
+
+static history_log_t history_log = {0};
+RTC_DATA_ATTR static history_log_pending_t history_log_pending;
+static SemaphoreHandle_t history_log_mutex=NULL; // guards history_log and history_log_pending
+MEM_SEMAPHORE_DEFINE(history_log_mutex);
+
+
+
+static void history_log_lock(void)
+{
+    if(history_log_mutex != NULL)
+        xSemaphoreTake(history_log_mutex, portMAX_DELAY);
+}
+
+
+static void history_log_unlock(void)
+{
+    if(history_log_mutex != NULL)
+        xSemaphoreGive(history_log_mutex);
+}
+
+
+static size_t history_log_slot_addr(uint8_t sector, uint16_t slot)
+{
+    return (size_t)sector * HISTORY_LOG_SECTOR_SIZE + sizeof(history_log_header_t) + (size_t)slot * sizeof(history_log_record_t);
+}
+
+
+static bool history_log_record_valid(const history_log_record_t *record)
+{
+    return record->crc == flash_util_crc(record, offsetof(history_log_record_t, crc));
+}
+
+
+static history_log_error_t history_log_open_sector(uint8_t sector, uint32_t seq, uint32_t first_cycle) //erase and write header
+{
+    history_log_header_t header = {
+        .magic = HISTORY_LOG_MAGIC,
+        .seq = seq,
+        .first_cycle = first_cycle,
+        .reserved = 0xFFFF
+    };
+    header.crc = flash_util_crc(&header, offsetof(history_log_header_t, crc));
+
+    history_log.seq[sector] = 0;
+    if(esp_partition_erase_range(history_log.partition, (size_t)sector * HISTORY_LOG_SECTOR_SIZE, HISTORY_LOG_SECTOR_SIZE) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Fail erase sector %u", sector);
+        return HISTORY_LOG_FAIL_ERASE;
+    }
+    if(esp_partition_write(history_log.partition, (size_t)sector * HISTORY_LOG_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Fail write header of sector %u", sector);
+        return HISTORY_LOG_FAIL_WRITE;
+    }
+
+    history_log.seq[sector] = seq;
+    history_log.first_cycle[sector] = first_cycle;
+    history_log.head = sector;
+    history_log.head_slot = 0;
+    return HISTORY_LOG_OK;
+}
+
+
+static history_log_error_t history_log_mount(void) //find head sector and first free slot after power loss or reset
+{
+    history_log_header_t header;
+    history_log_record_t record;
+    bool found = false;
+
+    for(uint8_t sector=0; sector<history_log.sectors_num; ++sector)
+    {
+        history_log.seq[sector] = 0;
+        if(esp_partition_read(history_log.partition, (size_t)sector * HISTORY_LOG_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Fail read header of sector %u", sector);
+            return HISTORY_LOG_FAIL_READ;
+        }
+        if(header.magic != HISTORY_LOG_MAGIC || header.seq == 0 ||
+            header.crc != flash_util_crc(&header, offsetof(history_log_header_t, crc)))
+            continue;
+
+        history_log.seq[sector] = header.seq;
+        history_log.first_cycle[sector] = header.first_cycle;
+        if(!found || header.seq > history_log.seq[history_log.head])
+            history_log.head = sector;
+        found = true;
+    }
+
+    if(!found) // empty partition
+    {
+        history_log.next_cycle = 0;
+        return history_log_open_sector(0, 1, 0);
+    }
+
+    // slots after torn record are still free, record is written only to blank slot
+    history_log.next_cycle = history_log.first_cycle[history_log.head];
+    history_log.head_slot = HISTORY_LOG_RECORDS_PER_SECTOR;
+    for(uint16_t slot=0; slot<HISTORY_LOG_RECORDS_PER_SECTOR; ++slot)
+    {
+        if(esp_partition_read(history_log.partition, history_log_slot_addr(history_log.head, slot), &record, sizeof(record)) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Fail read record");
+            return HISTORY_LOG_FAIL_READ;
+        }
+        if(flash_util_blank(&record, sizeof(record)))
+        {
+            history_log.head_slot = slot;
+            break;
+        }
+        if(history_log_record_valid(&record))
+            history_log.next_cycle = record.cycle + 1;
+    }
+    return HISTORY_LOG_OK;
+}
+
+
+static uint8_t history_log_tail(void) //oldest valid sector, sectors from tail to head are in order of cycles
+{
+    uint8_t sector = history_log.head;
+
+    for(uint8_t i=1; i<history_log.sectors_num; ++i)
+    {
+        uint8_t next = (history_log.head + i) % history_log.sectors_num;
+        if(history_log.seq[next] != 0)
+            return next;
+    }
+    return sector;
+}
+
+
+history_log_error_t history_log_init(void) //find partition and restore state of log
+{
+    history_log_error_t err;
+
+    if(history_log_mutex == NULL)
+        history_log_mutex = MEM_SEMAPHORE_CREATE_MUTEX(history_log_mutex);
+
+    history_log.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, HISTORY_LOG_PARTITION_SUBTYPE, HISTORY_LOG_PARTITION_LABEL);
+    if(history_log.partition == NULL)
+    {
+        ESP_LOGE(TAG, "No partition %s", HISTORY_LOG_PARTITION_LABEL);
+        return HISTORY_LOG_NO_PARTITION;
+    }
+
+    history_log.sectors_num = history_log.partition->size / HISTORY_LOG_SECTOR_SIZE < HISTORY_LOG_SECTORS_MAX ?
+        history_log.partition->size / HISTORY_LOG_SECTOR_SIZE : HISTORY_LOG_SECTORS_MAX;
+    if(history_log.sectors_num < 2)
+    {
+        history_log.partition = NULL;
+        ESP_LOGE(TAG, "Partition %s too small", HISTORY_LOG_PARTITION_LABEL);
+        return HISTORY_LOG_BAD_PARTITION;
+    }
+
+    err = history_log_mount();
+    if(err != HISTORY_LOG_OK)
+    {
+        history_log.partition = NULL;
+        return err;
+    }
+
+    // batch from RTC memory is valid only after deep sleep and only if it continues log in flash
+    if(esp_reset_reason() != ESP_RST_DEEPSLEEP || history_log_pending.magic != HISTORY_LOG_MAGIC ||
+        history_log_pending.num > HISTORY_LOG_BATCH_NUM ||
+        (history_log_pending.num > 0 && history_log_pending.records[0].cycle != history_log.next_cycle))
+    {
+        history_log_pending.magic = HISTORY_LOG_MAGIC;
+        history_log_pending.num = 0;
+    }
+
+    ESP_LOGI(TAG, "Cycles %u-%u in flash, %u pending", history_log_first_cycle(), history_log.next_cycle, history_log_pending.num);
+    return HISTORY_LOG_OK;
+}
+
+
+static history_log_error_t history_log_write_pending(void) //write pending records, next sector is opened when head is full
+{
+    history_log_error_t err = HISTORY_LOG_OK;
+    uint8_t written = 0;
+
+    while(written < history_log_pending.num)
+    {
+        if(history_log.head_slot >= HISTORY_LOG_RECORDS_PER_SECTOR)
+        {
+            err = history_log_open_sector((history_log.head + 1) % history_log.sectors_num, history_log.seq[history_log.head] + 1,
+                history_log_pending.records[written].cycle);
+            if(err != HISTORY_LOG_OK)
+                break;
+        }
+
+        uint16_t num = history_log_pending.num - written;
+        if(num > HISTORY_LOG_RECORDS_PER_SECTOR - history_log.head_slot)
+            num = HISTORY_LOG_RECORDS_PER_SECTOR - history_log.head_slot;
+
+        // slots are used even if write fails, they aren't blank anymore
+        esp_err_t write_err = esp_partition_write(history_log.partition, history_log_slot_addr(history_log.head, history_log.head_slot),
+            &history_log_pending.records[written], num * sizeof(history_log_record_t));
+        history_log.head_slot += num;
+        if(write_err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Fail write records");
+            err = HISTORY_LOG_FAIL_WRITE;
+            break;
+        }
+        written += num;
+        history_log.next_cycle = history_log_pending.records[written-1].cycle + 1;
+    }
+
+    history_log_pending.num -= written;
+    memmove(history_log_pending.records, &history_log_pending.records[written], history_log_pending.num * sizeof(history_log_record_t));
+    return err;
+}
+
+
+history_log_error_t history_log_flush(void) //write pending records now, before deep sleep or power down
+{
+    history_log_error_t err;
+
+    if(history_log.partition == NULL)
+        return HISTORY_LOG_NOT_INIT;
+
+    history_log_lock();
+    err = history_log_write_pending();
+    history_log_unlock();
+    return err;
+}
+
+
+history_log_error_t history_log_append(const dht_measurement_t *dht_value, const pms_measurement_t *pms_value, uint8_t esp_temp, uint32_t *cycle) //add record of cycle, flash is written when batch is full
+{
+    history_log_error_t err = HISTORY_LOG_OK;
+
+    if(history_log.partition == NULL)
+        return HISTORY_LOG_NOT_INIT;
+
+    history_log_lock();
+    if(history_log_pending.num >= HISTORY_LOG_BATCH_NUM && history_log_write_pending() != HISTORY_LOG_OK)
+    {
+        history_log_unlock();
+        return HISTORY_LOG_FAIL_WRITE;
+    }
+
+    history_log_record_t *record = &history_log_pending.records[history_log_pending.num];
+    *record = (history_log_record_t){
+        .cycle          = history_log.next_cycle + history_log_pending.num,
+        .temperature    = dht_value->temperature,
+        .humidity       = dht_value->humidity,
+        .pm             = {pms_value->sm.pm10, pms_value->sm.pm25, pms_value->sm.pm100,
+                           pms_value->ae.pm10, pms_value->ae.pm25, pms_value->ae.pm100},
+        .um             = {pms_value->num.um3, pms_value->num.um5, pms_value->num.um10,
+                           pms_value->num.um25, pms_value->num.um50, pms_value->num.um100},
+        .esp_temp       = esp_temp,
+        .reserved       = 0xFF
+    };
+    record->crc = flash_util_crc(record, offsetof(history_log_record_t, crc));
+    if(cycle != NULL)
+        *cycle = record->cycle;
+
+    if(++history_log_pending.num >= HISTORY_LOG_BATCH_NUM)
+        err = history_log_write_pending();
+    history_log_unlock();
+    return err;
+}
+
+
+static history_log_error_t history_log_find(uint32_t cycle, history_log_record_t *dst) //sector by binary search of first cycles, slot from cycle
+{
+    history_log_record_t record;
+
+    if(cycle >= history_log.next_cycle) // not written yet
+    {
+        if(cycle - history_log.next_cycle >= history_log_pending.num)
+            return HISTORY_LOG_NOT_FOUND;
+        *dst = history_log_pending.records[cycle - history_log.next_cycle];
+        return HISTORY_LOG_OK;
+    }
+
+    uint8_t tail = history_log_tail();
+    uint8_t count = (history_log.head + history_log.sectors_num - tail) % history_log.sectors_num + 1;
+    if(cycle < history_log.first_cycle[tail])
+        return HISTORY_LOG_NOT_FOUND;
+
+    // last sector with first_cycle <= cycle
+    uint8_t low = 0, high = count - 1;
+    while(low < high)
+    {
+        uint8_t mid = (low + high + 1) / 2;
+        if(history_log.first_cycle[(tail + mid) % history_log.sectors_num] <= cycle)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    uint8_t sector = (tail + low) % history_log.sectors_num;
+    uint16_t end = sector == history_log.head ? history_log.head_slot : HISTORY_LOG_RECORDS_PER_SECTOR;
+
+    // torn records only move later records forward
+    for(uint32_t slot=cycle - history_log.first_cycle[sector]; slot<end; ++slot)
+    {
+        if(esp_partition_read(history_log.partition, history_log_slot_addr(sector, slot), &record, sizeof(record)) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Fail read record");
+            return HISTORY_LOG_FAIL_READ;
+        }
+        if(flash_util_blank(&record, sizeof(record)))
+            break;
+        if(!history_log_record_valid(&record))
+            continue;
+        if(record.cycle == cycle)
+        {
+            *dst = record;
+            return HISTORY_LOG_OK;
+        }
+        if(record.cycle > cycle)
+            break;
+    }
+    return HISTORY_LOG_NOT_FOUND;
+}
+
+
+history_log_error_t history_log_read(uint32_t cycle, history_log_record_t *dst) //record of cycle from flash or pending batch
+{
+    history_log_error_t err;
+
+    if(history_log.partition == NULL)
+        return HISTORY_LOG_NOT_INIT;
+
+    history_log_lock();
+    err = history_log_find(cycle, dst);
+    history_log_unlock();
+    return err;
+}
+
+
+uint32_t history_log_first_cycle(void) //oldest cycle kept in log
+{
+    uint32_t cycle;
+
+    if(history_log.partition == NULL)
+        return 0;
+    history_log_lock();
+    cycle = history_log.first_cycle[history_log_tail()];
+    history_log_unlock();
+    return cycle;
+}
+
+
+uint32_t history_log_next_cycle(void) //number of cycle for next appended record
+{
+    uint32_t cycle;
+
+    history_log_lock();
+    cycle = history_log.next_cycle + history_log_pending.num;
+    history_log_unlock();
+    return cycle;
+}
+
+
+void history_log_unpack(const history_log_record_t *record, dht_measurement_t *dht_value, pms_measurement_t *pms_value, uint8_t *esp_temp)
+{
+    if(dht_value != NULL)
+    {
+        dht_value->temperature = record->temperature;
+        dht_value->humidity = record->humidity;
+    }
+    if(pms_value != NULL)
+    {
+        pms_value->sm.pm10 = record->pm[0];
+        pms_value->sm.pm25 = record->pm[1];
+        pms_value->sm.pm100 = record->pm[2];
+        pms_value->ae.pm10 = record->pm[3];
+        pms_value->ae.pm25 = record->pm[4];
+        pms_value->ae.pm100 = record->pm[5];
+        pms_value->num.um3 = record->um[0];
+        pms_value->num.um5 = record->um[1];
+        pms_value->num.um10 = record->um[2];
+        pms_value->num.um25 = record->um[3];
+        pms_value->num.um50 = record->um[4];
+        pms_value->num.um100 = record->um[5];
+    }
+    if(esp_temp != NULL)
+        *esp_temp = record->esp_temp;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef HISTORY_LOG_H_
+#define HISTORY_LOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_partition.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "mem_budget.h"
+#include "pms.h"
+#include "dht.h"
+
+// Append-only log of cycle aggregates in dedicated flash partition (see partitions.csv):
+// history, data, 0x40, , 128K
+// Partition is a ring of sectors, every sector = header + fixed size records, oldest sector is erased when
+// head sector is full, so every sector is erased once per lap (wear leveling). Records are batched in RTC memory
+// and written together, a record torn by power loss fails CRC and is skipped.
+// Functions are thread safe after history_log_init - records are appended by aggregator and read by BLE download.
+
+//CONFIG
+#define HISTORY_LOG_PARTITION_LABEL     "history"
+#define HISTORY_LOG_PARTITION_SUBTYPE   0x40
+#define HISTORY_LOG_SECTOR_SIZE         SPI_FLASH_SEC_SIZE
+#define HISTORY_LOG_SECTORS_MAX         64  // cap of used sectors (256KB), history partition in partitions.csv is 128K = 32 sectors
+#define HISTORY_LOG_BATCH_NUM           8   // records written at once (~45min of cycles), lost on power loss if not written
+#define HISTORY_LOG_MAGIC               0x4C48414D // "MAHL"
+#define HISTORY_LOG_PM_NUM              6   // sm pm1.0/2.5/10, ae pm1.0/2.5/10
+#define HISTORY_LOG_UM_NUM              6   // particles >0.3/0.5/1.0/2.5/5.0/10um
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t    magic;
+    uint32_t    seq;            // sector sequence number, +1 for every opened sector
+    uint32_t    first_cycle;    // cycle of first record in sector
+    uint16_t    reserved;
+    uint16_t    crc;            // CRC-16/CCITT of preceding bytes
+} history_log_header_t;//16bytes
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t    cycle;          // number of cycle since log was formatted
+    int16_t     temperature;    // 0.1 C
+    uint16_t    humidity;       // 0.1 %
+    uint16_t    pm[HISTORY_LOG_PM_NUM];
+    uint16_t    um[HISTORY_LOG_UM_NUM];
+    uint8_t     esp_temp;
+    uint8_t     reserved;
+    uint16_t    crc;            // CRC-16/CCITT of preceding bytes
+} history_log_record_t;//36bytes
+
+#define HISTORY_LOG_RECORDS_PER_SECTOR  ((HISTORY_LOG_SECTOR_SIZE - sizeof(history_log_header_t)) / sizeof(history_log_record_t))
+
+//ERROR
+typedef enum {
+    HISTORY_LOG_OK                  = 0,
+    HISTORY_LOG_NO_PARTITION        = -1,
+    HISTORY_LOG_BAD_PARTITION       = -2,
+    HISTORY_LOG_FAIL_READ           = -3,
+    HISTORY_LOG_FAIL_WRITE          = -4,
+    HISTORY_LOG_FAIL_ERASE          = -5,
+    HISTORY_LOG_NOT_FOUND           = -6,
+    HISTORY_LOG_NOT_INIT            = -7
+} history_log_error_t;
+
+
+history_log_error_t history_log_init(void);
+history_log_error_t history_log_append(const dht_measurement_t *dht_value, const pms_measurement_t *pms_value, uint8_t esp_temp, uint32_t *cycle);
+history_log_error_t history_log_flush(void);
+history_log_error_t history_log_read(uint32_t cycle, history_log_record_t *dst);
+uint32_t history_log_first_cycle(void);
+uint32_t history_log_next_cycle(void);
+void history_log_unpack(const history_log_record_t *record, dht_measurement_t *dht_value, pms_measurement_t *pms_value, uint8_t *esp_temp);
+
+#endif
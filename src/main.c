@@ -6,184 +6,655 @@
 #include <memory.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/event_groups.h>
 #include <esp_int_wdt.h>
 #include <esp_log.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_pm.h>
+#if CONFIG_IDF_TARGET_ESP32
+#include <esp32/pm.h>
+#endif
 
 #include "sdkconfig.h"
 #include "pms.h"
 #include "dht.h"
 #include "led_rgb.h"
 #include "ble_adv.h"
-
-#define ENCODE_MID_BYTE(high4bits, low4bits) ( ((uint8_t)high4bits<<4) | (((uint8_t)(low4bits>>8))&0x0F) )
+#include "payload.h"
+#include "history_log.h"
+#include "sensor_trace.h"
+#include "diag.h"
+#include "flash_util.h"
+#include "mem_budget.h"
+#include "sensor.h"
 
 #define TIME_SLEEP_MS           300000 //real + DELAY_START_PMS
-#define DELAY_START_PMS         40000 //wait minimum 30s to stable data from PMS
-#define DELAY_MEASUREMENT       2000 // delay between next measurment
-#define MAX_NUM_MEASUREMENT     10 // max number measurment to avg
-#define MAX_NUM_TRY_MEASUREMENT 60 // max number try measurment (number = sum of sucess measurment and fail measurment)
+#define CYCLE_PERIOD_MS         (TIME_SLEEP_MS + DELAY_START_PMS) // period of measurement cycle, sensors are measured concurrently inside
+#define HISTORY_WINDOW_LEN      10 // number of cycles in avg frame, cost per cycle doesn't depend on it
+
+//SENSORS - instances driven by sensor scheduler (sensor.h), adaptive PMS window is configured there
+#define SENSOR_PM_NUM           1 // 2 - redundant PMS on SENSOR_PM2_xxx wiring, live PM is avg of both
+
+//ADAPTIVE CYCLE - short cycle during PM spike, spike is reported after ~FAST_CYCLE_PERIOD_MS instead of CYCLE_PERIOD_MS
+#ifndef ADAPTIVE_CYCLE // -DADAPTIVE_CYCLE=0 - fixed cycle without edit
+#define ADAPTIVE_CYCLE          1
+#endif
+#define FAST_CYCLE_PERIOD_MS    60000 // must cover warm-up and burst of PMS
+#define SPIKE_ENTER_PCT         25 // rise of live PM2.5/PM10 between cycles which starts fast cycle
+#define SPIKE_ENTER_ABS         5 // ug/m3, minimal rise for low concentration
+#define SPIKE_STABLE_PCT        10 // change below it is stable, fast cycle ends after SPIKE_STABLE_NUM stable cycles (hysteresis)
+#define SPIKE_STABLE_ABS        2 // ug/m3
+#define SPIKE_STABLE_NUM        3
+#define FAN_DUTY_MAX_PCT        30 // fan time budget grows with this part of cycle, fast cycle only with budget for next fan run
+#define FAN_BUDGET_MAX_MS       600000 // max saved fan time (~20 fast cycles above duty limit)
+
+//LOW POWER MODE - what device is doing between cycles
+#define LOW_POWER_MODE_NONE     0 // CPU, BT controller and peripherals are running
+#define LOW_POWER_MODE_LIGHT    1 // automatic light sleep (needs CONFIG_PM_ENABLE, CONFIG_FREERTOS_USE_TICKLESS_IDLE and BT modem sleep)
+#define LOW_POWER_MODE_DEEP     2 // deep sleep, history and last data are kept in RTC memory
+#ifndef LOW_POWER_MODE // -DLOW_POWER_MODE=LOW_POWER_MODE_DEEP selects mode without edit (variants of host simulator)
+#define LOW_POWER_MODE          LOW_POWER_MODE_NONE
+#endif
+#ifndef LOW_POWER_STATE_CHECK // -DLOW_POWER_STATE_CHECK=1 - deep sleep exports low_power_state_crc for host simulator
+#define LOW_POWER_STATE_CHECK   0
+#endif
+#define ADV_AWAKE_MS            20000 // deep sleep - time of advertising new data before next sleep
+#define RTC_STATE_MAGIC         0x4D415331 // "MAS1"
+
+#if LOW_POWER_MODE == LOW_POWER_MODE_DEEP
+#define HISTORY_ATTR            RTC_DATA_ATTR
+#else
+#define HISTORY_ATTR
+#endif
+
+//ROLLUPS - cycle -> 1h -> 24h, every level is updated in O(1) from level below
+#define ROLLUP_HOUR_MS          3600000 // time of hour bucket, measured in cycle periods (valid also with deep sleep)
+#define ROLLUP_DAY_HOURS        24 // rolling window of hourly averages, day average is published when window is full
+#define MEASUREMENT_CHANNELS    (DHT_WINDOW_CHANNELS + PMS_WINDOW_CHANNELS + 1) // measurement_t as channels of stats
+
+//ADV FRAMES - payload type and number of rotation slots per round
+#define ADV_TYPE_LIVE           0
+#define ADV_TYPE_AVG            1 // HISTORY_WINDOW_LEN cycles
+#define ADV_TYPE_HOUR           2
+#define ADV_TYPE_DAY            3
+#define ADV_TYPES_NUM           4
+#define ADV_WEIGHT_LIVE         2
+#define ADV_WEIGHT_AVG          1
+#define ADV_WEIGHT_HOUR         1
+#define ADV_WEIGHT_DAY          1
+#define ADV_FRAME_DIAG          ADV_TYPES_NUM // own head id (DIAG_ADV_ID), not measurement type
+#define ADV_WEIGHT_DIAG         1
+#define ADV_FRAME_SENSOR        (ADV_TYPES_NUM + 1) // first instance frame - own head id (SENSOR_ADV_ID), type = instance
+#define ADV_SENSOR_FRAMES_MAX   (BLE_ADV_FRAMES_MAX - ADV_FRAME_SENSOR)
+#define ADV_WEIGHT_SENSOR       1
+
+//DIAG STACK SLOTS - lowest free stack of every task
+#define DIAG_SLOT_SENSOR        0 // first of SENSOR_INSTANCES_MAX slots, slot of instance = DIAG_SLOT_SENSOR + index
+#define DIAG_SLOT_AGGREGATOR    (DIAG_SLOT_SENSOR + SENSOR_INSTANCES_MAX)
+#define DIAG_SLOT_PUBLISHER     (DIAG_SLOT_AGGREGATOR + 1)
+
+//TASKS
+#define BOOT_TASK_STACK         2048
+#define BOOT_TASK_PRIO          4
+#define AGGREGATOR_TASK_STACK   4096
+#define AGGREGATOR_TASK_PRIO    3
+#define PUBLISHER_TASK_STACK    3072
+#define PUBLISHER_TASK_PRIO     3
+
+//EVENT GROUP BITS - boot tasks done, first cycle waits for them (and for init of sensors)
+#define BOOT_DONE_LED           BIT0
 static const char *TAG = "DHT";
 
-struct __attribute__((__packed__)) PayloadMeasurement {
-    // first 24bits: tttt 	ttyy	hhtt	tttt	hhhh	hhhh  <= t=temp | h=hum | y=type bits
-    uint8_t     type:2; 
-    uint16_t    temperature:12; //range -400 : 1250 => 0  : 2047 => 1sign bit + 11bits
-    uint16_t    humidity:10; //range 0 : 1000 => 0 : 1023 =>10bits
-    uint8_t     pm[9];  //6x12bit=9bytes => 2values pm on 3bytes
-    uint16_t    um[6];  //6x16bit=12bytes
-    uint8_t     esp_temperature; 
-};//25bytes
-
-void measure_dht(dht_measurement_t *dht_value_1h);
-void measure_pms(pms_measurement_t *pms_value_1h);
-void make_adv_data(const dht_measurement_t *dht_value_1h, const pms_measurement_t *pms_value_1h, uint8_t esp_temp, uint8_t type);
-static inline uint8_t esp_temp_calc_avg(const uint8_t *arr_src, uint8_t arr_size);
-uint8_t temprature_sens_read(void);
-
-uint32_t time_sleep_ms = TIME_SLEEP_MS;
+typedef struct { // one measurement of all sensors
+    dht_measurement_t dht;
+    pms_measurement_t pms;
+    uint8_t esp_temp;
+} measurement_t;
+
+typedef struct { // data to publish in adv frames
+    measurement_t live;
+    measurement_t avg;
+    measurement_t hour;
+    measurement_t day;
+    bool live_valid; // frame is aired since its first data - after boot only last known live data can be valid
+    bool avg_valid;
+    bool hour_valid; // frames of rollups are aired after first closed hour / full day
+    bool day_valid;
+    sensor_value_t instances[SENSOR_INSTANCES_MAX]; // last result of every sensor instance, aired in instance frames
+    uint8_t instances_valid; // bit of instance
+    uint8_t seq; // low bits of history log cycle, receivers drop repeats of the same cycle in rotation
+} adv_measurement_t;
+
+typedef struct { // adaptive cycle
+    uint32_t period_ms; // period of current cycle
+    uint32_t fan_budget_ms;
+    uint16_t last_pm25;
+    uint16_t last_pm100;
+    uint8_t last_band;
+    uint8_t stable_num; // consecutive stable fast cycles
+    bool last_valid;
+} cycle_schedule_t;
+
+typedef struct { // state kept between cycles in deep sleep
+    uint32_t magic;
+    adv_measurement_t last_adv; // advertised immediately after wake up
+    cycle_schedule_t schedule;
+} rtc_state_t;
+
+typedef struct { // band of air quality - LED color, bands are checked in order
+    uint16_t pm100;
+    uint16_t pm25;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} air_quality_band_t;
+
+static const air_quality_band_t AIR_QUALITY_BANDS[] = {
+    {20,            13,         0,   255, 0},   //green
+    {50,            35,         26,  255, 26},  //light green
+    {80,            55,         255, 30,  0},   //yeellow
+    {110,           75,         255, 10,  0},   //orange
+    {150,           110,        255, 4,   4},   //light red
+    {UINT16_MAX,    UINT16_MAX, 255, 0,   0},   //red
+};
+
+void make_adv_data(const dht_measurement_t *dht_value_1h, const pms_measurement_t *pms_value_1h, uint8_t esp_temp, uint8_t type, uint8_t frame);
+static void measurement_pack(const measurement_t *value, int32_t *values);
+static void measurement_unpack(const int32_t *values, measurement_t *dst);
+static uint32_t sensors_result(adv_measurement_t *dst);
+static uint8_t air_quality_band(const pms_measurement_t *pms_value);
+static void cycle_schedule_reset(cycle_schedule_t *schedule);
+static uint32_t cycle_schedule_next(cycle_schedule_t *schedule, const pms_measurement_t *pms_value, uint32_t fan_ms);
+
+static void aggregator_task(void *parameter);
+static void publisher_task(void *parameter);
+static void led_boot_task(void *parameter);
+static void boot_adv_value(adv_measurement_t *dst);
+static void publish_measurement(const measurement_t *value, uint8_t type, uint8_t weight, bool *aired);
+static void publish_instance(const adv_measurement_t *value, uint8_t instance, uint8_t frame, bool *aired);
+static bool low_power_init(void);
+static void low_power_sleep(uint32_t period_ms);
+#if LOW_POWER_MODE == LOW_POWER_MODE_DEEP && LOW_POWER_STATE_CHECK
+uint16_t low_power_state_crc(void);
+#endif
+
+static EventGroupHandle_t boot_events;
+static QueueHandle_t adv_queue;
+MEM_EVENT_GROUP_DEFINE(boot_events);
+MEM_QUEUE_DEFINE(adv_queue, 1, sizeof(adv_measurement_t));
+MEM_TASK_DEFINE(led_boot_task, BOOT_TASK_STACK);
+MEM_TASK_DEFINE(publisher_task, PUBLISHER_TASK_STACK);
+MEM_TASK_DEFINE(aggregator_task, AGGREGATOR_TASK_STACK);
+
+#if SENSOR_PM_NUM > 1
+static const pms_config_t PMS2_CONFIG = {
+    .uart_num   = SENSOR_PM2_UART_NUM,
+    .set_gpio   = SENSOR_PM2_SET_GPIO,
+    .reset_gpio = SENSOR_PM2_RESET_GPIO,
+    .rx_gpio    = SENSOR_PM2_RX_GPIO,
+    .tx_gpio    = SENSOR_PM2_TX_GPIO
+};
+#endif
+
+static sensor_t sensors[] = { // index of instance = type in its instance frame
+    {.ops = &sensor_pms_ops,        .name = "pms"},
+#if SENSOR_PM_NUM > 1
+    {.ops = &sensor_pms_ops,        .name = "pms2",     .config = &PMS2_CONFIG},
+#endif
+    {.ops = &sensor_dht_ops,        .name = "dht"},
+    {.ops = &sensor_chip_temp_ops,  .name = "esp temp"},
+};
+#define SENSORS_NUM             (sizeof(sensors) / sizeof(sensors[0]))
+static uint8_t adv_frames_num = ADV_FRAME_SENSOR;
+static uint8_t adv_sensor_frames[ADV_SENSOR_FRAMES_MAX]; // instance of every instance frame
+
+STATS_WINDOW_DEFINE_ATTR(dht_history, DHT_WINDOW_CHANNELS, HISTORY_WINDOW_LEN, HISTORY_ATTR);
+STATS_WINDOW_DEFINE_ATTR(pms_history, PMS_WINDOW_CHANNELS, HISTORY_WINDOW_LEN, HISTORY_ATTR);
+STATS_WINDOW_DEFINE_ATTR(esp_temp_history, 1, HISTORY_WINDOW_LEN, HISTORY_ATTR);
+STATS_BUCKET_DEFINE_ATTR(hour_rollup, MEASUREMENT_CHANNELS, ROLLUP_HOUR_MS, HISTORY_ATTR);
+STATS_WINDOW_DEFINE_ATTR(day_rollup, MEASUREMENT_CHANNELS, ROLLUP_DAY_HOURS, HISTORY_ATTR);
+HISTORY_ATTR static rtc_state_t rtc_state;
+static bool history_restored = false;
 
 void app_main(void)
 {
-    dht_measurement_t dht_value_1h[10] = {0};
-    pms_measurement_t pms_value_1h[10] = {0};
-    uint8_t esp_temp_1h[10]={0};
-    uint8_t offset_measurement_1h=0;
-    uint8_t num_measurement_1h=0;
+    adv_measurement_t boot_value;
+
+    history_restored = low_power_init();
+    diag_init();
+    sensor_trace_init(); // before sensors, capture mode only (SENSOR_TRACE)
+
+    boot_events = MEM_EVENT_GROUP_CREATE(boot_events);
+    adv_queue = MEM_QUEUE_CREATE(adv_queue);
+
+    // sensors init (in their tasks) and LED test run concurrently with BLE init, time to first adv = BLE init only
+    MEM_TASK_CREATE(led_boot_task, led_boot_task, "led boot", NULL, BOOT_TASK_PRIO, NULL);
+    sensor_scheduler_init(sensors, SENSORS_NUM, DIAG_SLOT_SENSOR);
+
+    // kinds with more instances (redundant PMS) - every instance has also own frame
+    for(uint8_t i=0; i<SENSORS_NUM && adv_frames_num<BLE_ADV_FRAMES_MAX; ++i)
+    {
+        if(sensors[i].ops->kind != SENSOR_KIND_CHIP_TEMP && sensor_kind_num(sensors[i].ops->kind) > 1)
+            adv_sensor_frames[adv_frames_num++ - ADV_FRAME_SENSOR] = i;
+    }
 
-    led_rgb_init();
-    dht_init();
-    pms_init(PMS_WORKMODE_PASSIVE);
     ble_adv_bt_init();
-    led_rgb_test();
-    led_rgb_set(0,0,0);
-    ble_adv_data_init(2, sizeof(struct PayloadMeasurement));
+    history_log_init();
+    ble_adv_data_init(adv_frames_num, payload_measurement_schema.size);
+    for(uint8_t i=0; i<adv_frames_num; ++i)
+        ble_adv_set_weight(i, 0); // publisher enables frame when it has data
+    ble_adv_set_id(ADV_FRAME_DIAG, DIAG_ADV_ID);
+    for(uint8_t i=ADV_FRAME_SENSOR; i<adv_frames_num; ++i)
+        ble_adv_set_id(i, SENSOR_ADV_ID);
+#if BLE_ADV_SCAN_RSP
+    // active scanner gets live and avg data (rollups together) in one adv event, other frames carry live data
+    ble_adv_set_response(ADV_TYPE_LIVE, ADV_TYPE_AVG);
+    ble_adv_set_response(ADV_TYPE_AVG, ADV_TYPE_LIVE);
+    ble_adv_set_response(ADV_TYPE_HOUR, ADV_TYPE_DAY);
+    ble_adv_set_response(ADV_TYPE_DAY, ADV_TYPE_HOUR);
+    for(uint8_t i=ADV_FRAME_DIAG; i<adv_frames_num; ++i)
+        ble_adv_set_response(i, ADV_TYPE_LIVE);
+#endif
+    MEM_TASK_CREATE(publisher_task, publisher_task, "publisher", NULL, PUBLISHER_TASK_PRIO, NULL);
+
+    // warming up - last known data (RTC memory or history log) and diagnostics frame until first cycle ends
+    boot_adv_value(&boot_value);
+    xQueueOverwrite(adv_queue, &boot_value);
+
+    MEM_TASK_CREATE(aggregator_task, aggregator_task, "aggregator", NULL, AGGREGATOR_TASK_PRIO, NULL);
+}
+
+static void led_boot_task(void *parameter) //LED init and self-test, test overlaps first cycle (LED is set at its end)
+{
+    led_rgb_init();
+    xEventGroupSetBits(boot_events, BOOT_DONE_LED);
+    if(!history_restored) // no LED test after wake up from deep sleep
+        led_rgb_test();
     led_rgb_set(0,0,0);
+    vTaskDelete(NULL);
+}
 
-    while(1)
-    {
-        measure_dht(&(dht_value_1h[offset_measurement_1h]));
-        measure_pms(&(pms_value_1h[offset_measurement_1h]));
-        esp_temp_1h[offset_measurement_1h]=temprature_sens_read();
-        if(num_measurement_1h<10)++num_measurement_1h; //max 10, fix avg if measurements less than 10, after start esp
+static void boot_adv_value(adv_measurement_t *dst) //last known data to advertise until first cycle ends
+{
+    history_log_record_t record;
+    uint32_t cycle = history_log_next_cycle();
 
-        dht_calc_avg(dht_value_1h, &(dht_value_1h[(offset_measurement_1h+1)%10]), num_measurement_1h);
-        pms_calc_avg(pms_value_1h, &(pms_value_1h[(offset_measurement_1h+1)%10]), num_measurement_1h);
-        esp_temp_1h[(offset_measurement_1h+1)%10] = esp_temp_calc_avg(esp_temp_1h, num_measurement_1h);
+    if(history_restored)
+    {
+        *dst = rtc_state.last_adv;
+        return;
+    }
 
-        make_adv_data(&(dht_value_1h[offset_measurement_1h]), &(pms_value_1h[offset_measurement_1h]), esp_temp_1h[offset_measurement_1h], 0);//type 0 - data live 
-        make_adv_data(&(dht_value_1h[(offset_measurement_1h+1)%10]), &(pms_value_1h[(offset_measurement_1h+1)%10]), esp_temp_1h[(offset_measurement_1h+1)%10], 1);//type 1 - data avg 10 measurements
+    memset(dst, 0, sizeof(adv_measurement_t));
+    if(cycle > history_log_first_cycle() && history_log_read(cycle - 1, &record) == HISTORY_LOG_OK)
+    {
+        history_log_unpack(&record, &(dst->live.dht), &(dst->live.pms), &(dst->live.esp_temp));
+        dst->live_valid = true;
+        dst->seq = cycle - 1;
+        ESP_LOGI(TAG, "Warming up with data of cycle %u", cycle - 1);
+    }
+}
 
-        if(++offset_measurement_1h>9) offset_measurement_1h=0;
+static void aggregator_task(void *parameter) //start cycle, join results of producers, update rolling window and pass to publisher
+{
+    adv_measurement_t adv_value;
+    uint32_t fan_ms;
+    int32_t esp_temp;
+    int32_t values[MEASUREMENT_CHANNELS];
+    uint32_t period_ms;
+    uint32_t cycle;
+    TickType_t cycle_start = xTaskGetTickCount();
+
+    if(history_restored)
+    {
+        adv_value = rtc_state.last_adv;
+    }
+    else
+    {
+        memset(&adv_value, 0, sizeof(adv_measurement_t));
+        stats_window_reset(&dht_history);
+        stats_window_reset(&pms_history);
+        stats_window_reset(&esp_temp_history);
+        stats_bucket_reset(&hour_rollup);
+        stats_window_reset(&day_rollup);
+        cycle_schedule_reset(&(rtc_state.schedule));
+    }
 
-        vTaskDelay(time_sleep_ms / portTICK_RATE_MS);
-        time_sleep_ms = TIME_SLEEP_MS;
+    xEventGroupWaitBits(boot_events, BOOT_DONE_LED, pdFALSE, pdTRUE, portMAX_DELAY);
+    sensor_scheduler_wait_ready();
+    mem_budget_boot_done();
+    while(1)
+    {
+        sensor_scheduler_start();
+
+        // critical path of cycle = slowest sensor
+        sensor_scheduler_wait();
+        sensor_trace_flush(); // sensors are idle, flash write doesn't disturb capture
+        fan_ms = sensors_result(&adv_value);
+
+        // O(1) per cycle, independent of HISTORY_WINDOW_LEN
+        esp_temp = adv_value.live.esp_temp;
+        dht_window_push(&dht_history, &(adv_value.live.dht));
+        pms_window_push(&pms_history, &(adv_value.live.pms));
+        stats_window_push(&esp_temp_history, &esp_temp);
+        if(history_log_append(&(adv_value.live.dht), &(adv_value.live.pms), adv_value.live.esp_temp, &cycle) == HISTORY_LOG_OK) // flash is written once per batch
+            adv_value.seq = cycle;
+        else
+            ++adv_value.seq;
+
+        dht_window_get(&dht_history, STATS_WINDOW_AVG, &(adv_value.avg.dht));
+        pms_window_get(&pms_history, STATS_WINDOW_AVG, &(adv_value.avg.pms));
+        stats_window_get(&esp_temp_history, STATS_WINDOW_AVG, &esp_temp);
+        adv_value.avg.esp_temp = esp_temp;
+        adv_value.live_valid = true;
+        adv_value.avg_valid = true;
+
+        // rollups - hour bucket closes every ~11 long cycles, only then day window is updated
+        period_ms = rtc_state.schedule.period_ms;
+        measurement_pack(&(adv_value.live), values);
+        if(stats_bucket_push(&hour_rollup, values, period_ms, values))
+        {
+            measurement_unpack(values, &(adv_value.hour));
+            adv_value.hour_valid = true;
+            stats_window_push(&day_rollup, values);
+            if(stats_window_count(&day_rollup) >= ROLLUP_DAY_HOURS &&
+                stats_window_get(&day_rollup, STATS_WINDOW_AVG, values) == STATS_WINDOW_OK)
+            {
+                measurement_unpack(values, &(adv_value.day));
+                adv_value.day_valid = true;
+            }
+        }
+        rtc_state.schedule.period_ms = cycle_schedule_next(&(rtc_state.schedule), &(adv_value.live.pms), fan_ms);
+        diag_cycle();
+        diag_heap_check();
+        diag_stack_check(DIAG_SLOT_AGGREGATOR);
+        mem_budget_check();
+        xQueueOverwrite(adv_queue, &adv_value);
+        rtc_state.last_adv = adv_value;
+        rtc_state.magic = RTC_STATE_MAGIC;
+
+        low_power_sleep(rtc_state.schedule.period_ms);
+        vTaskDelayUntil(&cycle_start, rtc_state.schedule.period_ms / portTICK_RATE_MS);
     }
 }
 
-void measure_dht(dht_measurement_t *dht_value_1h)
+static void publisher_task(void *parameter) //set adv frames from aggregated data, frame is aired since its first data
 {
-    dht_measurement_t dht_value_tmp[MAX_NUM_MEASUREMENT] = {0};
-    uint8_t offset_tmp=0;
+    adv_measurement_t adv_value;
+    bool aired[BLE_ADV_FRAMES_MAX] = {false};
+    uint8_t *payload;
+    while(1)
+    {
+        if(xQueueReceive(adv_queue, &adv_value, portMAX_DELAY) != pdTRUE)
+            continue;
 
-    for(uint8_t i=0; i<MAX_NUM_TRY_MEASUREMENT; ++i){
-        if(dht_read(&(dht_value_tmp[offset_tmp]))==DHT_OK)
+        // diagnostics first - at boot it is the warming up frame
+        diag_stack_check(DIAG_SLOT_PUBLISHER);
+        ble_adv_set_sequence(adv_value.seq);
+        if((payload = ble_adv_data_acquire(ADV_FRAME_DIAG)) != NULL)
         {
-            ESP_LOGI(TAG, "Part (%i) of measurment - Hum: %i Temp: %i \n", offset_tmp, dht_value_tmp[offset_tmp].humidity, dht_value_tmp[offset_tmp].temperature);
-            if(++offset_tmp>=MAX_NUM_MEASUREMENT)break;
-        } 
-        vTaskDelay(DELAY_MEASUREMENT / portTICK_RATE_MS);
-        time_sleep_ms-=DELAY_MEASUREMENT;
+            diag_encode(payload);
+            ble_adv_data_commit(ADV_FRAME_DIAG);
+            if(!aired[ADV_FRAME_DIAG])
+                aired[ADV_FRAME_DIAG] = ble_adv_set_weight(ADV_FRAME_DIAG, ADV_WEIGHT_DIAG) == BLE_ADV_OK;
+        }
+
+        if(adv_value.live_valid)
+            publish_measurement(&(adv_value.live), ADV_TYPE_LIVE, ADV_WEIGHT_LIVE, &(aired[ADV_TYPE_LIVE]));
+        if(adv_value.avg_valid)
+            publish_measurement(&(adv_value.avg), ADV_TYPE_AVG, ADV_WEIGHT_AVG, &(aired[ADV_TYPE_AVG]));
+        if(adv_value.hour_valid)
+            publish_measurement(&(adv_value.hour), ADV_TYPE_HOUR, ADV_WEIGHT_HOUR, &(aired[ADV_TYPE_HOUR]));
+        if(adv_value.day_valid)
+            publish_measurement(&(adv_value.day), ADV_TYPE_DAY, ADV_WEIGHT_DAY, &(aired[ADV_TYPE_DAY]));
+        for(uint8_t i=ADV_FRAME_SENSOR; i<adv_frames_num; ++i)
+        {
+            if(adv_value.instances_valid & (1 << adv_sensor_frames[i - ADV_FRAME_SENSOR]))
+                publish_instance(&adv_value, adv_sensor_frames[i - ADV_FRAME_SENSOR], i, &(aired[i]));
+        }
     }
-    dht_calc_avg(dht_value_tmp, dht_value_1h, offset_tmp);
+}
 
-    ESP_LOGI(TAG, "End measurment - Hum: %i Tmp: %i \n", dht_value_1h->humidity, dht_value_1h->temperature);
+static void publish_measurement(const measurement_t *value, uint8_t type, uint8_t weight, bool *aired) //set frame, enable it at first data
+{
+    make_adv_data(&(value->dht), &(value->pms), value->esp_temp, type, type);
+    if(!*aired)
+        *aired = ble_adv_set_weight(type, weight) == BLE_ADV_OK;
 }
 
-void measure_pms(pms_measurement_t *pms_value_1h)
+static void publish_instance(const adv_measurement_t *value, uint8_t instance, uint8_t frame, bool *aired) //result of one sensor, fields of other kinds are zero
 {
-    pms_measurement_t pms_value_tmp[MAX_NUM_MEASUREMENT] = {0};
-    uint8_t offset_tmp=0;
+    measurement_t instance_value;
+
+    memset(&instance_value, 0, sizeof(measurement_t));
+    instance_value.esp_temp = value->live.esp_temp;
+    if(sensors[instance].ops->kind == SENSOR_KIND_PM)
+        instance_value.pms = value->instances[instance].pm;
+    else if(sensors[instance].ops->kind == SENSOR_KIND_CLIMATE)
+        instance_value.dht = value->instances[instance].climate;
+
+    make_adv_data(&(instance_value.dht), &(instance_value.pms), instance_value.esp_temp, instance, frame);
+    if(!*aired)
+        *aired = ble_adv_set_weight(frame, ADV_WEIGHT_SENSOR) == BLE_ADV_OK;
+}
 
-    pms_wake();
-    vTaskDelay(DELAY_START_PMS / portTICK_RATE_MS);//wait minimum 30s to stable data from PMS
-    for(uint8_t i=0; i<MAX_NUM_TRY_MEASUREMENT; ++i){
-        if(pms_request_read(&(pms_value_tmp[offset_tmp]))==PMS_OK)
-        {
-            ESP_LOGI(TAG, "Part (%i) measurment - PM 1/2.5/10: %i/%i/%i \n",offset_tmp, pms_value_tmp[offset_tmp].ae.pm10, pms_value_tmp[offset_tmp].ae.pm25, pms_value_tmp[offset_tmp].ae.pm100);
-            if(++offset_tmp>=MAX_NUM_MEASUREMENT)break;
-        } 
-        vTaskDelay(DELAY_MEASUREMENT / portTICK_RATE_MS);
-        time_sleep_ms-=DELAY_MEASUREMENT;
+static bool low_power_init(void) //set low power mode, return true if history was restored from RTC memory
+{
+#if LOW_POWER_MODE == LOW_POWER_MODE_LIGHT && CONFIG_PM_ENABLE
+    const esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = 40,
+        .light_sleep_enable = true
+    };
+    if(esp_pm_configure(&pm_config) != ESP_OK)
+        ESP_LOGE(TAG, "Fail configure light sleep");
+#endif
+
+#if LOW_POWER_MODE == LOW_POWER_MODE_DEEP
+    // RTC memory is valid only after deep sleep, after power on or reset history starts from zero
+    if(esp_reset_reason() == ESP_RST_DEEPSLEEP && rtc_state.magic == RTC_STATE_MAGIC)
+    {
+        ESP_LOGI(TAG, "Restored history from RTC memory (%u cycles)", stats_window_count(&pms_history));
+        return true;
     }
-    pms_sleep();
+    rtc_state.magic = 0;
+#endif
+    return false;
+}
 
-    pms_calc_avg(pms_value_tmp, pms_value_1h, offset_tmp);
+static void low_power_sleep(uint32_t period_ms) //deep sleep - advertise new data for ADV_AWAKE_MS and sleep until next cycle
+{
+#if LOW_POWER_MODE == LOW_POWER_MODE_DEEP
+    int64_t time_sleep_us;
+
+    vTaskDelay(ADV_AWAKE_MS / portTICK_RATE_MS);
+    time_sleep_us = (int64_t)period_ms * 1000 - esp_timer_get_time(); // cycle starts at boot
+    if(time_sleep_us < 1000)
+        time_sleep_us = 1000;
+
+    sensor_scheduler_hold();
+    sensor_trace_flush();
+    esp_sleep_enable_timer_wakeup(time_sleep_us);
+    esp_deep_sleep_start();
+#endif
+}
 
-    //SET COLOR RGB QUALITY AIR
-    if(pms_value_1h->ae.pm100 <= 20 && pms_value_1h->ae.pm25 <= 13)         led_rgb_set(0,255,0);     //green
-    else if(pms_value_1h->ae.pm100 <= 50 && pms_value_1h->ae.pm25 <= 35)    led_rgb_set(26,255,26);   //light green
-    else if(pms_value_1h->ae.pm100 <= 80 && pms_value_1h->ae.pm25 <= 55)    led_rgb_set(255,30,0);    //yeellow
-    else if(pms_value_1h->ae.pm100 <= 110 && pms_value_1h->ae.pm25 <= 75)   led_rgb_set(255,10,0);    //orange
-    else if(pms_value_1h->ae.pm100 <= 150 && pms_value_1h->ae.pm25 <= 110)  led_rgb_set(255,4,4);     //light red
-    else                                                                    led_rgb_set(255,0,0);     //red
+#if LOW_POWER_MODE == LOW_POWER_MODE_DEEP && LOW_POWER_STATE_CHECK
+static uint16_t low_power_window_crc(uint16_t crc, const stats_window_t *window) //state and storage of window, storage through its pointers
+{
+    crc = flash_util_crc_update(crc, &(window->channels), sizeof(window->channels));
+    crc = flash_util_crc_update(crc, &(window->capacity), sizeof(window->capacity));
+    crc = flash_util_crc_update(crc, &(window->head), sizeof(window->head));
+    crc = flash_util_crc_update(crc, &(window->count), sizeof(window->count));
+    crc = flash_util_crc_update(crc, window->samples, (size_t)window->capacity * window->channels * sizeof(int32_t));
+    crc = flash_util_crc_update(crc, window->min_deque, (size_t)window->channels * window->capacity * sizeof(uint16_t));
+    crc = flash_util_crc_update(crc, window->max_deque, (size_t)window->channels * window->capacity * sizeof(uint16_t));
+    return flash_util_crc_update(crc, window->channel, window->channels * sizeof(stats_window_channel_t));
+}
 
-    ESP_LOGI(TAG, "End measurment - PM 1/2.5/10: %i/%i/%i \n", pms_value_1h->ae.pm10, pms_value_1h->ae.pm25, pms_value_1h->ae.pm100);
+uint16_t low_power_state_crc(void) //deep sleep - everything kept in RTC memory, host simulator compares it before sleep and after wake up
+{
+    uint16_t crc = FLASH_UTIL_CRC_INIT;
+
+    crc = low_power_window_crc(crc, &dht_history);
+    crc = low_power_window_crc(crc, &pms_history);
+    crc = low_power_window_crc(crc, &esp_temp_history);
+    crc = flash_util_crc_update(crc, &(hour_rollup.channels), sizeof(hour_rollup.channels));
+    crc = flash_util_crc_update(crc, &(hour_rollup.period_ms), sizeof(hour_rollup.period_ms));
+    crc = flash_util_crc_update(crc, &(hour_rollup.elapsed_ms), sizeof(hour_rollup.elapsed_ms));
+    crc = flash_util_crc_update(crc, &(hour_rollup.count), sizeof(hour_rollup.count));
+    crc = flash_util_crc_update(crc, &(hour_rollup.weight_ms), sizeof(hour_rollup.weight_ms));
+    crc = flash_util_crc_update(crc, hour_rollup.sum, hour_rollup.channels * sizeof(int64_t));
+    crc = low_power_window_crc(crc, &day_rollup);
+    crc = flash_util_crc_update(crc, &rtc_state, sizeof(rtc_state));
+    return crc;
 }
+#endif
 
-void make_adv_data(const dht_measurement_t *dht_value, const pms_measurement_t *pms_value, uint8_t esp_temp, uint8_t type)
+static uint32_t sensors_result(adv_measurement_t *dst) //live data - avg of instances of every kind, return fan on-time
 {
-    uint16_t dht_temp;
-    if(dht_value->temperature>=0)
+    sensor_value_t value;
+    uint32_t fan_ms;
+
+    // last known value is kept if all instances of kind failed
+    if(sensor_kind_result(SENSOR_KIND_CLIMATE, &value, NULL) == SENSOR_OK)
+        dst->live.dht = value.climate;
+    if(sensor_kind_result(SENSOR_KIND_CHIP_TEMP, &value, NULL) == SENSOR_OK)
+        dst->live.esp_temp = value.chip_temp;
+    if(sensor_kind_result(SENSOR_KIND_PM, &value, &fan_ms) == SENSOR_OK)
     {
-        dht_temp=dht_value->temperature & 0x07FF;//temperature 11bits, signed 12bit =0
+        dst->live.pms = value.pm;
+
+        //SET COLOR RGB QUALITY AIR
+        const air_quality_band_t *band = &(AIR_QUALITY_BANDS[air_quality_band(&(dst->live.pms))]);
+        led_rgb_set(band->red, band->green, band->blue);
     }
-    else
+
+    dst->instances_valid = 0;
+    for(uint8_t i=0; i<SENSORS_NUM; ++i)
     {
-        dht_temp=((dht_value->temperature*-1) & 0x07FF) | 0x0800;//temperature 11bits, sign 12bit =1
+        if(!sensors[i].result_valid)
+            continue;
+        dst->instances[i] = sensors[i].result;
+        dst->instances_valid |= 1 << i;
     }
 
-    const struct PayloadMeasurement payload={
-        .type=type,
-        .temperature=dht_temp,//temperature and set sign bit on 12bit
-        .humidity=dht_value->humidity,
-
+    ESP_LOGI(TAG, "End measurment - PM 1/2.5/10: %i/%i/%i Hum: %i Tmp: %i \n", dst->live.pms.ae.pm10, dst->live.pms.ae.pm25,
+        dst->live.pms.ae.pm100, dst->live.dht.humidity, dst->live.dht.temperature);
+    return fan_ms;
+}
 
-        .pm[0]=(uint8_t)(pms_value->sm.pm10>>4),
-        .pm[1]=ENCODE_MID_BYTE(pms_value->sm.pm10, pms_value->sm.pm25),
-        .pm[2]=(uint8_t)pms_value->sm.pm25,
-        
-        .pm[3]=(uint8_t)(pms_value->sm.pm100>>4),
-        .pm[4]=ENCODE_MID_BYTE(pms_value->sm.pm100, pms_value->ae.pm10),
-        .pm[5]=(uint8_t)pms_value->ae.pm10,
+static uint8_t air_quality_band(const pms_measurement_t *pms_value) //index in AIR_QUALITY_BANDS
+{
+    uint8_t i = 0;
+    while(i < sizeof(AIR_QUALITY_BANDS)/sizeof(AIR_QUALITY_BANDS[0]) - 1 &&
+        (pms_value->ae.pm100 > AIR_QUALITY_BANDS[i].pm100 || pms_value->ae.pm25 > AIR_QUALITY_BANDS[i].pm25))
+        ++i;
+    return i;
+}
 
-        .pm[6]=(uint8_t)(pms_value->ae.pm25>>4),
-        .pm[7]=ENCODE_MID_BYTE(pms_value->ae.pm25, pms_value->ae.pm100),
-        .pm[8]=(uint8_t)pms_value->ae.pm100,
+static inline bool pm_changed(uint16_t from, uint16_t to, uint8_t pct, uint16_t abs) //change is above both relative and absolute limit
+{
+    uint16_t delta = to > from ? to - from : from - to;
+    return delta > abs && (uint32_t)delta * 100 > (uint32_t)from * pct;
+}
 
+static void cycle_schedule_reset(cycle_schedule_t *schedule)
+{
+    schedule->period_ms = CYCLE_PERIOD_MS;
+    schedule->fan_budget_ms = FAN_BUDGET_MAX_MS;
+    schedule->stable_num = 0;
+    schedule->last_valid = false;
+}
 
-        .um[0]=pms_value->num.um3,
-        .um[1]=pms_value->num.um5,
-        .um[2]=pms_value->num.um10,
-        .um[3]=pms_value->num.um25,
-        .um[4]=pms_value->num.um50,
-        .um[5]=pms_value->num.um100,
+static uint32_t cycle_schedule_next(cycle_schedule_t *schedule, const pms_measurement_t *pms_value, uint32_t fan_ms) //period of next cycle
+{
+    bool fast = schedule->period_ms == FAST_CYCLE_PERIOD_MS;
+    uint8_t band = air_quality_band(pms_value);
+    int64_t budget = (int64_t)schedule->fan_budget_ms + (int64_t)schedule->period_ms * FAN_DUTY_MAX_PCT / 100 - fan_ms;
 
-        .esp_temperature=esp_temp
-    };
+    schedule->fan_budget_ms = budget < 0 ? 0 : (budget > FAN_BUDGET_MAX_MS ? FAN_BUDGET_MAX_MS : budget);
+#if ADAPTIVE_CYCLE
+    if(schedule->last_valid)
+    {
+        bool stable = !pm_changed(schedule->last_pm25, pms_value->ae.pm25, SPIKE_STABLE_PCT, SPIKE_STABLE_ABS) &&
+            !pm_changed(schedule->last_pm100, pms_value->ae.pm100, SPIKE_STABLE_PCT, SPIKE_STABLE_ABS);
+        bool spike = (band != schedule->last_band && !stable) || // noise at border of band is not spike
+            (pms_value->ae.pm25 > schedule->last_pm25 && pm_changed(schedule->last_pm25, pms_value->ae.pm25, SPIKE_ENTER_PCT, SPIKE_ENTER_ABS)) ||
+            (pms_value->ae.pm100 > schedule->last_pm100 && pm_changed(schedule->last_pm100, pms_value->ae.pm100, SPIKE_ENTER_PCT, SPIKE_ENTER_ABS));
 
-    ble_adv_set_data((const uint8_t*)&payload, type);
+        if(spike)
+        {
+            fast = true;
+            schedule->stable_num = 0;
+        }
+        else if(fast)
+        {
+            schedule->stable_num = stable ? schedule->stable_num + 1 : 0;
+            if(schedule->stable_num >= SPIKE_STABLE_NUM)
+                fast = false;
+        }
+    }
+    if(fast && schedule->fan_budget_ms < fan_ms) // no budget for next fan run, spike is followed by long cycles
+        fast = false;
+#endif
+    if(fast != (schedule->period_ms == FAST_CYCLE_PERIOD_MS))
+        ESP_LOGI(TAG, "%s cycle, PM 2.5/10: %u/%u, fan budget %u ms", fast ? "Fast" : "Long", pms_value->ae.pm25, pms_value->ae.pm100, schedule->fan_budget_ms);
+
+    schedule->last_pm25 = pms_value->ae.pm25;
+    schedule->last_pm100 = pms_value->ae.pm100;
+    schedule->last_band = band;
+    schedule->last_valid = true;
+    if(!fast)
+        schedule->stable_num = 0;
+    return fast ? FAST_CYCLE_PERIOD_MS : CYCLE_PERIOD_MS;
 }
 
-static inline uint8_t esp_temp_calc_avg(const uint8_t *arr_src, uint8_t arr_size)
+static void measurement_pack(const measurement_t *value, int32_t *values) //MEASUREMENT_CHANNELS channels: dht, pms, esp temp
 {
-    if(arr_size<1) return 0;
+    dht_pack_values(&(value->dht), values);
+    pms_pack_values(&(value->pms), values + DHT_WINDOW_CHANNELS);
+    values[DHT_WINDOW_CHANNELS + PMS_WINDOW_CHANNELS] = value->esp_temp;
+}
 
-    uint16_t sum=0;
+static void measurement_unpack(const int32_t *values, measurement_t *dst)
+{
+    dht_unpack_values(values, &(dst->dht));
+    pms_unpack_values(values + DHT_WINDOW_CHANNELS, &(dst->pms));
+    dst->esp_temp = values[DHT_WINDOW_CHANNELS + PMS_WINDOW_CHANNELS];
+}
 
-    for(int i=0; i<arr_size; ++i)
-    {
-        sum+=arr_src[i];
-    }
+void make_adv_data(const dht_measurement_t *dht_value, const pms_measurement_t *pms_value, uint8_t esp_temp, uint8_t type, uint8_t frame)
+{
+    const int32_t values[PAYLOAD_MEASUREMENT_FIELDS_NUM] = {
+        [PAYLOAD_FIELD_TYPE]            = type,
+        [PAYLOAD_FIELD_TEMPERATURE]     = dht_value->temperature,
+        [PAYLOAD_FIELD_HUMIDITY]        = dht_value->humidity,
+
+        [PAYLOAD_FIELD_SM_PM10]         = pms_value->sm.pm10,
+        [PAYLOAD_FIELD_SM_PM25]         = pms_value->sm.pm25,
+        [PAYLOAD_FIELD_SM_PM100]        = pms_value->sm.pm100,
+        [PAYLOAD_FIELD_AE_PM10]         = pms_value->ae.pm10,
+        [PAYLOAD_FIELD_AE_PM25]         = pms_value->ae.pm25,
+        [PAYLOAD_FIELD_AE_PM100]        = pms_value->ae.pm100,
+
+        [PAYLOAD_FIELD_UM3]             = pms_value->num.um3,
+        [PAYLOAD_FIELD_UM5]             = pms_value->num.um5,
+        [PAYLOAD_FIELD_UM10]            = pms_value->num.um10,
+        [PAYLOAD_FIELD_UM25]            = pms_value->num.um25,
+        [PAYLOAD_FIELD_UM50]            = pms_value->num.um50,
+        [PAYLOAD_FIELD_UM100]           = pms_value->num.um100,
+
+        [PAYLOAD_FIELD_ESP_TEMPERATURE] = esp_temp
+    };
 
-    return sum/arr_size;
+    // encode directly to staging buffer of adv frame
+    uint8_t *payload = ble_adv_data_acquire(frame);
+    if(payload == NULL)
+        return;
+    payload_encode(&payload_measurement_schema, values, payload);
+    ble_adv_data_commit(frame);
 }
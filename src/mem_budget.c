@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#include "mem_budget.h"
+#include "diag.h"
+
+static const char *TAG = "MEM_BUDGET";
+
+static uint32_t mem_budget_boot_heap = 0; // free heap when all tasks and drivers are started
+
+
+
+void mem_budget_boot_done(void) //all allocations of IDF are done, from now free heap is constant
+{
+    mem_budget_boot_heap = esp_get_free_heap_size();
+    ESP_LOGI(TAG, "Boot done, free heap %u B (min %u B), static allocation %s", mem_budget_boot_heap,
+        esp_get_minimum_free_heap_size(), MEM_STATIC_ALLOCATION ? "on" : "off");
+}
+
+
+mem_budget_error_t mem_budget_check(void) //heap and stack high water marks against limits, call periodically
+{
+    mem_budget_error_t result = MEM_BUDGET_OK;
+    uint32_t heap_free = esp_get_free_heap_size();
+    uint32_t heap_min = esp_get_minimum_free_heap_size();
+    diag_stats_t stats;
+
+    if(heap_min < MEM_HEAP_FREE_MIN)
+    {
+        ESP_LOGE(TAG, "Low heap, min free %u B", heap_min);
+        result = MEM_BUDGET_LOW_HEAP;
+    }
+
+    if(mem_budget_boot_heap != 0 && heap_free + MEM_HEAP_DRIFT_MAX < mem_budget_boot_heap)
+    {
+        ESP_LOGE(TAG, "Heap drift, free %u B after boot, now %u B", mem_budget_boot_heap, heap_free);
+        result = MEM_BUDGET_HEAP_DRIFT;
+    }
+
+    diag_get(&stats);
+    for(uint8_t i=0; i<DIAG_TASKS_MAX; ++i)
+    {
+        if(stats.stack_free_min[i] != 0 && stats.stack_free_min[i] - 1 < MEM_STACK_FREE_MIN) // 0 - slot not used
+        {
+            ESP_LOGE(TAG, "Low stack of task slot %u, min free %u B", i, stats.stack_free_min[i] - 1);
+            result = MEM_BUDGET_LOW_STACK;
+        }
+    }
+    return result;
+}
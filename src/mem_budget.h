@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef MEM_BUDGET_H_
+#define MEM_BUDGET_H_
+
+#include <stdint.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include "sdkconfig.h"
+
+// Memory of firmware is fixed at build time - task stacks and kernel objects are static (MEM_STATIC_ALLOCATION),
+// buffers are static arrays. Heap is used only by IDF (BT stack, UART driver) during init, so free heap must not drift
+// after boot (no fragmentation over months of uptime).
+// Build prints RAM (.data + .bss) of every module and fails over budget (mem_report.cmake),
+// heap and stack high water marks are checked at runtime against limits below.
+
+//CONFIG
+#define MEM_STATIC_ALLOCATION   1           // needs configSUPPORT_STATIC_ALLOCATION (CONFIG_FREERTOS_SUPPORT_STATIC_ALLOCATION)
+#define MEM_HEAP_FREE_MIN       (40*1024)   // bytes, lowest free heap since boot
+#define MEM_HEAP_DRIFT_MAX      1024        // bytes, decrease of free heap after boot (leak / fragmentation)
+#define MEM_STACK_FREE_MIN      256         // bytes, lowest free stack of every task (diag_stack_check slots)
+
+#if MEM_STATIC_ALLOCATION && !configSUPPORT_STATIC_ALLOCATION
+#error "MEM_STATIC_ALLOCATION needs CONFIG_FREERTOS_SUPPORT_STATIC_ALLOCATION=y in sdkconfig"
+#endif
+
+//ERROR
+typedef enum {
+    MEM_BUDGET_OK           = 0,
+    MEM_BUDGET_LOW_HEAP     = -1,
+    MEM_BUDGET_HEAP_DRIFT   = -2,
+    MEM_BUDGET_LOW_STACK    = -3
+} mem_budget_error_t;
+
+// kernel objects - MEM_xxx_DEFINE at file scope reserves memory, MEM_xxx_CREATE returns handle like xxxCreate,
+// MEM_xxx_DEFINE_ARRAY / MEM_xxx_CREATE_AT - memory of num instances of driver, instance i uses slot i
+#if MEM_STATIC_ALLOCATION
+#define MEM_TASK_DEFINE(name, stack_size) \
+    static StackType_t name##_stack[(stack_size) / sizeof(StackType_t)]; \
+    static StaticTask_t name##_tcb
+#define MEM_TASK_CREATE(name, function, label, parameter, priority, handle) \
+    mem_task_create_static((function), (label), sizeof(name##_stack), (parameter), (priority), (handle), name##_stack, &name##_tcb)
+#define MEM_QUEUE_DEFINE(name, length, item_size) \
+    enum { name##_length = (length), name##_item_size = (item_size) }; \
+    static uint8_t name##_storage[(length) * (item_size)]; \
+    static StaticQueue_t name##_queue_buffer
+#define MEM_QUEUE_CREATE(name) \
+    xQueueCreateStatic(name##_length, name##_item_size, name##_storage, &name##_queue_buffer)
+#define MEM_SEMAPHORE_DEFINE(name) \
+    static StaticSemaphore_t name##_semaphore_buffer
+#define MEM_SEMAPHORE_CREATE_BINARY(name)   xSemaphoreCreateBinaryStatic(&name##_semaphore_buffer)
+#define MEM_SEMAPHORE_CREATE_MUTEX(name)    xSemaphoreCreateMutexStatic(&name##_semaphore_buffer)
+#define MEM_EVENT_GROUP_DEFINE(name) \
+    static StaticEventGroup_t name##_event_group_buffer
+#define MEM_EVENT_GROUP_CREATE(name)        xEventGroupCreateStatic(&name##_event_group_buffer)
+#define MEM_TASK_DEFINE_ARRAY(name, num, stack_size) \
+    static StackType_t name##_stack[num][(stack_size) / sizeof(StackType_t)]; \
+    static StaticTask_t name##_tcb[num]
+#define MEM_TASK_CREATE_AT(name, i, function, label, parameter, priority, handle) \
+    mem_task_create_static((function), (label), sizeof(name##_stack[0]), (parameter), (priority), (handle), name##_stack[i], &name##_tcb[i])
+#define MEM_QUEUE_DEFINE_ARRAY(name, num, length, item_size) \
+    enum { name##_length = (length), name##_item_size = (item_size) }; \
+    static uint8_t name##_storage[num][(length) * (item_size)]; \
+    static StaticQueue_t name##_queue_buffer[num]
+#define MEM_QUEUE_CREATE_AT(name, i) \
+    xQueueCreateStatic(name##_length, name##_item_size, name##_storage[i], &name##_queue_buffer[i])
+#define MEM_SEMAPHORE_DEFINE_ARRAY(name, num) \
+    static StaticSemaphore_t name##_semaphore_buffer[num]
+#define MEM_SEMAPHORE_CREATE_BINARY_AT(name, i) xSemaphoreCreateBinaryStatic(&name##_semaphore_buffer[i])
+#define MEM_SEMAPHORE_CREATE_MUTEX_AT(name, i)  xSemaphoreCreateMutexStatic(&name##_semaphore_buffer[i])
+#else
+#define MEM_TASK_DEFINE(name, stack_size)   enum { name##_stack_size = (stack_size) }
+#define MEM_TASK_CREATE(name, function, label, parameter, priority, handle) \
+    xTaskCreate((function), (label), name##_stack_size, (parameter), (priority), (handle))
+#define MEM_QUEUE_DEFINE(name, length, item_size) \
+    enum { name##_length = (length), name##_item_size = (item_size) }
+#define MEM_QUEUE_CREATE(name)              xQueueCreate(name##_length, name##_item_size)
+#define MEM_SEMAPHORE_DEFINE(name)          enum { name##_semaphore_dynamic }
+#define MEM_SEMAPHORE_CREATE_BINARY(name)   xSemaphoreCreateBinary()
+#define MEM_SEMAPHORE_CREATE_MUTEX(name)    xSemaphoreCreateMutex()
+#define MEM_EVENT_GROUP_DEFINE(name)        enum { name##_event_group_dynamic }
+#define MEM_EVENT_GROUP_CREATE(name)        xEventGroupCreate()
+#define MEM_TASK_DEFINE_ARRAY(name, num, stack_size)    MEM_TASK_DEFINE(name, stack_size)
+#define MEM_TASK_CREATE_AT(name, i, function, label, parameter, priority, handle) \
+    MEM_TASK_CREATE(name, function, label, parameter, priority, handle)
+#define MEM_QUEUE_DEFINE_ARRAY(name, num, length, item_size)    MEM_QUEUE_DEFINE(name, length, item_size)
+#define MEM_QUEUE_CREATE_AT(name, i)        MEM_QUEUE_CREATE(name)
+#define MEM_SEMAPHORE_DEFINE_ARRAY(name, num)   MEM_SEMAPHORE_DEFINE(name)
+#define MEM_SEMAPHORE_CREATE_BINARY_AT(name, i) MEM_SEMAPHORE_CREATE_BINARY(name)
+#define MEM_SEMAPHORE_CREATE_MUTEX_AT(name, i)  MEM_SEMAPHORE_CREATE_MUTEX(name)
+#endif
+
+#if MEM_STATIC_ALLOCATION
+static inline BaseType_t mem_task_create_static(TaskFunction_t function, const char *label, uint32_t stack_size, void *parameter,
+                                                UBaseType_t priority, TaskHandle_t *handle, StackType_t *stack, StaticTask_t *tcb)
+{
+    TaskHandle_t task = xTaskCreateStatic(function, label, stack_size, parameter, priority, stack, tcb);
+    if(handle != NULL)
+        *handle = task;
+    return task != NULL ? pdPASS : pdFAIL;
+}
+#endif
+
+
+void mem_budget_boot_done(void);
+mem_budget_error_t mem_budget_check(void);
+
+#endif
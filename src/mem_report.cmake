@@ -0,0 +1,67 @@
+# RAM budget of firmware - after build prints static RAM (.data + .bss) of every module and fails if total is over budget.
+# All buffers, queues and task stacks are static (mem_budget.h), so this is whole RAM of firmware except IDF.
+# On target `idf.py size-files` shows the same per file after link.
+#
+#   include(mem_report.cmake)
+#   mem_report(<target> <budget bytes>)
+#
+# Script mode (run by POST_BUILD): cmake -DMEM_REPORT_SIZE=<size tool> -DMEM_REPORT_OBJECTS=<a|b|..> -DMEM_REPORT_BUDGET=<bytes> -P mem_report.cmake
+
+if(CMAKE_SCRIPT_MODE_FILE)
+    string(REPLACE "|" ";" objects "${MEM_REPORT_OBJECTS}")
+    execute_process(COMMAND ${MEM_REPORT_SIZE} ${objects}
+                    OUTPUT_VARIABLE size_output
+                    RESULT_VARIABLE size_result)
+    if(NOT size_result EQUAL 0)
+        message(WARNING "mem_report: ${MEM_REPORT_SIZE} failed, no RAM report")
+        return()
+    endif()
+
+    set(total 0)
+    message(STATUS "RAM budget per module (.data + .bss):")
+    string(REPLACE "\n" ";" lines "${size_output}")
+    foreach(line ${lines})
+        if(line MATCHES "^ *([0-9]+)[ \t]+([0-9]+)[ \t]+([0-9]+)[ \t]+[0-9]+[ \t]+[0-9a-fA-F]+[ \t]+(.+)$")
+            math(EXPR ram "${CMAKE_MATCH_2} + ${CMAKE_MATCH_3}")
+            math(EXPR total "${total} + ${ram}")
+            get_filename_component(module "${CMAKE_MATCH_4}" NAME_WE)
+            string(LENGTH "${module}" module_len)
+            math(EXPR pad "16 - ${module_len}")
+            if(pad LESS 1)
+                set(pad 1)
+            endif()
+            string(REPEAT " " ${pad} spaces)
+            message(STATUS "  ${module}${spaces}${ram} B")
+        endif()
+    endforeach()
+
+    message(STATUS "  total           ${total} B of ${MEM_REPORT_BUDGET} B")
+    if(total GREATER MEM_REPORT_BUDGET)
+        message(FATAL_ERROR "Static RAM ${total} B is over budget ${MEM_REPORT_BUDGET} B")
+    endif()
+    return()
+endif()
+
+set(MEM_REPORT_SCRIPT ${CMAKE_CURRENT_LIST_FILE})
+
+function(mem_report target budget)
+    # size of toolchain (xtensa-esp32-elf-size) is next to compiler
+    string(REGEX REPLACE "g?cc(\\.exe)?$" "size" size_hint "${CMAKE_C_COMPILER}")
+    if(EXISTS "${size_hint}" AND NOT size_hint STREQUAL CMAKE_C_COMPILER)
+        set(size_tool "${size_hint}")
+    else()
+        find_program(size_tool NAMES size)
+    endif()
+    if(NOT size_tool)
+        message(WARNING "mem_report: size tool not found, no RAM report of ${target}")
+        return()
+    endif()
+
+    add_custom_command(TARGET ${target} POST_BUILD
+        COMMAND ${CMAKE_COMMAND}
+                -DMEM_REPORT_SIZE=${size_tool}
+                "-DMEM_REPORT_OBJECTS=$<JOIN:$<TARGET_OBJECTS:${target}>,|>"
+                -DMEM_REPORT_BUDGET=${budget}
+                -P ${MEM_REPORT_SCRIPT}
+        VERBATIM)
+endfunction()
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#include <string.h>
+#include "payload.h"
+
+#define FIELD_MASK(bits)    ((bits) >= 32 ? 0xFFFFFFFFu : ((1u << (bits)) - 1u))
+
+static const payload_field_t PAYLOAD_MEASUREMENT_FIELDS[PAYLOAD_MEASUREMENT_FIELDS_NUM] = {
+    [PAYLOAD_FIELD_TYPE]            = {"type",              2,  PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_TEMPERATURE]     = {"temperature",       12, PAYLOAD_SIGN_MAGNITUDE, 1, 0},  //range -400 : 1250 => 1sign bit + 11bits
+    [PAYLOAD_FIELD_HUMIDITY]        = {"humidity",          10, PAYLOAD_UNSIGNED,       1, 0},  //range 0 : 1000
+    [PAYLOAD_FIELD_SM_PM10]         = {"sm_pm10",           12, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_SM_PM25]         = {"sm_pm25",           12, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_SM_PM100]        = {"sm_pm100",          12, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_AE_PM10]         = {"ae_pm10",           12, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_AE_PM25]         = {"ae_pm25",           12, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_AE_PM100]        = {"ae_pm100",          12, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_UM3]             = {"um3",               16, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_UM5]             = {"um5",               16, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_UM10]            = {"um10",              16, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_UM25]            = {"um25",              16, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_UM50]            = {"um50",              16, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_UM100]           = {"um100",             16, PAYLOAD_UNSIGNED,       1, 0},
+    [PAYLOAD_FIELD_ESP_TEMPERATURE] = {"esp_temperature",   8,  PAYLOAD_UNSIGNED,       1, 0},
+};
+
+#define PM_PAIR_SLICES(a, b)    {a, 4, 8}, {a, 0, 4}, {b, 8, 4}, {b, 0, 8}  // 2x12bits on 3bytes: aaaaaaaa aaaabbbb bbbbbbbb
+#define UINT16_LE_SLICES(a)     {a, 0, 8}, {a, 8, 8}                        // little endian 16bits
+
+static const payload_slice_t PAYLOAD_MEASUREMENT_SLICES[] = {
+    // first 24bits: tttt ttyy hhtt tttt hhhh hhhh  <= t=temp | h=hum | y=type bits
+    {PAYLOAD_FIELD_TEMPERATURE, 0, 6}, {PAYLOAD_FIELD_TYPE, 0, 2},
+    {PAYLOAD_FIELD_HUMIDITY, 0, 2}, {PAYLOAD_FIELD_TEMPERATURE, 6, 6},
+    {PAYLOAD_FIELD_HUMIDITY, 2, 8},
+    // pm 6x12bit=9bytes
+    PM_PAIR_SLICES(PAYLOAD_FIELD_SM_PM10, PAYLOAD_FIELD_SM_PM25),
+    PM_PAIR_SLICES(PAYLOAD_FIELD_SM_PM100, PAYLOAD_FIELD_AE_PM10),
+    PM_PAIR_SLICES(PAYLOAD_FIELD_AE_PM25, PAYLOAD_FIELD_AE_PM100),
+    // um 6x16bit=12bytes
+    UINT16_LE_SLICES(PAYLOAD_FIELD_UM3),
+    UINT16_LE_SLICES(PAYLOAD_FIELD_UM5),
+    UINT16_LE_SLICES(PAYLOAD_FIELD_UM10),
+    UINT16_LE_SLICES(PAYLOAD_FIELD_UM25),
+    UINT16_LE_SLICES(PAYLOAD_FIELD_UM50),
+    UINT16_LE_SLICES(PAYLOAD_FIELD_UM100),
+    {PAYLOAD_FIELD_ESP_TEMPERATURE, 0, 8},
+};
+
+const payload_schema_t payload_measurement_schema = {
+    .fields     = PAYLOAD_MEASUREMENT_FIELDS,
+    .fields_num = PAYLOAD_MEASUREMENT_FIELDS_NUM,
+    .slices     = PAYLOAD_MEASUREMENT_SLICES,
+    .slices_num = sizeof(PAYLOAD_MEASUREMENT_SLICES) / sizeof(PAYLOAD_MEASUREMENT_SLICES[0]),
+    .size       = 25
+};
+
+static const payload_field_t PAYLOAD_DIAG_FIELDS[PAYLOAD_DIAG_FIELDS_NUM] = {
+    [PAYLOAD_DIAG_FIELD_VERSION]            = {"version",           2,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_CYCLES]             = {"cycles",            14, PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_DHT_P50]            = {"dht_p50",           4,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_DHT_P95]            = {"dht_p95",           4,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_DHT_MAX]            = {"dht_max",           12, PAYLOAD_UNSIGNED,   1000,   0},
+    [PAYLOAD_DIAG_FIELD_PMS_P50]            = {"pms_p50",           4,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_PMS_P95]            = {"pms_p95",           4,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_PMS_MAX]            = {"pms_max",           12, PAYLOAD_UNSIGNED,   1000,   0},
+    [PAYLOAD_DIAG_FIELD_ADV_P50]            = {"adv_p50",           4,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_ADV_P95]            = {"adv_p95",           4,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_ADV_MAX]            = {"adv_max",           12, PAYLOAD_UNSIGNED,   1000,   0},
+    [PAYLOAD_DIAG_FIELD_DHT_OK]             = {"dht_ok",            10, PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_START]  = {"dht_timeout_start", 8,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_DATA]   = {"dht_timeout_data",  8,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_DHT_BAD_CHECKSUM]   = {"dht_bad_checksum",  8,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_PMS_OK]             = {"pms_ok",            10, PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_PMS_LOW_DATA]       = {"pms_low_data",      8,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_PMS_NOT_FULL]       = {"pms_not_full",      8,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_PMS_NOT_FIND]       = {"pms_not_find",      8,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_PMS_BAD_CHECKSUM]   = {"pms_bad_checksum",  8,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_PMS_TIMEOUT]        = {"pms_timeout",       8,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_PMS_OTHER]          = {"pms_other",         8,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_RETRIES_MAX]        = {"retries_max",       6,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_HEAP_MIN]           = {"heap_min",          9,  PAYLOAD_UNSIGNED,   1024,   0},
+    [PAYLOAD_DIAG_FIELD_STACK_MIN]          = {"stack_min",         8,  PAYLOAD_UNSIGNED,   16,     0},
+    [PAYLOAD_DIAG_FIELD_STACK_SLOT]         = {"stack_slot",        3,  PAYLOAD_UNSIGNED,   1,      0},
+    [PAYLOAD_DIAG_FIELD_BOOT_ADV]           = {"boot_adv",          6,  PAYLOAD_UNSIGNED,   50000,  0},
+};
+
+static const payload_slice_t PAYLOAD_DIAG_SLICES[] = { // fields one after another, MSB first, 200bits
+    {PAYLOAD_DIAG_FIELD_VERSION, 0, 2},             {PAYLOAD_DIAG_FIELD_CYCLES, 0, 14},
+    {PAYLOAD_DIAG_FIELD_DHT_P50, 0, 4},             {PAYLOAD_DIAG_FIELD_DHT_P95, 0, 4},
+    {PAYLOAD_DIAG_FIELD_DHT_MAX, 0, 12},
+    {PAYLOAD_DIAG_FIELD_PMS_P50, 0, 4},             {PAYLOAD_DIAG_FIELD_PMS_P95, 0, 4},
+    {PAYLOAD_DIAG_FIELD_PMS_MAX, 0, 12},
+    {PAYLOAD_DIAG_FIELD_ADV_P50, 0, 4},             {PAYLOAD_DIAG_FIELD_ADV_P95, 0, 4},
+    {PAYLOAD_DIAG_FIELD_ADV_MAX, 0, 12},
+    {PAYLOAD_DIAG_FIELD_DHT_OK, 0, 10},             {PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_START, 0, 8},
+    {PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_DATA, 0, 8},    {PAYLOAD_DIAG_FIELD_DHT_BAD_CHECKSUM, 0, 8},
+    {PAYLOAD_DIAG_FIELD_PMS_OK, 0, 10},             {PAYLOAD_DIAG_FIELD_PMS_LOW_DATA, 0, 8},
+    {PAYLOAD_DIAG_FIELD_PMS_NOT_FULL, 0, 8},        {PAYLOAD_DIAG_FIELD_PMS_NOT_FIND, 0, 8},
+    {PAYLOAD_DIAG_FIELD_PMS_BAD_CHECKSUM, 0, 8},    {PAYLOAD_DIAG_FIELD_PMS_TIMEOUT, 0, 8},
+    {PAYLOAD_DIAG_FIELD_PMS_OTHER, 0, 8},
+    {PAYLOAD_DIAG_FIELD_RETRIES_MAX, 0, 6},         {PAYLOAD_DIAG_FIELD_HEAP_MIN, 0, 9},
+    {PAYLOAD_DIAG_FIELD_STACK_MIN, 0, 8},           {PAYLOAD_DIAG_FIELD_STACK_SLOT, 0, 3},
+    {PAYLOAD_DIAG_FIELD_BOOT_ADV, 0, 6},
+};
+
+const payload_schema_t payload_diag_schema = {
+    .fields     = PAYLOAD_DIAG_FIELDS,
+    .fields_num = PAYLOAD_DIAG_FIELDS_NUM,
+    .slices     = PAYLOAD_DIAG_SLICES,
+    .slices_num = sizeof(PAYLOAD_DIAG_SLICES) / sizeof(PAYLOAD_DIAG_SLICES[0]),
+    .size       = 25
+};
+
+static inline uint32_t payload_field_to_raw(const payload_field_t *field, int32_t value, payload_error_t *result);
+static inline int32_t payload_raw_to_field(const payload_field_t *field, uint32_t raw);
+
+
+
+static inline uint32_t payload_field_to_raw(const payload_field_t *field, int32_t value, payload_error_t *result) //scale, offset and clamp value to bits of field
+{
+    int64_t scaled = ((int64_t)value - field->offset) / (field->scale ? field->scale : 1);
+    int64_t min, max;
+
+    switch(field->sign)
+    {
+    case PAYLOAD_SIGNED:
+        max = (int64_t)FIELD_MASK(field->bits - 1);
+        min = -max - 1;
+        break;
+    case PAYLOAD_SIGN_MAGNITUDE:
+        max = (int64_t)FIELD_MASK(field->bits - 1);
+        min = -max;
+        break;
+    default:
+        max = (int64_t)FIELD_MASK(field->bits);
+        min = 0;
+        break;
+    }
+
+    if(scaled > max || scaled < min)
+    {
+        scaled = scaled > max ? max : min;
+        *result = PAYLOAD_OUT_OF_RANGE;
+    }
+
+    if(field->sign == PAYLOAD_SIGN_MAGNITUDE && scaled < 0)
+        return ((uint32_t)(-scaled)) | (1u << (field->bits - 1));
+    return ((uint32_t)scaled) & FIELD_MASK(field->bits);
+}
+
+
+static inline int32_t payload_raw_to_field(const payload_field_t *field, uint32_t raw) //sign, scale and offset raw bits of field
+{
+    int64_t value;
+    uint32_t sign_bit = 1u << (field->bits - 1);
+
+    switch(field->sign)
+    {
+    case PAYLOAD_SIGNED:
+        value = (raw & sign_bit) ? (int64_t)raw - ((int64_t)1 << field->bits) : (int64_t)raw;
+        break;
+    case PAYLOAD_SIGN_MAGNITUDE:
+        value = (raw & sign_bit) ? -(int64_t)(raw & (sign_bit - 1)) : (int64_t)raw;
+        break;
+    default:
+        value = raw;
+        break;
+    }
+
+    return (int32_t)(value * (field->scale ? field->scale : 1) + field->offset);
+}
+
+
+payload_error_t payload_schema_check(const payload_schema_t *schema) //sum of slices must be size of payload, every bit of field in exactly one slice
+{
+    uint32_t covered[32] = {0};
+    uint32_t bits = 0;
+
+    if(schema->fields_num > sizeof(covered)/sizeof(covered[0]))
+        return PAYLOAD_BAD_SCHEMA;
+
+    for(uint8_t i=0; i<schema->slices_num; ++i)
+    {
+        const payload_slice_t *slice = &(schema->slices[i]);
+        if(slice->field >= schema->fields_num ||
+            slice->bits == 0 || slice->bits > 32 ||
+            slice->shift + slice->bits > schema->fields[slice->field].bits)
+            return PAYLOAD_BAD_SCHEMA;
+
+        uint32_t mask = FIELD_MASK(slice->bits) << slice->shift;
+        if(covered[slice->field] & mask)
+            return PAYLOAD_BAD_SCHEMA;
+        covered[slice->field] |= mask;
+        bits += slice->bits;
+    }
+
+    for(uint8_t i=0; i<schema->fields_num; ++i)
+    {
+        if(schema->fields[i].bits == 0 || schema->fields[i].bits > 32 || covered[i] != FIELD_MASK(schema->fields[i].bits))
+            return PAYLOAD_BAD_SCHEMA;
+    }
+    return bits == (uint32_t)schema->size * 8 ? PAYLOAD_OK : PAYLOAD_BAD_SCHEMA;
+}
+
+
+payload_error_t payload_encode(const payload_schema_t *schema, const int32_t *values, uint8_t *dst) //values[fields_num] -> dst[size]
+{
+    payload_error_t result = PAYLOAD_OK;
+    uint32_t raw[32];
+    uint16_t pos = 0; // bit position, 0 = MSB of first byte
+
+    if(schema->fields_num > sizeof(raw)/sizeof(raw[0]))
+        return PAYLOAD_BAD_SCHEMA;
+
+    for(uint8_t i=0; i<schema->fields_num; ++i)
+        raw[i] = payload_field_to_raw(&(schema->fields[i]), values[i], &result);
+
+    memset(dst, 0, schema->size);
+    for(uint8_t i=0; i<schema->slices_num; ++i)
+    {
+        const payload_slice_t *slice = &(schema->slices[i]);
+        uint32_t value = (raw[slice->field] >> slice->shift) & FIELD_MASK(slice->bits);
+        uint8_t bits = slice->bits;
+
+        while(bits > 0) // write by bytes, not by bits
+        {
+            uint8_t free = 8 - (pos & 7);
+            uint8_t n = bits < free ? bits : free;
+
+            dst[pos >> 3] |= (uint8_t)(((value >> (bits - n)) & FIELD_MASK(n)) << (free - n));
+            pos += n;
+            bits -= n;
+        }
+    }
+    return result;
+}
+
+
+payload_error_t payload_decode(const payload_schema_t *schema, const uint8_t *src, int32_t *values) //src[size] -> values[fields_num]
+{
+    uint32_t raw[32] = {0};
+    uint16_t pos = 0;
+
+    if(schema->fields_num > sizeof(raw)/sizeof(raw[0]))
+        return PAYLOAD_BAD_SCHEMA;
+
+    for(uint8_t i=0; i<schema->slices_num; ++i)
+    {
+        const payload_slice_t *slice = &(schema->slices[i]);
+        uint32_t value = 0;
+        uint8_t bits = slice->bits;
+
+        while(bits > 0)
+        {
+            uint8_t free = 8 - (pos & 7);
+            uint8_t n = bits < free ? bits : free;
+
+            value = (value << n) | ((src[pos >> 3] >> (free - n)) & FIELD_MASK(n));
+            pos += n;
+            bits -= n;
+        }
+        raw[slice->field] |= value << slice->shift;
+    }
+
+    for(uint8_t i=0; i<schema->fields_num; ++i)
+        values[i] = payload_raw_to_field(&(schema->fields[i]), raw[i]);
+    return PAYLOAD_OK;
+}
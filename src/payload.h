@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef PAYLOAD_H_  
+#define PAYLOAD_H_
+
+#include <stdint.h>
+
+// Declarative bit packing of adv payload, no ESP-IDF dependencies - same code is used by firmware and host decoders.
+// Field - value with width, scale, offset and signedness.
+// Slice - part of field placed in payload, payload is written MSB first, slice by slice.
+// One field can be split to many slices, that keeps layout of existing frames byte exact.
+
+//ERROR
+typedef enum {
+    PAYLOAD_OK              = 0,
+    PAYLOAD_OUT_OF_RANGE    = -1, // value was clamped to range of field
+    PAYLOAD_BAD_SCHEMA      = -2
+} payload_error_t;
+
+typedef enum {
+    PAYLOAD_UNSIGNED        = 0,
+    PAYLOAD_SIGNED          = 1,  // two's complement
+    PAYLOAD_SIGN_MAGNITUDE  = 2   // highest bit = sign, rest = magnitude
+} payload_sign_t;
+
+typedef struct {
+    const char      *name;
+    uint8_t         bits;       // width of encoded value, max 32
+    uint8_t         sign;       // payload_sign_t
+    uint16_t        scale;      // encoded = (value - offset) / scale
+    int32_t         offset;
+} payload_field_t;
+
+typedef struct {
+    uint8_t         field;      // index in fields
+    uint8_t         shift;      // lowest bit of field in slice
+    uint8_t         bits;       // width of slice
+} payload_slice_t;
+
+typedef struct {
+    const payload_field_t   *fields;
+    uint8_t                 fields_num;
+    const payload_slice_t   *slices;
+    uint8_t                 slices_num;
+    uint8_t                 size;       // bytes
+} payload_schema_t;
+
+// fields of measurement payload (frame type 0 - live, 1 - avg, 2 - 1h avg, 3 - 24h avg)
+typedef enum {
+    PAYLOAD_FIELD_TYPE = 0,
+    PAYLOAD_FIELD_TEMPERATURE,      // 0.1 C, sign-magnitude
+    PAYLOAD_FIELD_HUMIDITY,         // 0.1 %
+    PAYLOAD_FIELD_SM_PM10,          // ug/m3, 12bits
+    PAYLOAD_FIELD_SM_PM25,
+    PAYLOAD_FIELD_SM_PM100,
+    PAYLOAD_FIELD_AE_PM10,
+    PAYLOAD_FIELD_AE_PM25,
+    PAYLOAD_FIELD_AE_PM100,
+    PAYLOAD_FIELD_UM3,              // number of particles, 16bits
+    PAYLOAD_FIELD_UM5,
+    PAYLOAD_FIELD_UM10,
+    PAYLOAD_FIELD_UM25,
+    PAYLOAD_FIELD_UM50,
+    PAYLOAD_FIELD_UM100,
+    PAYLOAD_FIELD_ESP_TEMPERATURE,
+    PAYLOAD_MEASUREMENT_FIELDS_NUM
+} payload_measurement_field_t;
+
+extern const payload_schema_t payload_measurement_schema; // 25bytes
+#define PAYLOAD_MEASUREMENT_TYPE(payload)   ((payload)[0] & 0x03) // type field without decoding - lowest bits of first byte
+
+// fields of diagnostics payload (frame with id DIAG_ADV_ID), counters (PAYLOAD_DIAG_COUNTER) are sent modulo 2^bits of field -
+// receiver sums deltas of consecutive frames modulo 2^bits, other fields saturate at max of field,
+// cycles = 0 - device is warming up after power on (or counter wrapped), measurement frames carry last known values
+typedef enum {
+    PAYLOAD_DIAG_FIELD_VERSION = 0,
+    PAYLOAD_DIAG_FIELD_CYCLES,              // cycles since stats were cleared
+    PAYLOAD_DIAG_FIELD_DHT_P50,             // latency of dht read, log2 bin of histogram
+    PAYLOAD_DIAG_FIELD_DHT_P95,
+    PAYLOAD_DIAG_FIELD_DHT_MAX,             // us, 1ms resolution
+    PAYLOAD_DIAG_FIELD_PMS_P50,             // latency of pms frame
+    PAYLOAD_DIAG_FIELD_PMS_P95,
+    PAYLOAD_DIAG_FIELD_PMS_MAX,
+    PAYLOAD_DIAG_FIELD_ADV_P50,             // latency of adv data update
+    PAYLOAD_DIAG_FIELD_ADV_P95,
+    PAYLOAD_DIAG_FIELD_ADV_MAX,
+    PAYLOAD_DIAG_FIELD_DHT_OK,
+    PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_START,
+    PAYLOAD_DIAG_FIELD_DHT_TIMEOUT_DATA,
+    PAYLOAD_DIAG_FIELD_DHT_BAD_CHECKSUM,
+    PAYLOAD_DIAG_FIELD_PMS_OK,
+    PAYLOAD_DIAG_FIELD_PMS_LOW_DATA,
+    PAYLOAD_DIAG_FIELD_PMS_NOT_FULL,
+    PAYLOAD_DIAG_FIELD_PMS_NOT_FIND,
+    PAYLOAD_DIAG_FIELD_PMS_BAD_CHECKSUM,
+    PAYLOAD_DIAG_FIELD_PMS_TIMEOUT,
+    PAYLOAD_DIAG_FIELD_PMS_OTHER,
+    PAYLOAD_DIAG_FIELD_RETRIES_MAX,         // failed tries in one burst
+    PAYLOAD_DIAG_FIELD_HEAP_MIN,            // bytes, 1KB resolution
+    PAYLOAD_DIAG_FIELD_STACK_MIN,           // bytes, 16B resolution, lowest of all tasks
+    PAYLOAD_DIAG_FIELD_STACK_SLOT,          // task with lowest free stack
+    PAYLOAD_DIAG_FIELD_BOOT_ADV,            // us from boot to first adv data, 50ms resolution
+    PAYLOAD_DIAG_FIELDS_NUM
+} payload_diag_field_t;
+
+#define PAYLOAD_DIAG_VERSION    3 // 3 - counters wrap, 2 - counters saturated
+#define PAYLOAD_DIAG_COUNTER(field) ((field) == PAYLOAD_DIAG_FIELD_CYCLES || \
+    ((field) >= PAYLOAD_DIAG_FIELD_DHT_OK && (field) <= PAYLOAD_DIAG_FIELD_PMS_OTHER))
+
+extern const payload_schema_t payload_diag_schema; // 25bytes
+
+
+payload_error_t payload_encode(const payload_schema_t *schema, const int32_t *values, uint8_t *dst);
+payload_error_t payload_decode(const payload_schema_t *schema, const uint8_t *src, int32_t *values);
+payload_error_t payload_schema_check(const payload_schema_t *schema);
+
+#endif
@@ -2,7 +2,11 @@
  * Copyright (c) 2021, 2022 by
  * Slawomir Krzykala. All rights reserved.
  */ 
+#include <string.h>
 #include "pms.h"
+#include "diag.h"
+#include "mem_budget.h"
+#include "sensor_trace.h"
 #define COMBINE_UINT8(high, low) ( (((uint16_t)high)<<8) | ((uint16_t)low) )
 static const char *TAG = "PMS";
 
@@ -22,20 +26,26 @@ static const uart_config_t PMS_UART_CONFIG = { //config UART from documentation
     .rx_flow_ctrl_thresh = 122,
 };
 
-static QueueHandle_t pms_uart_queue;
+static pms_t pms_instances[PMS_INSTANCES_MAX]; // slot of instance = index, also slot of static memory below
+static uint8_t pms_instances_num=0;
+MEM_QUEUE_DEFINE_ARRAY(pms_frame_queue, PMS_INSTANCES_MAX, PMS_FRAME_QUEUE_SIZE, sizeof(pms_measurement_t));
+MEM_TASK_DEFINE_ARRAY(pms_acquisition_task, PMS_INSTANCES_MAX, PMS_ACQUISITION_TASK_STACK);
+MEM_SEMAPHORE_DEFINE_ARRAY(pms_acquisition_resume, PMS_INSTANCES_MAX);
+MEM_SEMAPHORE_DEFINE_ARRAY(pms_acquisition_parked, PMS_INSTANCES_MAX);
 
-static pms_error_t pms_uart_init(void);
+static pms_error_t pms_uart_init(pms_t *pms);
+static void pms_acquisition_uart_task(void *parameter);
 
 
 
-static pms_error_t pms_uart_init(void)//init uart  to pms
+static pms_error_t pms_uart_init(pms_t *pms)//init uart  to pms
 {
     // Config UART
-    if(!uart_is_driver_installed(PMS_UART_NUM))
+    if(!uart_is_driver_installed(pms->config.uart_num))
     {   
-        if(uart_param_config(PMS_UART_NUM , &PMS_UART_CONFIG) !=0 ||
-            uart_set_pin(PMS_UART_NUM , PMS_TX_GPIO, PMS_RX_GPIO, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) !=0 ||
-            uart_driver_install(PMS_UART_NUM , PMS_UART_BUFFER_RX_SIZE, PMS_UART_BUFFER_TX_SIZE, 2, &pms_uart_queue, 0) !=0)
+        if(uart_param_config(pms->config.uart_num , &PMS_UART_CONFIG) !=0 ||
+            uart_set_pin(pms->config.uart_num , pms->config.tx_gpio, pms->config.rx_gpio, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) !=0 ||
+            uart_driver_install(pms->config.uart_num , PMS_UART_BUFFER_RX_SIZE, PMS_UART_BUFFER_TX_SIZE, PMS_UART_QUEUE_SIZE, &pms->uart_queue, 0) !=0)
         {
             ESP_LOGE(TAG, "Fail init UART.");
             return PMS_FAIL_INIT_UART;
@@ -46,39 +56,59 @@ static pms_error_t pms_uart_init(void)//init uart  to pms
 }
 
 
-pms_error_t pms_init(const pms_workmode_t workmode)//init gpio pms and uart to pms
-{
+pms_error_t pms_init(const pms_config_t *config, const pms_workmode_t workmode, pms_t **dst)//init gpio pms and uart to pms, instance is found by UART
+{                                                                                            //or new one is taken from static pool
+    pms_t *pms = NULL;
+
+    for(uint8_t i=0; i<pms_instances_num; ++i)
+        if(pms_instances[i].config.uart_num == config->uart_num)
+            pms = &(pms_instances[i]);
+    if(pms == NULL)
+    {
+        if(pms_instances_num >= PMS_INSTANCES_MAX)
+        {
+            ESP_LOGE(TAG, "Too many PMS, max %u.", PMS_INSTANCES_MAX);
+            return PMS_FAIL_MEMALLOC;
+        }
+        pms = &(pms_instances[pms_instances_num]);
+        pms->slot = pms_instances_num++;
+    }
+    pms->config = *config;
+    *dst = pms;
+
+    gpio_hold_dis(pms->config.set_gpio); // after deep sleep GPIO SET can be still held by pms_hold_sleep
+
     //config PMS RESET GPIO
-    if (gpio_reset_pin(PMS_RESET_GPIO) !=0 ||
-        gpio_set_direction(PMS_RESET_GPIO, GPIO_MODE_OUTPUT) !=0 ||
-        gpio_set_level(PMS_RESET_GPIO, 1) !=0)
+    if (gpio_reset_pin(pms->config.reset_gpio) !=0 ||
+        gpio_set_direction(pms->config.reset_gpio, GPIO_MODE_OUTPUT) !=0 ||
+        gpio_set_level(pms->config.reset_gpio, 1) !=0)
     {
         ESP_LOGE(TAG, "Fail init GPIO RESET");
         return PMS_FAIL_INIT_GPIO;
     }
 
     //config PMS SET GPIO
-    if (gpio_reset_pin(PMS_SET_GPIO) !=0 ||
-        gpio_set_direction(PMS_SET_GPIO, GPIO_MODE_OUTPUT) !=0 ||
-        gpio_set_level(PMS_SET_GPIO, 1) !=0)
+    if (gpio_reset_pin(pms->config.set_gpio) !=0 ||
+        gpio_set_direction(pms->config.set_gpio, GPIO_MODE_OUTPUT) !=0 ||
+        gpio_set_level(pms->config.set_gpio, 1) !=0)
     {
         ESP_LOGE(TAG, "Fail init GPIO SET");
         return PMS_FAIL_INIT_GPIO;
     }
 
-    pms_error_t result = pms_uart_init();
+    pms_error_t result = pms_uart_init(pms);
     if(result != 0)
         return result;
     vTaskDelay(600 / portTICK_RATE_MS);
-    return pms_set_workmode(workmode);
+    return pms_set_workmode(pms, workmode);
 }
 
 
-pms_error_t pms_set_workmode(const pms_workmode_t workmode) //send command set mode active/passive
+pms_error_t pms_set_workmode(pms_t *pms, const pms_workmode_t workmode) //send command set mode active/passive
 {
     if (workmode == PMS_WORKMODE_ACTIVE)
     {
-        if(sizeof(PMS_CMD_MODE_ACTIVE) != uart_tx_chars(PMS_UART_NUM, (const char*)&PMS_CMD_MODE_ACTIVE, sizeof(PMS_CMD_MODE_ACTIVE))) 
+        if(sizeof(PMS_CMD_MODE_ACTIVE) != uart_tx_chars(pms->config.uart_num, (const char*)&PMS_CMD_MODE_ACTIVE, sizeof(PMS_CMD_MODE_ACTIVE))) 
         {
             ESP_LOGE(TAG, "Fail send frame - command set active mode.");
             return PMS_FAIL_SEND_FRAME;
@@ -86,134 +116,517 @@ pms_error_t pms_set_workmode(const pms_workmode_t workmode) //send command set m
     }
     else if(workmode == PMS_WORKMODE_PASSIVE)
     {
-        if(sizeof(PMS_CMD_MODE_PASSIVE) != uart_tx_chars(PMS_UART_NUM, (const char*)&PMS_CMD_MODE_PASSIVE, sizeof(PMS_CMD_MODE_PASSIVE))) 
+        if(sizeof(PMS_CMD_MODE_PASSIVE) != uart_tx_chars(pms->config.uart_num, (const char*)&PMS_CMD_MODE_PASSIVE, sizeof(PMS_CMD_MODE_PASSIVE))) 
         {
             ESP_LOGE(TAG, "Fail send frame - command set mode passive.");
             return PMS_FAIL_SEND_FRAME;
         }
     }
+    sensor_trace_pms(pms->slot, SENSOR_TRACE_PMS_TX, workmode == PMS_WORKMODE_ACTIVE ? PMS_CMD_MODE_ACTIVE : PMS_CMD_MODE_PASSIVE, sizeof(PMS_CMD_MODE_ACTIVE));
     
-    uart_flush_input(PMS_UART_NUM);
+    uart_flush_input(pms->config.uart_num);
     return PMS_OK;
 }
 
 
-pms_error_t pms_sleep(void)//send command go sleep 
+pms_error_t pms_sleep(pms_t *pms)//send command go sleep 
 {
-    if(gpio_set_level(PMS_SET_GPIO, 0)!=0)
+    if(gpio_set_level(pms->config.set_gpio, 0)!=0)
     {
         ESP_LOGE(TAG, "Fail set to 0 GPIO SET.");
         return PMS_FAIL_SET_LEVEL_GPIO;
     }
+    sensor_trace_pms(pms->slot, SENSOR_TRACE_PMS_SLEEP, NULL, 0);
+    return PMS_OK;
+}
+
+pms_error_t pms_hold_sleep(pms_t *pms)//keep PMS sleeping during deep sleep of ESP, GPIO SET is held low
+{
+    pms_error_t result = pms_sleep(pms);
+    if(result != 0)
+        return result;
+
+    if(gpio_hold_en(pms->config.set_gpio)!=0)
+    {
+        ESP_LOGE(TAG, "Fail hold GPIO SET.");
+        return PMS_FAIL_SET_LEVEL_GPIO;
+    }
+    gpio_deep_sleep_hold_en();
     return PMS_OK;
 }
 
-pms_error_t pms_wake(void)//send command wake up
+pms_error_t pms_wake(pms_t *pms)//send command wake up
 {
-    if(gpio_set_level(PMS_SET_GPIO, 1)!=0)
+    if(gpio_set_level(pms->config.set_gpio, 1)!=0)
     {
         ESP_LOGE(TAG, "Fail set to 1 GPIO SET.");
         return PMS_FAIL_SET_LEVEL_GPIO;
     }
+    sensor_trace_pms(pms->slot, SENSOR_TRACE_PMS_WAKE, NULL, 0);
     return PMS_OK;
 }
 
 
-pms_error_t pms_request_read(pms_measurement_t *dst) //send command "get measurement results" and read data -> function pms_read_from_buffer
+pms_error_t pms_request_read(pms_t *pms, pms_measurement_t *dst) //send command "get measurement results" and read data -> function pms_read_from_buffer
 {
-    pms_error_t result = pms_uart_init();
+    pms_error_t result = pms_uart_init(pms);
     if(result != 0)
         return result;
 
-    uart_flush(PMS_UART_NUM);
-    if(sizeof(PMS_CMD_REQUEST_READ) != uart_tx_chars(PMS_UART_NUM, (const char*)&PMS_CMD_REQUEST_READ, sizeof(PMS_CMD_REQUEST_READ)))
+    uart_flush(pms->config.uart_num);
+    if(sizeof(PMS_CMD_REQUEST_READ) != uart_tx_chars(pms->config.uart_num, (const char*)&PMS_CMD_REQUEST_READ, sizeof(PMS_CMD_REQUEST_READ)))
     {
         ESP_LOGE(TAG, "Fail send frame - command read data.");
         return PMS_FAIL_SEND_FRAME;
     } 
+    sensor_trace_pms(pms->slot, SENSOR_TRACE_PMS_TX, PMS_CMD_REQUEST_READ, sizeof(PMS_CMD_REQUEST_READ));
 
     vTaskDelay(600 / portTICK_RATE_MS);
-    result = pms_read_from_buffer(dst);
-    uart_driver_delete(PMS_UART_NUM);
-    return result;
+    return pms_read_from_buffer(pms, dst);
 }
 
 
-pms_error_t pms_read_from_buffer(pms_measurement_t *dst) //read data from UART buffor from PMS
+pms_error_t pms_read_from_buffer(pms_t *pms, pms_measurement_t *dst) //read data from UART buffor from PMS, keep newest valid frame
 {
-    uint8_t *received_data=NULL;
-    uint16_t length = 0;
+    uint8_t received_data[PMS_FRAME_LEN];
+    size_t length = 0;
+    pms_parser_t parser;
+    pms_error_t result = PMS_NOT_FIND_FRAME;
+    pms_error_t status;
 
 //check length data in bufor uart PMS
-    uart_get_buffered_data_len(PMS_UART_NUM, (size_t*)&length);
+    uart_get_buffered_data_len(pms->config.uart_num, &length);
 
-    if(length < 32) //check if data is minimum frame length (32bytes)
+    if(length < PMS_FRAME_LEN) //check if data is minimum frame length (32bytes)
     {
         ESP_LOGE(TAG, "Low state of received data in bufor. (%u bytes)", length);
         return PMS_LOW_DATA_BUFOR;
     }
 
-//alloc mem to read data
-    received_data = malloc(length * sizeof(uint8_t));
-    if(received_data==NULL){
-        ESP_LOGE(TAG, "Fail alloc mem (%u bytes) to data from buffer UART.", length);
-        return PMS_FAIL_MEMALLOC;
+// read data from bufor uart PMS in frame sized chunks and parse on the fly
+    pms_parser_reset(&parser);
+    sensor_trace_pms(pms->slot, SENSOR_TRACE_PMS_RESET, NULL, 0);
+    while(length > 0)
+    {
+        int chunk = uart_read_bytes(pms->config.uart_num, received_data, length < sizeof(received_data) ? length : sizeof(received_data), 100 / portTICK_RATE_MS);
+        if(chunk <= 0)
+            break;
+        length -= chunk;
+        sensor_trace_pms(pms->slot, SENSOR_TRACE_PMS_RX, received_data, chunk);
+
+        for(int i=0; i<chunk; ++i)
+        {
+            status = pms_parser_feed(&parser, received_data[i], dst);
+            if(status == PMS_OK || status == PMS_BAD_CHECKSUM)
+                sensor_trace_pms_result(pms->slot, status, dst);
+            if(status == PMS_OK || (status == PMS_BAD_CHECKSUM && result != PMS_OK))
+                result = status;
+        }
     }
+    uart_flush(pms->config.uart_num);
 
-// read data from bufor uart PMS and flush
-    length = uart_read_bytes(PMS_UART_NUM, received_data, length, 100);
-    uart_flush(PMS_UART_NUM);
+    if(result == PMS_NOT_FIND_FRAME && parser.pos > 0)
+        result = PMS_NOT_FULL_FRAME;
 
-// parse received data
-    for(uint16_t i=0; i<length; ++i)
+    switch(result)
     {
-        if(received_data[i] == 0x42 && received_data[i+1] == 0x4D)// looking for start frame bytes
+    case PMS_OK:
+        break;
+    case PMS_BAD_CHECKSUM:
+        ESP_LOGE(TAG, "Bad checksum received data.");
+        break;
+    case PMS_NOT_FULL_FRAME:
+        ESP_LOGE(TAG, "Frame is not full in received data.");
+        break;
+    default:
+        ESP_LOGE(TAG, "Not find frame in received data.");
+        break;
+    }
+    return result;
+}
+
+
+pms_error_t pms_acquisition_start(pms_t *pms) //switch PMS to active mode, frames are parsed from UART events by task and put to frame queue
+{
+    if(pms->acquisition_running)
+        return PMS_OK;
+
+    pms_error_t result = pms_uart_init(pms);
+    if(result != 0)
+        return result;
+
+    if(pms->frame_queue == NULL)
+    {
+        pms->frame_queue = MEM_QUEUE_CREATE_AT(pms_frame_queue, pms->slot);
+        if(pms->frame_queue == NULL)
         {
-        // check whole frame
-            if(i+31 >= length)
-            {
-                ESP_LOGE(TAG, "Frame is not full in received data.");
-                free(received_data);
-                return PMS_NOT_FULL_FRAME;
-            }
+            ESP_LOGE(TAG, "Fail create frame queue.");
+            return PMS_FAIL_MEMALLOC;
+        }
+    }
+    xQueueReset(pms->frame_queue);
+
+    // pattern = start byte after idle line, marks begin of frame sent by PMS in active mode
+    if(uart_enable_pattern_det_baud_intr(pms->config.uart_num, PMS_FRAME_START_1, 1, 9, 0, PMS_UART_PATTERN_PRE_IDLE) != 0 ||
+        uart_pattern_queue_reset(pms->config.uart_num, PMS_UART_PATTERN_QUEUE_SIZE) != 0)
+    {
+        ESP_LOGE(TAG, "Fail enable UART pattern detection.");
+        uart_disable_pattern_det_intr(pms->config.uart_num);
+        return PMS_FAIL_INIT_UART;
+    }
+
+    result = pms_set_workmode(pms, PMS_WORKMODE_ACTIVE);
+    if(result != 0)
+    {
+        uart_disable_pattern_det_intr(pms->config.uart_num);
+        return result;
+    }
+    xQueueReset(pms->uart_queue);
+
+    if(pms->acquisition_task == NULL)
+    {
+        if(pms->acquisition_resume == NULL)
+            pms->acquisition_resume = MEM_SEMAPHORE_CREATE_BINARY_AT(pms_acquisition_resume, pms->slot);
+        if(pms->acquisition_parked == NULL)
+            pms->acquisition_parked = MEM_SEMAPHORE_CREATE_BINARY_AT(pms_acquisition_parked, pms->slot);
+        if(pms->acquisition_resume == NULL || pms->acquisition_parked == NULL ||
+            MEM_TASK_CREATE_AT(pms_acquisition_task, pms->slot, pms_acquisition_uart_task, "pms acquisition", pms, PMS_ACQUISITION_TASK_PRIO, &(pms->acquisition_task)) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Fail create acquisition task.");
+            pms->acquisition_task = NULL;
+            // nothing reads frames - back to state before start, PMS doesn't send frames in passive mode
+            uart_disable_pattern_det_intr(pms->config.uart_num);
+            pms_set_workmode(pms, PMS_WORKMODE_PASSIVE);
+            return PMS_FAIL_CREATE_TASK;
+        }
+    }
+    pms->acquisition_running = true;
+    xSemaphoreGive(pms->acquisition_resume);
+    return PMS_OK;
+}
+
+
+pms_error_t pms_acquisition_read(pms_t *pms, pms_measurement_t *dst, TickType_t timeout) //wait for next frame from active mode
+{
+    if(pms->frame_queue == NULL || !pms->acquisition_running)
+    {
+        ESP_LOGE(TAG, "Acquisition is not started.");
+        return PMS_NOT_FIND_FRAME;
+    }
+
+    if(xQueueReceive(pms->frame_queue, dst, timeout) != pdTRUE)
+    {
+        ESP_LOGE(TAG, "Timeout waiting for frame.");
+        return PMS_TIMEOUT;
+    }
+    return PMS_OK;
+}
+
+
+pms_error_t pms_acquisition_stop(pms_t *pms) //stop task, back to passive mode
+{
+    const uart_event_t stop_event = { .type = UART_EVENT_MAX };
+
+    if(!pms->acquisition_running)
+        return PMS_OK;
+
+    // task is parked by itself, it can't be stopped while it holds UART driver
+    xQueueSendToFront(pms->uart_queue, &stop_event, portMAX_DELAY);
+    xSemaphoreTake(pms->acquisition_parked, portMAX_DELAY);
+    pms->acquisition_running = false;
+
+    uart_disable_pattern_det_intr(pms->config.uart_num);
+    return pms_set_workmode(pms, PMS_WORKMODE_PASSIVE);
+}
+
+
+void pms_acquisition_flush(pms_t *pms) //drop frames waiting for consumer
+{
+    if(pms->frame_queue != NULL)
+        xQueueReset(pms->frame_queue);
+}
+
+
+static void pms_acquisition_put_frame(pms_t *pms, const pms_measurement_t *value) //put frame to queue, if consumer is late drop oldest
+{
+    pms_measurement_t dropped;
+
+    if(xQueueSend(pms->frame_queue, value, 0) != pdTRUE)
+    {
+        xQueueReceive(pms->frame_queue, &dropped, 0);
+        xQueueSend(pms->frame_queue, value, 0);
+    }
+}
+
+
+static void pms_acquisition_feed(pms_t *pms, size_t length) //read bytes from UART buffer and feed parser
+{
+    uint8_t received_data[PMS_FRAME_LEN];
+    pms_measurement_t value;
+
+    while(length > 0)
+    {
+        int chunk = uart_read_bytes(pms->config.uart_num, received_data, length < sizeof(received_data) ? length : sizeof(received_data), 0);
+        if(chunk <= 0)
+            return;
+        length -= chunk;
+        sensor_trace_pms(pms->slot, SENSOR_TRACE_PMS_RX, received_data, chunk);
+
+        for(int i=0; i<chunk; ++i)
+        {
+            pms_error_t status = pms_parser_feed(&(pms->parser), received_data[i], &value);
+            if(status == PMS_OK || status == PMS_BAD_CHECKSUM)
+                sensor_trace_pms_result(pms->slot, status, &value);
+            if(status == PMS_OK)
+                pms_acquisition_put_frame(pms, &value);
+            else if(status == PMS_BAD_CHECKSUM)
+                diag_pms_result(status); // frame lost before consumer, not seen by pms_acquisition_read
+        }
+    }
+}
+
+
+static void pms_acquisition_reset(pms_t *pms) //drop partial frame, bytes before it are end of previous frame
+{
+    pms_parser_reset(&(pms->parser));
+    sensor_trace_pms(pms->slot, SENSOR_TRACE_PMS_RESET, NULL, 0);
+}
 
-        // verification checksum
-            uint16_t checksum=0;
-            for(uint8_t j=i; j<(i+30); ++j)
-                checksum+=received_data[j];
 
-            if(checksum != ((((uint16_t)received_data[30])<<8) | received_data[31]))
+static void pms_acquisition_uart_task(void *parameter) //task read UART events, complete frame is sent to queue as soon as last byte arrives,
+{                                                       //between acquisitions task waits for acquisition_resume (no task churn)
+    pms_t *pms = parameter;
+    uart_event_t event;
+    size_t length;
+    int pattern_pos;
+    bool active = false;
+
+    while(1)
+    {
+        if(!active)
+        {
+            xSemaphoreTake(pms->acquisition_resume, portMAX_DELAY);
+            pms_acquisition_reset(pms);
+            active = true;
+        }
+
+        if(xQueueReceive(pms->uart_queue, &event, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        switch(event.type)
+        {
+        case UART_DATA:
+            uart_get_buffered_data_len(pms->config.uart_num, &length);
+            pms_acquisition_feed(pms, length);
+            break;
+
+        case UART_PATTERN_DET: // bytes before pattern are end of previous frame, new frame starts at pattern
+            pattern_pos = uart_pattern_pop_pos(pms->config.uart_num);
+            if(pattern_pos >= 0)
             {
-                ESP_LOGE(TAG, "Bad checksum received data.");
-                free(received_data);
-                return PMS_BAD_CHECKSUM;
+                pms_acquisition_feed(pms, pattern_pos);
+                pms_acquisition_reset(pms);
             }
+            uart_get_buffered_data_len(pms->config.uart_num, &length);
+            pms_acquisition_feed(pms, length);
+            break;
+
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            ESP_LOGE(TAG, "UART overflow, drop received data.");
+            uart_flush_input(pms->config.uart_num);
+            uart_pattern_queue_reset(pms->config.uart_num, PMS_UART_PATTERN_QUEUE_SIZE);
+            pms_acquisition_reset(pms);
+            break;
+
+        case UART_EVENT_MAX: // stop request from pms_acquisition_stop
+            active = false;
+            xSemaphoreGive(pms->acquisition_parked);
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+
+void pms_parser_reset(pms_parser_t *parser) //drop partial frame, wait for start bytes
+{
+    parser->pos = 0;
+    parser->checksum = 0;
+}
+
+
+static void pms_parser_decode(const uint8_t *frame, pms_measurement_t *dst) //save verified frame to struct
+{
+    dst->sm.pm10 = COMBINE_UINT8(frame[4], frame[5]);
+    dst->sm.pm25 = COMBINE_UINT8(frame[6], frame[7]);
+    dst->sm.pm100 = COMBINE_UINT8(frame[8], frame[9]);
+
+    dst->ae.pm10 = COMBINE_UINT8(frame[10], frame[11]);
+    dst->ae.pm25 = COMBINE_UINT8(frame[12], frame[13]);
+    dst->ae.pm100 = COMBINE_UINT8(frame[14], frame[15]);
+
+    dst->num.um3 = COMBINE_UINT8(frame[16], frame[17]);
+    dst->num.um5 = COMBINE_UINT8(frame[18], frame[19]);
+    dst->num.um10 = COMBINE_UINT8(frame[20], frame[21]);
+    dst->num.um25 = COMBINE_UINT8(frame[22], frame[23]);
+    dst->num.um50 = COMBINE_UINT8(frame[24], frame[25]);
+    dst->num.um100 = COMBINE_UINT8(frame[26], frame[27]);
+}
+
+
+static void pms_parser_resync(pms_parser_t *parser) //after error look for next start bytes inside already received part of frame
+{
+    uint8_t length = parser->pos;
+
+    while(length > 1)
+    {
+        uint8_t shift = 1;
+        while(shift < length && parser->frame[shift] != PMS_FRAME_START_1)
+            ++shift;
+
+        length -= shift;
+        memmove(parser->frame, parser->frame + shift, length);
+
+        if(length >= 2 && parser->frame[1] != PMS_FRAME_START_2)
+            continue;
+        if(length >= 4 && COMBINE_UINT8(parser->frame[2], parser->frame[3]) != PMS_FRAME_DATA_LEN)
+            continue;
+        break;
+    }
 
-        // save received data to struct 
-            dst->sm.pm10 = COMBINE_UINT8(received_data[i+4], received_data[i+5]); 
-            dst->sm.pm25 = COMBINE_UINT8(received_data[i+6], received_data[i+7]); 
-            dst->sm.pm100 = COMBINE_UINT8(received_data[i+8], received_data[i+9]); 
-
-            dst->ae.pm10 = COMBINE_UINT8(received_data[i+10], received_data[i+11]); 
-            dst->ae.pm25 = COMBINE_UINT8(received_data[i+12], received_data[i+13]); 
-            dst->ae.pm100 = COMBINE_UINT8(received_data[i+14], received_data[i+15]); 
-
-            dst->num.um3 = COMBINE_UINT8(received_data[i+16], received_data[i+17]); 
-            dst->num.um5 = COMBINE_UINT8(received_data[i+18], received_data[i+19]); 
-            dst->num.um10 = COMBINE_UINT8(received_data[i+20], received_data[i+21]); 
-            dst->num.um25 = COMBINE_UINT8(received_data[i+22], received_data[i+23]); 
-            dst->num.um50 = COMBINE_UINT8(received_data[i+24], received_data[i+25]);
-            dst->num.um100 = COMBINE_UINT8(received_data[i+26], received_data[i+27]); 
-            
-            //break;
-            free(received_data);
-            return PMS_OK;
+    parser->pos = length;
+    parser->checksum = 0;
+    for(uint8_t i=0; i<length; ++i) // length < PMS_FRAME_LEN-2, all bytes are covered by checksum
+        parser->checksum += parser->frame[i];
+}
+
+
+pms_error_t pms_parser_feed(pms_parser_t *parser, uint8_t byte, pms_measurement_t *dst) //state machine, one byte per call
+{
+    uint8_t pos = parser->pos;
+
+    parser->frame[pos] = byte;
+    parser->pos = ++pos;
+    if(pos <= PMS_FRAME_LEN-2)
+        parser->checksum += byte;
+
+    switch(pos)
+    {
+    case 1: // first start byte
+        if(byte != PMS_FRAME_START_1)
+        {
+            pms_parser_reset(parser);
+            return PMS_NOT_FIND_FRAME;
+        }
+        return PMS_NOT_FULL_FRAME;
+
+    case 2: // second start byte
+        if(byte != PMS_FRAME_START_2)
+        {
+            pms_parser_resync(parser);
+            return PMS_NOT_FIND_FRAME;
+        }
+        return PMS_NOT_FULL_FRAME;
+
+    case 4: // frame length, only one length is defined in doc
+        if(COMBINE_UINT8(parser->frame[2], parser->frame[3]) != PMS_FRAME_DATA_LEN)
+        {
+            pms_parser_resync(parser);
+            return PMS_NOT_FIND_FRAME;
+        }
+        return PMS_NOT_FULL_FRAME;
+
+    case PMS_FRAME_LEN: // whole frame, verification checksum
+        if(parser->checksum != COMBINE_UINT8(parser->frame[PMS_FRAME_LEN-2], parser->frame[PMS_FRAME_LEN-1]))
+        {
+            pms_parser_resync(parser);
+            return PMS_BAD_CHECKSUM;
         }
+        pms_parser_decode(parser->frame, dst);
+        pms_parser_reset(parser);
+        return PMS_OK;
+
+    default:
+        return PMS_NOT_FULL_FRAME;
+    }
+}
+
+
+uint16_t pms_parser_feed_buffer(pms_parser_t *parser, const uint8_t *data, uint16_t length, pms_measurement_t *dst, uint16_t dst_size) //parse buffer, save every valid frame
+{                                                                                                                                      //if dst is full newest frame overwrite last element
+    uint16_t found = 0;
+
+    if(dst_size < 1)
+        return 0;
+
+    for(uint16_t i=0; i<length; ++i)
+    {
+        if(pms_parser_feed(parser, data[i], &(dst[found < dst_size ? found : dst_size-1])) == PMS_OK)
+            ++found;
+    }
+    return found;
+}
+
+
+void pms_convergence_reset(pms_convergence_t *conv, pms_convergence_mode_t mode, uint8_t tolerance_pct, uint8_t tolerance_abs, uint8_t stable_num) //start new detection
+{
+    memset(conv, 0, sizeof(pms_convergence_t));
+    conv->mode = mode;
+    conv->tolerance_pct = tolerance_pct;
+    conv->tolerance_abs = tolerance_abs;
+    conv->stable_num = stable_num;
+}
+
+
+static inline bool pms_convergence_is_close(uint32_t value, uint32_t last, const pms_convergence_t *conv) //values x16, tolerance = max(pct, abs)
+{
+    uint32_t diff = value > last ? value - last : last - value;
+    uint32_t tolerance = last * conv->tolerance_pct / 100;
+
+    if(tolerance < ((uint32_t)conv->tolerance_abs)*16)
+        tolerance = ((uint32_t)conv->tolerance_abs)*16;
+    return diff <= tolerance;
+}
+
+
+bool pms_convergence_push(pms_convergence_t *conv, const pms_measurement_t *pms_value) //add sample, true if PM2.5 and PM10 are stable
+{
+    uint32_t pm25, pm100;
+
+    conv->sum_pm25 += pms_value->ae.pm25;
+    conv->sum_pm100 += pms_value->ae.pm100;
+    if(conv->count < UINT8_MAX)
+        ++conv->count;
+
+    if(conv->mode == PMS_CONVERGENCE_MEAN)
+    {
+        pm25 = (conv->sum_pm25 << 4) / conv->count;
+        pm100 = (conv->sum_pm100 << 4) / conv->count;
+    }
+    else
+    {
+        pm25 = ((uint32_t)pms_value->ae.pm25) << 4;
+        pm100 = ((uint32_t)pms_value->ae.pm100) << 4;
+    }
+
+    if(conv->count > 1 &&
+        pms_convergence_is_close(pm25, conv->last_pm25, conv) &&
+        pms_convergence_is_close(pm100, conv->last_pm100, conv))
+    {
+        if(conv->stable_count < UINT8_MAX)
+            ++conv->stable_count;
+    }
+    else
+    {
+        conv->stable_count = 0;
     }
 
-    ESP_LOGE(TAG, "Not find frame in received data.");
-    free(received_data);
-    return PMS_NOT_FIND_FRAME;
+    conv->last_pm25 = pm25;
+    conv->last_pm100 = pm100;
+    return conv->stable_count >= conv->stable_num;
 }
 
 
@@ -262,3 +675,65 @@ pms_error_t pms_calc_avg(const pms_measurement_t *arr_src, pms_measurement_t *ds
 
     return PMS_OK;
 }
+
+
+void pms_pack_values(const pms_measurement_t *value, int32_t *values) //measurement as PMS_WINDOW_CHANNELS channels of stats
+{
+    values[0] = value->sm.pm10;
+    values[1] = value->sm.pm25;
+    values[2] = value->sm.pm100;
+
+    values[3] = value->ae.pm10;
+    values[4] = value->ae.pm25;
+    values[5] = value->ae.pm100;
+
+    values[6] = value->num.um3;
+    values[7] = value->num.um5;
+    values[8] = value->num.um10;
+    values[9] = value->num.um25;
+    values[10] = value->num.um50;
+    values[11] = value->num.um100;
+}
+
+
+void pms_unpack_values(const int32_t *values, pms_measurement_t *dst)
+{
+    dst->sm.pm10 = values[0];
+    dst->sm.pm25 = values[1];
+    dst->sm.pm100 = values[2];
+
+    dst->ae.pm10 = values[3];
+    dst->ae.pm25 = values[4];
+    dst->ae.pm100 = values[5];
+
+    dst->num.um3 = values[6];
+    dst->num.um5 = values[7];
+    dst->num.um10 = values[8];
+    dst->num.um25 = values[9];
+    dst->num.um50 = values[10];
+    dst->num.um100 = values[11];
+}
+
+
+void pms_window_push(stats_window_t *window, const pms_measurement_t *value) //add measurement to rolling window (PMS_WINDOW_CHANNELS channels)
+{
+    int32_t values[PMS_WINDOW_CHANNELS];
+
+    pms_pack_values(value, values);
+    stats_window_push(window, values);
+}
+
+
+pms_error_t pms_window_get(const stats_window_t *window, stats_window_stat_t stat, pms_measurement_t *dst) //avg/min/max of rolling window
+{
+    int32_t values[PMS_WINDOW_CHANNELS];
+
+    if(stats_window_get(window, stat, values) != STATS_WINDOW_OK)
+    {
+        ESP_LOGE(TAG, "Rolling window is empty.");
+        return PMS_BAD_AVG_ARR_SIZE;
+    }
+
+    pms_unpack_values(values, dst);
+    return PMS_OK;
+}
\ No newline at end of file
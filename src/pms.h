@@ -6,11 +6,16 @@
 #define PMS_H_
 
 #include <stdio.h>
+#include <stdbool.h>
 #include "driver/uart.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "stats_window.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 
-//CONFIG
+//CONFIG - wiring of first PMS (PMS_CONFIG_DEFAULT), next ones are passed to pms_init
 #define PMS_RESET_GPIO  5
 #define PMS_SET_GPIO    2
 #define PMS_RX_GPIO     16
@@ -19,6 +24,22 @@
 #define PMS_UART_NUM                UART_NUM_2
 #define PMS_UART_BUFFER_RX_SIZE     256
 #define PMS_UART_BUFFER_TX_SIZE     256
+#define PMS_UART_QUEUE_SIZE         20
+#define PMS_UART_PATTERN_QUEUE_SIZE 8
+#define PMS_UART_PATTERN_PRE_IDLE   20 // baud cycles of idle line before start byte, inside frame bytes are sent back to back
+
+#define PMS_FRAME_QUEUE_SIZE        10 // frames waiting for consumer in active mode
+#define PMS_ACQUISITION_TASK_STACK  2048
+#define PMS_ACQUISITION_TASK_PRIO   5
+#define PMS_INSTANCES_MAX           2 // static memory of driver (acquisition task, frame queue) for each PMS
+
+//FRAME
+#define PMS_FRAME_START_1           0x42
+#define PMS_FRAME_START_2           0x4D
+#define PMS_FRAME_LEN               32 // start(2) + length(2) + data(26) + checksum(2)
+#define PMS_FRAME_DATA_LEN          28 // value of length field = data + checksum
+
+#define PMS_WINDOW_CHANNELS         12 // number of fields in pms_measurement_t
 
 //ERROR
 typedef enum {
@@ -32,7 +53,9 @@ typedef enum {
     PMS_FAIL_INIT_UART     = -7,
     PMS_FAIL_SET_LEVEL_GPIO = -8,
     PMS_BAD_AVG_ARR_SIZE    = -9,
-    PMS_FAIL_MEMALLOC       = -10
+    PMS_FAIL_MEMALLOC       = -10,
+    PMS_FAIL_CREATE_TASK    = -11,
+    PMS_TIMEOUT             = -12
 } pms_error_t;
 
 typedef enum {
@@ -61,14 +84,78 @@ typedef struct{  // all measurements
     struct PMS_Num num;
 } pms_measurement_t ;
 
+typedef struct{  // streaming parser context, fixed size - feed byte by byte
+    uint8_t     frame[PMS_FRAME_LEN];
+    uint8_t     pos;        // number of bytes of current frame already received
+    uint16_t    checksum;   // running sum of frame[0..pos-1], only first 30 bytes
+} pms_parser_t;
+
+typedef enum {
+    PMS_CONVERGENCE_SAMPLE  = 0,    // consecutive samples are close - end of warm-up
+    PMS_CONVERGENCE_MEAN    = 1     // running mean doesn't change - end of measurement burst
+} pms_convergence_mode_t;
+
+typedef struct{  // wiring of one PMS, every PMS has own UART
+    uart_port_t     uart_num;
+    gpio_num_t      set_gpio;
+    gpio_num_t      reset_gpio;
+    gpio_num_t      rx_gpio;
+    gpio_num_t      tx_gpio;
+} pms_config_t;
+
+#define PMS_CONFIG_DEFAULT() { \
+    .uart_num   = PMS_UART_NUM, \
+    .set_gpio   = PMS_SET_GPIO, \
+    .reset_gpio = PMS_RESET_GPIO, \
+    .rx_gpio    = PMS_RX_GPIO, \
+    .tx_gpio    = PMS_TX_GPIO }
+
+typedef struct{  // one PMS - state of driver, instances are owned by driver (pms_init)
+    pms_config_t        config;
+    uint8_t             slot;                   // index of instance and its static memory
+    QueueHandle_t       uart_queue;
+    QueueHandle_t       frame_queue;            // frames waiting for consumer in active mode
+    TaskHandle_t        acquisition_task;       // created once, parked between pms_acquisition_stop and pms_acquisition_start
+    SemaphoreHandle_t   acquisition_resume;     // given by pms_acquisition_start
+    SemaphoreHandle_t   acquisition_parked;     // given by task after stop request
+    volatile bool       acquisition_running;
+    pms_parser_t        parser;                 // used only by acquisition task
+} pms_t;
+
+typedef struct{  // stability detector of PM2.5 and PM10 (ae)
+    pms_convergence_mode_t  mode;
+    uint8_t     tolerance_pct;  // allowed change, percent of value
+    uint8_t     tolerance_abs;  // allowed change, ug/m3 - for low concentrations
+    uint8_t     stable_num;     // number of consecutive stable samples to converge
+    uint8_t     stable_count;
+    uint8_t     count;
+    uint32_t    sum_pm25;
+    uint32_t    sum_pm100;
+    uint32_t    last_pm25;      // last compared value, fixed point x16
+    uint32_t    last_pm100;
+} pms_convergence_t;
 
 
-pms_error_t pms_init(const pms_workmode_t workmode);
-pms_error_t pms_wake(void);
-pms_error_t pms_sleep(void);
-pms_error_t pms_set_workmode(const pms_workmode_t mode);
-pms_error_t pms_request_read(pms_measurement_t *pms_value);
-pms_error_t pms_read_from_buffer(pms_measurement_t *pms_value);
+pms_error_t pms_init(const pms_config_t *config, const pms_workmode_t workmode, pms_t **pms);
+pms_error_t pms_wake(pms_t *pms);
+pms_error_t pms_sleep(pms_t *pms);
+pms_error_t pms_hold_sleep(pms_t *pms);
+pms_error_t pms_set_workmode(pms_t *pms, const pms_workmode_t mode);
+pms_error_t pms_request_read(pms_t *pms, pms_measurement_t *pms_value);
+pms_error_t pms_read_from_buffer(pms_t *pms, pms_measurement_t *pms_value);
+pms_error_t pms_acquisition_start(pms_t *pms);
+pms_error_t pms_acquisition_read(pms_t *pms, pms_measurement_t *pms_value, TickType_t timeout);
+pms_error_t pms_acquisition_stop(pms_t *pms);
+void pms_acquisition_flush(pms_t *pms);
+void pms_parser_reset(pms_parser_t *parser);
+pms_error_t pms_parser_feed(pms_parser_t *parser, uint8_t byte, pms_measurement_t *dst);
+uint16_t pms_parser_feed_buffer(pms_parser_t *parser, const uint8_t *data, uint16_t length, pms_measurement_t *dst, uint16_t dst_size);
+void pms_convergence_reset(pms_convergence_t *conv, pms_convergence_mode_t mode, uint8_t tolerance_pct, uint8_t tolerance_abs, uint8_t stable_num);
+bool pms_convergence_push(pms_convergence_t *conv, const pms_measurement_t *pms_value);
 pms_error_t pms_calc_avg(const pms_measurement_t *arr_src, pms_measurement_t *dst, uint8_t arr_size);
+void pms_pack_values(const pms_measurement_t *value, int32_t *values);
+void pms_unpack_values(const int32_t *values, pms_measurement_t *dst);
+void pms_window_push(stats_window_t *window, const pms_measurement_t *value);
+pms_error_t pms_window_get(const stats_window_t *window, stats_window_stat_t stat, pms_measurement_t *dst);
 
 #endif
\ No newline at end of file
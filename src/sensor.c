@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#include <memory.h>
+#include <esp_timer.h>
+#include "sensor.h"
+
+#define SENSOR_EVENT_START(i)   (BIT0 << (i))       // start of burst of instance i
+#define SENSOR_EVENT_DONE(i)    (BIT0 << (8 + (i))) // result of instance i is ready
+#define SENSOR_EVENT_READY(i)   (BIT0 << (16 + (i)))// init of instance i done (also failed)
+
+static const char *TAG = "SENSOR";
+
+uint8_t temprature_sens_read(void);
+
+static void sensor_task(void *parameter);
+static void sensor_burst(sensor_t *sensor, sensor_value_t *samples);
+static EventBits_t sensor_events_all(uint8_t shift);
+
+static sensor_t *sensor_table = NULL;
+static uint8_t sensor_num = 0;
+static uint8_t sensor_diag_slot = 0;
+static EventGroupHandle_t sensor_events;
+static SemaphoreHandle_t sensor_bus_locks[SENSOR_BUSES_MAX];
+static sensor_value_t sensor_samples[SENSOR_INSTANCES_MAX][MAX_NUM_MEASUREMENT]; // static - counted in RAM budget, not in stack
+MEM_EVENT_GROUP_DEFINE(sensor_events);
+MEM_SEMAPHORE_DEFINE_ARRAY(sensor_bus_locks, SENSOR_BUSES_MAX);
+MEM_TASK_DEFINE_ARRAY(sensor_task, SENSOR_INSTANCES_MAX, SENSOR_TASK_STACK);
+
+
+
+sensor_error_t sensor_scheduler_init(sensor_t *sensors, uint8_t num, uint8_t diag_slot) //start task of every instance, init runs in it
+{
+    if(num > SENSOR_INSTANCES_MAX)
+    {
+        ESP_LOGE(TAG, "Too many sensors %u, max %u", num, SENSOR_INSTANCES_MAX);
+        return SENSOR_TOO_MANY;
+    }
+    for(uint8_t i=0; i<num; ++i)
+    {
+        if(sensors[i].bus > SENSOR_BUSES_MAX)
+        {
+            ESP_LOGE(TAG, "Bad bus %u of %s", sensors[i].bus, sensors[i].name);
+            return SENSOR_FAIL_INIT;
+        }
+    }
+
+    sensor_table = sensors;
+    sensor_num = num;
+    sensor_diag_slot = diag_slot;
+    sensor_events = MEM_EVENT_GROUP_CREATE(sensor_events);
+    for(uint8_t i=0; i<SENSOR_BUSES_MAX; ++i)
+        sensor_bus_locks[i] = MEM_SEMAPHORE_CREATE_MUTEX_AT(sensor_bus_locks, i);
+
+    // instances on shared bus sample in turns - k-th of n starts k/n of sample period later
+    for(uint8_t i=0; i<num; ++i)
+    {
+        uint8_t rank = 0, on_bus = 0;
+        for(uint8_t j=0; sensors[i].bus != 0 && j<num; ++j)
+        {
+            if(sensors[j].bus != sensors[i].bus)
+                continue;
+            if(j < i)
+                ++rank;
+            ++on_bus;
+        }
+        sensors[i].index = i;
+        sensors[i].ready = false;
+        sensors[i].result_valid = false;
+        sensors[i].phase_ms = on_bus > 1 ? sensors[i].ops->sample_period_ms * rank / on_bus : 0;
+    }
+
+    for(uint8_t i=0; i<num; ++i)
+    {
+        if(MEM_TASK_CREATE_AT(sensor_task, i, sensor_task, sensors[i].name, &(sensors[i]), SENSOR_TASK_PRIO, NULL) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Fail create task of %s", sensors[i].name);
+            return SENSOR_FAIL_CREATE_TASK;
+        }
+    }
+    return SENSOR_OK;
+}
+
+
+void sensor_scheduler_wait_ready(void) //init of all instances done, PMS needs time after reset
+{
+    xEventGroupWaitBits(sensor_events, sensor_events_all(16), pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+
+void sensor_scheduler_start(void) //start burst of all instances
+{
+    xEventGroupSetBits(sensor_events, sensor_events_all(0));
+}
+
+
+void sensor_scheduler_wait(void) //wait for results of all instances
+{
+    xEventGroupWaitBits(sensor_events, sensor_events_all(8), pdTRUE, pdTRUE, portMAX_DELAY);
+}
+
+
+void sensor_scheduler_hold(void) //before deep sleep - sensors stay off while ESP is sleeping
+{
+    for(uint8_t i=0; i<sensor_num; ++i)
+    {
+        if(sensor_table[i].ready && sensor_table[i].ops->hold != NULL)
+            sensor_table[i].ops->hold(&(sensor_table[i]));
+    }
+}
+
+
+uint8_t sensor_kind_num(sensor_kind_t kind) //number of instances of kind
+{
+    uint8_t num = 0;
+    for(uint8_t i=0; i<sensor_num; ++i)
+    {
+        if(sensor_table[i].ops->kind == kind)
+            ++num;
+    }
+    return num;
+}
+
+
+sensor_error_t sensor_kind_result(sensor_kind_t kind, sensor_value_t *dst, uint32_t *active_ms) //avg of valid results of all instances of kind, active_ms - the longest
+{
+    sensor_value_t results[SENSOR_INSTANCES_MAX];
+    const sensor_ops_t *ops = NULL;
+    uint8_t num = 0;
+
+    if(active_ms != NULL)
+        *active_ms = 0;
+    for(uint8_t i=0; i<sensor_num; ++i)
+    {
+        if(sensor_table[i].ops->kind != kind)
+            continue;
+        if(active_ms != NULL && sensor_table[i].active_ms > *active_ms)
+            *active_ms = sensor_table[i].active_ms;
+        if(!sensor_table[i].result_valid)
+            continue;
+        ops = sensor_table[i].ops;
+        results[num++] = sensor_table[i].result;
+    }
+    if(num == 0)
+        return SENSOR_NO_SAMPLES;
+    return ops->combine(results, num, dst);
+}
+
+
+static EventBits_t sensor_events_all(uint8_t shift) //bits of all instances
+{
+    return (((EventBits_t)1 << sensor_num) - 1) << shift;
+}
+
+
+static void sensor_task(void *parameter) //one instance - init once, then burst at every start of cycle
+{
+    sensor_t *sensor = parameter;
+    const uint8_t i = sensor->index;
+
+    sensor->ready = sensor->ops->init(sensor) == SENSOR_OK;
+    if(!sensor->ready)
+        ESP_LOGE(TAG, "Fail init %s", sensor->name);
+    xEventGroupSetBits(sensor_events, SENSOR_EVENT_READY(i));
+    while(1)
+    {
+        xEventGroupWaitBits(sensor_events, SENSOR_EVENT_START(i), pdTRUE, pdTRUE, portMAX_DELAY);
+        if(!sensor->ready)
+            sensor->ready = sensor->ops->init(sensor) == SENSOR_OK;
+        if(sensor->ready)
+            sensor_burst(sensor, sensor_samples[i]);
+        else
+            sensor->active_ms = 0;
+        diag_stack_check(sensor_diag_slot + i);
+        xEventGroupSetBits(sensor_events, SENSOR_EVENT_DONE(i));
+    }
+}
+
+
+static void sensor_burst(sensor_t *sensor, sensor_value_t *samples) //wake, samples until samples_max or stable, sleep and combine
+{
+    const sensor_ops_t *ops = sensor->ops;
+    SemaphoreHandle_t lock = sensor->bus != 0 ? sensor_bus_locks[sensor->bus - 1] : NULL;
+    int64_t start = esp_timer_get_time();
+    uint8_t num = 0;
+    uint8_t fails = 0;
+    sensor_error_t result;
+
+    memset(samples, 0, sizeof(sensor_value_t) * MAX_NUM_MEASUREMENT);
+    sensor->stable = false;
+    if(ops->wake(sensor) != SENSOR_OK)
+    {
+        ESP_LOGE(TAG, "Fail wake %s, skipped in this cycle, last result kept", sensor->name);
+        ops->sleep(sensor);
+        sensor->active_ms = (esp_timer_get_time() - start) / 1000;
+        return;
+    }
+    if(sensor->phase_ms > 0)
+        vTaskDelay(sensor->phase_ms / portTICK_RATE_MS);
+
+    for(uint8_t i=0; i<MAX_NUM_TRY_MEASUREMENT; ++i)
+    {
+        if(lock != NULL)
+            xSemaphoreTake(lock, portMAX_DELAY);
+        result = ops->sample(sensor, &(samples[num]));
+        if(lock != NULL)
+            xSemaphoreGive(lock);
+
+        if(result == SENSOR_OK)
+        {
+            if(++num >= ops->samples_max || (sensor->stable && num >= MIN_NUM_MEASUREMENT))
+                break;
+        }
+        else ++fails;
+        if(ops->sample_period_ms > 0)
+            vTaskDelay(ops->sample_period_ms / portTICK_RATE_MS);
+    }
+    diag_burst(fails);
+    ops->sleep(sensor);
+    sensor->active_ms = (esp_timer_get_time() - start) / 1000;
+
+    sensor->result_samples = num;
+    if(num > 0 && ops->combine(samples, num, &(sensor->result)) == SENSOR_OK)
+        sensor->result_valid = true;
+    else
+        ESP_LOGE(TAG, "No samples of %s, last result kept", sensor->name);
+    ESP_LOGI(TAG, "End burst of %s - %u samples, %u fails, %u ms", sensor->name, num, fails, sensor->active_ms);
+}
+
+
+// PMS - fan is on from wake to sleep, frames are received in active mode (acquisition task of driver)
+
+static pms_error_t sensor_pms_read(pms_t *pms, pms_measurement_t *dst) //pms_acquisition_read with latency and result counted in diagnostics
+{
+    int64_t start = esp_timer_get_time();
+    pms_error_t result = pms_acquisition_read(pms, dst, PMS_FRAME_TIMEOUT_MS / portTICK_RATE_MS);
+
+    if(result == PMS_OK)
+        diag_latency(DIAG_STAGE_PMS_FRAME, esp_timer_get_time() - start);
+    diag_pms_result(result);
+    return result;
+}
+
+static sensor_error_t sensor_pms_init(sensor_t *sensor)
+{
+    static const pms_config_t default_config = PMS_CONFIG_DEFAULT();
+    pms_t *pms = NULL;
+    pms_error_t result = pms_init(sensor->config != NULL ? sensor->config : &default_config, PMS_WORKMODE_PASSIVE, &pms);
+
+    sensor->driver = pms;
+    return result == PMS_OK ? SENSOR_OK : SENSOR_FAIL_INIT;
+}
+
+static sensor_error_t sensor_pms_wake(sensor_t *sensor) //return when data of PMS are stable (at most DELAY_START_PMS)
+{
+    pms_t *pms = sensor->driver;
+
+    if(pms_wake(pms) != PMS_OK)
+    {
+        ESP_LOGE(TAG, "Fail wake %s", sensor->name);
+        return SENSOR_FAIL_WAKE;
+    }
+#if PMS_ADAPTIVE_WINDOW
+    pms_measurement_t value;
+    TickType_t warmup_start = xTaskGetTickCount();
+
+    // frames during warm-up are used only to detect stable state of PMS
+    if(pms_acquisition_start(pms) != PMS_OK)
+    {
+        ESP_LOGE(TAG, "Fail start acquisition of %s", sensor->name);
+        return SENSOR_FAIL_WAKE;
+    }
+    vTaskDelay(PMS_WARMUP_MIN_MS / portTICK_RATE_MS);
+    pms_acquisition_flush(pms);
+    pms_convergence_reset(&(sensor->convergence), PMS_CONVERGENCE_SAMPLE, PMS_CONVERGENCE_TOLERANCE_PCT, PMS_CONVERGENCE_TOLERANCE_ABS, PMS_CONVERGENCE_STABLE_NUM);
+    while((xTaskGetTickCount() - warmup_start) < DELAY_START_PMS / portTICK_RATE_MS)
+    {
+        pms_error_t result = sensor_pms_read(pms, &value);
+
+        if(result == PMS_OK && pms_convergence_push(&(sensor->convergence), &value))
+            break;
+        if(result != PMS_OK && result != PMS_TIMEOUT) // read doesn't wait for frame, don't spin until end of warm-up
+            vTaskDelay(PMS_READ_RETRY_MS / portTICK_RATE_MS);
+    }
+    ESP_LOGI(TAG, "%s warm-up %u ms", sensor->name, (xTaskGetTickCount() - warmup_start) * portTICK_RATE_MS);
+
+    // stop burst when running mean is stable
+    pms_convergence_reset(&(sensor->convergence), PMS_CONVERGENCE_MEAN, PMS_CONVERGENCE_TOLERANCE_PCT, PMS_CONVERGENCE_TOLERANCE_ABS, PMS_CONVERGENCE_STABLE_NUM);
+#else
+    vTaskDelay(DELAY_START_PMS / portTICK_RATE_MS);//wait minimum 30s to stable data from PMS
+    if(pms_acquisition_start(pms) != PMS_OK)//active mode, frames are received at sensor output rate
+    {
+        ESP_LOGE(TAG, "Fail start acquisition of %s", sensor->name);
+        return SENSOR_FAIL_WAKE;
+    }
+#endif
+    return SENSOR_OK;
+}
+
+static sensor_error_t sensor_pms_sleep(sensor_t *sensor)
+{
+    pms_acquisition_stop(sensor->driver);
+    return pms_sleep(sensor->driver) == PMS_OK ? SENSOR_OK : SENSOR_FAIL_SAMPLE;
+}
+
+static sensor_error_t sensor_pms_sample(sensor_t *sensor, sensor_value_t *dst)
+{
+    if(sensor_pms_read(sensor->driver, &(dst->pm)) != PMS_OK)
+        return SENSOR_FAIL_SAMPLE;
+    ESP_LOGI(TAG, "Part of %s measurment - PM 1/2.5/10: %i/%i/%i", sensor->name, dst->pm.ae.pm10, dst->pm.ae.pm25, dst->pm.ae.pm100);
+#if PMS_ADAPTIVE_WINDOW
+    sensor->stable = pms_convergence_push(&(sensor->convergence), &(dst->pm));
+#endif
+    return SENSOR_OK;
+}
+
+static sensor_error_t sensor_pms_combine(const sensor_value_t *samples, uint8_t num, sensor_value_t *dst)
+{
+    pms_measurement_t values[MAX_NUM_MEASUREMENT];
+
+    if(num > MAX_NUM_MEASUREMENT)
+        num = MAX_NUM_MEASUREMENT;
+    for(uint8_t i=0; i<num; ++i)
+        values[i] = samples[i].pm;
+    return pms_calc_avg(values, &(dst->pm), num) == PMS_OK ? SENSOR_OK : SENSOR_NO_SAMPLES;
+}
+
+static sensor_error_t sensor_pms_hold(sensor_t *sensor)
+{
+    return pms_hold_sleep(sensor->driver) == PMS_OK ? SENSOR_OK : SENSOR_FAIL_SAMPLE;
+}
+
+const sensor_ops_t sensor_pms_ops = {
+    .kind               = SENSOR_KIND_PM,
+    .sample_period_ms   = 0, // sample waits for next frame
+    .samples_max        = MAX_NUM_MEASUREMENT,
+    .init               = sensor_pms_init,
+    .wake               = sensor_pms_wake,
+    .sleep              = sensor_pms_sleep,
+    .sample             = sensor_pms_sample,
+    .combine            = sensor_pms_combine,
+    .hold               = sensor_pms_hold
+};
+
+
+// DHT - always powered, sample every DELAY_MEASUREMENT (min 2s between reads)
+
+static sensor_error_t sensor_dht_init(sensor_t *sensor)
+{
+    static const dht_config_t default_config = DHT_CONFIG_DEFAULT();
+    dht_t *dht = NULL;
+    dht_error_t result = dht_init(sensor->config != NULL ? sensor->config : &default_config, &dht);
+
+    sensor->driver = dht;
+    return result == DHT_OK ? SENSOR_OK : SENSOR_FAIL_INIT;
+}
+
+static sensor_error_t sensor_dht_idle(sensor_t *sensor)
+{
+    return SENSOR_OK;
+}
+
+static sensor_error_t sensor_dht_sample(sensor_t *sensor, sensor_value_t *dst) //dht_read with latency and result counted in diagnostics
+{
+    int64_t start = esp_timer_get_time();
+    dht_error_t result = dht_read(sensor->driver, &(dst->climate));
+
+    diag_latency(DIAG_STAGE_DHT_READ, esp_timer_get_time() - start);
+    diag_dht_result(result);
+    if(result != DHT_OK)
+        return SENSOR_FAIL_SAMPLE;
+    ESP_LOGI(TAG, "Part of %s measurment - Hum: %i Temp: %i", sensor->name, dst->climate.humidity, dst->climate.temperature);
+    return SENSOR_OK;
+}
+
+static sensor_error_t sensor_dht_combine(const sensor_value_t *samples, uint8_t num, sensor_value_t *dst)
+{
+    dht_measurement_t values[MAX_NUM_MEASUREMENT];
+
+    if(num > MAX_NUM_MEASUREMENT)
+        num = MAX_NUM_MEASUREMENT;
+    for(uint8_t i=0; i<num; ++i)
+        values[i] = samples[i].climate;
+    return dht_calc_avg(values, &(dst->climate), num) == DHT_OK ? SENSOR_OK : SENSOR_NO_SAMPLES;
+}
+
+const sensor_ops_t sensor_dht_ops = {
+    .kind               = SENSOR_KIND_CLIMATE,
+    .sample_period_ms   = DELAY_MEASUREMENT,
+    .samples_max        = MAX_NUM_MEASUREMENT,
+    .init               = sensor_dht_init,
+    .wake               = sensor_dht_idle,
+    .sleep              = sensor_dht_idle,
+    .sample             = sensor_dht_sample,
+    .combine            = sensor_dht_combine,
+    .hold               = NULL
+};
+
+
+// CHIP TEMP - internal sensor of ESP, one sample per cycle
+
+static sensor_error_t sensor_chip_temp_idle(sensor_t *sensor)
+{
+    return SENSOR_OK;
+}
+
+static sensor_error_t sensor_chip_temp_sample(sensor_t *sensor, sensor_value_t *dst)
+{
+    dst->chip_temp = temprature_sens_read();
+    return SENSOR_OK;
+}
+
+static sensor_error_t sensor_chip_temp_combine(const sensor_value_t *samples, uint8_t num, sensor_value_t *dst)
+{
+    uint32_t sum = 0;
+
+    if(num == 0)
+        return SENSOR_NO_SAMPLES;
+    for(uint8_t i=0; i<num; ++i)
+        sum += samples[i].chip_temp;
+    dst->chip_temp = (sum + num / 2) / num;
+    return SENSOR_OK;
+}
+
+const sensor_ops_t sensor_chip_temp_ops = {
+    .kind               = SENSOR_KIND_CHIP_TEMP,
+    .sample_period_ms   = 0,
+    .samples_max        = 1,
+    .init               = sensor_chip_temp_idle,
+    .wake               = sensor_chip_temp_idle,
+    .sleep              = sensor_chip_temp_idle,
+    .sample             = sensor_chip_temp_sample,
+    .combine            = sensor_chip_temp_combine,
+    .hold               = NULL
+};
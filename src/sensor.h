@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef SENSOR_H_
+#define SENSOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include "esp_log.h"
+#include "pms.h"
+#include "dht.h"
+#include "diag.h"
+#include "mem_budget.h"
+
+// Sensors behind one driver interface (sensor_ops_t) and scheduler of their measurement bursts.
+// Every instance has own task, bursts of all instances run concurrently inside cycle - critical path is the slowest sensor.
+// Instances on the same bus never sample at the same time, their samples are shifted by sample period / instances on bus.
+
+//CONFIG
+#define SENSOR_INSTANCES_MAX        4   // static task of each instance, instance frame has index in 2 bits of type field
+#define SENSOR_BUSES_MAX            2   // shared buses, bus 0 - instance has own bus
+#define SENSOR_TASK_STACK           4096
+#define SENSOR_TASK_PRIO            4
+#define SENSOR_ADV_ID               0x0688 // id in head of instance frame (payload_measurement_schema, type = instance), low byte is AD type - unassigned one
+#define DELAY_START_PMS             40000 //wait minimum 30s to stable data from PMS
+#define DELAY_MEASUREMENT           2000 // delay between next measurment
+#define MAX_NUM_MEASUREMENT         10 // max number measurment to avg
+#define MAX_NUM_TRY_MEASUREMENT     60 // max number try measurment (number = sum of sucess measurment and fail measurment)
+#define PMS_FRAME_TIMEOUT_MS        3000 // max time between frames in PMS active mode (in doc -> 2.3s in stable mode)
+#define PMS_READ_RETRY_MS           1000 // back-off after failed read of frame (other than timeout), frame period in active mode
+
+//ADAPTIVE PMS WINDOW - shorter fan on-time, DELAY_START_PMS and MAX_NUM_MEASUREMENT are upper limits
+#define PMS_ADAPTIVE_WINDOW             1
+#define PMS_WARMUP_MIN_MS               15000 // fan must run some time even if data look stable
+#define MIN_NUM_MEASUREMENT             3 // min number measurment to avg
+#define PMS_CONVERGENCE_TOLERANCE_PCT   5 // allowed change of PM2.5/PM10 between samples (warm-up) or of running mean (burst)
+#define PMS_CONVERGENCE_TOLERANCE_ABS   1 // ug/m3, for low concentration
+#define PMS_CONVERGENCE_STABLE_NUM      3 // number of consecutive stable samples
+
+//SECOND PMS - wiring of redundant PMS (SENSOR_PM_NUM 2 in main.c)
+#define SENSOR_PM2_UART_NUM         UART_NUM_1
+#define SENSOR_PM2_RESET_GPIO       19
+#define SENSOR_PM2_SET_GPIO         18
+#define SENSOR_PM2_RX_GPIO          26
+#define SENSOR_PM2_TX_GPIO          27
+
+//ERROR
+typedef enum {
+    SENSOR_OK               = 0,
+    SENSOR_FAIL_INIT        = -1,
+    SENSOR_FAIL_SAMPLE      = -2,
+    SENSOR_NO_SAMPLES       = -3,
+    SENSOR_TOO_MANY         = -4,
+    SENSOR_FAIL_CREATE_TASK = -5,
+    SENSOR_FAIL_WAKE        = -6
+} sensor_error_t;
+
+typedef enum {
+    SENSOR_KIND_PM          = 0, // pms_measurement_t
+    SENSOR_KIND_CLIMATE     = 1, // dht_measurement_t
+    SENSOR_KIND_CHIP_TEMP   = 2, // temperature of ESP, raw value in F
+    SENSOR_KINDS_NUM        = 3
+} sensor_kind_t;
+
+typedef union { // sample or result of any kind
+    pms_measurement_t   pm;
+    dht_measurement_t   climate;
+    uint8_t             chip_temp;
+} sensor_value_t;
+
+typedef struct sensor sensor_t;
+
+typedef struct { // driver of one kind of sensor, shared by all its instances
+    sensor_kind_t   kind;
+    uint32_t        sample_period_ms;   // delay after every sample, 0 - sample waits for data itself
+    uint8_t         samples_max;        // samples in burst, up to MAX_NUM_MEASUREMENT
+    sensor_error_t  (*init)(sensor_t *sensor);  // once at boot, sets driver
+    sensor_error_t  (*wake)(sensor_t *sensor);  // power on and warm-up, samples are valid after return, error - burst of cycle is skipped
+    sensor_error_t  (*sleep)(sensor_t *sensor);
+    sensor_error_t  (*sample)(sensor_t *sensor, sensor_value_t *dst); // one sample, sets stable if burst can end
+    sensor_error_t  (*combine)(const sensor_value_t *samples, uint8_t num, sensor_value_t *dst); // avg of samples or instances
+    sensor_error_t  (*hold)(sensor_t *sensor);  // optional - keep sensor off during deep sleep of ESP
+} sensor_ops_t;
+
+struct sensor { // one instance - table of instances is passed to sensor_scheduler_init
+    const sensor_ops_t  *ops;
+    const char          *name;
+    const void          *config;    // pms_config_t / dht_config_t, NULL - default wiring
+    uint8_t             bus;        // 0 - own bus, instances with the same bus take turns
+    // state - set by scheduler and driver
+    void                *driver;    // pms_t / dht_t
+    bool                ready;      // init done, failed init is repeated at next cycle
+    bool                stable;     // set by sample - burst can end before samples_max
+    uint8_t             index;
+    uint32_t            phase_ms;   // delay of first sample on shared bus
+    pms_convergence_t   convergence;
+    sensor_value_t      result;     // last result, kept if all samples of burst fail
+    bool                result_valid;
+    uint8_t             result_samples;
+    uint32_t            active_ms;  // time from wake to sleep in last cycle (fan on-time)
+};
+
+extern const sensor_ops_t sensor_pms_ops;
+extern const sensor_ops_t sensor_dht_ops;
+extern const sensor_ops_t sensor_chip_temp_ops;
+
+
+sensor_error_t sensor_scheduler_init(sensor_t *sensors, uint8_t num, uint8_t diag_slot);
+void sensor_scheduler_wait_ready(void);
+void sensor_scheduler_start(void);
+void sensor_scheduler_wait(void);
+void sensor_scheduler_hold(void);
+uint8_t sensor_kind_num(sensor_kind_t kind);
+sensor_error_t sensor_kind_result(sensor_kind_t kind, sensor_value_t *dst, uint32_t *active_ms);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "flash_util.h"
+#include "sensor_trace.h"
+
+#if SENSOR_TRACE
+static const char *TAG = "SENSOR_TRACE";
+
+typedef struct { // state of capture
+    const esp_partition_t   *partition;
+    size_t                  offset;     // next chunk
+    uint16_t                len;        // bytes of records in buffer
+    uint16_t                dropped;    // records which didn't fit to buffer since last chunk
+    bool                    full;       // no space for next chunk, capture is stopped
+} sensor_trace_t;
+
+static sensor_trace_t sensor_trace = {0};
+static uint8_t sensor_trace_buffer[sizeof(sensor_trace_chunk_t) + SENSOR_TRACE_BUFFER_SIZE]; // head of chunk + records, one flash write
+#define SENSOR_TRACE_DROPPED_LEN    (sizeof(sensor_trace_record_t) + sizeof(uint16_t)) // space kept for SENSOR_TRACE_DROPPED
+static SemaphoreHandle_t sensor_trace_mutex=NULL; // guards sensor_trace and buffer, records come from tasks of sensors
+MEM_SEMAPHORE_DEFINE(sensor_trace_mutex);
+
+
+
+static size_t sensor_trace_align(size_t offset)
+{
+    return (offset + SENSOR_TRACE_ALIGN - 1) / SENSOR_TRACE_ALIGN * SENSOR_TRACE_ALIGN;
+}
+
+
+static sensor_trace_error_t sensor_trace_mount(void) //find end of trace by walking heads of chunks
+{
+    sensor_trace_chunk_t chunk;
+    size_t offset = 0;
+
+    while(offset + sizeof(chunk) <= sensor_trace.partition->size)
+    {
+        if(esp_partition_read(sensor_trace.partition, offset, &chunk, sizeof(chunk)) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Fail read chunk at %u", offset);
+            return SENSOR_TRACE_FAIL_READ;
+        }
+        if(flash_util_blank(&chunk, sizeof(chunk)))
+            break;
+
+        if(chunk.magic != SENSOR_TRACE_MAGIC || chunk.len > SENSOR_TRACE_BUFFER_SIZE)
+        {
+            if(offset > 0) // head torn by power loss, chunks after it can't be found - keep what was captured
+            {
+                ESP_LOGE(TAG, "Damaged chunk at %u, capture stopped", offset);
+                sensor_trace.full = true;
+                break;
+            }
+            ESP_LOGI(TAG, "Partition %s is not a trace, erasing", SENSOR_TRACE_PARTITION_LABEL);
+            if(esp_partition_erase_range(sensor_trace.partition, 0, sensor_trace.partition->size) != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Fail erase partition %s", SENSOR_TRACE_PARTITION_LABEL);
+                return SENSOR_TRACE_FAIL_ERASE;
+            }
+            break;
+        }
+        offset = sensor_trace_align(offset + sizeof(chunk) + chunk.len);
+    }
+
+    sensor_trace.offset = offset;
+    if(offset + sizeof(chunk) >= sensor_trace.partition->size)
+        sensor_trace.full = true;
+    return SENSOR_TRACE_OK;
+}
+
+
+static void sensor_trace_append(sensor_trace_type_t type, uint8_t slot, const void *payload, uint8_t len) //record to buffer, caller checks space
+{
+    sensor_trace_record_t record = {
+        .type = type,
+        .slot = slot,
+        .len = len,
+        .time = (uint32_t)esp_timer_get_time()
+    };
+    uint8_t *dst = sensor_trace_buffer + sizeof(sensor_trace_chunk_t) + sensor_trace.len;
+
+    memcpy(dst, &record, sizeof(record));
+    if(len > 0)
+        memcpy(dst + sizeof(record), payload, len);
+    sensor_trace.len += sizeof(record) + len;
+}
+
+
+static sensor_trace_error_t sensor_trace_write(void) //records in buffer as one chunk at end of trace
+{
+    sensor_trace_chunk_t *chunk = (sensor_trace_chunk_t*)sensor_trace_buffer;
+    size_t size;
+    esp_err_t err;
+
+    if(sensor_trace.dropped > 0) // space is kept by sensor_trace_put
+    {
+        ESP_LOGW(TAG, "Dropped %u records, buffer is %u bytes", sensor_trace.dropped, SENSOR_TRACE_BUFFER_SIZE);
+        sensor_trace_append(SENSOR_TRACE_DROPPED, 0, &(sensor_trace.dropped), sizeof(sensor_trace.dropped));
+        sensor_trace.dropped = 0;
+    }
+    if(sensor_trace.len == 0)
+        return SENSOR_TRACE_OK;
+
+    size = sizeof(sensor_trace_chunk_t) + sensor_trace.len;
+    if(sensor_trace.offset + size > sensor_trace.partition->size)
+    {
+        ESP_LOGW(TAG, "Partition %s is full, capture stopped", SENSOR_TRACE_PARTITION_LABEL);
+        sensor_trace.full = true;
+        sensor_trace.len = 0;
+        return SENSOR_TRACE_FULL;
+    }
+
+    // chunk torn by power loss fails CRC on host, its space is skipped like written one
+    chunk->magic = SENSOR_TRACE_MAGIC;
+    chunk->len = sensor_trace.len;
+    chunk->crc = flash_util_crc(sensor_trace_buffer + sizeof(sensor_trace_chunk_t), sensor_trace.len);
+    err = esp_partition_write(sensor_trace.partition, sensor_trace.offset, sensor_trace_buffer, size);
+    sensor_trace.offset = sensor_trace_align(sensor_trace.offset + size);
+    sensor_trace.len = 0;
+    if(err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Fail write chunk");
+        return SENSOR_TRACE_FAIL_WRITE;
+    }
+    return SENSOR_TRACE_OK;
+}
+
+
+static void sensor_trace_put(sensor_trace_type_t type, uint8_t slot, const void *payload, uint8_t len) //append record, flash is written only by sensor_trace_flush
+{
+    if(sensor_trace.partition == NULL || sensor_trace.full)
+        return;
+
+    xSemaphoreTake(sensor_trace_mutex, portMAX_DELAY);
+    if(sensor_trace.len + sizeof(sensor_trace_record_t) + len > SENSOR_TRACE_BUFFER_SIZE - SENSOR_TRACE_DROPPED_LEN)
+    {
+        if(sensor_trace.dropped < UINT16_MAX) // cycle doesn't fit to buffer, flash write now would disturb capture
+            ++sensor_trace.dropped;
+    }
+    else
+        sensor_trace_append(type, slot, payload, len);
+    xSemaphoreGive(sensor_trace_mutex);
+}
+
+
+sensor_trace_error_t sensor_trace_init(void) //find partition and end of trace, capture of boot starts with boot record
+{
+    sensor_trace_error_t err;
+    uint8_t boot[2] = {esp_reset_reason(), SENSOR_TRACE_VERSION};
+
+    if(sensor_trace_mutex == NULL)
+        sensor_trace_mutex = MEM_SEMAPHORE_CREATE_MUTEX(sensor_trace_mutex);
+
+    sensor_trace.partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SENSOR_TRACE_PARTITION_SUBTYPE, SENSOR_TRACE_PARTITION_LABEL);
+    if(sensor_trace.partition == NULL)
+    {
+        ESP_LOGE(TAG, "No partition %s", SENSOR_TRACE_PARTITION_LABEL);
+        return SENSOR_TRACE_NO_PARTITION;
+    }
+
+    err = sensor_trace_mount();
+    if(err != SENSOR_TRACE_OK)
+    {
+        sensor_trace.partition = NULL;
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Trace uses %u of %u bytes", sensor_trace.offset, sensor_trace.partition->size);
+    if(sensor_trace.full)
+        return SENSOR_TRACE_FULL;
+    sensor_trace_put(SENSOR_TRACE_BOOT, 0, boot, sizeof(boot));
+    return SENSOR_TRACE_OK;
+}
+
+
+sensor_trace_error_t sensor_trace_flush(void) //write records now - between cycles, before deep sleep
+{
+    sensor_trace_error_t err;
+
+    if(sensor_trace.partition == NULL)
+        return SENSOR_TRACE_NO_PARTITION;
+
+    xSemaphoreTake(sensor_trace_mutex, portMAX_DELAY);
+    err = sensor_trace.full ? SENSOR_TRACE_FULL : sensor_trace_write();
+    xSemaphoreGive(sensor_trace_mutex);
+    return err;
+}
+
+
+void sensor_trace_pms(uint8_t slot, sensor_trace_type_t type, const uint8_t *data, int len) //event of PMS, bytes of UART in order of reading
+{
+    do
+    {
+        uint8_t part = len > UINT8_MAX ? UINT8_MAX : len;
+        sensor_trace_put(type, slot, data, part);
+        data += part;
+        len -= part;
+    } while(len > 0);
+}
+
+
+void sensor_trace_pms_result(uint8_t slot, pms_error_t status, const pms_measurement_t *value) //frame found by parser, values only if valid
+{
+    uint8_t payload[1 + PMS_WINDOW_CHANNELS * sizeof(uint16_t)];
+    int32_t values[PMS_WINDOW_CHANNELS];
+    uint8_t len = 1;
+
+    payload[0] = (uint8_t)(int8_t)status;
+    if(status == PMS_OK)
+    {
+        pms_pack_values(value, values);
+        for(uint8_t i=0; i<PMS_WINDOW_CHANNELS; ++i)
+        {
+            uint16_t v = values[i];
+            memcpy(&payload[len], &v, sizeof(v));
+            len += sizeof(v);
+        }
+    }
+    sensor_trace_put(SENSOR_TRACE_PMS_RESULT, slot, payload, len);
+}
+
+
+void sensor_trace_dht(uint8_t slot, const uint32_t *edges, uint8_t edges_num, uint32_t ticks_per_us, dht_error_t result, const dht_measurement_t *value) //edges as pulses, result of decode
+{
+    uint8_t payload[SENSOR_TRACE_PAYLOAD_MAX];
+    sensor_trace_dht_t head = {
+        .edges_num = edges_num,
+        .ticks_per_us = ticks_per_us,
+        .result = result,
+        .temperature = result == DHT_OK ? value->temperature : 0,
+        .humidity = result == DHT_OK ? value->humidity : 0
+    };
+    uint8_t len = sizeof(head);
+
+    memcpy(payload, &head, sizeof(head));
+    for(uint8_t i=1; i<edges_num && i<DHT_EDGES_NUM; ++i)
+    {
+        uint32_t pulse = edges[i] - edges[i-1]; // unsigned subtraction, CPU cycle counter can overflow
+        uint16_t saved = pulse > SENSOR_TRACE_PULSE_MAX ? SENSOR_TRACE_PULSE_MAX : pulse;
+        memcpy(&payload[len], &saved, sizeof(saved));
+        len += sizeof(saved);
+    }
+    sensor_trace_put(SENSOR_TRACE_DHT, slot, payload, len);
+}
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */
+#ifndef SENSOR_TRACE_H_
+#define SENSOR_TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_partition.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "mem_budget.h"
+#include "pms.h"
+#include "dht.h"
+
+// Capture of raw sensor streams for replay on host (SENSOR_TRACE 1) - bytes read by PMS driver from UART, timestamps
+// of DHT edges and results decoded from them, in dedicated flash partition (see partitions.csv):
+// trace, data, 0x41, , 256K
+// Records are collected in RAM and written as one chunk only by sensor_trace_flush between cycles, flash write (cache
+// is off) never disturbs capture. Records which don't fit to buffer are dropped and counted (SENSOR_TRACE_DROPPED).
+// Partition is filled once, capture stops when it's full - erase partition to start new capture.
+// Host reads partition (parttool.py read_partition --partition-name trace) and replays it in simulator (--replay).
+// Capture is ~4KB per cycle (mostly DHT edges), 256KB partition holds ~5 hours of default cycles.
+
+//CONFIG
+#ifndef SENSOR_TRACE // -DSENSOR_TRACE=1 selects capture mode without edit (variant of host simulator)
+#define SENSOR_TRACE                    0   // 1 - capture mode, hooks of drivers are empty macros otherwise
+#endif
+#define SENSOR_TRACE_PARTITION_LABEL    "trace"
+#define SENSOR_TRACE_PARTITION_SUBTYPE  0x41
+#define SENSOR_TRACE_BUFFER_SIZE        8192 // RAM buffer = max chunk, records of one cycle (~3.5KB, ~4.5KB with 2 PMS and retries)
+#define SENSOR_TRACE_MAGIC              0x5254414D // "MATR"
+#define SENSOR_TRACE_VERSION            2   // 2 - records over buffer are dropped (SENSOR_TRACE_DROPPED), not written mid-cycle
+#define SENSOR_TRACE_ALIGN              4   // chunks start at aligned offset of partition
+
+// FORMAT - partition = chunks, chunk = head + records, first blank head (0xFF) is end of trace.
+// Record = head + payload, time is low 32 bits of esp_timer_get_time (us since boot), little endian.
+typedef enum {
+    SENSOR_TRACE_BOOT       = 1,    // u8 reset reason, u8 version
+    SENSOR_TRACE_PMS_WAKE   = 2,    // SET pin high - start of session of PMS
+    SENSOR_TRACE_PMS_SLEEP  = 3,    // SET pin low
+    SENSOR_TRACE_PMS_TX     = 4,    // command sent to PMS, replay answers it with following bytes
+    SENSOR_TRACE_PMS_RX     = 5,    // bytes read from UART and fed to parser
+    SENSOR_TRACE_PMS_RESET  = 6,    // parser dropped partial frame (start of read, pattern, overflow)
+    SENSOR_TRACE_PMS_RESULT = 7,    // frame status of parser (i8), PMS_OK is followed by 12 values (u16)
+    SENSOR_TRACE_DHT        = 8,    // sensor_trace_dht_t + (edges_num-1) pulses (u16 CPU cycles)
+    SENSOR_TRACE_DROPPED    = 9     // u16 records dropped since previous chunk (buffer full), last record of chunk
+} sensor_trace_type_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t    magic;
+    uint16_t    len;            // bytes of records
+    uint16_t    crc;            // CRC-16/CCITT of records
+} sensor_trace_chunk_t;//8bytes
+
+typedef struct __attribute__((__packed__)) {
+    uint8_t     type;           // sensor_trace_type_t
+    uint8_t     slot;           // instance of driver
+    uint8_t     len;            // bytes of payload
+    uint32_t    time;           // us
+} sensor_trace_record_t;//7bytes
+
+typedef struct __attribute__((__packed__)) {
+    uint8_t     edges_num;
+    uint8_t     ticks_per_us;   // CPU cycles of edge timestamps
+    int8_t      result;         // dht_error_t of dht_decode_edges
+    int16_t     temperature;    // valid only for DHT_OK
+    uint16_t    humidity;
+} sensor_trace_dht_t;//7bytes
+
+// pulse longer than u16 is saved as 0xFFFF, it's still above DHT_PULSE_TIMEOUT_US up to 252MHz - decode is the same
+#define SENSOR_TRACE_PULSE_MAX          UINT16_MAX
+#define SENSOR_TRACE_PAYLOAD_MAX        (sizeof(sensor_trace_dht_t) + (DHT_EDGES_NUM - 1) * sizeof(uint16_t))
+
+//ERROR
+typedef enum {
+    SENSOR_TRACE_OK                 = 0,
+    SENSOR_TRACE_NO_PARTITION       = -1,
+    SENSOR_TRACE_FAIL_READ          = -2,
+    SENSOR_TRACE_FAIL_WRITE         = -3,
+    SENSOR_TRACE_FAIL_ERASE         = -4,
+    SENSOR_TRACE_FULL               = -5
+} sensor_trace_error_t;
+
+
+#if SENSOR_TRACE
+sensor_trace_error_t sensor_trace_init(void);
+sensor_trace_error_t sensor_trace_flush(void);
+void sensor_trace_pms(uint8_t slot, sensor_trace_type_t type, const uint8_t *data, int len);
+void sensor_trace_pms_result(uint8_t slot, pms_error_t status, const pms_measurement_t *value);
+void sensor_trace_dht(uint8_t slot, const uint32_t *edges, uint8_t edges_num, uint32_t ticks_per_us, dht_error_t result, const dht_measurement_t *value);
+#else
+static inline sensor_trace_error_t sensor_trace_init(void) { return SENSOR_TRACE_OK; }
+static inline sensor_trace_error_t sensor_trace_flush(void) { return SENSOR_TRACE_OK; }
+#define sensor_trace_pms(slot, type, data, len)             ((void)0)
+#define sensor_trace_pms_result(slot, status, value)        ((void)0)
+#define sensor_trace_dht(slot, edges, num, ticks, res, val) ((void)0)
+#endif
+
+#endif
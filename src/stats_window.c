@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#include <string.h>
+#include "stats_window.h"
+
+#define DEQUE_AT(deque, head, i, capacity)    ((deque)[((head)+(i))%(capacity)])
+
+static inline void stats_window_evict(stats_window_t *window, uint8_t c, uint16_t slot);
+static inline void stats_window_insert(stats_window_t *window, uint8_t c, uint16_t slot, int32_t value);
+
+
+
+void stats_window_reset(stats_window_t *window) //drop all samples
+{
+    window->head = 0;
+    window->count = 0;
+    memset(window->channel, 0, sizeof(stats_window_channel_t) * window->channels);
+}
+
+
+static inline void stats_window_evict(stats_window_t *window, uint8_t c, uint16_t slot) //remove oldest sample of channel
+{
+    stats_window_channel_t *ch = &(window->channel[c]);
+    uint16_t *min_deque = window->min_deque + (uint32_t)c * window->capacity;
+    uint16_t *max_deque = window->max_deque + (uint32_t)c * window->capacity;
+
+    ch->sum -= window->samples[(uint32_t)slot * window->channels + c];
+
+    // oldest sample can be only on front of deque
+    if(ch->min_len > 0 && min_deque[ch->min_head] == slot)
+    {
+        ch->min_head = (ch->min_head + 1) % window->capacity;
+        --ch->min_len;
+    }
+    if(ch->max_len > 0 && max_deque[ch->max_head] == slot)
+    {
+        ch->max_head = (ch->max_head + 1) % window->capacity;
+        --ch->max_len;
+    }
+}
+
+
+static inline void stats_window_insert(stats_window_t *window, uint8_t c, uint16_t slot, int32_t value) //add newest sample of channel
+{
+    stats_window_channel_t *ch = &(window->channel[c]);
+    uint16_t *min_deque = window->min_deque + (uint32_t)c * window->capacity;
+    uint16_t *max_deque = window->max_deque + (uint32_t)c * window->capacity;
+    const int32_t *samples = window->samples;
+
+    ch->sum += value;
+
+    // samples behind newer and smaller (bigger) sample will never be min (max), every slot is pushed and popped once
+    while(ch->min_len > 0 && samples[(uint32_t)DEQUE_AT(min_deque, ch->min_head, ch->min_len-1, window->capacity) * window->channels + c] >= value)
+        --ch->min_len;
+    DEQUE_AT(min_deque, ch->min_head, ch->min_len, window->capacity) = slot;
+    ++ch->min_len;
+
+    while(ch->max_len > 0 && samples[(uint32_t)DEQUE_AT(max_deque, ch->max_head, ch->max_len-1, window->capacity) * window->channels + c] <= value)
+        --ch->max_len;
+    DEQUE_AT(max_deque, ch->max_head, ch->max_len, window->capacity) = slot;
+    ++ch->max_len;
+}
+
+
+void stats_window_push(stats_window_t *window, const int32_t *values) //add sample (one value per channel), if window is full oldest sample is removed
+{
+    uint16_t slot = window->head;
+    int32_t *sample = window->samples + (uint32_t)slot * window->channels;
+
+    for(uint8_t c=0; c<window->channels; ++c)
+    {
+        if(window->count == window->capacity)
+            stats_window_evict(window, c, slot);
+        sample[c] = values[c];
+        stats_window_insert(window, c, slot, values[c]);
+    }
+
+    if(window->count < window->capacity)
+        ++window->count;
+    if(++window->head >= window->capacity)
+        window->head = 0;
+}
+
+
+uint16_t stats_window_count(const stats_window_t *window)
+{
+    return window->count;
+}
+
+
+stats_window_error_t stats_window_get(const stats_window_t *window, stats_window_stat_t stat, int32_t *dst) //avg/min/max of every channel
+{
+    if(window->count < 1)
+        return STATS_WINDOW_EMPTY;
+
+    for(uint8_t c=0; c<window->channels; ++c)
+    {
+        const stats_window_channel_t *ch = &(window->channel[c]);
+
+        switch(stat)
+        {
+        case STATS_WINDOW_MIN:
+            dst[c] = window->samples[(uint32_t)window->min_deque[(uint32_t)c * window->capacity + ch->min_head] * window->channels + c];
+            break;
+        case STATS_WINDOW_MAX:
+            dst[c] = window->samples[(uint32_t)window->max_deque[(uint32_t)c * window->capacity + ch->max_head] * window->channels + c];
+            break;
+        default:
+            dst[c] = ch->sum / window->count;
+            break;
+        }
+    }
+    return STATS_WINDOW_OK;
+}
+
+
+void stats_bucket_reset(stats_bucket_t *bucket) //drop samples of open bucket
+{
+    bucket->elapsed_ms = 0;
+    bucket->count = 0;
+    bucket->weight_ms = 0;
+    memset(bucket->sum, 0, sizeof(int64_t) * bucket->channels);
+}
+
+
+bool stats_bucket_push(stats_bucket_t *bucket, const int32_t *values, uint32_t duration_ms, int32_t *avg) //add sample covering duration_ms,
+{                                                                                                       // true - bucket closed, its avg is in avg
+    uint32_t weight = duration_ms ? duration_ms : 1;
+
+    for(uint8_t c=0; c<bucket->channels; ++c)
+        bucket->sum[c] += (int64_t)values[c] * weight;
+    ++bucket->count;
+    bucket->weight_ms += weight;
+    bucket->elapsed_ms += duration_ms;
+
+    if(bucket->elapsed_ms < bucket->period_ms)
+        return false;
+
+    for(uint8_t c=0; c<bucket->channels; ++c)
+    {
+        avg[c] = bucket->sum[c] / (int64_t)bucket->weight_ms;
+        bucket->sum[c] = 0;
+    }
+    bucket->count = 0;
+    bucket->weight_ms = 0;
+    bucket->elapsed_ms -= bucket->period_ms; // sample crossing boundary belongs to closed bucket, rest of its time starts next one
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2021, 2022 by
+ * Slawomir Krzykala. All rights reserved.
+ */ 
+#ifndef STATS_WINDOW_H_  
+#define STATS_WINDOW_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//ERROR
+typedef enum {
+    STATS_WINDOW_OK         = 0,
+    STATS_WINDOW_EMPTY      = -1
+} stats_window_error_t;
+
+typedef enum {
+    STATS_WINDOW_AVG        = 0,
+    STATS_WINDOW_MIN        = 1,
+    STATS_WINDOW_MAX        = 2
+} stats_window_stat_t;
+
+typedef struct { // running state of one channel (one field of measurement)
+    int64_t     sum;
+    uint16_t    min_head;   // monotonic deques of sample slots, front = min/max of window
+    uint16_t    min_len;
+    uint16_t    max_head;
+    uint16_t    max_len;
+} stats_window_channel_t;
+
+typedef struct { // fixed capacity sliding window, O(1) per push for every channel
+    uint8_t                 channels;
+    uint16_t                capacity;
+    uint16_t                head;       // slot of next sample, oldest sample if window is full
+    uint16_t                count;
+    int32_t                 *samples;   // [capacity][channels]
+    uint16_t                *min_deque; // [channels][capacity]
+    uint16_t                *max_deque; // [channels][capacity]
+    stats_window_channel_t  *channel;   // [channels]
+} stats_window_t;
+
+typedef struct { // time bucket of rollup - samples are summed until period elapses, closed bucket feeds next level
+    uint8_t                 channels;
+    uint32_t                period_ms;
+    uint32_t                elapsed_ms; // time covered by samples in bucket, carried over to next bucket
+    uint32_t                count;
+    uint32_t                weight_ms;  // time covered by samples summed in bucket
+    int64_t                 *sum;       // [channels], sum of value * duration - samples of variable cycle are time weighted
+} stats_bucket_t;
+
+// static storage and window, capacity and number of channels are set at compile time
+// attr - section of storage, e.g. RTC_DATA_ATTR to keep window during deep sleep
+#define STATS_WINDOW_DEFINE_ATTR(name, channels_num, capacity_num, attr) \
+    attr static int32_t name##_samples[(capacity_num)*(channels_num)]; \
+    attr static uint16_t name##_min_deque[(channels_num)*(capacity_num)]; \
+    attr static uint16_t name##_max_deque[(channels_num)*(capacity_num)]; \
+    attr static stats_window_channel_t name##_channel[(channels_num)]; \
+    attr static stats_window_t name = { \
+        .channels = (channels_num), \
+        .capacity = (capacity_num), \
+        .samples = name##_samples, \
+        .min_deque = name##_min_deque, \
+        .max_deque = name##_max_deque, \
+        .channel = name##_channel \
+    }
+
+#define STATS_WINDOW_DEFINE(name, channels_num, capacity_num) \
+    STATS_WINDOW_DEFINE_ATTR(name, channels_num, capacity_num, )
+
+#define STATS_BUCKET_DEFINE_ATTR(name, channels_num, period, attr) \
+    attr static int64_t name##_sum[(channels_num)]; \
+    attr static stats_bucket_t name = { \
+        .channels = (channels_num), \
+        .period_ms = (period), \
+        .sum = name##_sum \
+    }
+
+
+void stats_window_reset(stats_window_t *window);
+void stats_window_push(stats_window_t *window, const int32_t *values);
+uint16_t stats_window_count(const stats_window_t *window);
+stats_window_error_t stats_window_get(const stats_window_t *window, stats_window_stat_t stat, int32_t *dst);
+void stats_bucket_reset(stats_bucket_t *bucket);
+bool stats_bucket_push(stats_bucket_t *bucket, const int32_t *values, uint32_t duration_ms, int32_t *avg);
+
+#endif